@@ -41,6 +41,27 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
 	    }
 
+        TEST_METHOD(picohash_resize)
+        {
+            int ret = picohash_resize_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(picohash_shared)
+        {
+            int ret = picohash_shared_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(picohash_shared_bench)
+        {
+            int ret = picohash_shared_bench_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(bytestream)
         {
             int ret = bytestream_test();
@@ -83,6 +104,27 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(spsc_queue)
+        {
+            int ret = util_spsc_queue_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(worker_pool)
+        {
+            int ret = util_worker_pool_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(file_writer)
+        {
+            int ret = util_file_writer_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(random_tester)
         {
             int ret = random_tester_test();
@@ -111,6 +153,20 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(wheel)
+        {
+            int ret = wheel_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(wheel_bench)
+        {
+            int ret = wheel_bench_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(test_cnxcreation)
         {
             int ret = cnxcreation_test();
@@ -118,6 +174,13 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(packet_pool)
+        {
+            int ret = packet_pool_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(parse_header)
         {
             int ret = parseheadertest();
@@ -229,6 +292,21 @@ namespace UnitTest1
 
             Assert::AreEqual(ret, 0);
         }
+
+        TEST_METHOD(stream_priority)
+        {
+            int ret = stream_priority_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(memory_accounting)
+        {
+            int ret = memory_accounting_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(stream_retransmit_copy)
         {
             int ret = test_copy_for_retransmit();
@@ -243,6 +321,13 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(stream_retransmit_compact)
+        {
+            int ret = test_compact_for_retransmitted();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(stateless_blowback) {
             int ret = test_stateless_blowback();
 
@@ -263,6 +348,13 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(ack_vector)
+        {
+            int ret = ackvector_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(ack_disorder)
         {
             int ret = ack_disorder_test();
@@ -284,6 +376,13 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(ack_index)
+        {
+            int ret = ack_index_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(test_sim_link)
         {
             int ret = sim_link_test();
@@ -312,12 +411,26 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(cid_for_lb_packet)
+        {
+            int ret = cid_for_lb_packet_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(retry_protection_vector)
         {
             int ret = retry_protection_vector_test();
 
             Assert::AreEqual(ret, 0);
         }
+
+        TEST_METHOD(initial_salt_cache)
+        {
+            int ret = initial_salt_cache_test();
+
+            Assert::AreEqual(ret, 0);
+        }
         
         TEST_METHOD(test_pn_enc_1rtt)
         {
@@ -360,6 +473,42 @@ namespace UnitTest1
 
             Assert::AreEqual(ret, 0);
         }
+
+        TEST_METHOD(incoming_batch)
+        {
+            int ret = incoming_batch_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(prepare_batch)
+        {
+            int ret = prepare_batch_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(prepare_batch_multi)
+        {
+            int ret = prepare_batch_multi_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(tls_worker)
+        {
+            int ret = tls_worker_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(tls_worker_large_hello)
+        {
+            int ret = tls_worker_large_hello_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(null_sni)
         {
             int ret = null_sni_test();
@@ -766,6 +915,34 @@ namespace UnitTest1
 
             Assert::AreEqual(ret, 0);
         }
+
+        TEST_METHOD(test_sockets_timestamp)
+        {
+            int ret = socket_timestamp_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(sockloop_mt)
+        {
+            int ret = sockloop_mt_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(sockloop_pipelined)
+        {
+            int ret = sockloop_pipelined_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(sockloop_busy_poll)
+        {
+            int ret = sockloop_busy_poll_test();
+
+            Assert::AreEqual(ret, 0);
+        }
         
         TEST_METHOD(ticket_store)
         {
@@ -1088,6 +1265,13 @@ namespace UnitTest1
 
             Assert::AreEqual(ret, 0);
         }
+
+        TEST_METHOD(pn_enc_batch)
+        {
+            int ret = pn_enc_batch_test();
+
+            Assert::AreEqual(ret, 0);
+        }
         
         TEST_METHOD(zero_rtt_spurious)
         {
@@ -1368,6 +1552,13 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(qlog_trace_threads)
+        {
+            int ret = qlog_trace_threads_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(path_packet_queue)
         {
             int ret = path_packet_queue_test();
@@ -1375,6 +1566,13 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(gso_handshake)
+        {
+            int ret = gso_handshake_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(perflog)
         {
             int ret = perflog_test();
@@ -1678,6 +1876,18 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(queue_network_input_ref) {
+            int ret = queue_network_input_ref_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(queue_network_input_slice) {
+            int ret = queue_network_input_slice_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(pacing_update) {
             int ret = pacing_update_test();
 
@@ -24,6 +24,8 @@
 */
 
 #include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
 #include "logreader.h"
 #include "bytestream.h"
 #include "qlog.h"
@@ -31,63 +33,168 @@
 #include "picoquic_binlog.h"
 #include "picoquic.h"
 
-int autoqlog(picoquic_cnx_t* cnx)
+static int autoqlog_convert(const picoquic_connection_id_t* cid, const char* binlog_file_name,
+    const char* qlog_file_name, const char* qlog_dir, int delete_binlog)
 {
     int ret = 0;
-    uint64_t log_time = cnx->start_time;
+    uint64_t log_time = 0;
     uint16_t flags = 0;
-    FILE* f_binlog = picoquic_open_cc_log_file_for_read(cnx->binlog_file_name, &flags, &log_time);
+    FILE* f_binlog = picoquic_open_cc_log_file_for_read(binlog_file_name, &flags, &log_time);
     if (f_binlog == NULL) {
-        DBG_PRINTF("Cannot open file %s for reading.\n", cnx->binlog_file_name);
+        DBG_PRINTF("Cannot open file %s for reading.\n", binlog_file_name);
         ret = -1;
     }
     else {
-        char filename[512];
-        char cid_name[2 * PICOQUIC_CONNECTION_ID_MAX_SIZE + 1];
-
-        if (picoquic_print_connection_id_hexa(cid_name, sizeof(cid_name), &cnx->initial_cnxid) != 0) {
-            DBG_PRINTF("Cannot convert connection id for %s", cnx->binlog_file_name);
-            ret = -1;
+        ret = qlog_convert(cid, f_binlog, binlog_file_name, qlog_file_name, qlog_dir, flags);
+        picoquic_file_close(f_binlog);
+        if (ret != 0) {
+            DBG_PRINTF("Cannot convert file %s to qlog, err = %d.\n", binlog_file_name, ret);
         }
-        else
-        {
-            int sprintf_ret = -1;
-            if (cnx->quic->use_unique_log_names) {
-                sprintf_ret = picoquic_sprintf(filename, sizeof(filename), NULL, "%s%s%s.%x.%s.%s",
-                    cnx->quic->qlog_dir, PICOQUIC_FILE_SEPARATOR, cid_name, cnx->log_unique,
-                    (cnx->client_mode) ? "client" : "server", "qlog");
-            }
-            else {
-                sprintf_ret = picoquic_sprintf(filename, sizeof(filename), NULL, "%s%s%s.%s.%s",
-                    cnx->quic->qlog_dir, PICOQUIC_FILE_SEPARATOR, cid_name,
-                    (cnx->client_mode) ? "client" : "server", "qlog");
+        else {
+            if (delete_binlog) {
+                int last_err = 0;
+                if ((ret = picoquic_file_delete(binlog_file_name, &last_err)) != 0) {
+                    DBG_PRINTF("Cannot delete file %s to qlog, err = %d.\n", binlog_file_name, last_err);
+                }
             }
+        }
+    }
 
-            if (sprintf_ret != 0) {
-                DBG_PRINTF("Cannot format file name for connection %s in file %s", cid_name, cnx->binlog_file_name);
-                ret = -1;
-            }
-            else {
-                ret = qlog_convert(&cnx->initial_cnxid, f_binlog, cnx->binlog_file_name, filename, cnx->quic->qlog_dir, flags);
-                picoquic_file_close(f_binlog);
-                if (ret != 0) {
-                    DBG_PRINTF("Cannot convert file %s to qlog, err = %d.\n", cnx->binlog_file_name, ret);
-                }
-                else {
-                    if (cnx->quic->binlog_dir == NULL) {
-                        int last_err = 0;
-                        if ((ret = picoquic_file_delete(cnx->binlog_file_name, &last_err)) != 0) {
-                            DBG_PRINTF("Cannot delete file %s to qlog, err = %d.\n", cnx->binlog_file_name, last_err);
-                        }
-                    }
-                }
+    return ret;
+}
+
+/* Conversion job, running on the qlog worker pool. The job is allocated as a
+ * single block, with the file names copied after the job structure, so that
+ * the core can free it once completed. If the binary log is written by the
+ * writer thread, the job first waits until the closing record is written.
+ */
+typedef struct st_autoqlog_job_t {
+    picoquic_worker_job_t worker_job;
+    picoquic_file_writer_t* binlog_writer;
+    uint64_t binlog_mark;
+    picoquic_connection_id_t initial_cnxid;
+    int delete_binlog;
+    char* binlog_file_name;
+    char* qlog_file_name;
+    char* qlog_dir;
+} autoqlog_job_t;
+
+static void autoqlog_job_fn(picoquic_worker_job_t* worker_job)
+{
+    autoqlog_job_t* job = (autoqlog_job_t*)worker_job;
+
+    if (job->binlog_writer != NULL) {
+        picoquic_file_writer_wait_mark(job->binlog_writer, job->binlog_mark);
+    }
+    (void)autoqlog_convert(&job->initial_cnxid, job->binlog_file_name, job->qlog_file_name,
+        job->qlog_dir, job->delete_binlog);
+}
+
+static int autoqlog_submit(picoquic_cnx_t* cnx, const char* qlog_file_name)
+{
+    int ret = 0;
+    picoquic_quic_t* quic = cnx->quic;
+    size_t l_binlog = strlen(cnx->binlog_file_name) + 1;
+    size_t l_qlog = strlen(qlog_file_name) + 1;
+    size_t l_dir = strlen(quic->qlog_dir) + 1;
+    autoqlog_job_t* job = (autoqlog_job_t*)malloc(sizeof(autoqlog_job_t) + l_binlog + l_qlog + l_dir);
+
+    /* Release the jobs already completed */
+    picoquic_collect_qlog_jobs(quic, 0);
+
+    if (job == NULL) {
+        /* Do not lose the trace, convert it now */
+        if (quic->binlog_writer != NULL) {
+            picoquic_file_writer_flush(quic->binlog_writer);
+        }
+        ret = autoqlog_convert(&cnx->initial_cnxid, cnx->binlog_file_name, qlog_file_name,
+            quic->qlog_dir, quic->binlog_dir == NULL);
+    }
+    else {
+        memset(job, 0, sizeof(autoqlog_job_t));
+        job->worker_job.job_fn = autoqlog_job_fn;
+        job->binlog_writer = quic->binlog_writer;
+        if (job->binlog_writer != NULL) {
+            job->binlog_mark = picoquic_file_writer_mark(job->binlog_writer);
+        }
+        job->initial_cnxid = cnx->initial_cnxid;
+        job->delete_binlog = (quic->binlog_dir == NULL);
+        job->binlog_file_name = (char*)(job + 1);
+        memcpy(job->binlog_file_name, cnx->binlog_file_name, l_binlog);
+        job->qlog_file_name = job->binlog_file_name + l_binlog;
+        memcpy(job->qlog_file_name, qlog_file_name, l_qlog);
+        job->qlog_dir = job->qlog_file_name + l_qlog;
+        memcpy(job->qlog_dir, quic->qlog_dir, l_dir);
+
+        picoquic_worker_pool_submit(quic->qlog_worker_pool, &job->worker_job);
+        quic->nb_qlog_jobs++;
+    }
+
+    return ret;
+}
+
+int autoqlog(picoquic_cnx_t* cnx)
+{
+    int ret = 0;
+    char filename[512];
+    char cid_name[2 * PICOQUIC_CONNECTION_ID_MAX_SIZE + 1];
+
+    if (picoquic_print_connection_id_hexa(cid_name, sizeof(cid_name), &cnx->initial_cnxid) != 0) {
+        DBG_PRINTF("Cannot convert connection id for %s", cnx->binlog_file_name);
+        ret = -1;
+    }
+    else
+    {
+        int sprintf_ret = -1;
+        if (cnx->quic->use_unique_log_names) {
+            sprintf_ret = picoquic_sprintf(filename, sizeof(filename), NULL, "%s%s%s.%x.%s.%s",
+                cnx->quic->qlog_dir, PICOQUIC_FILE_SEPARATOR, cid_name, cnx->log_unique,
+                (cnx->client_mode) ? "client" : "server", "qlog");
+        }
+        else {
+            sprintf_ret = picoquic_sprintf(filename, sizeof(filename), NULL, "%s%s%s.%s.%s",
+                cnx->quic->qlog_dir, PICOQUIC_FILE_SEPARATOR, cid_name,
+                (cnx->client_mode) ? "client" : "server", "qlog");
+        }
+
+        if (sprintf_ret != 0) {
+            DBG_PRINTF("Cannot format file name for connection %s in file %s", cid_name, cnx->binlog_file_name);
+            ret = -1;
+        }
+        else if (cnx->quic->qlog_worker_pool != NULL) {
+            ret = autoqlog_submit(cnx, filename);
+        }
+        else {
+            if (cnx->quic->binlog_writer != NULL) {
+                /* The conversion reads the complete file */
+                picoquic_file_writer_flush(cnx->quic->binlog_writer);
             }
+            ret = autoqlog_convert(&cnx->initial_cnxid, cnx->binlog_file_name, filename,
+                cnx->quic->qlog_dir, cnx->quic->binlog_dir == NULL);
         }
     }
 
     return ret;
 }
 
+int picoquic_set_qlog_threads(picoquic_quic_t* quic, int nb_threads)
+{
+    int ret = 0;
+
+    /* Pending conversions complete before the pool is replaced */
+    if (quic->qlog_worker_pool != NULL) {
+        picoquic_collect_qlog_jobs(quic, 1);
+        picoquic_worker_pool_delete(quic->qlog_worker_pool);
+        quic->qlog_worker_pool = NULL;
+    }
+    if (nb_threads > 0 &&
+        (quic->qlog_worker_pool = picoquic_worker_pool_create(nb_threads)) == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+
+    return ret;
+}
+
 int picoquic_set_qlog(picoquic_quic_t* quic, char const* qlog_dir)
 {
     quic->autoqlog_fn = autoqlog; 
@@ -38,6 +38,15 @@ extern "C" {
     */
 int picoquic_set_qlog(picoquic_quic_t* quic, char const* qlog_dir);
 
+/* Convert the binary traces to qlog on a pool of "nb_threads" background threads,
+ * instead of on the thread that owns the QUIC context when the connection closes.
+ * If the binary logs are written by the writer thread (see
+ * picoquic_set_binlog_writer_thread), the conversion waits until the end of the
+ * trace is written. Setting 0 threads waits for the pending conversions, and
+ * restores the conversion at connection close.
+ */
+int picoquic_set_qlog_threads(picoquic_quic_t* quic, int nb_threads);
+
 #ifdef __cplusplus
 }
 #endif
@@ -159,6 +159,7 @@ void picoquic_update_stream_initial_remote(picoquic_cnx_t* cnx)
                 stream->maxdata_remote = cnx->remote_parameters.initial_max_stream_data_bidi_local;
             }
         }
+        picoquic_wake_output_stream(cnx, stream);
         stream = picoquic_next_stream(stream);
     };
 }
@@ -232,10 +233,7 @@ uint8_t * picoquic_format_stream_reset_frame(picoquic_cnx_t* cnx, picoquic_strea
             while (stream->send_queue != NULL) {
                 picoquic_stream_queue_node_t* next = stream->send_queue->next_stream_data;
 
-                if (stream->send_queue->bytes != NULL) {
-                    free(stream->send_queue->bytes);
-                }
-                free(stream->send_queue);
+                picoquic_free_stream_queue_node(cnx, stream->send_queue);
                 stream->send_queue = next;
             }
             (void)picoquic_delete_stream_if_closed(cnx, stream);
@@ -856,10 +854,80 @@ static void picoquic_stream_data_chunk_callback(picoquic_cnx_t* cnx, picoquic_st
     }
 }
 
+/* Scatter gather delivery of the contiguous data found at the consumed offset.
+ * The data received in sequence, if any, is passed first, followed by the
+ * queued chunks. The chunks are only released after the callback returns.
+ */
+static void picoquic_stream_data_iovec_callback(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream,
+    const uint8_t* bytes, size_t data_length)
+{
+    picoquic_iovec_t iov[PICOQUIC_STREAM_IOVEC_MAX];
+    size_t nb_iov = 0;
+
+    do {
+        picoquic_stream_data_node_t* data = (picoquic_stream_data_node_t*)picosplay_first(&stream->stream_data_tree);
+        uint64_t run_offset = stream->consumed_offset;
+        int is_fin = 0;
+        int ret = 0;
+
+        nb_iov = 0;
+        if (data_length > 0) {
+            iov[0].base = bytes;
+            iov[0].len = data_length;
+            run_offset += data_length;
+            data_length = 0;
+            nb_iov++;
+        }
+
+        while (data != NULL && nb_iov < PICOQUIC_STREAM_IOVEC_MAX && data->offset <= run_offset) {
+            if (data->offset + data->length > run_offset) {
+                size_t start = (size_t)(run_offset - data->offset);
+                iov[nb_iov].base = data->bytes + start;
+                iov[nb_iov].len = data->length - start;
+                run_offset += iov[nb_iov].len;
+                nb_iov++;
+            }
+            data = (picoquic_stream_data_node_t*)picosplay_next(&data->stream_data_node);
+        }
+
+        is_fin = stream->fin_received && !stream->fin_signalled && run_offset >= stream->fin_offset;
+
+        if (nb_iov == 0 && !is_fin) {
+            break;
+        }
+
+        if (!stream->stop_sending_requested && !stream->is_discarded &&
+            (ret = stream->iovec_receive_fn(cnx, stream->stream_id, is_fin, iov, nb_iov, stream->consumed_offset,
+                stream->iovec_receive_ctx)) != 0) {
+            uint64_t err = (ret >= PICOQUIC_ERROR_CLASS) ? PICOQUIC_TRANSPORT_INTERNAL_ERROR : (uint64_t)ret;
+            picoquic_log_app_message(cnx, "Data callback (iovec, n=%zu) on stream %" PRIu64 " returns error 0x%x",
+                nb_iov, stream->stream_id, ret);
+            picoquic_connection_error(cnx, err, 0);
+            break;
+        }
+
+        stream->consumed_offset = run_offset;
+        if (is_fin) {
+            stream->fin_signalled = 1;
+        }
+
+        /* Release the chunks that were delivered */
+        while ((data = (picoquic_stream_data_node_t*)picosplay_first(&stream->stream_data_tree)) != NULL &&
+            data->offset + data->length <= stream->consumed_offset) {
+            picosplay_delete_hint(&stream->stream_data_tree, &data->stream_data_node);
+        }
+    } while (nb_iov == PICOQUIC_STREAM_IOVEC_MAX);
+}
+
 void picoquic_stream_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
 {
     picoquic_stream_data_node_t* data;
 
+    if (stream->iovec_receive_fn != NULL) {
+        picoquic_stream_data_iovec_callback(cnx, stream, NULL, 0);
+        return;
+    }
+
     while ((data = (picoquic_stream_data_node_t*)picosplay_first(&stream->stream_data_tree)) != NULL && data->offset <= stream->consumed_offset) {
         size_t start = (size_t)(stream->consumed_offset - data->offset);
         if (data->length >= start) {
@@ -873,14 +941,37 @@ void picoquic_stream_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head_t*
     picoquic_stream_data_chunk_callback(cnx, stream, NULL, 0);
 }
 
-static int add_chunk_node(picoquic_quic_t * quic, picosplay_tree_t* tree, uint64_t offset,
-    size_t length, const uint8_t* bytes, int* chunk_added, picoquic_stream_data_node_t * received_data)
+static int add_chunk_node(picoquic_quic_t * quic, picoquic_cnx_t * cnx, picosplay_tree_t* tree, uint64_t offset,
+    size_t length, const uint8_t* bytes, int* chunk_added, picoquic_stream_data_node_t * received_data,
+    picoquic_stream_data_node_t * previous)
 {
     int ret = 0;
 
     picoquic_stream_data_node_t* node = received_data;
+
+    if (previous != NULL && previous->is_compact && previous->data_capacity > 0 &&
+        previous->offset + previous->length == offset &&
+        previous->length + length <= previous->data_capacity) {
+        /* Append the chunk to the adjacent copy node */
+        memcpy(previous->data + previous->length, bytes, length);
+        previous->length += length;
+        *chunk_added = 1;
+        return 0;
+    }
     
-    if (received_data == NULL || received_data->bytes != NULL) {
+    if (length < PICOQUIC_STREAM_DATA_COPY_MAX) {
+        /* Small chunks are copied, instead of holding a whole packet */
+        node = picoquic_stream_data_node_alloc_copy(quic, PICOQUIC_STREAM_DATA_COPY_CAPACITY);
+        if (node == NULL) {
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+        else {
+            memcpy(node->data, bytes, length);
+            node->offset = offset;
+            node->length = length;
+        }
+    }
+    else if (received_data == NULL) {
         node = picoquic_stream_data_node_alloc(quic);
         if (node == NULL) {
             ret = PICOQUIC_ERROR_MEMORY;
@@ -892,14 +983,36 @@ static int add_chunk_node(picoquic_quic_t * quic, picosplay_tree_t* tree, uint64
             node->length = length;
         }
     }
+    else if (received_data->bytes != NULL) {
+        /* The packet node is already queued. Queue a reference to
+         * the data instead of copying it. */
+        node = picoquic_stream_data_node_alloc_ref(received_data);
+        if (node == NULL) {
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+        else {
+            node->bytes = bytes;
+            node->offset = offset;
+            node->length = length;
+        }
+    }
     else {
-        /* The pointer "bytes" is inside the received data packet. */
+        /* The pointer "bytes" is inside the received data packet.
+         * The tree holds the node in addition to the packet processing. */
         node->bytes = bytes;
         node->offset = offset;
         node->length = length;
+        node->nb_data_refs++;
     }
 
     if (node != NULL){
+        if (cnx != NULL) {
+            /* A node holding packet data is charged for the whole packet */
+            node->charged_cnx = cnx;
+            node->charged_bytes = (node->is_compact) ?
+                offsetof(picoquic_stream_data_node_t, data) + node->data_capacity : sizeof(picoquic_stream_data_node_t);
+            picoquic_memory_charge(cnx, node->charged_bytes);
+        }
         picosplay_insert(tree, node);
         *chunk_added = 1;
     }
@@ -907,8 +1020,10 @@ static int add_chunk_node(picoquic_quic_t * quic, picosplay_tree_t* tree, uint64
     return ret;
 }
 
-/* Common code to data stream and crypto hs stream */
-int picoquic_queue_network_input(picoquic_quic_t * quic, picosplay_tree_t* tree, uint64_t consumed_offset,
+/* Common code to data stream and crypto hs stream.
+ * The nodes added to the tree are charged to the connection, if not NULL.
+ */
+int picoquic_queue_network_input_ex(picoquic_quic_t * quic, picoquic_cnx_t * cnx, picosplay_tree_t* tree, uint64_t consumed_offset,
     uint64_t frame_data_offset, const uint8_t* bytes, size_t length, picoquic_stream_data_node_t* received_data, int* new_data_available)
 {
     const uint64_t input_begin = frame_data_offset;
@@ -925,7 +1040,7 @@ int picoquic_queue_network_input(picoquic_quic_t * quic, picosplay_tree_t* tree,
     if (frame_data_offset < input_end) {
 
         picoquic_stream_data_node_t target;
-        memset(&target, 0, sizeof(picoquic_stream_data_node_t));
+        memset(&target, 0, offsetof(picoquic_stream_data_node_t, data));
         target.offset = frame_data_offset;
 
         picoquic_stream_data_node_t* prev = (picoquic_stream_data_node_t*)picosplay_find_previous(tree, &target);
@@ -949,10 +1064,11 @@ int picoquic_queue_network_input(picoquic_quic_t * quic, picosplay_tree_t* tree,
 
             if (chunk_len > 0) {
                 /* There is a gap between previous and next frame, and it will be at least partially filled */
-                ret = add_chunk_node(quic, tree, chunk_ofs, (size_t)chunk_len, bytes + frame_data_offset - input_begin, new_data_available, received_data);
+                ret = add_chunk_node(quic, cnx, tree, chunk_ofs, (size_t)chunk_len, bytes + frame_data_offset - input_begin, new_data_available, received_data, prev);
             }
 
             frame_data_offset = next->offset + next->length;
+            prev = next;
             next = (picoquic_stream_data_node_t*)picosplay_next(&next->stream_data_node);
         }
 
@@ -960,13 +1076,20 @@ int picoquic_queue_network_input(picoquic_quic_t * quic, picosplay_tree_t* tree,
         if (ret == 0 && frame_data_offset < input_end) {
             const uint64_t chunk_ofs = frame_data_offset;
             const uint64_t chunk_len = input_end - frame_data_offset;
-            ret = add_chunk_node(quic, tree, chunk_ofs, (size_t)chunk_len, bytes + frame_data_offset - input_begin, new_data_available, received_data);
+            ret = add_chunk_node(quic, cnx, tree, chunk_ofs, (size_t)chunk_len, bytes + frame_data_offset - input_begin, new_data_available, received_data, prev);
         }
     }
 
     return ret;
 }
 
+int picoquic_queue_network_input(picoquic_quic_t * quic, picosplay_tree_t* tree, uint64_t consumed_offset,
+    uint64_t frame_data_offset, const uint8_t* bytes, size_t length, picoquic_stream_data_node_t* received_data, int* new_data_available)
+{
+    return picoquic_queue_network_input_ex(quic, NULL, tree, consumed_offset, frame_data_offset, bytes, length,
+        received_data, new_data_available);
+}
+
 static int picoquic_stream_network_input(picoquic_cnx_t* cnx, uint64_t stream_id,
     uint64_t offset, int fin, const uint8_t* bytes, size_t length,
     picoquic_stream_data_node_t* received_data, uint64_t current_time)
@@ -1025,10 +1148,15 @@ static int picoquic_stream_network_input(picoquic_cnx_t* cnx, uint64_t stream_id
                 uint64_t delivered_index = stream->consumed_offset - offset;
                 uint64_t data_length = length - delivered_index;
 
-                /* Ugly cast, but the callback requires a non-const pointer */
-                picoquic_stream_data_chunk_callback(cnx, stream, (uint8_t *)bytes + delivered_index, (size_t)data_length);
-                /* Adjust the tree if needed */
-                picoquic_stream_data_callback(cnx, stream);
+                if (stream->iovec_receive_fn != NULL) {
+                    picoquic_stream_data_iovec_callback(cnx, stream, bytes + delivered_index, (size_t)data_length);
+                }
+                else {
+                    /* Ugly cast, but the callback requires a non-const pointer */
+                    picoquic_stream_data_chunk_callback(cnx, stream, (uint8_t*)bytes + delivered_index, (size_t)data_length);
+                    /* Adjust the tree if needed */
+                    picoquic_stream_data_callback(cnx, stream);
+                }
             }
             else {
                 /* Nothing to do with these incoming data, they are duplicate */
@@ -1036,7 +1164,7 @@ static int picoquic_stream_network_input(picoquic_cnx_t* cnx, uint64_t stream_id
         } else {
             int new_data_available = 0;
 
-            ret = picoquic_queue_network_input(cnx->quic, &stream->stream_data_tree, stream->consumed_offset,
+            ret = picoquic_queue_network_input_ex(cnx->quic, cnx, &stream->stream_data_tree, stream->consumed_offset,
                 offset, bytes, length, received_data, &new_data_available);
             if (ret != 0) {
                 ret = picoquic_connection_error(cnx, (int64_t)ret, 0);
@@ -1103,16 +1231,22 @@ const uint8_t* picoquic_decode_stream_frame(picoquic_cnx_t* cnx, const uint8_t*
     return bytes;
 }
 
+/* Find the next stream ready to send.
+ * Streams that cannot send anything are parked when found at the head of
+ * the output list, and exhausted streams are removed, so the ready stream
+ * is normally the first one. When the connection is blocked by flow control,
+ * only reset or stop sending frames can be sent, and the search continues
+ * through the list.
+ */
 picoquic_stream_head_t* picoquic_find_ready_stream(picoquic_cnx_t* cnx)
 {
-    picoquic_stream_head_t* first_stream = cnx->first_output_stream;
-    picoquic_stream_head_t* stream = first_stream;
+    picoquic_stream_head_t* stream = cnx->first_output_stream;
     picoquic_stream_head_t* found_stream = NULL;
-    picoquic_stream_head_t* previous_stream = NULL;
-
 
     /* Look for a ready stream */
     while (stream != NULL) {
+        picoquic_stream_head_t* next_stream = stream->next_output_stream;
+
         if ((cnx->maxdata_remote > cnx->data_sent&& stream->sent_offset < stream->maxdata_remote && (stream->is_active ||
             (stream->send_queue != NULL && stream->send_queue->length > stream->send_queue->offset) ||
             (stream->fin_requested && !stream->fin_sent))) ||
@@ -1123,26 +1257,30 @@ picoquic_stream_head_t* picoquic_find_ready_stream(picoquic_cnx_t* cnx)
             break;
         }
         else if (((stream->fin_requested && stream->fin_sent) || (stream->reset_requested && stream->reset_sent)) && (!stream->stop_sending_requested || stream->stop_sending_sent)) {
-            picoquic_stream_head_t* next_stream = stream->next_output_stream;
             /* If stream is exhausted, remove from output list */
-            picoquic_remove_output_stream(cnx, stream, previous_stream);
+            picoquic_remove_output_stream(cnx, stream, NULL);
 
             picoquic_delete_stream_if_closed(cnx, stream);
-            stream = next_stream;
         }
-        else {
+        else if (stream->sent_offset >= stream->maxdata_remote) {
             if (stream->is_active ||
                 (stream->send_queue != NULL && stream->send_queue->length > stream->send_queue->offset)) {
-                if (stream->sent_offset >= stream->maxdata_remote) {
-                    cnx->stream_blocked = 1;
-                }
-                else if (cnx->maxdata_remote <= cnx->data_sent) {
-                    cnx->flow_blocked = 1;
-                }
+                cnx->stream_blocked = 1;
             }
-            previous_stream = stream;
-            stream = stream->next_output_stream;
+            /* Wait until the peer sends MAX_STREAM_DATA */
+            picoquic_park_output_stream(cnx, stream);
+        }
+        else if (stream->is_active ||
+            (stream->send_queue != NULL && stream->send_queue->length > stream->send_queue->offset) ||
+            (stream->fin_requested && !stream->fin_sent)) {
+            /* Only blocked by connection flow control */
+            cnx->flow_blocked = 1;
+        }
+        else {
+            /* Nothing to send, wait until the application provides data */
+            picoquic_park_output_stream(cnx, stream);
         }
+        stream = next_stream;
     }
 
     return found_stream;
@@ -1508,8 +1646,7 @@ uint8_t * picoquic_format_stream_frame(picoquic_cnx_t* cnx, picoquic_stream_head
                     stream->send_queue->offset += length;
                     if (stream->send_queue->offset >= stream->send_queue->length) {
                         picoquic_stream_queue_node_t* next = stream->send_queue->next_stream_data;
-                        free(stream->send_queue->bytes);
-                        free(stream->send_queue);
+                        picoquic_free_stream_queue_node(cnx, stream->send_queue);
                         stream->send_queue = next;
                     }
 
@@ -1544,6 +1681,10 @@ uint8_t * picoquic_format_stream_frame(picoquic_cnx_t* cnx, picoquic_stream_head
                 /* mark the stream as unblocked since we sent something */
                 stream->stream_data_blocked_sent = 0;
                 cnx->sent_blocked_frame = 0;
+                if (bytes != bytes0) {
+                    /* Let the other incremental streams of the same urgency go next */
+                    picoquic_requeue_output_stream(cnx, stream);
+                }
             }
         }
     }
@@ -1692,7 +1833,7 @@ uint8_t* picoquic_format_stream_frame_for_retransmit(picoquic_cnx_t* cnx,
     }
 
     if (all_sent) {
-        picoquic_delete_misc_or_dg(&cnx->stream_frame_retransmit_queue, &cnx->stream_frame_retransmit_queue_last, misc);
+        picoquic_delete_misc_or_dg(cnx, &cnx->stream_frame_retransmit_queue, &cnx->stream_frame_retransmit_queue_last, misc);
     }
 
     return bytes_next;
@@ -1766,7 +1907,7 @@ const uint8_t* picoquic_decode_crypto_hs_frame(picoquic_cnx_t* cnx, const uint8_
     } else {
         picoquic_stream_head_t* stream = &cnx->tls_stream[epoch];
         int new_data_available;
-        int ret = picoquic_queue_network_input(cnx->quic, &stream->stream_data_tree, stream->consumed_offset,
+        int ret = picoquic_queue_network_input_ex(cnx->quic, cnx, &stream->stream_data_tree, stream->consumed_offset,
             offset, data_bytes, (size_t)data_length, received_data, &new_data_available);
         if (ret != 0) {
             picoquic_connection_error(cnx, (int64_t)ret, picoquic_frame_type_crypto_hs);
@@ -2574,9 +2715,14 @@ void picoquic_update_path_rtt(picoquic_cnx_t* cnx, picoquic_path_t* old_path, pi
 void process_decoded_packet_data(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
     uint64_t current_time, picoquic_packet_data_t* packet_data)
 {
+    /* RTT samples are based on the arrival time of the packet, which may be provided by the
+     * kernel and is then not affected by the queuing delays in the application. */
+    uint64_t receive_time = (cnx->quic->segment_receive_time != 0 && cnx->quic->segment_receive_time <= current_time) ?
+        cnx->quic->segment_receive_time : current_time;
+
     for (int i = 0; i < packet_data->nb_path_ack; i++) {
         picoquic_update_path_rtt(cnx, packet_data->path_ack[i].acked_path, path_x,
-            packet_data->path_ack[i].largest_sent_time, current_time, packet_data->last_ack_delay,
+            packet_data->path_ack[i].largest_sent_time, receive_time, packet_data->last_ack_delay,
             packet_data->last_time_stamp_received);
 
         picoquic_estimate_path_bandwidth(cnx, packet_data->path_ack[i].acked_path, packet_data->path_ack[i].largest_sent_time,
@@ -2615,8 +2761,12 @@ static picoquic_packet_t* picoquic_find_acked_packet(picoquic_cnx_t* cnx, picoqu
         pkt_ctx->ack_of_ack_requested = 0;
         *is_new_ack = 1;
 
-        while (packet != NULL && packet->previous_packet != NULL && packet->sequence_number < largest) {
-            packet = packet->previous_packet;
+        /* If the largest acknowledged packet is still queued, it is found directly in the index */
+        if ((packet = picoquic_retransmit_index_get(pkt_ctx, largest)) == NULL) {
+            packet = pkt_ctx->retransmit_oldest;
+            while (packet != NULL && packet->previous_packet != NULL && packet->sequence_number < largest) {
+                packet = packet->previous_packet;
+            }
         }
     }
 
@@ -2984,6 +3134,19 @@ int picoquic_check_frame_needs_repeat(picoquic_cnx_t* cnx, const uint8_t* bytes,
     return ret;
 }
 
+static void picoquic_record_ack_of_stream_data(picoquic_cnx_t* cnx, uint64_t stream_id,
+    uint64_t offset, uint64_t data_length, int fin)
+{
+    picoquic_stream_head_t* stream = picoquic_find_stream(cnx, stream_id);
+
+    if (stream != NULL) {
+        (void)picoquic_update_sack_list(&stream->sack_list,
+            offset, offset + data_length - ((fin) ? 0 : 1), 0);
+
+        picoquic_delete_stream_if_closed(cnx, stream);
+    }
+}
+
 int picoquic_process_ack_of_stream_frame(picoquic_cnx_t* cnx, uint8_t* bytes,
     size_t bytes_max, size_t* consumed)
 {
@@ -2992,7 +3155,6 @@ int picoquic_process_ack_of_stream_frame(picoquic_cnx_t* cnx, uint8_t* bytes,
     size_t data_length;
     uint64_t stream_id;
     uint64_t offset;
-    picoquic_stream_head_t* stream = NULL;
 
     /* skip stream frame */
     ret = picoquic_parse_stream_header(bytes, bytes_max,
@@ -3002,13 +3164,136 @@ int picoquic_process_ack_of_stream_frame(picoquic_cnx_t* cnx, uint8_t* bytes,
         *consumed += data_length;
 
         /* record the ack range for the stream */
-        stream = picoquic_find_stream(cnx, stream_id);
-        if (stream != NULL) {
-            (void)picoquic_update_sack_list(&stream->sack_list,
-                offset, offset + data_length - ((fin) ? 0 : 1), 0);
+        picoquic_record_ack_of_stream_data(cnx, stream_id, offset, data_length, fin);
+    }
 
-            picoquic_delete_stream_if_closed(cnx, stream);
+    return ret;
+}
+
+/* In the compact copy of lost packets, stream frames are replaced by
+ * descriptors, formatted as a stream frame with offset and length fields
+ * but without the stream data.
+ */
+static int picoquic_process_ack_of_stream_descriptor(picoquic_cnx_t* cnx, const uint8_t* bytes,
+    size_t bytes_max, size_t* consumed)
+{
+    int ret = 0;
+    int fin = bytes[0] & 1;
+    uint64_t stream_id = 0;
+    uint64_t offset = 0;
+    uint64_t data_length = 0;
+    const uint8_t* bytes_next;
+
+    if ((bytes_next = picoquic_frames_varint_decode(bytes + 1, bytes + bytes_max, &stream_id)) == NULL ||
+        (bytes_next = picoquic_frames_varint_decode(bytes_next, bytes + bytes_max, &offset)) == NULL ||
+        (bytes_next = picoquic_frames_varint_decode(bytes_next, bytes + bytes_max, &data_length)) == NULL) {
+        /* Internal error -- cannot parse the stored descriptor */
+        *consumed = bytes_max;
+        ret = -1;
+    }
+    else {
+        *consumed = bytes_next - bytes;
+        picoquic_record_ack_of_stream_data(cnx, stream_id, offset, data_length, fin);
+    }
+
+    return ret;
+}
+
+/* List of the frames that picoquic_process_ack_of_frames acts upon, other than
+ * stream frames. The other frames are ignored when a packet is acknowledged.
+ */
+static int picoquic_frame_needs_ack_processing(uint64_t ftype)
+{
+    int needs_processing = 0;
+
+    switch (ftype) {
+    case picoquic_frame_type_ack:
+    case picoquic_frame_type_ack_ecn:
+    case picoquic_frame_type_ack_mp:
+    case picoquic_frame_type_ack_mp_ecn:
+    case picoquic_frame_type_handshake_done:
+    case picoquic_frame_type_new_connection_id:
+    case picoquic_frame_type_retire_connection_id:
+    case picoquic_frame_type_crypto_hs:
+    case picoquic_frame_type_new_token:
+    case picoquic_frame_type_max_data:
+    case picoquic_frame_type_max_stream_data:
+    case picoquic_frame_type_max_streams_bidir:
+    case picoquic_frame_type_max_streams_unidir:
+        needs_processing = 1;
+        break;
+    default:
+        needs_processing = PICOQUIC_IN_RANGE(ftype, picoquic_frame_type_datagram, picoquic_frame_type_datagram_l);
+        break;
+    }
+
+    return needs_processing;
+}
+
+/* Lost packets are kept for a while after their content was queued for
+ * retransmission, so that late acknowledgements can be processed as
+ * spurious losses. The processing only needs the frames handled by
+ * picoquic_process_ack_of_frames, and for stream frames only the stream
+ * ID, offset, length and fin bit. This function copies these frames, with
+ * stream frames reduced to descriptors. It returns -1 if the frames cannot
+ * be parsed, or if the copy does not fit in "compact_max" bytes.
+ */
+int picoquic_compact_frames_for_ack(const uint8_t* bytes, size_t bytes_max,
+    uint8_t* compact, size_t compact_max, size_t* compact_length)
+{
+    int ret = 0;
+    size_t byte_index = 0;
+    size_t frame_length = 0;
+    int frame_is_pure_ack = 0;
+
+    *compact_length = 0;
+
+    while (ret == 0 && byte_index < bytes_max) {
+        uint64_t ftype;
+        size_t l_ftype = picoquic_varint_decode(&bytes[byte_index], bytes_max - byte_index, &ftype);
+
+        if (l_ftype == 0) {
+            ret = -1;
+        }
+        else if (PICOQUIC_IN_RANGE(ftype, picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
+            uint64_t stream_id;
+            uint64_t offset;
+            size_t data_length;
+            int fin;
+            size_t consumed;
+
+            ret = picoquic_parse_stream_header(&bytes[byte_index], bytes_max - byte_index,
+                &stream_id, &offset, &data_length, &fin, &consumed);
+            if (ret == 0) {
+                uint8_t* c_next = compact + *compact_length;
+                uint8_t* c_max = compact + compact_max;
+
+                if ((c_next = picoquic_frames_uint8_encode(c_next, c_max,
+                    (uint8_t)(picoquic_frame_type_stream_range_min | 6 | fin))) == NULL ||
+                    (c_next = picoquic_frames_varint_encode(c_next, c_max, stream_id)) == NULL ||
+                    (c_next = picoquic_frames_varint_encode(c_next, c_max, offset)) == NULL ||
+                    (c_next = picoquic_frames_varint_encode(c_next, c_max, data_length)) == NULL) {
+                    ret = -1;
+                }
+                else {
+                    *compact_length = c_next - compact;
+                    frame_length = consumed + data_length;
+                }
+            }
         }
+        else {
+            ret = picoquic_skip_frame(&bytes[byte_index], bytes_max - byte_index, &frame_length, &frame_is_pure_ack);
+            if (ret == 0 && picoquic_frame_needs_ack_processing(ftype)) {
+                if (*compact_length + frame_length > compact_max) {
+                    ret = -1;
+                }
+                else {
+                    memcpy(compact + *compact_length, &bytes[byte_index], frame_length);
+                    *compact_length += frame_length;
+                }
+            }
+        }
+        byte_index += frame_length;
     }
 
     return ret;
@@ -3024,6 +3309,8 @@ void picoquic_process_ack_of_frames(picoquic_cnx_t* cnx, picoquic_packet_t* p,
     size_t byte_index;
     int frame_is_pure_ack = 0;
     size_t frame_length = 0;
+    /* Compact copies of lost packets only hold the frames, without header */
+    size_t bytes_max = (p->is_compacted) ? p->compact_length : p->length;
 
     if (p->ptype == picoquic_packet_0rtt_protected) {
         cnx->nb_zero_rtt_acked++;
@@ -3031,9 +3318,9 @@ void picoquic_process_ack_of_frames(picoquic_cnx_t* cnx, picoquic_packet_t* p,
 
     byte_index = p->offset;
 
-    while (ret == 0 && byte_index < p->length) {
+    while (ret == 0 && byte_index < bytes_max) {
         uint64_t ftype;
-        size_t l_ftype = picoquic_varint_decode(&p->bytes[byte_index], p->length - byte_index, &ftype);
+        size_t l_ftype = picoquic_varint_decode(&p->bytes[byte_index], bytes_max - byte_index, &ftype);
         if (l_ftype == 0) {
             break;
         }
@@ -3041,20 +3328,20 @@ void picoquic_process_ack_of_frames(picoquic_cnx_t* cnx, picoquic_packet_t* p,
         switch (ftype) {
         case picoquic_frame_type_ack:
             ret = picoquic_process_ack_of_ack_frame(&cnx->ack_ctx[p->pc].sack_list,
-                &p->bytes[byte_index], p->length - byte_index, &frame_length, 0);
+                &p->bytes[byte_index], bytes_max - byte_index, &frame_length, 0);
             byte_index += frame_length;
             break;
         case picoquic_frame_type_ack_ecn:
             ret = picoquic_process_ack_of_ack_frame(&cnx->ack_ctx[p->pc].sack_list,
-                &p->bytes[byte_index], p->length - byte_index, &frame_length, 1);
+                &p->bytes[byte_index], bytes_max - byte_index, &frame_length, 1);
             byte_index += frame_length;
             break;
         case picoquic_frame_type_ack_mp:
-            ret = picoquic_process_ack_of_ack_mp_frame(cnx, &p->bytes[byte_index], p->length - byte_index, &frame_length, 0);
+            ret = picoquic_process_ack_of_ack_mp_frame(cnx, &p->bytes[byte_index], bytes_max - byte_index, &frame_length, 0);
             byte_index += frame_length;
             break;
         case picoquic_frame_type_ack_mp_ecn:
-            ret = picoquic_process_ack_of_ack_mp_frame(cnx, &p->bytes[byte_index], p->length - byte_index, &frame_length, 1);
+            ret = picoquic_process_ack_of_ack_mp_frame(cnx, &p->bytes[byte_index], bytes_max - byte_index, &frame_length, 1);
             byte_index += frame_length;
             break;
         case picoquic_frame_type_handshake_done:
@@ -3062,39 +3349,44 @@ void picoquic_process_ack_of_frames(picoquic_cnx_t* cnx, picoquic_packet_t* p,
             byte_index += l_ftype;
             break;
         case picoquic_frame_type_new_connection_id:
-            ret = picoquic_process_ack_of_new_cid_frame(cnx, &p->bytes[byte_index], p->length - byte_index, &frame_length);
+            ret = picoquic_process_ack_of_new_cid_frame(cnx, &p->bytes[byte_index], bytes_max - byte_index, &frame_length);
             byte_index += frame_length;
             break;
         case picoquic_frame_type_retire_connection_id:
-            ret = picoquic_process_ack_of_retire_connection_id_frame(cnx, &p->bytes[byte_index], p->length - byte_index, &frame_length);
+            ret = picoquic_process_ack_of_retire_connection_id_frame(cnx, &p->bytes[byte_index], bytes_max - byte_index, &frame_length);
             byte_index += frame_length;
             break;
         case picoquic_frame_type_crypto_hs:
-            ret = picoquic_process_ack_of_crypto_frame(cnx, &p->bytes[byte_index], p->length - byte_index, p->ptype, &frame_length);
+            ret = picoquic_process_ack_of_crypto_frame(cnx, &p->bytes[byte_index], bytes_max - byte_index, p->ptype, &frame_length);
             byte_index += frame_length;
             break;
         case picoquic_frame_type_new_token:
             ret = picoquic_skip_frame(&p->bytes[byte_index],
-                p->length - byte_index, &frame_length, &frame_is_pure_ack);
+                bytes_max - byte_index, &frame_length, &frame_is_pure_ack);
             byte_index += frame_length;
             cnx->is_new_token_acked = 1;
             break;
         case picoquic_frame_type_max_data:
-            ret = picoquic_process_ack_of_max_data_frame(cnx, &p->bytes[byte_index], p->length - byte_index, &frame_length);
+            ret = picoquic_process_ack_of_max_data_frame(cnx, &p->bytes[byte_index], bytes_max - byte_index, &frame_length);
             byte_index += frame_length;
             break;
         case picoquic_frame_type_max_stream_data:
-            ret = picoquic_process_ack_of_max_stream_data_frame(cnx, &p->bytes[byte_index], p->length - byte_index, &frame_length);
+            ret = picoquic_process_ack_of_max_stream_data_frame(cnx, &p->bytes[byte_index], bytes_max - byte_index, &frame_length);
             byte_index += frame_length;
             break;
         case picoquic_frame_type_max_streams_bidir:
         case picoquic_frame_type_max_streams_unidir:
-            ret = picoquic_process_ack_of_max_streams_frame(cnx, &p->bytes[byte_index], p->length - byte_index, &frame_length);
+            ret = picoquic_process_ack_of_max_streams_frame(cnx, &p->bytes[byte_index], bytes_max - byte_index, &frame_length);
             byte_index += frame_length;
             break;
         default:
             if (PICOQUIC_IN_RANGE(ftype, picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
-                ret = picoquic_process_ack_of_stream_frame(cnx, &p->bytes[byte_index], p->length - byte_index, &frame_length);
+                if (p->is_compacted) {
+                    ret = picoquic_process_ack_of_stream_descriptor(cnx, &p->bytes[byte_index], bytes_max - byte_index, &frame_length);
+                }
+                else {
+                    ret = picoquic_process_ack_of_stream_frame(cnx, &p->bytes[byte_index], bytes_max - byte_index, &frame_length);
+                }
                 byte_index += frame_length;
                 if (p->send_path != NULL) {
                     if (p->send_time > p->send_path->last_time_acked_data_frame_sent) {
@@ -3113,7 +3405,7 @@ void picoquic_process_ack_of_frames(picoquic_cnx_t* cnx, picoquic_packet_t* p,
                         uint8_t* content_bytes;
 
                         /* Parse and skip type and length */
-                        content_bytes = picoquic_decode_datagram_frame_header(&p->bytes[byte_index], &p->bytes[p->length],
+                        content_bytes = picoquic_decode_datagram_frame_header(&p->bytes[byte_index], &p->bytes[bytes_max],
                             &frame_id, &content_length);
 
                         ret = (cnx->callback_fn)(cnx, p->send_time, content_bytes, (size_t)content_length,
@@ -3123,7 +3415,7 @@ void picoquic_process_ack_of_frames(picoquic_cnx_t* cnx, picoquic_packet_t* p,
                 }
 
                 ret = picoquic_skip_frame(&p->bytes[byte_index],
-                    p->length - byte_index, &frame_length, &frame_is_pure_ack);
+                    bytes_max - byte_index, &frame_length, &frame_is_pure_ack);
                 byte_index += frame_length;
             }
             break;
@@ -3137,75 +3429,83 @@ static int picoquic_process_ack_range(
     uint64_t current_time, picoquic_packet_data_t* packet_data)
 {
     picoquic_packet_t* p = *ppacket;
+    uint64_t lowest = highest + 1 - range;
     int ret = 0;
 
-    /* Compare the range to the retransmit queue */
-    while (p != NULL && range > 0) {
-        if (p->sequence_number > highest) {
-            p = p->next_packet;
-        } else {
-            if (p->sequence_number == highest) {
-                picoquic_packet_t* next = p->next_packet;
-                picoquic_path_t * old_path = p->send_path;
-
-                if (p->is_ack_trap) {
-                    ret = picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, picoquic_frame_type_ack);
-                    break;
+    if (range > 0) {
+        /* Skip the packets above the range. If the top of the range is still
+         * queued, it is found directly in the index. */
+        if (p != NULL && p->sequence_number > highest) {
+            picoquic_packet_t* p_indexed = picoquic_retransmit_index_get(pkt_ctx, highest);
+            if (p_indexed != NULL) {
+                p = p_indexed;
+            }
+            else {
+                while (p != NULL && p->sequence_number > highest) {
+                    p = p->next_packet;
                 }
+            }
+        }
 
-                if (old_path != NULL) {
-                    old_path->delivered += p->length;
-                    /* Reset the flags tracking loss of ack only packets and corresponding ping */
-                    old_path->is_ack_lost = 0;
-                    old_path->is_ack_expected = 0;
-                    /* Track timer for the packet */
-                    if (p->path_packet_number > old_path->path_packet_acked_number) {
-                        old_path->path_packet_acked_number = p->path_packet_number;
-                        old_path->path_packet_acked_time_sent = p->send_time;
-                        old_path->path_packet_acked_received = current_time;
-                        old_path->nb_retransmit = 0;
-                    }
+        /* The queued packets in the range follow each other in the queue */
+        while (p != NULL && p->sequence_number >= lowest) {
+            picoquic_packet_t* next = p->next_packet;
+            picoquic_path_t * old_path = p->send_path;
 
-                    picoquic_record_ack_packet_data(packet_data, p);
+            if (p->is_ack_trap) {
+                ret = picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, picoquic_frame_type_ack);
+                break;
+            }
 
-                    /* In theory this is not needed, the congestion window increases could just
-                     * as well be performed once per packet. However, we keep this code here in
-                     * order to maintain the same schedule of CWIN increase as the previous
-                     * non-1WD version */
-                    if (cnx->congestion_alg != NULL) {
-                        cnx->congestion_alg->alg_notify(cnx, old_path,
-                            picoquic_congestion_notification_acknowledgement,
-                            0, 0, p->length, 0, current_time);
-                    }
+            if (old_path != NULL) {
+                old_path->delivered += p->length;
+                /* Reset the flags tracking loss of ack only packets and corresponding ping */
+                old_path->is_ack_lost = 0;
+                old_path->is_ack_expected = 0;
+                /* Track timer for the packet */
+                if (p->path_packet_number > old_path->path_packet_acked_number) {
+                    old_path->path_packet_acked_number = p->path_packet_number;
+                    old_path->path_packet_acked_time_sent = p->send_time;
+                    old_path->path_packet_acked_received = current_time;
+                    old_path->nb_retransmit = 0;
+                }
 
-                    /* If packet is larger than the current MTU, update the MTU */
-                    if ((p->length + p->checksum_overhead) == old_path->send_mtu) {
-                        old_path->nb_mtu_losses = 0;
-                    } else if ((p->length + p->checksum_overhead) > old_path->send_mtu) {
-                        old_path->send_mtu = p->length + p->checksum_overhead;
-                        old_path->mtu_probe_sent = 0;
-                    }
+                picoquic_record_ack_packet_data(packet_data, p);
+
+                /* In theory this is not needed, the congestion window increases could just
+                 * as well be performed once per packet. However, we keep this code here in
+                 * order to maintain the same schedule of CWIN increase as the previous
+                 * non-1WD version */
+                if (cnx->congestion_alg != NULL) {
+                    cnx->congestion_alg->alg_notify(cnx, old_path,
+                        picoquic_congestion_notification_acknowledgement,
+                        0, 0, p->length, 0, current_time);
                 }
 
-                /* If the packet contained an ACK frame, perform the ACK of ACK pruning logic.
-                 * Record stream data as acknowledged, signal datagram frames as acknowledged.
-                 */
-                picoquic_process_ack_of_frames(cnx, p, 0, current_time);
-
-                /* Keep track of reception of ACK of 1RTT data */
-                if (p->ptype == picoquic_packet_1rtt_protected &&
-                    (cnx->cnx_state == picoquic_state_client_ready_start ||
-                        cnx->cnx_state == picoquic_state_server_false_start)) {
-                    /* Transition to client ready state.
-                     * The handshake is complete, all the handshake packets are implicitly acknowledged */
-                    picoquic_ready_state_transition(cnx, current_time);
+                /* If packet is larger than the current MTU, update the MTU */
+                if ((p->length + p->checksum_overhead) == old_path->send_mtu) {
+                    old_path->nb_mtu_losses = 0;
+                } else if ((p->length + p->checksum_overhead) > old_path->send_mtu) {
+                    old_path->send_mtu = p->length + p->checksum_overhead;
+                    old_path->mtu_probe_sent = 0;
                 }
-                (void)picoquic_dequeue_retransmit_packet(cnx, pkt_ctx, p, 1);
-                p = next;
             }
 
-            range--;
-            highest--;
+            /* If the packet contained an ACK frame, perform the ACK of ACK pruning logic.
+             * Record stream data as acknowledged, signal datagram frames as acknowledged.
+             */
+            picoquic_process_ack_of_frames(cnx, p, 0, current_time);
+
+            /* Keep track of reception of ACK of 1RTT data */
+            if (p->ptype == picoquic_packet_1rtt_protected &&
+                (cnx->cnx_state == picoquic_state_client_ready_start ||
+                    cnx->cnx_state == picoquic_state_server_false_start)) {
+                /* Transition to client ready state.
+                 * The handshake is complete, all the handshake packets are implicitly acknowledged */
+                picoquic_ready_state_transition(cnx, current_time);
+            }
+            (void)picoquic_dequeue_retransmit_packet(cnx, pkt_ctx, p, 1);
+            p = next;
         }
     }
 
@@ -3409,7 +3709,7 @@ uint8_t* picoquic_format_ack_frame_in_context(picoquic_cnx_t* cnx, uint8_t* byte
             /* Implement adaptive tuning of lowest repeat range */
             int nb_sent_max_acked = 0;
             int nb_sent_max_skip = 0;
-            picoquic_sack_item_t* next_sack = picoquic_sack_previous_item(last_sack);
+            picoquic_sack_item_t* next_sack = picoquic_sack_previous_item(&ack_ctx->sack_list, last_sack);
 
             /* Update send count for the top range */
             picoquic_sack_item_record_sent(&ack_ctx->sack_list, last_sack, is_opportunistic);
@@ -3446,7 +3746,7 @@ uint8_t* picoquic_format_ack_frame_in_context(picoquic_cnx_t* cnx, uint8_t* byte
                         }
                     }
                 }
-                next_sack = picoquic_sack_previous_item(next_sack);
+                next_sack = picoquic_sack_previous_item(&ack_ctx->sack_list, next_sack);
             }
             /* When numbers are lower than 64, varint encoding fits on one byte */
             *num_block_byte = (uint8_t)num_block;
@@ -3866,6 +4166,7 @@ const uint8_t* picoquic_decode_max_stream_data_frame(picoquic_cnx_t* cnx, const
         if (maxdata > cnx->max_max_stream_data_remote) {
             cnx->max_max_stream_data_remote = maxdata;
         }
+        picoquic_wake_output_stream(cnx, stream);
     }
 
 
@@ -4095,7 +4396,7 @@ int picoquic_check_max_streams_frame_needs_repeat(picoquic_cnx_t* cnx, const uin
 /* Common code for datagrams and misc frames
  */
 
-uint8_t * picoquic_format_first_misc_or_dg_frame(uint8_t* bytes, uint8_t * bytes_max, int * more_data, int * is_pure_ack,
+uint8_t * picoquic_format_first_misc_or_dg_frame(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t * bytes_max, int * more_data, int * is_pure_ack,
     picoquic_misc_frame_header_t** first, picoquic_misc_frame_header_t** last)
 {
     picoquic_misc_frame_header_t* misc_frame = *first;
@@ -4107,7 +4408,7 @@ uint8_t * picoquic_format_first_misc_or_dg_frame(uint8_t* bytes, uint8_t * bytes
         memcpy(bytes, frame, misc_frame->length);
         bytes += misc_frame->length;
         *is_pure_ack &= misc_frame->is_pure_ack;
-        picoquic_delete_misc_or_dg(first, last, *first);
+        picoquic_delete_misc_or_dg(cnx, first, last, *first);
     }
 
     return bytes;
@@ -4119,7 +4420,7 @@ uint8_t * picoquic_format_first_misc_or_dg_frame(uint8_t* bytes, uint8_t * bytes
 
 uint8_t* picoquic_format_first_misc_frame(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max, int* more_data, int* is_pure_ack)
 {
-    return picoquic_format_first_misc_or_dg_frame(bytes, bytes_max, more_data, is_pure_ack, &cnx->first_misc_frame, &cnx->last_misc_frame);
+    return picoquic_format_first_misc_or_dg_frame(cnx, bytes, bytes_max, more_data, is_pure_ack, &cnx->first_misc_frame, &cnx->last_misc_frame);
 }
 
 /*
@@ -4441,7 +4742,7 @@ uint8_t * picoquic_format_first_datagram_frame(picoquic_cnx_t* cnx, uint8_t* byt
         *more_data = 1;
     }
     else {
-        bytes = picoquic_format_first_misc_or_dg_frame(bytes, bytes_max, more_data, is_pure_ack, 
+        bytes = picoquic_format_first_misc_or_dg_frame(cnx, bytes, bytes_max, more_data, is_pure_ack, 
             &cnx->first_datagram, &cnx->last_datagram);
     }
 
@@ -24,6 +24,7 @@
 */
 
 #include <stdarg.h>
+#include <stdlib.h>
 #include "picoquic_binlog.h"
 #include "bytestream.h"
 #include "tls_api.h"
@@ -58,18 +59,30 @@ static const uint8_t* picoquic_log_length(const uint8_t* bytes, const uint8_t* b
     return (len == 0 || *nsz != n64) ? NULL : bytes + len;
 }
 
-static void picoquic_binlog_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+/* Set up a bytestream for writing a record in a buffer larger than
+ * the BYTESTREAM_MAX_BUFFER_SIZE of bytestream_buf */
+static bytestream* binlog_record_init(bytestream* s, uint8_t* buffer, size_t buffer_size)
+{
+    s->data = buffer;
+    s->size = buffer_size;
+    s->ptr = 0;
+
+    return s;
+}
+
+static void picoquic_binlog_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     if (bytes != NULL && bytes_max != NULL) {
         size_t len = bytes_max - bytes;
-        uint8_t varlen[8];
-        size_t l_varlen = picoquic_varint_encode(varlen, 8, len);
-        fwrite(varlen, 1, l_varlen, f);
-        fwrite(bytes, 1, len, f);
+
+        if (bytestream_remain(s) >= bytestream_vint_len(len) + len) {
+            (void)bytewrite_vint(s, len);
+            (void)bytewrite_buffer(s, bytes, len);
+        }
     }
 }
 
-static const uint8_t* picoquic_log_stream_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_stream_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     uint8_t ftype = bytes[0];
@@ -101,7 +114,7 @@ static const uint8_t* picoquic_log_stream_frame(FILE* f, const uint8_t* bytes, c
             extra_bytes = length;
         }
         if (has_length) {
-            picoquic_binlog_frame(f, bytes_begin, bytes + extra_bytes);
+            picoquic_binlog_frame(s, bytes_begin, bytes + extra_bytes);
         }
         else {
             uint8_t* log_next = log_buffer;
@@ -112,10 +125,10 @@ static const uint8_t* picoquic_log_stream_frame(FILE* f, const uint8_t* bytes, c
             if ((log_next = picoquic_frames_varint_encode(log_next, log_buffer + 256, length)) != NULL) {
                 memcpy(log_next, bytes, extra_bytes);
                 log_next += extra_bytes;
-                picoquic_binlog_frame(f, log_buffer, log_next);
+                picoquic_binlog_frame(s, log_buffer, log_next);
             }
             else {
-                picoquic_binlog_frame(f, log_buffer, log_buffer + l_head);
+                picoquic_binlog_frame(s, log_buffer, log_buffer + l_head);
             }
         }
 
@@ -127,12 +140,12 @@ static const uint8_t* picoquic_log_stream_frame(FILE* f, const uint8_t* bytes, c
         if (length > 26) {
             length = 26;
         }
-        picoquic_binlog_frame(f, bytes_begin, bytes_begin + length);
+        picoquic_binlog_frame(s, bytes_begin, bytes_begin + length);
     }
     return bytes;
 }
 
-static const uint8_t* picoquic_log_ack_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_ack_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     uint64_t ftype = 0;
@@ -163,11 +176,11 @@ static const uint8_t* picoquic_log_ack_frame(FILE* f, const uint8_t* bytes, cons
         bytes = picoquic_log_varint_skip(bytes, bytes_max);
     }
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_reset_stream_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_reset_stream_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t * bytes_begin = bytes;
 
@@ -176,11 +189,11 @@ static const uint8_t* picoquic_log_reset_stream_frame(FILE* f, const uint8_t* by
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_stop_sending_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_stop_sending_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
@@ -188,11 +201,11 @@ static const uint8_t* picoquic_log_stop_sending_frame(FILE* f, const uint8_t* by
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_close_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_close_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     size_t length = 0;
@@ -203,11 +216,11 @@ static const uint8_t* picoquic_log_close_frame(FILE* f, const uint8_t* bytes, co
     bytes = picoquic_log_length(bytes, bytes_max, &length);
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, length);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_app_close_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_app_close_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     size_t length = 0;
@@ -217,22 +230,22 @@ static const uint8_t* picoquic_log_app_close_frame(FILE* f, const uint8_t* bytes
     bytes = picoquic_log_length(bytes, bytes_max, &length);
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, length);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_max_data_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_max_data_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_max_stream_data_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_max_stream_data_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
@@ -240,33 +253,33 @@ static const uint8_t* picoquic_log_max_stream_data_frame(FILE* f, const uint8_t*
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_max_stream_id_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_max_stream_id_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_blocked_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_blocked_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_stream_blocked_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_stream_blocked_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
@@ -274,22 +287,22 @@ static const uint8_t* picoquic_log_stream_blocked_frame(FILE* f, const uint8_t*
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_streams_blocked_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_streams_blocked_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_new_connection_id_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_new_connection_id_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
@@ -302,22 +315,22 @@ static const uint8_t* picoquic_log_new_connection_id_frame(FILE* f, const uint8_
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, PICOQUIC_RESET_SECRET_SIZE);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_retire_connection_id_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_retire_connection_id_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_new_token_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_new_token_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     size_t length = 0;
@@ -327,21 +340,21 @@ static const uint8_t* picoquic_log_new_token_frame(FILE* f, const uint8_t* bytes
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, length);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_path_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_path_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1 + 8);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_crypto_hs_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_crypto_hs_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     size_t length = 0;
@@ -350,24 +363,24 @@ static const uint8_t* picoquic_log_crypto_hs_frame(FILE* f, const uint8_t* bytes
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
     bytes = picoquic_log_length(bytes, bytes_max, &length);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, length);
     return bytes;
 }
 
 
-static const uint8_t* picoquic_log_handshake_done_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_handshake_done_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_datagram_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_datagram_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     uint8_t ftype = bytes[0];
@@ -381,36 +394,36 @@ static const uint8_t* picoquic_log_datagram_frame(FILE* f, const uint8_t* bytes,
         length = bytes_max - bytes;
     }
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, length);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_time_stamp_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_time_stamp_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_varint_skip(bytes, bytes_max); /* frame type as varint */
     bytes = picoquic_log_varint_skip(bytes, bytes_max); /* time stamp as varint */
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
 
     return bytes;
 }
 
-static const uint8_t* picoquic_log_path_abandon_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_path_abandon_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     bytes = picoquic_log_varint_skip(bytes, bytes_max); /* frame type as varint */
     bytes = picoquic_skip_path_abandon_frame(bytes, bytes_max); /* skip abandon frame */
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
 
     return bytes;
 }
 
 
-static const uint8_t* picoquic_log_ack_frequency_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_ack_frequency_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
@@ -420,24 +433,24 @@ static const uint8_t* picoquic_log_ack_frequency_frame(FILE* f, const uint8_t* b
     bytes = picoquic_log_varint_skip(bytes, bytes_max); /* Max ACK delay */
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1); /* Ignore order */
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
 
     return bytes;
 }
 
-static const uint8_t* picoquic_log_erroring_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_erroring_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     size_t frame_size = bytes_max - bytes;
     size_t copied = (frame_size > 8) ? 8 : frame_size;
 
-    picoquic_binlog_frame(f, bytes, bytes + copied);
+    picoquic_binlog_frame(s, bytes, bytes + copied);
 
     return NULL;
 }
 
-static const uint8_t* picoquic_log_padding(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_padding(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
-    picoquic_binlog_frame(f, bytes, bytes + 1);
+    picoquic_binlog_frame(s, bytes, bytes + 1);
 
     uint8_t ftype = bytes[0];
     while (bytes < bytes_max && bytes[0] == ftype) {
@@ -447,7 +460,7 @@ static const uint8_t* picoquic_log_padding(FILE* f, const uint8_t* bytes, const
     return bytes;
 }
 
-static const uint8_t* picoquic_log_bdp_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_bdp_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     size_t ip_len = 0;
@@ -459,12 +472,12 @@ static const uint8_t* picoquic_log_bdp_frame(FILE* f, const uint8_t* bytes, cons
     bytes = picoquic_log_length(bytes, bytes_max, &ip_len); /*  IP Address length */
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, ip_len); /* IP address value */
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
 
     return bytes;
 }
 
-void picoquic_binlog_frames(FILE * f, const uint8_t* bytes, size_t length)
+static void binlog_frames(bytestream* s, const uint8_t* bytes, size_t length)
 {
     const uint8_t* bytes_max = bytes + length;
 
@@ -484,7 +497,7 @@ void picoquic_binlog_frames(FILE * f, const uint8_t* bytes, size_t length)
         }
 
         if (PICOQUIC_IN_RANGE(ftype, picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
-            bytes = picoquic_log_stream_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_stream_frame(s, bytes, bytes_max);
             continue;
         }
 
@@ -493,86 +506,102 @@ void picoquic_binlog_frames(FILE * f, const uint8_t* bytes, size_t length)
         case picoquic_frame_type_ack_ecn:
         case picoquic_frame_type_ack_mp:
         case picoquic_frame_type_ack_mp_ecn:
-            bytes = picoquic_log_ack_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_ack_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_retire_connection_id:
-            bytes = picoquic_log_retire_connection_id_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_retire_connection_id_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_padding:
         case picoquic_frame_type_ping:
-            bytes = picoquic_log_padding(f, bytes, bytes_max);
+            bytes = picoquic_log_padding(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_reset_stream:
-            bytes = picoquic_log_reset_stream_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_reset_stream_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_connection_close:
-            bytes = picoquic_log_close_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_close_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_application_close:
-            bytes = picoquic_log_app_close_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_app_close_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_max_data:
-            bytes = picoquic_log_max_data_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_max_data_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_max_stream_data:
-            bytes = picoquic_log_max_stream_data_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_max_stream_data_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_max_streams_bidir:
         case picoquic_frame_type_max_streams_unidir:
-            bytes = picoquic_log_max_stream_id_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_max_stream_id_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_data_blocked:
-            bytes = picoquic_log_blocked_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_blocked_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_stream_data_blocked:
-            bytes = picoquic_log_stream_blocked_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_stream_blocked_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_streams_blocked_bidir:
         case picoquic_frame_type_streams_blocked_unidir:
-            bytes = picoquic_log_streams_blocked_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_streams_blocked_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_new_connection_id:
-            bytes = picoquic_log_new_connection_id_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_new_connection_id_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_stop_sending:
-            bytes = picoquic_log_stop_sending_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_stop_sending_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_path_challenge:
         case picoquic_frame_type_path_response:
-            bytes = picoquic_log_path_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_path_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_crypto_hs:
-            bytes = picoquic_log_crypto_hs_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_crypto_hs_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_new_token:
-            bytes = picoquic_log_new_token_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_new_token_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_handshake_done:
-            bytes = picoquic_log_handshake_done_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_handshake_done_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_datagram:
         case picoquic_frame_type_datagram_l:
-            bytes = picoquic_log_datagram_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_datagram_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_ack_frequency:
-            bytes = picoquic_log_ack_frequency_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_ack_frequency_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_time_stamp:
-            bytes = picoquic_log_time_stamp_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_time_stamp_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_path_abandon:
-            bytes = picoquic_log_path_abandon_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_path_abandon_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_bdp:
-            bytes = picoquic_log_bdp_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_bdp_frame(s, bytes, bytes_max);
             break;
         default:
-            bytes = picoquic_log_erroring_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_erroring_frame(s, bytes, bytes_max);
             break;
         }
     }
 }
 
+/* Each logged frame takes at most twice its size in the log */
+void picoquic_binlog_frames(FILE * f, const uint8_t* bytes, size_t length)
+{
+    size_t buffer_size = 2 * length + 16;
+    uint8_t* buffer = (uint8_t*)malloc(buffer_size);
+
+    if (buffer != NULL) {
+        bytestream stream;
+        bytestream* s = binlog_record_init(&stream, buffer, buffer_size);
+
+        binlog_frames(s, bytes, length);
+        (void)fwrite(bytestream_data(s), bytestream_length(s), 1, f);
+        free(buffer);
+    }
+}
+
 static void binlog_compose_event_header(bytestream* msg, const picoquic_connection_id_t* cid, uint64_t current_time,
     uint64_t path_id, picoquic_log_event_type event_type)
 {
@@ -599,12 +628,59 @@ static uint64_t binlog_get_path_id(picoquic_cnx_t* cnx, picoquic_path_t* path_x)
     return path_id;
 }
 
-void binlog_pdu(FILE* f, const picoquic_connection_id_t* cid, int receiving, uint64_t current_time,
-    const struct sockaddr* addr_peer, const struct sockaddr* addr_local, size_t packet_length)
+/* Each event is framed in memory, starting with 4 bytes reserved for the length
+ * of the record, and written to the log file in a single call. If the Quic
+ * context has a writer thread, the record is queued to that thread, which owns
+ * the file from then on.
+ */
+
+/* The records leave BYTESTREAM_MAX_BUFFER_SIZE bytes for the event after the
+ * length, so that long events are truncated at the same size as when the length
+ * was framed separately. */
+#define BINLOG_RECORD_MAX (BYTESTREAM_MAX_BUFFER_SIZE + 4)
+static void binlog_write_record_to_file(FILE* f, bytestream* msg)
+{
+    picoformat_32(msg->data, (uint32_t)(msg->ptr - 4));
+    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+}
+
+static void binlog_write_record(picoquic_cnx_t* cnx, bytestream* msg)
+{
+    if (cnx->quic->binlog_writer == NULL) {
+        binlog_write_record_to_file(cnx->f_binlog, msg);
+    }
+    else {
+        picoformat_32(msg->data, (uint32_t)(msg->ptr - 4));
+        (void)picoquic_file_writer_write(cnx->quic->binlog_writer, cnx->f_binlog,
+            bytestream_data(msg), bytestream_length(msg));
+    }
+}
+
+/* Close the log file after writing the last record, if any */
+static void binlog_close_file(picoquic_cnx_t* cnx, bytestream* msg)
 {
-    bytestream_buf stream_msg;
-    bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    if (cnx->quic->binlog_writer == NULL) {
+        if (msg != NULL) {
+            binlog_write_record_to_file(cnx->f_binlog, msg);
+            fflush(cnx->f_binlog);
+        }
+        (void)picoquic_file_close(cnx->f_binlog);
+    }
+    else if (msg != NULL) {
+        picoformat_32(msg->data, (uint32_t)(msg->ptr - 4));
+        (void)picoquic_file_writer_close(cnx->quic->binlog_writer, cnx->f_binlog,
+            bytestream_data(msg), bytestream_length(msg));
+    }
+    else {
+        (void)picoquic_file_writer_close(cnx->quic->binlog_writer, cnx->f_binlog, NULL, 0);
+    }
+    cnx->f_binlog = NULL;
+}
 
+static void binlog_compose_pdu(bytestream* msg, const picoquic_connection_id_t* cid, int receiving, uint64_t current_time,
+    const struct sockaddr* addr_peer, const struct sockaddr* addr_local, size_t packet_length)
+{
+    bytewrite_int32(msg, 0);
     /* Common chunk header */
     binlog_compose_event_header(msg, cid, current_time, 0, picoquic_log_event_pdu_sent + receiving);
 
@@ -612,33 +688,40 @@ void binlog_pdu(FILE* f, const picoquic_connection_id_t* cid, int receiving, uin
     bytewrite_addr(msg, addr_peer);
     bytewrite_vint(msg, packet_length);
     bytewrite_addr(msg, addr_local);
+}
 
-    uint8_t head[4] = { 0 };
-    picoformat_32(head, (uint32_t)bytestream_length(msg));
+void binlog_pdu(FILE* f, const picoquic_connection_id_t* cid, int receiving, uint64_t current_time,
+    const struct sockaddr* addr_peer, const struct sockaddr* addr_local, size_t packet_length)
+{
+    uint8_t record[BINLOG_RECORD_MAX];
+    bytestream stream_msg;
+    bytestream* msg = binlog_record_init(&stream_msg, record, sizeof(record));
 
-    (void)fwrite(head, sizeof(head), 1, f);
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_compose_pdu(msg, cid, receiving, current_time, addr_peer, addr_local, packet_length);
+    binlog_write_record_to_file(f, msg);
 }
 
 static void binlog_pdu_ex(picoquic_cnx_t* cnx, int receiving, uint64_t current_time,
     const struct sockaddr* addr_peer, const struct sockaddr* addr_local, size_t packet_length)
 {
     if (cnx != NULL && cnx->f_binlog != NULL && picoquic_cnx_is_still_logging(cnx)) {
-        binlog_pdu(cnx->f_binlog, &cnx->initial_cnxid, receiving, current_time, addr_peer, addr_local, packet_length);
+        uint8_t record[BINLOG_RECORD_MAX];
+        bytestream stream_msg;
+        bytestream* msg = binlog_record_init(&stream_msg, record, sizeof(record));
+
+        binlog_compose_pdu(msg, &cnx->initial_cnxid, receiving, current_time, addr_peer, addr_local, packet_length);
+        binlog_write_record(cnx, msg);
     }
 }
 
-void binlog_packet(FILE* f, const picoquic_connection_id_t* cid, uint64_t path_id, int receiving, uint64_t current_time,
+/* The packet records are composed in a buffer large enough for the frames of
+ * a full size packet, so the length of the record is known before it is written. */
+#define BINLOG_PACKET_RECORD_MAX (2 * PICOQUIC_MAX_PACKET_SIZE + 256)
+
+static void binlog_compose_packet(bytestream* msg, const picoquic_connection_id_t* cid, uint64_t path_id, int receiving, uint64_t current_time,
     const picoquic_packet_header* ph, const uint8_t* bytes, size_t bytes_max)
 {
-    long fpos0 = ftell(f);
-
-    uint8_t head[4] = { 0 };
-    (void)fwrite(head, 4, 1, f);
-
-    bytestream_buf stream_msg;
-    bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
-
+    bytewrite_int32(msg, 0);
     /* Common chunk header */
     binlog_compose_event_header(msg, cid, current_time, path_id, picoquic_log_event_packet_sent + receiving);
 
@@ -664,32 +747,43 @@ void binlog_packet(FILE* f, const picoquic_connection_id_t* cid, uint64_t path_i
         bytewrite_buffer(msg, ph->token_bytes, ph->token_length);
     }
 
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
-
     /* frame information */
     if (ph->ptype == picoquic_packet_version_negotiation || ph->ptype == picoquic_packet_retry) {
-        picoquic_binlog_frame(f, bytes + ph->offset, bytes + bytes_max);
+        picoquic_binlog_frame(msg, bytes + ph->offset, bytes + bytes_max);
     }
     else if (ph->ptype != picoquic_packet_error) {
-        picoquic_binlog_frames(f, bytes + ph->offset, ph->payload_length);
+        binlog_frames(msg, bytes + ph->offset, ph->payload_length);
     }
+}
+
+void binlog_packet(FILE* f, const picoquic_connection_id_t* cid, uint64_t path_id, int receiving, uint64_t current_time,
+    const picoquic_packet_header* ph, const uint8_t* bytes, size_t bytes_max)
+{
+    uint8_t record[BINLOG_PACKET_RECORD_MAX];
+    bytestream stream_msg;
+    bytestream* msg = binlog_record_init(&stream_msg, record, sizeof(record));
 
-    /* re-write chunk size field */
-    long fpos1 = ftell(f);
+    binlog_compose_packet(msg, cid, path_id, receiving, current_time, ph, bytes, bytes_max);
+    binlog_write_record_to_file(f, msg);
+}
 
-    picoformat_32(head, (uint32_t)(fpos1 - fpos0 - 4));
+static void binlog_packet_to_cnx(picoquic_cnx_t* cnx, picoquic_path_t* path_x, int receiving, uint64_t current_time,
+    const picoquic_packet_header* ph, const uint8_t* bytes, size_t bytes_max)
+{
+    uint8_t record[BINLOG_PACKET_RECORD_MAX];
+    bytestream stream_msg;
+    bytestream* msg = binlog_record_init(&stream_msg, record, sizeof(record));
 
-    (void)fseek(f, fpos0, SEEK_SET);
-    (void)fwrite(head, 4, 1, f);
-    (void)fseek(f, 0, SEEK_END);
+    binlog_compose_packet(msg, &cnx->initial_cnxid, binlog_get_path_id(cnx, path_x), receiving, current_time,
+        ph, bytes, bytes_max);
+    binlog_write_record(cnx, msg);
 }
 
 static void binlog_packet_ex(picoquic_cnx_t* cnx, picoquic_path_t * path_x, int receiving, uint64_t current_time,
     picoquic_packet_header* ph, const uint8_t* bytes, size_t bytes_max)
 {
     if (cnx != NULL && cnx->f_binlog != NULL && picoquic_cnx_is_still_logging(cnx)) {
-        binlog_packet(cnx->f_binlog, &cnx->initial_cnxid, binlog_get_path_id(cnx, path_x),
-            receiving, current_time, ph, bytes, bytes_max);
+        binlog_packet_to_cnx(cnx, path_x, receiving, current_time, ph, bytes, bytes_max);
     }
 }
 
@@ -697,10 +791,10 @@ void binlog_dropped_packet(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
     picoquic_packet_header* ph,  size_t packet_size, int err,
     uint8_t * raw_data, uint64_t current_time)
 {
-    FILE* f = cnx->f_binlog;
     size_t raw_size = packet_size;
-    bytestream_buf stream_msg;
-    bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    uint8_t record[BINLOG_RECORD_MAX];
+    bytestream stream_msg;
+    bytestream* msg = binlog_record_init(&stream_msg, record, sizeof(record));
 
     if (err == PICOQUIC_ERROR_AEAD_CHECK) {
         /* Do not log on decryption error, because the buffer was randomized by decryption */
@@ -721,16 +815,15 @@ void binlog_dropped_packet(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
     (void)bytewrite_buffer(msg, raw_data, raw_size);
 
     /* write the frame length at the reserved spot, and save to log file*/
-    picoformat_32(msg->data, (uint32_t)(msg->ptr - 4));
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_record(cnx, msg);
 }
 
 void binlog_buffered_packet(picoquic_cnx_t* cnx, picoquic_path_t* path_x, 
     picoquic_packet_type_enum ptype, uint64_t current_time)
 {
-    FILE* f = cnx->f_binlog;
-    bytestream_buf stream_msg;
-    bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    uint8_t record[BINLOG_RECORD_MAX];
+    bytestream stream_msg;
+    bytestream* msg = binlog_record_init(&stream_msg, record, sizeof(record));
 
     bytewrite_int32(msg, 0);
     /* Common chunk header */
@@ -741,8 +834,7 @@ void binlog_buffered_packet(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
     (void)bytewrite_cstr(msg, "keys_unavailable");
 
     /* write the frame length at the reserved spot, and save to log file*/
-    picoformat_32(msg->data, (uint32_t)(msg->ptr - 4));
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_record(cnx, msg);
 }
 
 
@@ -750,15 +842,11 @@ void binlog_outgoing_packet(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
     uint8_t * bytes, uint64_t sequence_number, size_t pn_length, size_t length,
     uint8_t* send_buffer, size_t send_length, uint64_t current_time)
 {
-    FILE* f = cnx->f_binlog;
-
     picoquic_cnx_t* pcnx = cnx;
     picoquic_packet_header ph;
     size_t checksum_length = 16;
     struct sockaddr_in default_addr;
 
-    const picoquic_connection_id_t * cnxid = (cnx != NULL) ? &cnx->initial_cnxid : &picoquic_null_connection_id;
-
     memset(&default_addr, 0, sizeof(struct sockaddr_in));
     default_addr.sin_family = AF_INET;
 
@@ -792,7 +880,7 @@ void binlog_outgoing_packet(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
         }
     }
 
-    binlog_packet(f, cnxid, binlog_get_path_id(cnx, path_x),  0, current_time, &ph, bytes, length);
+    binlog_packet_to_cnx(cnx, path_x, 0, current_time, &ph, bytes, length);
 }
 
 void binlog_packet_lost(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
@@ -800,10 +888,9 @@ void binlog_packet_lost(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
     picoquic_connection_id_t * dcid, size_t packet_size,
     uint64_t current_time)
 {
-    FILE* f = cnx->f_binlog;
-
-    bytestream_buf stream_msg;
-    bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    uint8_t record[BINLOG_RECORD_MAX];
+    bytestream stream_msg;
+    bytestream* msg = binlog_record_init(&stream_msg, record, sizeof(record));
 
     bytewrite_int32(msg, 0);
     /* Common chunk header */
@@ -821,8 +908,7 @@ void binlog_packet_lost(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
     bytewrite_vint(msg, packet_size);
 
     /* write the frame length at the reserved spot, and save to log file*/
-    picoformat_32(msg->data, (uint32_t)(msg->ptr - 4));
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_record(cnx, msg);
 }
 
 
@@ -830,10 +916,10 @@ void binlog_negotiated_alpn(picoquic_cnx_t* cnx, int is_local,
     uint8_t const * sni, size_t sni_len, uint8_t const* alpn, size_t alpn_len,
     const ptls_iovec_t* alpn_list, size_t alpn_count)
 {
-    FILE* f = cnx->f_binlog;
-
-    bytestream_buf stream_msg;
-    bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    uint8_t record[BINLOG_RECORD_MAX];
+    bytestream stream_msg;
+    bytestream* msg = binlog_record_init(&stream_msg, record, sizeof(record));
+    bytewrite_int32(msg, 0);
     /* Common chunk header */
     binlog_compose_event_header(msg, &cnx->initial_cnxid, picoquic_get_quic_time(cnx->quic), 0, picoquic_log_event_alpn_update);
     /* Event header */
@@ -856,21 +942,16 @@ void binlog_negotiated_alpn(picoquic_cnx_t* cnx, int is_local,
         bytewrite_buffer(msg, alpn, alpn_len);
     }
 
-    bytestream_buf stream_head;
-    bytestream* head = bytestream_buf_init(&stream_head, 4);
-    bytewrite_int32(head, (uint32_t)bytestream_length(msg));
-
-    (void)fwrite(bytestream_data(head), bytestream_length(head), 1, f);
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_record(cnx, msg);
 }
 
 void binlog_transport_extension(picoquic_cnx_t* cnx, int is_local,
     size_t param_length, uint8_t* params)
 {
-    FILE* f = cnx->f_binlog;
-
-    bytestream_buf stream_msg;
-    bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    uint8_t record[BINLOG_RECORD_MAX];
+    bytestream stream_msg;
+    bytestream* msg = binlog_record_init(&stream_msg, record, sizeof(record));
+    bytewrite_int32(msg, 0);
     /* Common chunk header */
     binlog_compose_event_header(msg, &cnx->initial_cnxid, picoquic_get_quic_time(cnx->quic), 0, picoquic_log_event_param_update);
     /* Event header */
@@ -881,42 +962,49 @@ void binlog_transport_extension(picoquic_cnx_t* cnx, int is_local,
         bytewrite_buffer(msg, params, param_length);
     }
 
-    bytestream_buf stream_head;
-    bytestream* head = bytestream_buf_init(&stream_head, 4);
-    bytewrite_int32(head, (uint32_t)bytestream_length(msg));
-
-    (void)fwrite(bytestream_data(head), bytestream_length(head), 1, f);
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_record(cnx, msg);
 }
 
-void binlog_picotls_ticket(FILE* f, picoquic_connection_id_t cnx_id,
+static void binlog_compose_picotls_ticket(bytestream* msg, picoquic_connection_id_t cnx_id,
     uint8_t* ticket, uint16_t ticket_length)
 {
-    bytestream_buf stream_msg;
-    bytestream * msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    bytewrite_int32(msg, 0);
     /* Common chunk header */
     binlog_compose_event_header(msg, &cnx_id, 0, 0, picoquic_log_event_tls_key_update);
 
     bytewrite_vint(msg, ticket_length);
     bytewrite_buffer(msg, ticket, ticket_length);
+}
 
-    bytestream_buf stream_head;
-    bytestream * head = bytestream_buf_init(&stream_head, 8);
-    bytewrite_int32(head, (uint32_t)bytestream_length(msg));
+void binlog_picotls_ticket(FILE* f, picoquic_connection_id_t cnx_id,
+    uint8_t* ticket, uint16_t ticket_length)
+{
+    uint8_t record[BINLOG_RECORD_MAX];
+    bytestream stream_msg;
+    bytestream* msg = binlog_record_init(&stream_msg, record, sizeof(record));
 
-    (void)fwrite(bytestream_data(head), bytestream_length(head), 1, f);
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_compose_picotls_ticket(msg, cnx_id, ticket, ticket_length);
+    binlog_write_record_to_file(f, msg);
 }
 
 static void binlog_picotls_ticket_ex(picoquic_cnx_t* cnx,
     uint8_t* ticket, uint16_t ticket_length)
 {
     if (cnx != NULL && cnx->f_binlog != NULL && picoquic_cnx_is_still_logging(cnx)) {
-        binlog_picotls_ticket(cnx->f_binlog, cnx->initial_cnxid, ticket, ticket_length);
+        uint8_t record[BINLOG_RECORD_MAX];
+        bytestream stream_msg;
+        bytestream* msg = binlog_record_init(&stream_msg, record, sizeof(record));
+
+        binlog_compose_picotls_ticket(msg, cnx->initial_cnxid, ticket, ticket_length);
+        binlog_write_record(cnx, msg);
     }
 }
 
-FILE* create_binlog(char const* binlog_file, uint64_t creation_time, unsigned int multipath_enabled);
+FILE* create_binlog_ex(char const* binlog_file, uint64_t creation_time, unsigned int is_multipath_supported,
+    size_t buffer_size);
+
+/* Size of the stdio buffer of the log files written by the writer thread */
+#define BINLOG_WRITER_FILE_BUFFER_SIZE 0x10000
 
 void binlog_new_connection(picoquic_cnx_t * cnx)
 {
@@ -932,8 +1020,10 @@ void binlog_new_connection(picoquic_cnx_t * cnx)
 
     int ret = 0;
 
-    cnx->f_binlog = picoquic_file_close(cnx->f_binlog);
-    
+    if (cnx->f_binlog != NULL) {
+        binlog_close_file(cnx, NULL);
+    }
+
     char cid_name[2 * PICOQUIC_CONNECTION_ID_MAX_SIZE + 1];
     if (picoquic_print_connection_id_hexa(cid_name, sizeof(cid_name), &cnx->initial_cnxid) != 0) {
         ret = -1;
@@ -962,8 +1052,9 @@ void binlog_new_connection(picoquic_cnx_t * cnx)
     }
 
     if (ret == 0) {
-        cnx->f_binlog = create_binlog(log_filename, picoquic_get_quic_time(cnx->quic),
-            cnx->local_parameters.enable_multipath);
+        cnx->f_binlog = create_binlog_ex(log_filename, picoquic_get_quic_time(cnx->quic),
+            cnx->local_parameters.enable_multipath,
+            (cnx->quic->binlog_writer == NULL) ? 0 : BINLOG_WRITER_FILE_BUFFER_SIZE);
         if (cnx->f_binlog == NULL) {
             cnx->binlog_file_name = picoquic_string_free(cnx->binlog_file_name);
             ret = -1;
@@ -974,8 +1065,10 @@ void binlog_new_connection(picoquic_cnx_t * cnx)
     }
 
     if (ret == 0) {
-        bytestream_buf stream_msg;
-        bytestream * msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+        uint8_t record[BINLOG_RECORD_MAX];
+        bytestream stream_msg;
+        bytestream* msg = binlog_record_init(&stream_msg, record, sizeof(record));
+        bytewrite_int32(msg, 0);
         /* Common chunk header */
         binlog_compose_event_header(msg, &cnx->initial_cnxid, cnx->start_time, 0, picoquic_log_event_new_connection);
 
@@ -987,37 +1080,24 @@ void binlog_new_connection(picoquic_cnx_t * cnx)
         bytewrite_cstr(msg, cnx->congestion_alg->congestion_algorithm_id);
         bytewrite_vint(msg, cnx->spin_policy);
 
-        bytestream_buf stream_head;
-        bytestream * head = bytestream_buf_init(&stream_head, 8);
-        bytewrite_int32(head, (uint32_t)bytestream_length(msg));
-
-        (void)fwrite(bytestream_data(head), bytestream_length(head), 1, cnx->f_binlog);
-        (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, cnx->f_binlog);
+        binlog_write_record(cnx, msg);
     }
 }
 
 void binlog_close_connection(picoquic_cnx_t * cnx)
 {
-    FILE * f = cnx->f_binlog;
-    if (f == NULL) {
+    if (cnx->f_binlog == NULL) {
         return;
     }
 
-    bytestream_buf stream_msg;
-    bytestream * msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    uint8_t record[BINLOG_RECORD_MAX];
+    bytestream stream_msg;
+    bytestream* msg = binlog_record_init(&stream_msg, record, sizeof(record));
+    bytewrite_int32(msg, 0);
     /* Common chunk header */
     binlog_compose_event_header(msg, &cnx->initial_cnxid, picoquic_get_quic_time(cnx->quic), 0, picoquic_log_event_connection_close);
 
-    bytestream_buf stream_head;
-    bytestream * head = bytestream_buf_init(&stream_head, 8);
-    bytewrite_int32(head, (uint32_t)bytestream_length(msg));
-
-    (void)fwrite(bytestream_data(head), bytestream_length(head), 1, f);
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
-
-    fflush(f);
-
-    cnx->f_binlog = picoquic_file_close(cnx->f_binlog);
+    binlog_close_file(cnx, msg);
 
     if (cnx->quic->qlog_dir != NULL && cnx->quic->autoqlog_fn != NULL) {
         (void)cnx->quic->autoqlog_fn(cnx);
@@ -1028,13 +1108,18 @@ void binlog_close_connection(picoquic_cnx_t * cnx)
     }
 }
 
-FILE* create_binlog(char const* binlog_file, uint64_t creation_time, unsigned int is_multipath_supported)
+FILE* create_binlog_ex(char const* binlog_file, uint64_t creation_time, unsigned int is_multipath_supported,
+    size_t buffer_size)
 {
     FILE* f_binlog = picoquic_file_open(binlog_file, "wb");
     if (f_binlog == NULL) {
         DBG_PRINTF("Cannot open file %s for write.\n", binlog_file);
     }
     else {
+        if (buffer_size > 0) {
+            (void)setvbuf(f_binlog, NULL, _IOFBF, buffer_size);
+        }
+
         /* Write a header text with version identifier and current date  */
         bytestream_buf stream;
         bytestream* ps = bytestream_buf_init(&stream, 16);
@@ -1052,6 +1137,11 @@ FILE* create_binlog(char const* binlog_file, uint64_t creation_time, unsigned in
     return f_binlog;
 }
 
+FILE* create_binlog(char const* binlog_file, uint64_t creation_time, unsigned int is_multipath_supported)
+{
+    return create_binlog_ex(binlog_file, creation_time, is_multipath_supported, 0);
+}
+
 /*
  * Log the state of the congestion management, retransmission, etc.
  * Call either just after processing a received packet, or just after
@@ -1064,8 +1154,10 @@ void binlog_cc_dump(picoquic_cnx_t* cnx, uint64_t current_time)
         return;
     }
 
-    bytestream_buf stream_msg;
-    bytestream* ps_msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    uint8_t record[BINLOG_RECORD_MAX];
+    bytestream stream_msg;
+    bytestream* ps_msg = binlog_record_init(&stream_msg, record, sizeof(record));
+    bytewrite_int32(ps_msg, 0);
     int path_max = (cnx->is_multipath_enabled || cnx->is_simple_multipath_enabled) ? cnx->nb_paths : 1;
 
     for (int path_id = 0; path_id < path_max; path_id++)
@@ -1140,13 +1232,7 @@ void binlog_cc_dump(picoquic_cnx_t* cnx, uint64_t current_time)
         bytewrite_vint(ps_msg, path->max_bandwidth_estimate);
         bytewrite_vint(ps_msg, path->bytes_in_transit);
 
-        bytestream_buf stream_head;
-        bytestream* ps_head = bytestream_buf_init(&stream_head, BYTESTREAM_MAX_BUFFER_SIZE);
-
-        bytewrite_int32(ps_head, (uint32_t)bytestream_length(ps_msg));
-
-        (void)fwrite(bytestream_data(ps_head), bytestream_length(ps_head), 1, cnx->f_binlog);
-        (void)fwrite(bytestream_data(ps_msg), bytestream_length(ps_msg), 1, cnx->f_binlog);
+        binlog_write_record(cnx, ps_msg);
     }
 }
 
@@ -1159,11 +1245,13 @@ void picoquic_binlog_message_v(picoquic_cnx_t* cnx, const char* fmt, va_list var
     if (cnx->f_binlog == NULL) {
         return;
     }
-    bytestream_buf stream_msg;
-    bytestream* ps_msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    uint8_t record[BINLOG_RECORD_MAX];
+    bytestream stream_msg;
+    bytestream* ps_msg = binlog_record_init(&stream_msg, record, sizeof(record));
     size_t message_len;
     char* message_text;
     int written = -1;
+    bytewrite_int32(ps_msg, 0);
     /* Common chunk header */
     binlog_compose_event_header(ps_msg, &cnx->initial_cnxid, picoquic_get_quic_time(cnx->quic), 0, picoquic_log_event_info_message);
 
@@ -1182,13 +1270,7 @@ void picoquic_binlog_message_v(picoquic_cnx_t* cnx, const char* fmt, va_list var
 #endif
     ps_msg->ptr += message_len;
 
-    bytestream_buf stream_head;
-    bytestream* ps_head = bytestream_buf_init(&stream_head, BYTESTREAM_MAX_BUFFER_SIZE);
-
-    bytewrite_int32(ps_head, (uint32_t)bytestream_length(ps_msg));
-
-    (void)fwrite(bytestream_data(ps_head), bytestream_length(ps_head), 1, cnx->f_binlog);
-    (void)fwrite(bytestream_data(ps_msg), bytestream_length(ps_msg), 1, cnx->f_binlog);
+    binlog_write_record(cnx, ps_msg);
 }
 
 /* Log an event that cannot be attached to a specific connection */
@@ -480,7 +480,14 @@ int picoquic_remove_header_protection(picoquic_cnx_t* cnx,
             uint32_t pn_val = 0;
 
             memcpy(decrypted_bytes, bytes, ph->pn_offset);
-            picoquic_pn_encrypt(pn_enc, bytes + sample_offset, mask_bytes, mask_bytes, mask_length);
+            if (cnx->quic->rx_hp_mask != NULL && cnx->quic->rx_hp_mask->bytes == bytes &&
+                cnx->quic->rx_hp_mask->pn_dec == pn_enc) {
+                /* The mask was computed with the rest of the batch */
+                memcpy(mask_bytes, cnx->quic->rx_hp_mask->mask, mask_length);
+            }
+            else {
+                picoquic_pn_encrypt(pn_enc, bytes + sample_offset, mask_bytes, mask_bytes, mask_length);
+            }
             /* Decode the first byte */
             first_byte ^= (mask_bytes[0] & first_mask);
             pn_l = (first_byte & 3) + 1;
@@ -759,7 +766,12 @@ int picoquic_parse_header_and_decrypt(
             }
 
             if (ret == 0) {
-                if (*pcnx != NULL) {
+                if (*pcnx != NULL && (*pcnx)->tls_job != NULL) {
+                    /* A worker thread is running the TLS handshake of this connection,
+                     * and may be changing its keys. Drop the packet. */
+                    ret = PICOQUIC_ERROR_TLS_JOB_PENDING;
+                }
+                else if (*pcnx != NULL) {
                     /* Test whether we need to do a version upgrade */
                     if (ph->version_index != (*pcnx)->version_index) {
                         if ((*pcnx)->client_mode &&
@@ -2149,6 +2161,8 @@ int picoquic_incoming_segment(
     if (decrypted_data == NULL) {
         return -1;
     }
+    /* Document the arrival time of the segment, for use in RTT samples */
+    quic->segment_receive_time = receive_time;
     /* Parse the header and decrypt the segment */
     ret = picoquic_parse_header_and_decrypt(quic, raw_bytes, length, packet_length, addr_from,
         current_time, decrypted_data, &ph, &cnx, consumed, &new_context_created);
@@ -2163,7 +2177,7 @@ int picoquic_incoming_segment(
 
 
         /* if needed, log that the packet is received */
-        if (cnx != NULL) {
+        if (cnx != NULL && ret != PICOQUIC_ERROR_TLS_JOB_PENDING) {
             picoquic_log_pdu(cnx, 1, current_time, addr_from, addr_to, packet_length);
         }
         else {
@@ -2192,8 +2206,9 @@ int picoquic_incoming_segment(
         is_buffered = picoquic_incoming_not_decrypted(cnx, &ph, current_time, bytes, length, addr_from, addr_to, if_index_to, received_ecn);
     }
 
-    /* Find the path and if required log the incoming packet */
-    if (cnx != NULL) {
+    /* Find the path and if required log the incoming packet.
+     * Connections waiting for a TLS worker are not logged, as the worker may be logging. */
+    if (cnx != NULL && ret != PICOQUIC_ERROR_TLS_JOB_PENDING) {
         if (ret == 0 && ph.ptype == picoquic_packet_1rtt_protected) {
             if (ph.payload_length == 0) {
                 /* empty payload! */
@@ -2373,11 +2388,13 @@ int picoquic_incoming_segment(
         ret == PICOQUIC_ERROR_VERSION_NOT_SUPPORTED ||
         ret == PICOQUIC_ERROR_PACKET_TOO_LONG ||
         ret == PICOQUIC_ERROR_DUPLICATE ||
-        ret == PICOQUIC_ERROR_AEAD_NOT_READY) {
+        ret == PICOQUIC_ERROR_AEAD_NOT_READY ||
+        ret == PICOQUIC_ERROR_TLS_JOB_PENDING) {
         /* Bad packets are dropped silently */
         if (ret == PICOQUIC_ERROR_AEAD_CHECK ||
             ret == PICOQUIC_ERROR_PACKET_WRONG_VERSION ||
             ret == PICOQUIC_ERROR_AEAD_NOT_READY ||
+            ret == PICOQUIC_ERROR_TLS_JOB_PENDING ||
             ret == PICOQUIC_ERROR_PACKET_TOO_LONG ||
             ret == PICOQUIC_ERROR_VERSION_NOT_SUPPORTED) {
             ret = 0;
@@ -2400,10 +2417,14 @@ int picoquic_incoming_segment(
         ret = -1;
     }
 
-    if (decrypted_data != NULL && decrypted_data->bytes == NULL) {
+    if (decrypted_data != NULL) {
+        /* Release the hold of the packet processing. The node remains
+         * allocated if stream data chunks still point to its content. */
         picoquic_stream_data_node_recycle(decrypted_data);
     }
 
+    quic->segment_receive_time = 0;
+
     return ret;
 }
 
@@ -2417,6 +2438,22 @@ int picoquic_incoming_packet_ex(
     unsigned char received_ecn,
     picoquic_cnx_t** first_cnx,
     uint64_t current_time)
+{
+    return picoquic_incoming_packet_ex2(quic, bytes, packet_length, addr_from, addr_to,
+        if_index_to, received_ecn, first_cnx, current_time, 0);
+}
+
+int picoquic_incoming_packet_ex2(
+    picoquic_quic_t* quic,
+    uint8_t* bytes,
+    size_t packet_length,
+    struct sockaddr* addr_from,
+    struct sockaddr* addr_to,
+    int if_index_to,
+    unsigned char received_ecn,
+    picoquic_cnx_t** first_cnx,
+    uint64_t current_time,
+    uint64_t receive_time)
 {
     size_t consumed_index = 0;
     int ret = 0;
@@ -2427,13 +2464,18 @@ int picoquic_incoming_packet_ex(
         return 0;
     }
 
+    if (receive_time == 0 || receive_time > current_time ||
+        current_time - receive_time > PICOQUIC_RECEIVE_TIME_LAG_MAX) {
+        /* Time stamp not available or not plausible, use the current time instead */
+        receive_time = current_time;
+    }
 
     while (consumed_index < packet_length) {
         size_t consumed = 0;
 
         ret = picoquic_incoming_segment(quic, bytes + consumed_index, 
             packet_length - consumed_index, packet_length,
-            &consumed, addr_from, addr_to, if_index_to, received_ecn, current_time, current_time,
+            &consumed, addr_from, addr_to, if_index_to, received_ecn, current_time, receive_time,
             &previous_destid, first_cnx);
 
         if (ret == 0) {
@@ -2452,6 +2494,118 @@ int picoquic_incoming_packet_ex(
         (*first_cnx)->max_mtu_received = packet_length;
     }
 
+    if (quic->first_tls_job_ready != NULL) {
+        /* Submit the TLS jobs created while processing the packet */
+        picoquic_tls_jobs_dispatch(quic);
+    }
+
+    return ret;
+}
+
+/*
+ * Processing of a batch of datagrams, such as received with recvmmsg or GRO.
+ * Most datagrams in a batch carry short header packets for the same connection,
+ * protected with the same header protection key. Before processing the datagrams
+ * one by one, the header protection masks of all these packets are computed
+ * with a single multi-block cipher call per key. A precomputed mask is only used
+ * if the packet still maps to the same key when it is processed. Otherwise, for
+ * example if the CID does not match a connection or the keys are not available
+ * yet, the mask is computed per packet as usual.
+ */
+#define PICOQUIC_INCOMING_BATCH_MAX 64
+
+static void picoquic_incoming_batch_masks(picoquic_quic_t* quic, picoquic_received_packet_t* packets,
+    size_t nb_packets, picoquic_rx_hp_mask_t* hp_masks)
+{
+    void* pn_ecb[PICOQUIC_INCOMING_BATCH_MAX];
+    size_t rank[PICOQUIC_INCOMING_BATCH_MAX];
+    uint8_t samples[PICOQUIC_INCOMING_BATCH_MAX * PICOQUIC_HP_SAMPLE_SIZE];
+    uint8_t masks[PICOQUIC_INCOMING_BATCH_MAX * PICOQUIC_HP_SAMPLE_SIZE];
+    size_t sample_offset = (size_t)1 + quic->local_cnxid_length + 4;
+
+    /* Find the header protection key of each short header packet */
+    for (size_t i = 0; i < nb_packets; i++) {
+        const uint8_t* bytes = packets[i].bytes;
+        picoquic_cnx_t* cnx = NULL;
+
+        hp_masks[i].bytes = NULL;
+        hp_masks[i].pn_dec = NULL;
+        pn_ecb[i] = NULL;
+
+        if (packets[i].length >= sample_offset + PICOQUIC_HP_SAMPLE_SIZE && (bytes[0] & 0x80) == 0) {
+            if (quic->local_cnxid_length == 0) {
+                cnx = picoquic_cnx_by_net(quic, packets[i].addr_from);
+            }
+            else {
+                picoquic_connection_id_t dest_cnx_id;
+
+                (void)picoquic_parse_connection_id(bytes + 1, quic->local_cnxid_length, &dest_cnx_id);
+                cnx = picoquic_cnx_by_id(quic, dest_cnx_id, NULL);
+            }
+
+            if (cnx != NULL && cnx->tls_job == NULL && cnx->crypto_context[picoquic_epoch_1rtt].pn_dec_ecb != NULL) {
+                hp_masks[i].bytes = bytes;
+                hp_masks[i].pn_dec = cnx->crypto_context[picoquic_epoch_1rtt].pn_dec;
+                pn_ecb[i] = cnx->crypto_context[picoquic_epoch_1rtt].pn_dec_ecb;
+            }
+        }
+    }
+
+    /* Compute the masks of all the packets that share a key in one call */
+    for (size_t i = 0; i < nb_packets; i++) {
+        void* key_ecb = pn_ecb[i];
+        size_t nb_samples = 0;
+
+        if (key_ecb == NULL) {
+            continue;
+        }
+        for (size_t j = i; j < nb_packets; j++) {
+            if (pn_ecb[j] == key_ecb) {
+                rank[nb_samples] = j;
+                memcpy(samples + nb_samples * PICOQUIC_HP_SAMPLE_SIZE, packets[j].bytes + sample_offset,
+                    PICOQUIC_HP_SAMPLE_SIZE);
+                pn_ecb[j] = NULL;
+                nb_samples++;
+            }
+        }
+        picoquic_pn_encrypt_batch(hp_masks[i].pn_dec, key_ecb, samples, masks, nb_samples);
+        for (size_t k = 0; k < nb_samples; k++) {
+            memcpy(hp_masks[rank[k]].mask, masks + k * PICOQUIC_HP_SAMPLE_SIZE, sizeof(hp_masks[rank[k]].mask));
+        }
+    }
+}
+
+int picoquic_incoming_packet_batch(
+    picoquic_quic_t* quic,
+    picoquic_received_packet_t* packets,
+    size_t nb_packets,
+    picoquic_cnx_t** first_cnx,
+    uint64_t current_time)
+{
+    int ret = 0;
+    picoquic_rx_hp_mask_t hp_masks[PICOQUIC_INCOMING_BATCH_MAX];
+    size_t first = 0;
+
+    while (ret == 0 && first < nb_packets) {
+        size_t nb_batch = nb_packets - first;
+
+        if (nb_batch > PICOQUIC_INCOMING_BATCH_MAX) {
+            nb_batch = PICOQUIC_INCOMING_BATCH_MAX;
+        }
+        picoquic_incoming_batch_masks(quic, packets + first, nb_batch, hp_masks);
+
+        for (size_t i = 0; ret == 0 && i < nb_batch; i++) {
+            picoquic_received_packet_t* packet = &packets[first + i];
+
+            quic->rx_hp_mask = &hp_masks[i];
+            ret = picoquic_incoming_packet_ex2(quic, packet->bytes, packet->length, packet->addr_from,
+                packet->addr_to, packet->if_index_to, packet->received_ecn, first_cnx, current_time,
+                packet->receive_time);
+        }
+        quic->rx_hp_mask = NULL;
+        first += nb_batch;
+    }
+
     return ret;
 }
 
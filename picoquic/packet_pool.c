@@ -0,0 +1,330 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2022, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Packet pool.
+ *
+ * Packets are carved from arenas, each holding a number of packets.
+ * The first arena is small, and each new arena doubles the number of
+ * packets reserved by the context, up to the size of a huge page.
+ * Arenas of that size are aligned on a huge page boundary, and the OS
+ * is advised to back them with a huge page when possible.
+ *
+ * Each packet is preceded by a pointer to its arena, and each arena keeps
+ * its own list of free packets and its count of packets in use. The
+ * arenas that have free packets are kept at the head of the list of
+ * arenas, so packets are always taken from the first arena. When all the
+ * packets of an arena are recycled, the arena is released if the other
+ * arenas have at least as many free packets, so the memory reserved
+ * during a burst is returned to the system once the burst is over, while
+ * some spare packets are kept for the next one.
+ *
+ * Only the metadata of the packets is set to zero when packets are
+ * carved or recycled. The content of "bytes" is always written by
+ * the sender before it is read.
+ *
+ * If a memory budget is set, no arena is allocated past that budget,
+ * and the creation of packets fails once all packets are in use.
+ *
+ * Lost packets kept for the detection of spurious retransmissions are
+ * replaced by compact copies, which only hold the metadata and the
+ * frames needed for processing late acknowledgements. These copies are
+ * allocated individually, outside of the arenas, and are freed instead
+ * of being returned to the free list.
+ */
+
+#ifndef _WINDOWS
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/mman.h>
+#endif
+#include "picoquic_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define PICOQUIC_PACKET_ARENA_HEADER_SIZE 64
+#define PICOQUIC_PACKET_ARENA_MIN_PACKETS 32
+#define PICOQUIC_PACKET_ARENA_HUGE_PAGE_SIZE 0x200000
+
+typedef struct st_picoquic_packet_arena_t {
+    struct st_picoquic_packet_arena_t* next_arena;
+    struct st_picoquic_packet_arena_t* previous_arena;
+    size_t arena_bytes;
+    size_t nb_packets;
+    size_t nb_in_use;
+    picoquic_packet_t* first_free;
+} picoquic_packet_arena_t;
+
+typedef struct st_picoquic_packet_slot_t {
+    picoquic_packet_arena_t* arena;
+    picoquic_packet_t packet;
+} picoquic_packet_slot_t;
+
+#define picoquic_packet_get_arena(p) \
+    (((picoquic_packet_slot_t*)((uint8_t*)(p) - offsetof(picoquic_packet_slot_t, packet)))->arena)
+
+static void* picoquic_packet_arena_alloc(size_t arena_bytes)
+{
+    void* arena = NULL;
+#if defined(MADV_HUGEPAGE)
+    if (arena_bytes == PICOQUIC_PACKET_ARENA_HUGE_PAGE_SIZE) {
+        if (posix_memalign(&arena, PICOQUIC_PACKET_ARENA_HUGE_PAGE_SIZE, arena_bytes) == 0) {
+            (void)madvise(arena, arena_bytes, MADV_HUGEPAGE);
+        }
+        else {
+            arena = NULL;
+        }
+    }
+    else
+#endif
+    {
+        arena = malloc(arena_bytes);
+    }
+    return arena;
+}
+
+static size_t picoquic_packet_arena_nb_packets(picoquic_quic_t* quic)
+{
+    size_t nb_max = (PICOQUIC_PACKET_ARENA_HUGE_PAGE_SIZE - PICOQUIC_PACKET_ARENA_HEADER_SIZE) / sizeof(picoquic_packet_slot_t);
+    size_t nb_packets = (quic->nb_packets_allocated == 0) ? PICOQUIC_PACKET_ARENA_MIN_PACKETS : (size_t)quic->nb_packets_allocated;
+
+    if (nb_packets > nb_max) {
+        nb_packets = nb_max;
+    }
+
+    if (quic->packet_memory_budget > 0) {
+        size_t available = (quic->packet_memory_budget > quic->packet_arena_bytes) ?
+            quic->packet_memory_budget - quic->packet_arena_bytes : 0;
+        size_t nb_available = (available > PICOQUIC_PACKET_ARENA_HEADER_SIZE) ?
+            (available - PICOQUIC_PACKET_ARENA_HEADER_SIZE) / sizeof(picoquic_packet_slot_t) : 0;
+        if (nb_packets > nb_available) {
+            nb_packets = nb_available;
+        }
+    }
+
+    return nb_packets;
+}
+
+static void picoquic_packet_arena_unlink(picoquic_quic_t* quic, picoquic_packet_arena_t* arena)
+{
+    if (arena->previous_arena == NULL) {
+        quic->packet_arena_first = arena->next_arena;
+    }
+    else {
+        arena->previous_arena->next_arena = arena->next_arena;
+    }
+    if (arena->next_arena == NULL) {
+        quic->packet_arena_last = arena->previous_arena;
+    }
+    else {
+        arena->next_arena->previous_arena = arena->previous_arena;
+    }
+    arena->next_arena = NULL;
+    arena->previous_arena = NULL;
+}
+
+static void picoquic_packet_arena_insert_first(picoquic_quic_t* quic, picoquic_packet_arena_t* arena)
+{
+    arena->previous_arena = NULL;
+    arena->next_arena = quic->packet_arena_first;
+    if (quic->packet_arena_first == NULL) {
+        quic->packet_arena_last = arena;
+    }
+    else {
+        quic->packet_arena_first->previous_arena = arena;
+    }
+    quic->packet_arena_first = arena;
+}
+
+static void picoquic_packet_arena_insert_last(picoquic_quic_t* quic, picoquic_packet_arena_t* arena)
+{
+    arena->next_arena = NULL;
+    arena->previous_arena = quic->packet_arena_last;
+    if (quic->packet_arena_last == NULL) {
+        quic->packet_arena_first = arena;
+    }
+    else {
+        quic->packet_arena_last->next_arena = arena;
+    }
+    quic->packet_arena_last = arena;
+}
+
+static int picoquic_packet_arena_add(picoquic_quic_t* quic)
+{
+    int ret = 0;
+    size_t nb_packets = picoquic_packet_arena_nb_packets(quic);
+    size_t arena_bytes = PICOQUIC_PACKET_ARENA_HEADER_SIZE + nb_packets * sizeof(picoquic_packet_slot_t);
+    picoquic_packet_arena_t* arena;
+
+    if (nb_packets == 0) {
+        ret = -1;
+    }
+    else {
+        /* Round up the largest arenas to the huge page size */
+        if (arena_bytes + sizeof(picoquic_packet_slot_t) > PICOQUIC_PACKET_ARENA_HUGE_PAGE_SIZE &&
+            (quic->packet_memory_budget == 0 ||
+                quic->packet_arena_bytes + PICOQUIC_PACKET_ARENA_HUGE_PAGE_SIZE <= quic->packet_memory_budget)) {
+            arena_bytes = PICOQUIC_PACKET_ARENA_HUGE_PAGE_SIZE;
+        }
+        if ((arena = (picoquic_packet_arena_t*)picoquic_packet_arena_alloc(arena_bytes)) == NULL) {
+            ret = -1;
+        }
+        else {
+            picoquic_packet_slot_t* slots = (picoquic_packet_slot_t*)((uint8_t*)arena + PICOQUIC_PACKET_ARENA_HEADER_SIZE);
+
+            arena->arena_bytes = arena_bytes;
+            arena->nb_packets = nb_packets;
+            arena->nb_in_use = 0;
+            arena->first_free = NULL;
+            picoquic_packet_arena_insert_first(quic, arena);
+            quic->packet_arena_bytes += arena_bytes;
+            quic->nb_packet_arenas++;
+            quic->nb_packets_allocated += (int)nb_packets;
+
+            /* Chain the new packets in the free list, lowest address first */
+            for (size_t i = nb_packets; i > 0; i--) {
+                picoquic_packet_t* packet = &slots[i - 1].packet;
+                slots[i - 1].arena = arena;
+                memset(packet, 0, offsetof(struct st_picoquic_packet_t, bytes));
+                packet->next_packet = arena->first_free;
+                arena->first_free = packet;
+            }
+            quic->nb_packets_in_pool += (int)nb_packets;
+        }
+    }
+
+    return ret;
+}
+
+static void picoquic_packet_arena_release(picoquic_quic_t* quic, picoquic_packet_arena_t* arena)
+{
+    picoquic_packet_arena_unlink(quic, arena);
+    quic->packet_arena_bytes -= arena->arena_bytes;
+    quic->nb_packet_arenas--;
+    quic->nb_packets_allocated -= (int)arena->nb_packets;
+    quic->nb_packets_in_pool -= (int)arena->nb_packets;
+    free(arena);
+}
+
+void picoquic_packet_pool_free(picoquic_quic_t* quic)
+{
+    while (quic->packet_arena_first != NULL) {
+        picoquic_packet_arena_t* arena = quic->packet_arena_first;
+        quic->packet_arena_first = arena->next_arena;
+        free(arena);
+    }
+    quic->packet_arena_last = NULL;
+    quic->nb_packets_in_pool = 0;
+    quic->nb_packets_allocated = 0;
+    quic->packet_arena_bytes = 0;
+    quic->nb_packet_arenas = 0;
+}
+
+picoquic_packet_t* picoquic_create_packet(picoquic_quic_t * quic)
+{
+    picoquic_packet_arena_t* arena = quic->packet_arena_first;
+    picoquic_packet_t* packet = NULL;
+
+    if ((arena == NULL || arena->first_free == NULL) && picoquic_packet_arena_add(quic) == 0) {
+        arena = quic->packet_arena_first;
+    }
+
+    if (arena == NULL || arena->first_free == NULL) {
+        quic->nb_packets_refused++;
+    }
+    else {
+        /* The metadata was set to zero when the packet was carved or recycled */
+        packet = arena->first_free;
+        arena->first_free = packet->next_packet;
+        arena->nb_in_use++;
+        quic->nb_packets_in_pool--;
+        packet->next_packet = NULL;
+        if (arena->first_free == NULL && arena->next_arena != NULL) {
+            /* Full arenas go after those that have free packets */
+            picoquic_packet_arena_unlink(quic, arena);
+            picoquic_packet_arena_insert_last(quic, arena);
+        }
+    }
+
+    return packet;
+}
+
+/* Allocate a compact copy of a packet, with the metadata of the packet and
+ * only "bytes_length" bytes of content. The caller marks the copy as compacted.
+ */
+picoquic_packet_t* picoquic_create_compact_packet(const picoquic_packet_t* packet, const uint8_t* bytes, size_t bytes_length)
+{
+    uint8_t* compact = NULL;
+
+    if (bytes_length <= PICOQUIC_MAX_PACKET_SIZE) {
+        compact = (uint8_t*)malloc(offsetof(struct st_picoquic_packet_t, bytes) + bytes_length);
+        if (compact != NULL) {
+            memcpy(compact, packet, offsetof(struct st_picoquic_packet_t, bytes));
+            memcpy(compact + offsetof(struct st_picoquic_packet_t, bytes), bytes, bytes_length);
+        }
+    }
+
+    return (picoquic_packet_t*)compact;
+}
+
+void picoquic_recycle_packet(picoquic_quic_t * quic, picoquic_packet_t* packet)
+{
+    if (packet != NULL && packet->is_compacted) {
+        free(packet);
+    }
+    else if (packet != NULL) {
+        picoquic_packet_arena_t* arena = picoquic_packet_get_arena(packet);
+
+        memset(packet, 0, offsetof(struct st_picoquic_packet_t, bytes));
+        if (arena->first_free == NULL && arena->previous_arena != NULL) {
+            picoquic_packet_arena_unlink(quic, arena);
+            picoquic_packet_arena_insert_first(quic, arena);
+        }
+        packet->next_packet = arena->first_free;
+        arena->first_free = packet;
+        arena->nb_in_use--;
+        quic->nb_packets_in_pool++;
+
+        if (arena->nb_in_use == 0 &&
+            (size_t)quic->nb_packets_in_pool >= 2 * arena->nb_packets) {
+            /* The other arenas have enough spare packets */
+            picoquic_packet_arena_release(quic, arena);
+        }
+    }
+}
+
+void picoquic_set_packet_memory_budget(picoquic_quic_t* quic, size_t memory_budget)
+{
+    quic->packet_memory_budget = memory_budget;
+}
+
+void picoquic_get_packet_pool_stats(picoquic_quic_t* quic, picoquic_packet_pool_stats_t* stats)
+{
+    stats->packet_size = sizeof(picoquic_packet_slot_t);
+    stats->memory_budget = quic->packet_memory_budget;
+    stats->arena_bytes = quic->packet_arena_bytes;
+    stats->nb_arenas = quic->nb_packet_arenas;
+    stats->nb_packets_allocated = (uint64_t)quic->nb_packets_allocated;
+    stats->nb_packets_in_pool = (uint64_t)quic->nb_packets_in_pool;
+    stats->nb_packets_in_use = (uint64_t)(quic->nb_packets_allocated - quic->nb_packets_in_pool);
+    stats->nb_packets_refused = quic->nb_packets_refused;
+}
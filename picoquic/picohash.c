@@ -20,26 +20,159 @@
 */
 
 /*
- * Basic hash implementation, like we have seen tons off already.
+ * Open addressing hash table, using Robin Hood linear probing: an item being
+ * inserted takes the bin of any item that is closer to its home bin, which
+ * keeps the probe sequences short and lets lookups stop early. Deletions
+ * shift the following items back instead of leaving tombstones.
+ *
+ * When the table grows, the items of the previous table are moved a few bins
+ * at a time. The moved bins of the previous table are marked with a sentinel
+ * key, so that lookups in that table can still probe past them. Lookups
+ * search the current table first, then the previous one.
  */
 #include "picohash.h"
 #include <stdlib.h>
 #include <string.h>
 
+#define PICOHASH_MIN_BINS 8
+#define PICOHASH_MOVE_STEP 16
+
+static const uint8_t picohash_moved_marker = 0;
+#define PICOHASH_MOVED ((const void*)&picohash_moved_marker)
+
+/* Home bin of a hash, using multiplicative hashing to spread weak hashes */
+static size_t picohash_home_bin(uint64_t hash, size_t nb_bin)
+{
+    return (size_t)((hash * 0x9E3779B97F4A7C15ull) >> 32) & (nb_bin - 1);
+}
+
+static size_t picohash_bin_distance(const picohash_item* bin, size_t index, size_t nb_bin)
+{
+    return (index - picohash_home_bin(bin->hash, nb_bin)) & (nb_bin - 1);
+}
+
+static picohash_item* picohash_alloc_bins(size_t nb_bin)
+{
+    picohash_item* bins = (picohash_item*)malloc(sizeof(picohash_item) * nb_bin);
+
+    if (bins != NULL) {
+        (void)memset(bins, 0, sizeof(picohash_item) * nb_bin);
+    }
+
+    return bins;
+}
+
+static picohash_item* picohash_find_in_bins(picohash_table* hash_table, picohash_item* bins, size_t nb_bin,
+    uint64_t hash, const void* key)
+{
+    size_t index = picohash_home_bin(hash, nb_bin);
+
+    for (size_t distance = 0; distance < nb_bin; distance++) {
+        picohash_item* bin = &bins[index];
+
+        if (bin->key == NULL || picohash_bin_distance(bin, index, nb_bin) < distance) {
+            break;
+        }
+        if (bin->hash == hash && bin->key != PICOHASH_MOVED &&
+            hash_table->picohash_compare(key, bin->key) == 0) {
+            return bin;
+        }
+        index = (index + 1) & (nb_bin - 1);
+    }
+
+    return NULL;
+}
+
+/* Insert in the current table, which is known to have free bins */
+static void picohash_insert_in_bins(picohash_item* bins, size_t nb_bin, uint64_t hash, const void* key)
+{
+    picohash_item item;
+    size_t index = picohash_home_bin(hash, nb_bin);
+    size_t distance = 0;
+
+    item.hash = hash;
+    item.key = key;
+
+    while (bins[index].key != NULL) {
+        size_t bin_distance = picohash_bin_distance(&bins[index], index, nb_bin);
+
+        if (bin_distance < distance) {
+            picohash_item evicted = bins[index];
+            bins[index] = item;
+            item = evicted;
+            distance = bin_distance;
+        }
+        index = (index + 1) & (nb_bin - 1);
+        distance++;
+    }
+    bins[index] = item;
+}
+
+/* Move some bins of the previous table, and free it when all are moved */
+static void picohash_move_old_bins(picohash_table* hash_table, size_t nb_steps)
+{
+    while (hash_table->old_bin != NULL && nb_steps > 0) {
+        picohash_item* bin = &hash_table->old_bin[hash_table->old_bin_moved];
+
+        if (bin->key != NULL && bin->key != PICOHASH_MOVED) {
+            picohash_insert_in_bins(hash_table->hash_bin, hash_table->nb_bin, bin->hash, bin->key);
+        }
+        bin->key = PICOHASH_MOVED;
+        hash_table->old_bin_moved++;
+        nb_steps--;
+
+        if (hash_table->old_bin_moved >= hash_table->old_nb_bin) {
+            free(hash_table->old_bin);
+            hash_table->old_bin = NULL;
+            hash_table->old_nb_bin = 0;
+            hash_table->old_bin_moved = 0;
+        }
+    }
+}
+
+static int picohash_grow(picohash_table* hash_table)
+{
+    int ret = 0;
+    picohash_item* new_bins;
+
+    /* Complete the previous resize before starting a new one */
+    picohash_move_old_bins(hash_table, hash_table->old_nb_bin);
+
+    new_bins = picohash_alloc_bins(hash_table->nb_bin * 2);
+    if (new_bins == NULL) {
+        ret = -1;
+    }
+    else {
+        hash_table->old_bin = hash_table->hash_bin;
+        hash_table->old_nb_bin = hash_table->nb_bin;
+        hash_table->old_bin_moved = 0;
+        hash_table->hash_bin = new_bins;
+        hash_table->nb_bin *= 2;
+    }
+
+    return ret;
+}
+
 picohash_table* picohash_create(size_t nb_bin,
     uint64_t (*picohash_hash)(const void*),
     int (*picohash_compare)(const void*, const void*))
 {
     picohash_table* t = (picohash_table*)malloc(sizeof(picohash_table));
+    size_t nb_bin_pow2 = PICOHASH_MIN_BINS;
+
+    while (nb_bin_pow2 < nb_bin) {
+        nb_bin_pow2 *= 2;
+    }
+
     if (t != NULL) {
-        t->hash_bin = (picohash_item**)malloc(sizeof(picohash_item*) * nb_bin);
+        (void)memset(t, 0, sizeof(picohash_table));
+        t->hash_bin = picohash_alloc_bins(nb_bin_pow2);
 
         if (t->hash_bin == NULL) {
             free(t);
             t = NULL;
         } else {
-            (void)memset(t->hash_bin, 0, sizeof(picohash_item*) * nb_bin);
-            t->nb_bin = nb_bin;
+            t->nb_bin = nb_bin_pow2;
             t->count = 0;
             t->picohash_hash = picohash_hash;
             t->picohash_compare = picohash_compare;
@@ -52,15 +185,10 @@ picohash_table* picohash_create(size_t nb_bin,
 picohash_item* picohash_retrieve(picohash_table* hash_table, const void* key)
 {
     uint64_t hash = hash_table->picohash_hash(key);
-    uint32_t bin = (uint32_t)(hash % hash_table->nb_bin);
-    picohash_item* item = hash_table->hash_bin[bin];
+    picohash_item* item = picohash_find_in_bins(hash_table, hash_table->hash_bin, hash_table->nb_bin, hash, key);
 
-    while (item != NULL) {
-        if (hash_table->picohash_compare(key, item->key) == 0) {
-            break;
-        } else {
-            item = item->next_in_bin;
-        }
+    if (item == NULL && hash_table->old_bin != NULL) {
+        item = picohash_find_in_bins(hash_table, hash_table->old_bin, hash_table->old_nb_bin, hash, key);
     }
 
     return item;
@@ -69,18 +197,16 @@ picohash_item* picohash_retrieve(picohash_table* hash_table, const void* key)
 int picohash_insert(picohash_table* hash_table, const void* key)
 {
     uint64_t hash = hash_table->picohash_hash(key);
-    uint32_t bin = (uint32_t)(hash % hash_table->nb_bin);
     int ret = 0;
-    picohash_item* item = (picohash_item*)malloc(sizeof(picohash_item));
 
-    if (item == NULL) {
-        ret = -1;
-    } else {
-        item->hash = hash;
-        item->key = key;
-        item->next_in_bin = hash_table->hash_bin[bin];
-        hash_table->hash_bin[bin] = item;
+    if ((hash_table->count + 1) * 4 > hash_table->nb_bin * 3) {
+        ret = picohash_grow(hash_table);
+    }
+
+    if (ret == 0) {
+        picohash_insert_in_bins(hash_table->hash_bin, hash_table->nb_bin, hash, key);
         hash_table->count++;
+        picohash_move_old_bins(hash_table, PICOHASH_MOVE_STEP);
     }
 
     return ret;
@@ -88,29 +214,35 @@ int picohash_insert(picohash_table* hash_table, const void* key)
 
 void picohash_delete_item(picohash_table* hash_table, picohash_item* item, int delete_key_too)
 {
-    uint32_t bin = (uint32_t)(item->hash % hash_table->nb_bin);
-    picohash_item* previous = hash_table->hash_bin[bin];
-
-    if (previous == item) {
-        hash_table->hash_bin[bin] = item->next_in_bin;
-        hash_table->count--;
-    } else {
-        while (previous != NULL) {
-            if (previous->next_in_bin == item) {
-                previous->next_in_bin = item->next_in_bin;
-                hash_table->count--;
-                break;
-            } else {
-                previous = previous->next_in_bin;
-            }
+    const void* key = item->key;
+
+    if (hash_table->old_bin != NULL && item >= hash_table->old_bin &&
+        item < hash_table->old_bin + hash_table->old_nb_bin) {
+        /* Items of the previous table are simply marked, so probing continues past them */
+        item->key = PICOHASH_MOVED;
+    }
+    else {
+        /* Shift the following items back until an empty bin or an item at its home bin */
+        size_t nb_bin = hash_table->nb_bin;
+        size_t index = (size_t)(item - hash_table->hash_bin);
+        size_t next = (index + 1) & (nb_bin - 1);
+
+        while (hash_table->hash_bin[next].key != NULL &&
+            picohash_bin_distance(&hash_table->hash_bin[next], next, nb_bin) > 0) {
+            hash_table->hash_bin[index] = hash_table->hash_bin[next];
+            index = next;
+            next = (index + 1) & (nb_bin - 1);
         }
+        hash_table->hash_bin[index].key = NULL;
+        hash_table->hash_bin[index].hash = 0;
     }
+    hash_table->count--;
 
     if (delete_key_too) {
-        free((void*)item->key);
+        free((void*)key);
     }
 
-    free(item);
+    picohash_move_old_bins(hash_table, PICOHASH_MOVE_STEP);
 }
 
 void picohash_delete_key(picohash_table* hash_table, void* key, int delete_key_too)
@@ -127,23 +259,55 @@ void picohash_delete_key(picohash_table* hash_table, void* key, int delete_key_t
 
 void picohash_delete(picohash_table* hash_table, int delete_key_too)
 {
-    for (uint32_t i = 0; i < hash_table->nb_bin; i++) {
-        picohash_item* item = hash_table->hash_bin[i];
-        while (item != NULL) {
-            picohash_item* tmp = item;
-            item = item->next_in_bin;
-
-            if (delete_key_too) {
-                free((void*)tmp->key);
-            }
-            free(tmp);
+    if (delete_key_too) {
+        for (picohash_item* item = picohash_first(hash_table); item != NULL;
+            item = picohash_next(hash_table, item)) {
+            free((void*)item->key);
         }
     }
 
+    if (hash_table->old_bin != NULL) {
+        free(hash_table->old_bin);
+    }
     free(hash_table->hash_bin);
     free(hash_table);
 }
 
+/* Items are visited in the current table, then in the previous one */
+static picohash_item* picohash_next_used(const picohash_table* hash_table, picohash_item* bin, int in_old_bin)
+{
+    if (!in_old_bin) {
+        for (; bin < hash_table->hash_bin + hash_table->nb_bin; bin++) {
+            if (bin->key != NULL) {
+                return bin;
+            }
+        }
+        bin = hash_table->old_bin;
+    }
+
+    if (bin != NULL) {
+        for (; bin < hash_table->old_bin + hash_table->old_nb_bin; bin++) {
+            if (bin->key != NULL && bin->key != PICOHASH_MOVED) {
+                return bin;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+picohash_item* picohash_first(const picohash_table* hash_table)
+{
+    return picohash_next_used(hash_table, hash_table->hash_bin, 0);
+}
+
+picohash_item* picohash_next(const picohash_table* hash_table, const picohash_item* item)
+{
+    int in_old_bin = (item < hash_table->hash_bin || item >= hash_table->hash_bin + hash_table->nb_bin);
+
+    return picohash_next_used(hash_table, (picohash_item*)item + 1, in_old_bin);
+}
+
 uint64_t picohash_hash_mix(uint64_t hash, uint64_t h2)
 {
     h2 ^= (hash << 17) ^ (hash >> 37);
@@ -33,17 +33,27 @@
 extern "C" {
 #endif
 
+/*
+ * The table uses open addressing with Robin Hood linear probing. Items are
+ * stored in the bins, with the full hash used as a tag before comparing keys,
+ * so there is no allocation per insert. When the load exceeds 3/4, the items
+ * are moved to a table of twice the size, a few bins at a time during the
+ * following inserts and deletes. Pointers returned by picohash_retrieve are
+ * only valid until the next insert or delete. The table is not protected
+ * against concurrent access, see picohash_shared_table for that.
+ */
 typedef struct _picohash_item {
     uint64_t hash;
-    struct _picohash_item* next_in_bin;
     const void* key;
 } picohash_item;
 
 typedef struct picohash_table {
-    /* TODO: lock ! */
-    picohash_item** hash_bin;
+    picohash_item* hash_bin;
     size_t nb_bin;
     size_t count;
+    picohash_item* old_bin; /* Previous table, during resize */
+    size_t old_nb_bin;
+    size_t old_bin_moved; /* Number of bins of the previous table already moved */
     uint64_t (*picohash_hash)(const void*);
     int (*picohash_compare)(const void*, const void*);
 } picohash_table;
@@ -62,6 +72,44 @@ void picohash_delete_key(picohash_table* hash_table, void* key, int delete_key_t
 
 void picohash_delete(picohash_table* hash_table, int delete_key_too);
 
+/* Iterate over the items. The table shall not be modified while iterating. */
+picohash_item* picohash_first(const picohash_table* hash_table);
+
+picohash_item* picohash_next(const picohash_table* hash_table, const picohash_item* item);
+
+/*
+ * Shared table, for lookups from several threads.
+ * The items are spread over a power of 2 number of shards by the high bits
+ * of the mixed hash. Each shard is a picohash table protected by a reader
+ * writer lock, so lookups in the same shard proceed in parallel and only
+ * wait for inserts and deletes in that shard.
+ * The table does not manage the lifetime of the keys. The key returned by
+ * picohash_shared_retrieve may be deleted by another thread after the call
+ * returns; picohash_shared_visit calls "visit_fn" while the shard is locked,
+ * so the key cannot be removed from the table during the visit.
+ */
+typedef struct st_picohash_shared_table_t picohash_shared_table;
+typedef void (*picohash_shared_visit_fn)(const void* key, void* visit_ctx);
+
+picohash_shared_table* picohash_shared_create(size_t nb_shards, size_t nb_bin,
+    uint64_t (*picohash_hash)(const void*),
+    int (*picohash_compare)(const void*, const void*));
+
+void picohash_shared_delete(picohash_shared_table* shared_table, int delete_key_too);
+
+int picohash_shared_insert(picohash_shared_table* shared_table, const void* key);
+
+const void* picohash_shared_retrieve(picohash_shared_table* shared_table, const void* key);
+
+int picohash_shared_visit(picohash_shared_table* shared_table, const void* key,
+    picohash_shared_visit_fn visit_fn, void* visit_ctx);
+
+int picohash_shared_remove(picohash_shared_table* shared_table, const void* key, int delete_key_too);
+
+size_t picohash_shared_count(picohash_shared_table* shared_table);
+
+size_t picohash_shared_nb_shards(picohash_shared_table* shared_table);
+
 uint64_t picohash_hash_mix(uint64_t hash, uint64_t h2);
 
 uint64_t picohash_bytes(const uint8_t* key, uint32_t length);
@@ -0,0 +1,216 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2022, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Shared hash table.
+ *
+ * The table is split in shards, each holding a regular picohash table
+ * and a reader/writer lock. The shard of a key is selected by the high
+ * bits of the mixed hash, while the bins inside the shard use lower bits,
+ * so keys remain well spread in each shard. Retrieving a key only takes
+ * the read lock of its shard, and inserts or deletes only block the
+ * lookups in the same shard.
+ */
+
+#ifdef _WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include "picohash.h"
+#include "picoquic_utils.h"
+
+#define PICOHASH_SHARED_MAX_SHARDS 256
+
+typedef struct st_picohash_shard_t {
+    picoquic_rwlock_t lock;
+    picohash_table* table;
+    /* Keep the locks of different shards on different cache lines */
+    uint8_t pad[64];
+} picohash_shard_t;
+
+struct st_picohash_shared_table_t {
+    picohash_shard_t* shards;
+    size_t nb_shards;
+    int shard_shift;
+    uint64_t (*picohash_hash)(const void*);
+};
+
+static picohash_shard_t* picohash_shared_shard(picohash_shared_table* shared_table, const void* key)
+{
+    uint64_t hash = shared_table->picohash_hash(key);
+    size_t shard_index = (shared_table->nb_shards == 1) ? 0 :
+        (size_t)((hash * 0x9E3779B97F4A7C15ull) >> shared_table->shard_shift);
+
+    return &shared_table->shards[shard_index];
+}
+
+picohash_shared_table* picohash_shared_create(size_t nb_shards, size_t nb_bin,
+    uint64_t (*picohash_hash)(const void*),
+    int (*picohash_compare)(const void*, const void*))
+{
+    picohash_shared_table* shared_table = (picohash_shared_table*)malloc(sizeof(picohash_shared_table));
+    size_t nb_shards_pow2 = 1;
+    int shard_shift = 64;
+
+    while (nb_shards_pow2 < nb_shards && nb_shards_pow2 < PICOHASH_SHARED_MAX_SHARDS) {
+        nb_shards_pow2 *= 2;
+        shard_shift--;
+    }
+
+    if (shared_table != NULL) {
+        memset(shared_table, 0, sizeof(picohash_shared_table));
+        shared_table->shards = (picohash_shard_t*)malloc(nb_shards_pow2 * sizeof(picohash_shard_t));
+        if (shared_table->shards == NULL) {
+            free(shared_table);
+            shared_table = NULL;
+        }
+        else {
+            memset(shared_table->shards, 0, nb_shards_pow2 * sizeof(picohash_shard_t));
+            shared_table->shard_shift = shard_shift;
+            shared_table->picohash_hash = picohash_hash;
+
+            for (size_t i = 0; i < nb_shards_pow2; i++) {
+                if ((shared_table->shards[i].table = picohash_create(nb_bin / nb_shards_pow2,
+                    picohash_hash, picohash_compare)) == NULL) {
+                    break;
+                }
+                if (picoquic_create_rwlock(&shared_table->shards[i].lock) != 0) {
+                    picohash_delete(shared_table->shards[i].table, 0);
+                    shared_table->shards[i].table = NULL;
+                    break;
+                }
+                shared_table->nb_shards++;
+            }
+
+            if (shared_table->nb_shards < nb_shards_pow2) {
+                picohash_shared_delete(shared_table, 0);
+                shared_table = NULL;
+            }
+        }
+    }
+
+    return shared_table;
+}
+
+void picohash_shared_delete(picohash_shared_table* shared_table, int delete_key_too)
+{
+    for (size_t i = 0; i < shared_table->nb_shards; i++) {
+        picohash_delete(shared_table->shards[i].table, delete_key_too);
+        (void)picoquic_delete_rwlock(&shared_table->shards[i].lock);
+    }
+    free(shared_table->shards);
+    free(shared_table);
+}
+
+int picohash_shared_insert(picohash_shared_table* shared_table, const void* key)
+{
+    picohash_shard_t* shard = picohash_shared_shard(shared_table, key);
+    int ret = picoquic_lock_rwlock_write(&shard->lock);
+
+    if (ret == 0) {
+        ret = picohash_insert(shard->table, key);
+        (void)picoquic_unlock_rwlock_write(&shard->lock);
+    }
+
+    return ret;
+}
+
+const void* picohash_shared_retrieve(picohash_shared_table* shared_table, const void* key)
+{
+    picohash_shard_t* shard = picohash_shared_shard(shared_table, key);
+    const void* found = NULL;
+
+    if (picoquic_lock_rwlock_read(&shard->lock) == 0) {
+        picohash_item* item = picohash_retrieve(shard->table, key);
+
+        if (item != NULL) {
+            found = item->key;
+        }
+        (void)picoquic_unlock_rwlock_read(&shard->lock);
+    }
+
+    return found;
+}
+
+int picohash_shared_visit(picohash_shared_table* shared_table, const void* key,
+    picohash_shared_visit_fn visit_fn, void* visit_ctx)
+{
+    picohash_shard_t* shard = picohash_shared_shard(shared_table, key);
+    int ret = picoquic_lock_rwlock_read(&shard->lock);
+
+    if (ret == 0) {
+        picohash_item* item = picohash_retrieve(shard->table, key);
+
+        if (item == NULL) {
+            ret = -1;
+        }
+        else {
+            visit_fn(item->key, visit_ctx);
+        }
+        (void)picoquic_unlock_rwlock_read(&shard->lock);
+    }
+
+    return ret;
+}
+
+int picohash_shared_remove(picohash_shared_table* shared_table, const void* key, int delete_key_too)
+{
+    picohash_shard_t* shard = picohash_shared_shard(shared_table, key);
+    int ret = picoquic_lock_rwlock_write(&shard->lock);
+
+    if (ret == 0) {
+        picohash_item* item = picohash_retrieve(shard->table, key);
+
+        if (item == NULL) {
+            ret = -1;
+        }
+        else {
+            picohash_delete_item(shard->table, item, delete_key_too);
+        }
+        (void)picoquic_unlock_rwlock_write(&shard->lock);
+    }
+
+    return ret;
+}
+
+/* The count is a snapshot: shards may change while they are added */
+size_t picohash_shared_count(picohash_shared_table* shared_table)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < shared_table->nb_shards; i++) {
+        if (picoquic_lock_rwlock_read(&shared_table->shards[i].lock) == 0) {
+            count += shared_table->shards[i].table->count;
+            (void)picoquic_unlock_rwlock_read(&shared_table->shards[i].lock);
+        }
+    }
+
+    return count;
+}
+
+size_t picohash_shared_nb_shards(picohash_shared_table* shared_table)
+{
+    return shared_table->nb_shards;
+}
@@ -102,6 +102,7 @@ extern "C" {
 #define PICOQUIC_ERROR_PACKET_WRONG_VERSION (PICOQUIC_ERROR_CLASS + 57)
 #define PICOQUIC_ERROR_PORT_BLOCKED (PICOQUIC_ERROR_CLASS + 58)
 #define PICOQUIC_ERROR_DATAGRAM_TOO_LONG (PICOQUIC_ERROR_CLASS + 59)
+#define PICOQUIC_ERROR_TLS_JOB_PENDING (PICOQUIC_ERROR_CLASS + 60)
 
 /*
  * Protocol errors defined in the QUIC spec
@@ -491,6 +492,84 @@ void picoquic_free(picoquic_quic_t* quic);
  * which is a bit faster but requires an additional 7KB of data per connection */
 int picoquic_set_low_memory_mode(picoquic_quic_t* quic, int low_memory_mode);
 
+/* Memory budget for the packets of the QUIC context.
+ * Packets are carved from arenas. An arena is released when none of its
+ * packets is in use, if the other arenas have at least as many free packets.
+ * If the budget is set, no arena is allocated past that number of bytes, and
+ * packets cannot be created when all packets in the arenas are in use, until
+ * some of them are acknowledged or declared lost. The default value, 0, means
+ * no limit. The statistics give the current state of the packet pool.
+ */
+typedef struct st_picoquic_packet_pool_stats_t {
+    size_t packet_size; /* Bytes used by each packet, including metadata */
+    size_t memory_budget; /* Current budget, 0 if not set */
+    size_t arena_bytes; /* Bytes allocated in arenas */
+    uint64_t nb_arenas; /* Number of arenas */
+    uint64_t nb_packets_allocated; /* Packets carved from the arenas */
+    uint64_t nb_packets_in_use; /* Packets currently used by connections */
+    uint64_t nb_packets_in_pool; /* Packets available for reuse */
+    uint64_t nb_packets_refused; /* Packet creations that failed for lack of memory or budget */
+} picoquic_packet_pool_stats_t;
+
+void picoquic_set_packet_memory_budget(picoquic_quic_t* quic, size_t memory_budget);
+void picoquic_get_packet_pool_stats(picoquic_quic_t* quic, picoquic_packet_pool_stats_t* stats);
+
+/* Memory accounting.
+ * Each connection is charged for the memory held on its behalf: connection
+ * and stream contexts, data queued by the application, data received out of
+ * order, queued frames, and packets waiting for acknowledgement. When a limit
+ * is exceeded, either by the connection or by the sum of all connections, the
+ * connection stops extending the flow control credit of the peer (MAX_DATA,
+ * MAX_STREAM_DATA and MAX_STREAMS) until memory is released. If both limits
+ * are exceeded, the connection is closed with PICOQUIC_TRANSPORT_INTERNAL_ERROR.
+ * The default value of the limits, 0, means no limit.
+ * picoquic_get_top_memory_consumers fills "cnx_list" with up to "nb_max"
+ * connections, by decreasing memory usage, and returns the number found.
+ */
+void picoquic_set_memory_limits(picoquic_quic_t* quic, size_t memory_limit_per_cnx, size_t memory_limit);
+size_t picoquic_get_cnx_memory_used(picoquic_cnx_t* cnx);
+size_t picoquic_get_quic_memory_used(picoquic_quic_t* quic);
+size_t picoquic_get_top_memory_consumers(picoquic_quic_t* quic, picoquic_cnx_t** cnx_list, size_t nb_max);
+
+/* TLS worker threads.
+ * When worker threads are set, the server runs the TLS processing of the
+ * client's Initial messages, i.e., the key exchange and the certificate
+ * signature, on a pool of "nb_threads" threads. The connection is parked while
+ * the job runs: packets received for it are dropped, and it does not send.
+ * Other connections are served normally. The results are collected by the
+ * thread that owns the QUIC context, when preparing packets; the wake up time
+ * is at most PICOQUIC_TLS_JOB_POLL_INTERVAL microseconds while jobs are
+ * running. Setting 0 threads stops the pool. The call fails if a job is
+ * still running.
+ * Threading contract: the callbacks of the TLS stack run on the worker
+ * thread while the job runs. This includes the ALPN selection callback set
+ * by picoquic_set_alpn_select_fn, the key log set by picoquic_set_key_log_file,
+ * the processing of the client's transport parameters, and the logs of the
+ * connection (text, binary and qlog) produced by these steps. These callbacks
+ * may thus run on several threads at the same time, for different connections,
+ * and must be thread safe. These steps also write to the connection context,
+ * e.g., the negotiated ALPN, the peer's transport parameters, or the error
+ * state if these parameters are invalid. The owner thread does not access
+ * the connection until the job is collected. The connection callback is not
+ * called by the workers. The transitions to the next handshake states and the
+ * sending of packets happen on the owner thread, after collection. Binary logs
+ * are safe to use with the writer thread set by picoquic_set_binlog_writer_thread.
+ */
+#define PICOQUIC_TLS_JOB_POLL_INTERVAL 1000
+int picoquic_set_tls_worker_threads(picoquic_quic_t* quic, int nb_threads);
+
+/* Write the binary logs from a background thread. The log records are
+ * composed on the thread that logs the event, i.e., the thread that owns the
+ * QUIC context or a TLS worker thread, and queued to the writer, which
+ * appends them to the files with large buffered writes. Up to
+ * "nb_records_max" records can be queued. When the queue is full, records are
+ * dropped, unless "block_if_full" is set, in which case the logging call waits.
+ * The number of dropped records is returned by picoquic_get_binlog_writer_drops.
+ * Setting 0 records stops the thread after writing the queued records.
+ */
+int picoquic_set_binlog_writer_thread(picoquic_quic_t* quic, size_t nb_records_max, int block_if_full);
+uint64_t picoquic_get_binlog_writer_drops(picoquic_quic_t* quic);
+
 /* management of retry policy.
  * The cookie mode can be used to force the following behavior:
  * - if cookie_mode&1, check the token and force a retry for each incoming connection.
@@ -818,6 +897,45 @@ int picoquic_incoming_packet_ex(
     picoquic_cnx_t** first_cnx,
     uint64_t current_time);
 
+/* Same as picoquic_incoming_packet_ex, with the addition of the time at which the
+ * packet was received, as reported by the kernel. This time is used for RTT
+ * samples and ACK delays. If it is zero or not plausible, the current time is
+ * used instead.
+ */
+int picoquic_incoming_packet_ex2(
+    picoquic_quic_t* quic,
+    uint8_t* bytes,
+    size_t packet_length,
+    struct sockaddr* addr_from,
+    struct sockaddr* addr_to,
+    int if_index_to,
+    unsigned char received_ecn,
+    picoquic_cnx_t** first_cnx,
+    uint64_t current_time,
+    uint64_t receive_time);
+
+/* Processing of a batch of received datagrams, for example obtained with
+ * recvmmsg or GRO. The result is the same as calling picoquic_incoming_packet_ex2
+ * for each datagram in sequence, but the header protection of the packets that
+ * belong to the same connection is removed with a single cipher call.
+ */
+typedef struct st_picoquic_received_packet_t {
+    uint8_t* bytes;
+    size_t length;
+    struct sockaddr* addr_from;
+    struct sockaddr* addr_to;
+    int if_index_to;
+    unsigned char received_ecn;
+    uint64_t receive_time;
+} picoquic_received_packet_t;
+
+int picoquic_incoming_packet_batch(
+    picoquic_quic_t* quic,
+    picoquic_received_packet_t* packets,
+    size_t nb_packets,
+    picoquic_cnx_t** first_cnx,
+    uint64_t current_time);
+
 /* Applications must regularly poll the "next packet" API to obtain the
  * next packet that will be set over the network. The API for that is
  * picoquic_prepare_next_packet", which operates on a "quic context".
@@ -840,6 +958,28 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
     struct sockaddr_storage* p_addr_to, struct sockaddr_storage* p_addr_from, int* if_index,
     size_t* send_msg_size);
 
+/* Preparation of a batch of datagrams in a single call, for example to be sent
+ * with sendmmsg or GSO. The datagrams are written back to back in the send buffer,
+ * and each entry describes one of them: its position in the buffer, addresses,
+ * interface and connection. If use_gso is set, an entry may hold a train of
+ * datagrams of size send_msg_size, the last one possibly shorter; otherwise,
+ * send_msg_size is zero and each entry holds exactly one datagram.
+ */
+typedef struct st_picoquic_prepared_packet_t {
+    uint8_t* bytes;
+    size_t length;
+    size_t send_msg_size;
+    struct sockaddr_storage addr_to;
+    struct sockaddr_storage addr_from;
+    int if_index;
+    picoquic_connection_id_t log_cid;
+    picoquic_cnx_t* cnx;
+} picoquic_prepared_packet_t;
+
+int picoquic_prepare_next_packet_batch(picoquic_quic_t* quic, uint64_t current_time,
+    uint8_t* send_buffer, size_t send_buffer_max, picoquic_prepared_packet_t* packets,
+    size_t nb_packets_max, size_t* nb_packets, int use_gso);
+
 int picoquic_prepare_packet(picoquic_cnx_t* cnx,
     uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length,
     struct sockaddr_storage* p_addr_to, struct sockaddr_storage* p_addr_from, int* if_index);
@@ -906,6 +1046,38 @@ typedef int (*picoquic_stream_direct_receive_fn)(picoquic_cnx_t* cnx,
 int picoquic_mark_direct_receive_stream(picoquic_cnx_t* cnx,
     uint64_t stream_id, picoquic_stream_direct_receive_fn direct_receive_fn, void* direct_receive_ctx);
 
+/* Scatter gather delivery of stream data.
+ *
+ * By default, data received out of order is passed to the application one
+ * chunk at a time once the gap is filled. If a stream is marked with
+ * picoquic_mark_iovec_receive_stream, the contiguous data available on the
+ * stream is instead passed in a single call, as an array of up to 16
+ * buffers pointing to the received packets. The buffers are only valid for
+ * the duration of the call. The offset is the stream offset of the first
+ * buffer, and fin is set if the last buffer ends the stream; in that case
+ * the array may be empty.
+ *
+ * The callback returns 0 if the data was processed. Other values are handled
+ * as for the direct receive callback, resulting in the connection being
+ * closed with the corresponding error.
+ *
+ * If stream data was queued at the time the function is called, the
+ * callback is activated immediately. Direct receive takes precedence
+ * if both are set on the same stream.
+ */
+
+typedef struct st_picoquic_iovec_t {
+    const uint8_t* base;
+    size_t len;
+} picoquic_iovec_t;
+
+typedef int (*picoquic_stream_iovec_receive_fn)(picoquic_cnx_t* cnx,
+    uint64_t stream_id, int fin, const picoquic_iovec_t* iov, size_t nb_iov, uint64_t offset,
+    void* iovec_receive_ctx);
+
+int picoquic_mark_iovec_receive_stream(picoquic_cnx_t* cnx,
+    uint64_t stream_id, picoquic_stream_iovec_receive_fn iovec_receive_fn, void* iovec_receive_ctx);
+
 /* Associate stream with app context */
 int picoquic_set_app_stream_ctx(picoquic_cnx_t* cnx,
     uint64_t stream_id, void* app_stream_ctx);
@@ -934,6 +1106,17 @@ int picoquic_mark_active_stream(picoquic_cnx_t* cnx,
 int picoquic_mark_high_priority_stream(picoquic_cnx_t* cnx,
     uint64_t stream_id, int is_high_priority);
 
+/* Set the priority of a stream, following the model of RFC 9218.
+ * The priority is set to (2*urgency + 1) for streams sent in FIFO order,
+ * and to (2*urgency) for incremental streams, which are served in round
+ * robin with the other incremental streams of the same urgency. Lower
+ * urgency values are served first, urgency values above 7 are treated
+ * as 7. The default is urgency 3, FIFO.
+ */
+#define PICOQUIC_DEFAULT_STREAM_PRIORITY 7
+
+int picoquic_set_stream_priority(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_t stream_priority);
+
 /* If a stream is marked active, the application will receive a callback with
  * event type "picoquic_callback_prepare_to_send" when the transport is ready to
  * send data on a stream. The "length" argument in the call back indicates the
@@ -28,6 +28,7 @@
 
 #include "picohash.h"
 #include "picosplay.h"
+#include "picowheel.h"
 #include "picoquic.h"
 #include "picoquic_utils.h"
 
@@ -75,6 +76,7 @@ extern "C" {
 #define PICOQUIC_MAX_BANDWIDTH_TIME_INTERVAL_MAX 15000
 
 #define PICOQUIC_SPURIOUS_RETRANSMIT_DELAY_MAX 1000000ull /* one second */
+#define PICOQUIC_RECEIVE_TIME_LAG_MAX 1000000ull /* Kernel time stamps older than one second are not plausible */
 
 #define PICOQUIC_MICROSEC_SILENCE_MAX 120000000ull /* 120 seconds for now */
 #define PICOQUIC_MICROSEC_HANDSHAKE_MAX 30000000ull /* 30 seconds for now */
@@ -110,6 +112,11 @@ extern "C" {
 #define PICOQUIC_MAX_ACK_RANGE_REPEAT 4
 #define PICOQUIC_MIN_ACK_RANGE_REPEAT 2
 
+#define PICOQUIC_RETRANSMIT_INDEX_MIN 64
+
+#define PICOQUIC_NB_STREAM_URGENCY 8 /* urgency levels 0 to 7, as in RFC 9218 */
+#define PICOQUIC_STREAM_IOVEC_MAX 16 /* max number of buffers in a scatter gather delivery */
+
 /*
  * Types of frames.
  */
@@ -252,6 +259,8 @@ typedef enum {
     picoquic_packet_type_max
 } picoquic_packet_type_enum;
 
+picoquic_packet_type_enum picoquic_parse_long_packet_type(uint8_t flags, int version_index);
+
 typedef enum {
     picoquic_packet_context_application = 0,
     picoquic_packet_context_handshake = 1,
@@ -342,14 +351,35 @@ void picoquic_queue_stateless_packet(picoquic_quic_t* quic, picoquic_stateless_p
 picoquic_stateless_packet_t* picoquic_dequeue_stateless_packet(picoquic_quic_t* quic);
 void picoquic_delete_stateless_packet(picoquic_stateless_packet_t* sp);
 
-/* Data structure used to hold chunk of stream data before in sequence delivery */
+/* Data structure used to hold chunk of stream data before in sequence delivery.
+ * Packets are decrypted into pooled nodes, and the first chunk of stream data
+ * found in a packet is queued using the packet node itself. Further chunks
+ * from the same packet are queued as "reference" nodes, which only carry the
+ * chunk metadata and point into the data of the packet node ("data_owner").
+ * The packet node is only recycled when the last reference is released.
+ *
+ * Reference nodes and copy nodes are "compact": they are allocated without
+ * the full packet buffer. Chunks shorter than PICOQUIC_STREAM_DATA_COPY_MAX
+ * are copied in copy nodes of PICOQUIC_STREAM_DATA_COPY_CAPACITY bytes
+ * instead of holding a whole packet, and small chunks that are adjacent
+ * in the stream are appended to the same copy node.
+ */
+#define PICOQUIC_STREAM_DATA_COPY_MAX 128
+#define PICOQUIC_STREAM_DATA_COPY_CAPACITY 512
+
 typedef struct st_picoquic_stream_data_node_t {
     picosplay_node_t stream_data_node;
     picoquic_quic_t* quic;
     struct st_picoquic_stream_data_node_t* next_stream_data;
+    struct st_picoquic_stream_data_node_t* data_owner; /* Node holding "bytes", if not this one */
     uint64_t offset;  /* Stream offset of the first octet in "bytes" */
     size_t length;    /* Number of octets in "bytes" */
     const uint8_t* bytes;
+    int nb_data_refs; /* Number of holders of this node */
+    int is_compact; /* Allocated without the full data buffer */
+    size_t data_capacity; /* Number of octets allocated for "data" */
+    picoquic_cnx_t* charged_cnx; /* Connection charged for the node while in a stream tree */
+    size_t charged_bytes; /* Octets charged to that connection */
     uint8_t data[PICOQUIC_MAX_PACKET_SIZE];
 } picoquic_stream_data_node_t;
 
@@ -384,6 +414,7 @@ typedef struct st_picoquic_packet_t {
     size_t length;
     size_t checksum_overhead;
     size_t offset;
+    size_t compact_length; /* If compacted, number of bytes in the compact copy of the frames */
     picoquic_packet_type_enum ptype;
     picoquic_packet_context_enum pc;
     unsigned int is_evaluated : 1;
@@ -396,12 +427,16 @@ typedef struct st_picoquic_packet_t {
     unsigned int was_preemptively_repeated : 1;
     unsigned int is_queued_to_path : 1;
     unsigned int is_queued_for_retransmit : 1;
+    unsigned int is_memory_charged : 1;
+    unsigned int is_compacted : 1; /* Compact copy of a lost packet, not allocated from the pool */
 
     uint8_t bytes[PICOQUIC_MAX_PACKET_SIZE];
 } picoquic_packet_t;
 
 picoquic_packet_t* picoquic_create_packet(picoquic_quic_t* quic);
+picoquic_packet_t* picoquic_create_compact_packet(const picoquic_packet_t* packet, const uint8_t* bytes, size_t bytes_length);
 void picoquic_recycle_packet(picoquic_quic_t* quic, picoquic_packet_t* packet);
+void picoquic_packet_pool_free(picoquic_quic_t* quic);
 
 /* Definition of the token register used to prevent repeated usage of
  * the same new token, retry token, or session ticket.
@@ -578,6 +613,13 @@ typedef uint64_t picoquic_tp_enum;
  */
 typedef int (*picoquic_autoqlog_fn)(picoquic_cnx_t * cnx);
 
+/* The conversion may run as a job of the qlog worker pool. Each job is a single
+ * allocation starting with the picoquic_worker_job_t header, so the completed
+ * jobs can be freed by the core. Collect the completed jobs, or wait for all
+ * submitted jobs to complete if "wait_all" is set.
+ */
+void picoquic_collect_qlog_jobs(picoquic_quic_t* quic, int wait_all);
+
 /* Callback used for the performance log
  */
 typedef int (*picoquic_performance_log_fn)(picoquic_quic_t* quic, picoquic_cnx_t* cnx, int should_delete);
@@ -620,6 +662,8 @@ typedef struct st_picoquic_quic_t {
     uint32_t max_number_connections;
     uint64_t stateless_reset_next_time; /* Next time Stateless Reset or VN packet can be sent */
     uint64_t stateless_reset_min_interval; /* Enforced interval between two stateless reset packets */
+    uint64_t segment_receive_time; /* Arrival time of the segment being processed, or 0 if none */
+    struct st_picoquic_rx_hp_mask_t* rx_hp_mask; /* Precomputed mask of the datagram being processed, or NULL */
     /* Flags */
     unsigned int check_token : 1;
     unsigned int force_check_token : 1;
@@ -652,9 +696,12 @@ typedef struct st_picoquic_quic_t {
 
     struct st_picoquic_cnx_t* cnx_list;
     struct st_picoquic_cnx_t* cnx_last;
-    picosplay_tree_t cnx_wake_tree;
+    picowheel_t cnx_wake_wheel;
 
-    struct st_picoquic_cnx_t* cnx_in_progress;
+    picoquic_worker_pool_t* tls_worker_pool; /* Threads running TLS jobs, NULL if none */
+    struct st_picoquic_tls_job_t* first_tls_job_ready; /* Jobs created but not yet submitted */
+    size_t nb_tls_jobs; /* Jobs created and not yet completed */
+    picoquic_mutex_t tls_ticket_mutex; /* Protects the ticket AEAD contexts if workers are used */
 
     picohash_table* table_cnx_by_id;
     picohash_table* table_cnx_by_net;
@@ -666,12 +713,23 @@ typedef struct st_picoquic_quic_t {
     picoquic_issued_ticket_t* table_issued_tickets_last;
     size_t table_issued_tickets_nb;
 
-    picoquic_packet_t * p_first_packet;
     int nb_packets_in_pool;
     int nb_packets_allocated;
+    struct st_picoquic_packet_arena_t* packet_arena_first; /* Arenas with free packets come first */
+    struct st_picoquic_packet_arena_t* packet_arena_last;
+    size_t packet_arena_bytes;
+    size_t packet_memory_budget;
+    uint64_t nb_packet_arenas;
+    uint64_t nb_packets_refused;
     picoquic_stream_data_node_t* p_first_data_node;
     int nb_data_nodes_in_pool;
     int nb_data_nodes_allocated;
+    picoquic_stream_data_node_t* p_first_data_ref;
+    int nb_data_refs_in_pool;
+    int nb_data_nodes_compact;
+    size_t memory_used; /* Sum of the memory charged to all connections */
+    size_t memory_limit; /* Limit of memory for all connections, 0 if none */
+    size_t memory_limit_per_cnx; /* Limit of memory per connection, 0 if none */
 
     picoquic_connection_id_cb_fn cnx_id_callback_fn;
     void* cnx_id_callback_ctx;
@@ -680,6 +738,7 @@ typedef struct st_picoquic_quic_t {
     void* aead_decrypt_ticket_ctx;
     void ** retry_integrity_sign_ctx;
     void ** retry_integrity_verify_ctx;
+    void ** initial_salt_hmac_ctx;
 
     struct st_ptls_verify_certificate_t * verify_certificate_callback;
     picoquic_free_verify_certificate_ctx free_verify_certificate_callback_fn;
@@ -695,7 +754,10 @@ typedef struct st_picoquic_quic_t {
     void* F_log;
     char* binlog_dir;
     char* qlog_dir;
+    picoquic_file_writer_t* binlog_writer; /* Thread writing the binary logs, NULL if none */
     picoquic_autoqlog_fn autoqlog_fn;
+    picoquic_worker_pool_t* qlog_worker_pool; /* Threads converting binary logs to qlog, NULL if none */
+    size_t nb_qlog_jobs; /* Conversion jobs submitted and not yet collected */
     struct st_picoquic_unified_logging_t* text_log_fns;
     struct st_picoquic_unified_logging_t* bin_log_fns;
     struct st_picoquic_unified_logging_t* qlog_fns;
@@ -717,7 +779,6 @@ void picoquic_registered_token_clear(picoquic_quic_t* quic, uint64_t expiry_time
  */
 
 typedef struct st_picoquic_sack_item_t {
-    picosplay_node_t node;
     uint64_t start_of_sack_range;
     uint64_t end_of_sack_range;
     uint64_t time_created;
@@ -728,7 +789,21 @@ typedef struct st_picoquic_sack_range_count_t {
     int range_counts[PICOQUIC_MAX_ACK_RANGE_REPEAT];
 } picoquic_sack_range_count_t;
 
+/*
+ * The ranges are kept in a sorted vector held inline in the list,
+ * which is all that is needed in the common case of a few ranges
+ * close to the top. If more than PICOQUIC_SACK_VECTOR_MAX ranges are
+ * needed, the list switches to a splay of allocated items, and comes
+ * back to the vector once the number of ranges has decreased.
+ * Pointers to items are only valid until the next insertion or
+ * deletion of an item below them.
+ */
+#define PICOQUIC_SACK_VECTOR_MAX 8
+
 typedef struct st_picoquic_sack_list_t {
+    picoquic_sack_item_t sack_vector[PICOQUIC_SACK_VECTOR_MAX];
+    int nb_sack_vector;
+    int is_tree;
     picosplay_tree_t ack_tree;
     uint64_t ack_horizon;
     int64_t horizon_delay;
@@ -778,7 +853,11 @@ typedef struct st_picoquic_stream_head_t {
     void * app_stream_ctx;
     picoquic_stream_direct_receive_fn direct_receive_fn; /* direct receive function, if not NULL */
     void* direct_receive_ctx; /* direct receive context */
+    picoquic_stream_iovec_receive_fn iovec_receive_fn; /* scatter gather receive function, if not NULL */
+    void* iovec_receive_ctx; /* scatter gather receive context */
     picoquic_sack_list_t sack_list; /* Track which parts of the stream were acknowledged by the peer */
+    uint8_t stream_priority; /* Urgency times 2, plus 1 if FIFO, 0 if incremental (round robin) */
+    uint8_t output_urgency; /* Urgency level used when the stream was inserted in the output list */
     /* Flags describing the state of the stream */
     unsigned int is_active : 1; /* The application is actively managing data sending through callbacks */
     unsigned int fin_requested : 1; /* Application has requested Fin of sending stream */
@@ -796,6 +875,7 @@ typedef struct st_picoquic_stream_head_t {
     unsigned int max_stream_updated : 1; /* After stream was closed in both directions, the max stream id number was updated */
     unsigned int stream_data_blocked_sent : 1; /* If stream_data_blocked has been sent to peer, and no data sent on stream since */
     unsigned int is_output_stream : 1; /* If stream is listed in the output list */
+    unsigned int is_output_parked : 1; /* If output stream is parked because it has nothing it can send */
     unsigned int is_closed : 1; /* Stream is closed, closure is accouted for */
     unsigned int is_discarded : 1; /* There should be no more callback for that stream, the application has discarded it */
 } picoquic_stream_head_t;
@@ -848,6 +928,11 @@ typedef struct st_picoquic_packet_context_t {
     picoquic_packet_t* retransmitted_newest;
     picoquic_packet_t* retransmitted_oldest;
     picoquic_packet_t* preemptive_repeat_ptr;
+    /* Index of the retransmit queue by sequence number. Packet N is found
+     * at position (N & (retransmit_index_size - 1)), the size being a
+     * power of 2 larger than the span of the queue. */
+    picoquic_packet_t** retransmit_index;
+    uint64_t retransmit_index_size;
     /* ECN Counters */
     uint64_t ecn_ect0_total_remote;
     uint64_t ecn_ect1_total_remote;
@@ -1110,6 +1195,15 @@ typedef struct st_picoquic_path_t {
     
 } picoquic_path_t;
 
+/* Header protection mask computed in advance for the first segment of a
+ * received datagram, when datagrams are processed in batches.
+ */
+typedef struct st_picoquic_rx_hp_mask_t {
+    const uint8_t* bytes;
+    void* pn_dec;
+    uint8_t mask[5];
+} picoquic_rx_hp_mask_t;
+
 /* Crypto context. There are four such contexts:
 * 0: Initial context, with encryption based on a version dependent key,
 * 1: 0-RTT context
@@ -1121,6 +1215,8 @@ typedef struct st_picoquic_crypto_context_t {
     void* aead_decrypt;
     void* pn_enc; /* Used for PN encryption */
     void* pn_dec; /* Used for PN decryption */
+    void* pn_enc_ecb; /* ECB context with the PN encryption key, used for batches if AES */
+    void* pn_dec_ecb; /* ECB context with the PN decryption key, used for batches if AES */
 } picoquic_crypto_context_t;
 
 /*
@@ -1246,7 +1342,7 @@ typedef struct st_picoquic_cnx_t {
 
     /* Next time sending data is expected */
     uint64_t next_wake_time;
-    picosplay_node_t cnx_wake_node;
+    picowheel_node_t cnx_wake_node;
 
     /* TLS context, TLS Send Buffer, streams, epochs */
     void* tls_ctx;
@@ -1260,6 +1356,7 @@ typedef struct st_picoquic_cnx_t {
     picoquic_crypto_context_t crypto_context[PICOQUIC_NUMBER_OF_EPOCHS]; /* Encryption and decryption objects */
     picoquic_crypto_context_t crypto_context_old; /* Old encryption and decryption context after key rotation */
     picoquic_crypto_context_t crypto_context_new; /* New encryption and decryption context just before key rotation */
+    struct st_picoquic_hp_batch_t* hp_batch; /* Deferred header protection while preparing a packet train */
     uint64_t crypto_failure_count;
     /* Liveness detection */
     uint64_t latest_progress_time; /* last local time at which the connection progressed */
@@ -1273,6 +1370,7 @@ typedef struct st_picoquic_cnx_t {
 
     /* Statistics */
     uint64_t nb_bytes_queued;
+    size_t memory_used; /* Bytes held on behalf of the connection */
     uint32_t nb_zero_rtt_sent;
     uint32_t nb_zero_rtt_acked;
     uint32_t nb_zero_rtt_received;
@@ -1332,9 +1430,12 @@ typedef struct st_picoquic_cnx_t {
     picoquic_misc_frame_header_t* last_misc_frame;
 
     /* Management of streams */
+    picohash_table* stream_table;
     picosplay_tree_t stream_tree;
     picoquic_stream_head_t * first_output_stream;
     picoquic_stream_head_t * last_output_stream;
+    picoquic_stream_head_t * last_output_of_urgency[PICOQUIC_NB_STREAM_URGENCY];
+    picoquic_stream_head_t * first_parked_stream;
     uint64_t high_priority_stream_id;
     uint64_t next_stream_id[4];
 
@@ -1382,6 +1483,9 @@ typedef struct st_picoquic_cnx_t {
     picoquic_stateless_packet_t* first_sooner;
     picoquic_stateless_packet_t* last_sooner;
 
+    /* TLS processing running on a worker thread, if any */
+    struct st_picoquic_tls_job_t* tls_job;
+
     /* Log handling */
     uint16_t log_unique;
     FILE* f_binlog;
@@ -1460,6 +1564,9 @@ void picoquic_queue_for_retransmit(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
 picoquic_packet_t* picoquic_dequeue_retransmit_packet(picoquic_cnx_t* cnx, picoquic_packet_context_t* pkt_ctx,
     picoquic_packet_t* p, int should_free);
 void picoquic_dequeue_retransmitted_packet(picoquic_cnx_t* cnx, picoquic_packet_context_t* pkt_ctx, picoquic_packet_t* p);
+picoquic_packet_t* picoquic_compact_retransmitted_packet(picoquic_cnx_t* cnx, picoquic_packet_t* p);
+picoquic_packet_t* picoquic_retransmit_index_get(picoquic_packet_context_t* pkt_ctx, uint64_t sequence_number);
+void picoquic_retransmit_index_free(picoquic_packet_context_t* pkt_ctx);
 
 #if 0
 /* Reset connection after receiving version negotiation */
@@ -1578,6 +1685,11 @@ int picoquic_parse_header_and_decrypt(
     size_t * consumed,
     int * new_context_created);
 
+int picoquic_remove_header_protection(picoquic_cnx_t* cnx,
+    uint8_t* bytes,
+    uint8_t* decrypted_bytes,
+    picoquic_packet_header* ph);
+
 /* handling of ACK logic */
 void picoquic_init_ack_ctx(picoquic_cnx_t* cnx, picoquic_ack_context_t* ack_ctx);
 
@@ -1604,8 +1716,8 @@ void picoquic_update_ack_horizon(picoquic_sack_list_t* sack_list, uint64_t curre
 /* Return the first ACK item in the list */
 picoquic_sack_item_t* picoquic_sack_first_item(picoquic_sack_list_t* sack_list);
 picoquic_sack_item_t* picoquic_sack_last_item(picoquic_sack_list_t* sack_list);
-picoquic_sack_item_t* picoquic_sack_next_item(picoquic_sack_item_t * sack);
-picoquic_sack_item_t* picoquic_sack_previous_item(picoquic_sack_item_t* sack);
+picoquic_sack_item_t* picoquic_sack_next_item(picoquic_sack_list_t* sack_list, picoquic_sack_item_t * sack);
+picoquic_sack_item_t* picoquic_sack_previous_item(picoquic_sack_list_t* sack_list, picoquic_sack_item_t* sack);
 int picoquic_sack_insert_item(picoquic_sack_list_t* sack_list, uint64_t range_min, 
     uint64_t range_max, uint64_t current_time);
 
@@ -1670,12 +1782,16 @@ void picoquic_update_stream_initial_remote(picoquic_cnx_t* cnx);
 picoquic_stream_head_t * picoquic_stream_from_node(picosplay_node_t * node);
 void picoquic_insert_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t * stream);
 void picoquic_remove_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t * stream, picoquic_stream_head_t * previous_stream);
+void picoquic_park_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream);
+void picoquic_wake_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream);
+void picoquic_requeue_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream);
 picoquic_stream_head_t * picoquic_first_stream(picoquic_cnx_t * cnx);
 picoquic_stream_head_t * picoquic_last_stream(picoquic_cnx_t * cnx);
 picoquic_stream_head_t * picoquic_next_stream(picoquic_stream_head_t * stream);
 picoquic_stream_head_t* picoquic_find_stream(picoquic_cnx_t* cnx, uint64_t stream_id);
 void picoquic_add_output_streams(picoquic_cnx_t * cnx, uint64_t old_limit, uint64_t new_limit, unsigned int is_bidir);
 picoquic_stream_head_t* picoquic_find_ready_stream(picoquic_cnx_t* cnx);
+void picoquic_stream_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream);
 int picoquic_is_tls_stream_ready(picoquic_cnx_t* cnx);
 const uint8_t* picoquic_decode_stream_frame(picoquic_cnx_t* cnx, const uint8_t* bytes,
     const uint8_t* bytes_max, picoquic_stream_data_node_t* received_data, uint64_t current_time);
@@ -1718,6 +1834,9 @@ void picoquic_set_ack_needed(picoquic_cnx_t* cnx, uint64_t current_time, picoqui
  */
 void picoquic_process_ack_of_frames(picoquic_cnx_t* cnx, picoquic_packet_t* p,
     int is_spurious, uint64_t current_time);
+/* Copy the frames that matter for the ack of frames processing, reducing stream frames to descriptors */
+int picoquic_compact_frames_for_ack(const uint8_t* bytes, size_t bytes_max,
+    uint8_t* compact, size_t compact_max, size_t* compact_length);
 
 /* Coding and decoding of frames */
 
@@ -1745,8 +1864,19 @@ uint64_t picoquic_cc_increased_window(picoquic_cnx_t* cnx, uint64_t previous_win
 uint8_t* picoquic_format_max_streams_frame_if_needed(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max, int* more_data, int* is_pure_ack);
 void picoquic_stream_data_node_recycle(picoquic_stream_data_node_t* stream_data);
 picoquic_stream_data_node_t* picoquic_stream_data_node_alloc(picoquic_quic_t* quic);
+picoquic_stream_data_node_t* picoquic_stream_data_node_alloc_ref(picoquic_stream_data_node_t* data_owner);
+picoquic_stream_data_node_t* picoquic_stream_data_node_alloc_copy(picoquic_quic_t* quic, size_t capacity);
 void picoquic_clear_stream(picoquic_stream_head_t* stream);
 void picoquic_delete_stream(picoquic_cnx_t * cnx, picoquic_stream_head_t * stream);
+void picoquic_free_stream_queue_node(picoquic_cnx_t* cnx, picoquic_stream_queue_node_t* stream_data);
+/* Memory held on behalf of a connection is charged to the connection and to
+ * the QUIC context, and refunded when released. A connection is constrained
+ * when either its own usage or the global usage exceeds the configured limit.
+ */
+void picoquic_memory_charge(picoquic_cnx_t* cnx, size_t bytes);
+void picoquic_memory_refund(picoquic_cnx_t* cnx, size_t bytes);
+int picoquic_is_memory_constrained(picoquic_cnx_t* cnx);
+int picoquic_is_memory_shedding_needed(picoquic_cnx_t* cnx);
 picoquic_local_cnxid_t* picoquic_create_local_cnxid(picoquic_cnx_t* cnx, picoquic_connection_id_t* suggested_value, uint64_t current_time);
 void picoquic_delete_local_cnxid(picoquic_cnx_t* cnx, picoquic_local_cnxid_t* l_cid);
 void picoquic_retire_local_cnxid(picoquic_cnx_t* cnx, uint64_t sequence);
@@ -1761,10 +1891,10 @@ uint8_t* picoquic_format_blocked_frames(picoquic_cnx_t* cnx, uint8_t* bytes, uin
 int picoquic_queue_retire_connection_id_frame(picoquic_cnx_t * cnx, uint64_t sequence);
 int picoquic_queue_new_token_frame(picoquic_cnx_t * cnx, uint8_t * token, size_t token_length);
 uint8_t* picoquic_format_one_blocked_frame(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max, int* more_data, int* is_pure_ack, picoquic_stream_head_t* stream);
-uint8_t* picoquic_format_first_misc_or_dg_frame(uint8_t* bytes, uint8_t* bytes_max, int* more_data, int* is_pure_ack, picoquic_misc_frame_header_t** first, picoquic_misc_frame_header_t** last);
+uint8_t* picoquic_format_first_misc_or_dg_frame(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max, int* more_data, int* is_pure_ack, picoquic_misc_frame_header_t** first, picoquic_misc_frame_header_t** last);
 uint8_t* picoquic_format_first_misc_frame(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max, int* more_data, int* is_pure_ack);
 int picoquic_queue_misc_or_dg_frame(picoquic_cnx_t* cnx, picoquic_misc_frame_header_t** first, picoquic_misc_frame_header_t** last, const uint8_t* bytes, size_t length, int is_pure_ack);
-void picoquic_delete_misc_or_dg(picoquic_misc_frame_header_t** first, picoquic_misc_frame_header_t** last, picoquic_misc_frame_header_t* frame);
+void picoquic_delete_misc_or_dg(picoquic_cnx_t* cnx, picoquic_misc_frame_header_t** first, picoquic_misc_frame_header_t** last, picoquic_misc_frame_header_t* frame);
 void picoquic_clear_ack_ctx(picoquic_ack_context_t* ack_ctx);
 int picoquic_queue_handshake_done_frame(picoquic_cnx_t* cnx);
 uint8_t* picoquic_format_first_datagram_frame(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max, int* more_data, int* is_pure_ack);
@@ -512,4 +512,47 @@ void picoquic_lb_compat_cid_config_free(picoquic_quic_t* quic)
         quic->cnx_id_callback_fn = NULL;
         quic->cnx_id_callback_ctx = NULL;
     }
-}
\ No newline at end of file
+}
+/* Find the server ID encoded in the destination CID of an incoming packet.
+ * This is used by multi-threaded servers to steer packets to the worker that
+ * owns the connection. Initial and 0-RTT packets carry a CID chosen by the
+ * client, and version negotiation or retry packets are never sent to servers,
+ * so only Handshake and 1-RTT packets are decoded. All other packets, as
+ * well as packets too short to carry a CID, return UINT64_MAX.
+ */
+uint64_t picoquic_lb_compat_packet_server_id(picoquic_quic_t* quic, const uint8_t* bytes, size_t length)
+{
+    uint64_t server_id64 = UINT64_MAX;
+
+    if (quic->cnx_id_callback_fn == picoquic_lb_compat_cid_generate &&
+        quic->cnx_id_callback_ctx != NULL && length > 0) {
+        picoquic_load_balancer_cid_context_t* lb_ctx = (picoquic_load_balancer_cid_context_t*)quic->cnx_id_callback_ctx;
+        picoquic_connection_id_t cnx_id;
+        size_t cid_offset = 0;
+
+        cnx_id.id_len = 0;
+        if ((bytes[0] & 0x80) == 0) {
+            /* Short header, the CID length is known locally */
+            cid_offset = 1;
+            cnx_id.id_len = lb_ctx->connection_id_length;
+        }
+        else if (length > 6) {
+            uint32_t version = PICOPARSE_32(bytes + 1);
+            int version_index = picoquic_get_version_index(version);
+
+            if (version != 0 && version_index >= 0 &&
+                picoquic_parse_long_packet_type(bytes[0], version_index) == picoquic_packet_handshake) {
+                cid_offset = 6;
+                cnx_id.id_len = bytes[5];
+            }
+        }
+
+        if (cnx_id.id_len > 0 && cnx_id.id_len <= PICOQUIC_CONNECTION_ID_MAX_SIZE &&
+            cid_offset + cnx_id.id_len <= length) {
+            memcpy(cnx_id.id, bytes + cid_offset, cnx_id.id_len);
+            server_id64 = picoquic_lb_compat_cid_verify(quic, lb_ctx, &cnx_id);
+        }
+    }
+
+    return server_id64;
+}
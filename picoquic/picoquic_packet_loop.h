@@ -24,6 +24,7 @@
 
 #include "picosocks.h"
 #include "picoquic.h"
+#include "picoquic_lb.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -44,12 +45,34 @@ typedef enum {
 
 typedef int (*picoquic_packet_loop_cb_fn)(picoquic_quic_t * quic, picoquic_packet_loop_cb_enum cb_mode, void * callback_ctx, void * callback_argv);
 
+/* Breakdown of the time spent waiting in the packet loop, between busy
+ * polling and blocking in select. Times are in microseconds.
+ */
+typedef struct st_picoquic_packet_loop_wait_stats_t {
+    uint64_t nb_spin_waits;
+    uint64_t spin_time;
+    uint64_t nb_sleep_waits;
+    uint64_t sleep_time;
+} picoquic_packet_loop_wait_stats_t;
+
 /* Packet loop option list shows support by application of optional features.
  * It is set to null initially, and then passed to the socket as argument to
  * the "ready" callback. Application should set the flags corresponding to
- * the features that it supports */
+ * the features that it supports.
+ *
+ * If busy_poll_delay is set, waits shorter than that many microseconds are
+ * done by polling the sockets with non blocking receive calls until the wake
+ * time, instead of blocking in select. This avoids the scheduling delays that
+ * cause pacing errors at high data rates, at the cost of keeping one core busy.
+ * In the pipelined loop, the protocol thread spins on the queues shared with
+ * the I/O thread instead, and the I/O thread still blocks in select. If
+ * wait_stats is set, the loop accumulates the time spent spinning and
+ * sleeping in that structure.
+ */
 typedef struct st_picoquic_packet_loop_options_t {
     int do_time_check : 1; /* App should be polled for next time before sock select */
+    int64_t busy_poll_delay;
+    picoquic_packet_loop_wait_stats_t* wait_stats;
 } picoquic_packet_loop_options_t;
 
 /* The time check option passes as argument a pointer to a structure specifying
@@ -73,6 +96,50 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
     picoquic_packet_loop_cb_fn loop_callback,
     void * loop_callback_ctx);
 
+/* Multi-threaded version of the packet loop, for servers.
+ * The application creates one QUIC context per worker, and optionally one
+ * callback context per worker. Each worker runs the packet loop in its own
+ * thread, with its own sockets bound to the same port using SO_REUSEPORT.
+ * The CID of each worker encode its worker ID, using the load balancer
+ * configuration in lb_config with server_id64 set to the worker ID, or
+ * by default a clear text one byte server ID in an 8 bytes CID. Packets that
+ * arrive at the wrong worker are forwarded to the owner of the connection.
+ * The callbacks are called from the worker threads, with the QUIC and
+ * callback context of the worker. When one worker stops, all workers stop.
+ */
+typedef struct st_picoquic_packet_loop_mt_param_t {
+    int nb_workers;
+    int local_port;
+    int local_af;
+    int dest_if;
+    int socket_buffer_size;
+    int do_not_use_gso;
+    int do_pin_threads; /* Pin worker N to CPU N modulo the number of CPU. Linux only. */
+    picoquic_load_balancer_config_t lb_config;
+} picoquic_packet_loop_mt_param_t;
+
+int picoquic_packet_loop_mt(picoquic_packet_loop_mt_param_t* param,
+    picoquic_quic_t** worker_quic,
+    picoquic_packet_loop_cb_fn loop_callback,
+    void** loop_callback_ctx);
+
+/* Pipelined version of the packet loop. The socket I/O runs in a separate
+ * thread, which receives and sends batches of datagrams, while the calling
+ * thread processes incoming packets and prepares outgoing packets. The two
+ * threads exchange descriptors through lock-free queues, so that system calls
+ * overlap with decryption and encryption. The callbacks are all called from
+ * the calling thread. The pseudo error codes used in the migration tests are
+ * not supported in that mode.
+ */
+int picoquic_packet_loop_pipelined(picoquic_quic_t* quic,
+    int local_port,
+    int local_af,
+    int dest_if,
+    int socket_buffer_size,
+    int do_not_use_gso,
+    picoquic_packet_loop_cb_fn loop_callback,
+    void* loop_callback_ctx);
+
 #ifdef _WINDOWS
 int picoquic_packet_loop_win(picoquic_quic_t* quic,
     int local_port,
@@ -192,6 +192,7 @@ int picoquic_constant_time_memcmp(const uint8_t* x, const uint8_t* y, size_t l);
 #define picoquic_thread_return_t DWORD WINAPI
 typedef DWORD (WINAPI* picoquic_thread_fn)(LPVOID lpParam);
 #define picoquic_mutex_t HANDLE
+#define picoquic_rwlock_t SRWLOCK
 #define picoquic_event_t HANDLE
 #define picoquic_thread_do_return return 0
 #else
@@ -200,6 +201,7 @@ typedef DWORD (WINAPI* picoquic_thread_fn)(LPVOID lpParam);
 #define picoquic_thread_return_t void*
 typedef void* (*picoquic_thread_fn) (void* lpParam);
 #define picoquic_mutex_t pthread_mutex_t 
+#define picoquic_rwlock_t pthread_rwlock_t
 #define picoquic_thread_do_return return (void *)NULL
 
 typedef struct st_picoquic_event_t {
@@ -216,11 +218,92 @@ int picoquic_delete_mutex(picoquic_mutex_t* mutex);
 int picoquic_lock_mutex(picoquic_mutex_t* mutex);
 int picoquic_unlock_mutex(picoquic_mutex_t* mutex);
 
+/* Reader/writer locks: several threads may hold the lock for reading,
+ * or a single thread for writing. */
+int picoquic_create_rwlock(picoquic_rwlock_t* rwlock);
+int picoquic_delete_rwlock(picoquic_rwlock_t* rwlock);
+int picoquic_lock_rwlock_read(picoquic_rwlock_t* rwlock);
+int picoquic_unlock_rwlock_read(picoquic_rwlock_t* rwlock);
+int picoquic_lock_rwlock_write(picoquic_rwlock_t* rwlock);
+int picoquic_unlock_rwlock_write(picoquic_rwlock_t* rwlock);
+
 int picoquic_create_event(picoquic_event_t* event);
 void picoquic_delete_event(picoquic_event_t* event);
 int picoquic_signal_event(picoquic_event_t* event);
 int picoquic_wait_for_event(picoquic_event_t* event, uint64_t microsec_wait);
 
+/* Lock free single producer, single consumer queue of pointers.
+ * Exactly one thread may push, and exactly one thread may pop.
+ * The producer only writes the tail index, the consumer only writes
+ * the head index, and the two indices are kept on separate cache lines.
+ * Push returns -1 if the queue is full, pop returns NULL if it is empty.
+ */
+typedef struct st_picoquic_spsc_queue_t {
+    void** items;
+    uint64_t mask;
+    uint8_t pad0[64];
+    volatile uint64_t head;
+    uint8_t pad1[64];
+    volatile uint64_t tail;
+    uint8_t pad2[64];
+} picoquic_spsc_queue_t;
+
+int picoquic_spsc_queue_init(picoquic_spsc_queue_t* queue, size_t nb_items_min);
+void picoquic_spsc_queue_release(picoquic_spsc_queue_t* queue);
+int picoquic_spsc_queue_push(picoquic_spsc_queue_t* queue, void* item);
+void* picoquic_spsc_queue_pop(picoquic_spsc_queue_t* queue);
+int picoquic_spsc_queue_is_empty(picoquic_spsc_queue_t* queue);
+
+/* Wake up protocol for consumers that sleep when their queue is empty.
+ * The producer pushes with picoquic_spsc_queue_push_ex, and only wakes up
+ * the consumer if the queue was empty. The consumer pops until the queue
+ * is empty, and only sleeps if picoquic_spsc_queue_is_drained confirms it.
+ * Both calls use a full memory barrier, so either the producer sees that
+ * the queue was empty, or the consumer sees the new item.
+ */
+int picoquic_spsc_queue_push_ex(picoquic_spsc_queue_t* queue, void* item, int* was_empty);
+int picoquic_spsc_queue_is_drained(picoquic_spsc_queue_t* queue);
+
+/* Pool of worker threads running jobs on behalf of a single owner thread.
+ * The owner submits jobs, and later retrieves them from the list of completed
+ * jobs. The job function runs on a worker thread, and the job must not be
+ * accessed by the owner between submission and completion.
+ */
+typedef struct st_picoquic_worker_job_t {
+    struct st_picoquic_worker_job_t* next_job;
+    void (*job_fn)(struct st_picoquic_worker_job_t* job);
+    int is_done;
+} picoquic_worker_job_t;
+
+typedef struct st_picoquic_worker_pool_t picoquic_worker_pool_t;
+
+picoquic_worker_pool_t* picoquic_worker_pool_create(int nb_threads);
+void picoquic_worker_pool_delete(picoquic_worker_pool_t* pool);
+void picoquic_worker_pool_submit(picoquic_worker_pool_t* pool, picoquic_worker_job_t* job);
+picoquic_worker_job_t* picoquic_worker_pool_next_done(picoquic_worker_pool_t* pool);
+void picoquic_worker_pool_wait_job(picoquic_worker_pool_t* pool, picoquic_worker_job_t* job);
+int picoquic_worker_pool_wait_done(picoquic_worker_pool_t* pool, uint64_t microsec_wait);
+
+/* Background thread writing records to log files on behalf of the threads that produce
+ * the logs, e.g., the thread owning the QUIC context and the TLS workers. Each record is
+ * appended to its file with a single write. Once a file has been passed to the writer,
+ * the producers must not access it anymore, and close it with
+ * picoquic_file_writer_close. Up to nb_records_max records can be queued. If the
+ * queue is full, the write call waits if block_if_full is set, or drops the record
+ * and returns -1. Closing records are never dropped. Deleting the writer writes the
+ * records still queued.
+ */
+typedef struct st_picoquic_file_writer_t picoquic_file_writer_t;
+
+picoquic_file_writer_t* picoquic_file_writer_create(size_t nb_records_max, int block_if_full);
+void picoquic_file_writer_delete(picoquic_file_writer_t* writer);
+int picoquic_file_writer_write(picoquic_file_writer_t* writer, FILE* F, const uint8_t* bytes, size_t length);
+int picoquic_file_writer_close(picoquic_file_writer_t* writer, FILE* F, const uint8_t* bytes, size_t length);
+void picoquic_file_writer_flush(picoquic_file_writer_t* writer);
+uint64_t picoquic_file_writer_mark(picoquic_file_writer_t* writer);
+void picoquic_file_writer_wait_mark(picoquic_file_writer_t* writer, uint64_t mark);
+uint64_t picoquic_file_writer_nb_dropped(picoquic_file_writer_t* writer);
+
 /* Set of random number generation functions, designed for tests.
  * The random numbers are defined by a 64 bit context, initialized to a seed.
  * The same seed will always generate the same sequence.
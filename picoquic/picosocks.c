@@ -55,6 +55,40 @@ int picoquic_get_local_address(SOCKET_TYPE sd, struct sockaddr_storage * addr)
     return getsockname(sd, (struct sockaddr *)addr, &name_len);
 }
 
+/* Allow several sockets, typically owned by different threads, to bind to the
+ * same port. The kernel then spreads the incoming flows between these sockets
+ * based on the address tuple. Returns -1 if the platform does not support it.
+ */
+int picoquic_socket_set_reuse_port(SOCKET_TYPE sd)
+{
+#ifdef SO_REUSEPORT
+    int val = 1;
+    return setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, (const char*)&val, sizeof(val));
+#else
+    (void)sd;
+    return -1;
+#endif
+}
+
+/* Request software receive time stamps from the kernel, so that the arrival time of
+ * packets does not include the queuing and scheduling delays in the application.
+ * Returns -1 if the platform does not support it, in which case the time at which
+ * the packet is read from the socket is used instead.
+ */
+int picoquic_socket_set_timestamp_options(SOCKET_TYPE sd)
+{
+    int val = 1;
+#if defined(SO_TIMESTAMPNS)
+    return setsockopt(sd, SOL_SOCKET, SO_TIMESTAMPNS, (const char*)&val, sizeof(val));
+#elif defined(SO_TIMESTAMP) && !defined(_WINDOWS)
+    return setsockopt(sd, SOL_SOCKET, SO_TIMESTAMP, (const char*)&val, sizeof(val));
+#else
+    (void)sd;
+    (void)val;
+    return -1;
+#endif
+}
+
 int picoquic_socket_set_pkt_info(SOCKET_TYPE sd, int af)
 {
     int ret;
@@ -327,9 +361,23 @@ void picoquic_socks_cmsg_parse(
     int* dest_if,
     unsigned char* received_ecn,
     size_t * udp_coalesced_size)
+{
+    picoquic_socks_cmsg_parse_ex(vmsg, addr_dest, dest_if, received_ecn, udp_coalesced_size, NULL);
+}
+
+void picoquic_socks_cmsg_parse_ex(
+    void* vmsg,
+    struct sockaddr_storage* addr_dest,
+    int* dest_if,
+    unsigned char* received_ecn,
+    size_t * udp_coalesced_size,
+    uint64_t * receive_time)
 {
     /* Assume that msg has been filled by a call to recvmsg */
 #if _WINDOWS
+    /* Receive time stamps are not supported on Windows */
+    (void)receive_time;
+
     struct cmsghdr* cmsg;
     WSAMSG* msg = (WSAMSG*)vmsg;
 
@@ -466,6 +514,22 @@ void picoquic_socks_cmsg_parse(
                 }
             }
         }
+        else if (cmsg->cmsg_level == SOL_SOCKET && receive_time != NULL) {
+#ifdef SCM_TIMESTAMPNS
+            if (cmsg->cmsg_type == SCM_TIMESTAMPNS && cmsg->cmsg_len >= CMSG_LEN(sizeof(struct timespec))) {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(struct timespec));
+                *receive_time = ((uint64_t)ts.tv_sec) * 1000000ull + ((uint64_t)ts.tv_nsec) / 1000;
+            }
+#endif
+#ifdef SCM_TIMESTAMP
+            if (cmsg->cmsg_type == SCM_TIMESTAMP && cmsg->cmsg_len >= CMSG_LEN(sizeof(struct timeval))) {
+                struct timeval tv;
+                memcpy(&tv, CMSG_DATA(cmsg), sizeof(struct timeval));
+                *receive_time = ((uint64_t)tv.tv_sec) * 1000000ull + (uint64_t)tv.tv_usec;
+            }
+#endif
+        }
     }
 #endif
 }
@@ -897,12 +961,55 @@ int picoquic_recvmsg_async_start(picoquic_recvmsg_async_ctx_t* ctx)
 
 #endif
 
-int picoquic_recvmsg(SOCKET_TYPE fd,
+#ifndef _WINDOWS
+static int picoquic_recvmsg_flags(SOCKET_TYPE fd,
     struct sockaddr_storage* addr_from,
     struct sockaddr_storage* addr_dest,
     int* dest_if,
     unsigned char* received_ecn,
-    uint8_t* buffer, int buffer_max)
+    uint8_t* buffer, int buffer_max,
+    uint64_t* receive_time,
+    int flags)
+{
+    int bytes_recv = 0;
+    struct msghdr msg;
+    struct iovec dataBuf;
+    char cmsg_buffer[1024];
+
+    if (dest_if != NULL) {
+        *dest_if = 0;
+    }
+
+    dataBuf.iov_base = (char*)buffer;
+    dataBuf.iov_len = buffer_max;
+
+    msg.msg_name = (struct sockaddr*)addr_from;
+    msg.msg_namelen = sizeof(struct sockaddr_storage);
+    msg.msg_iov = &dataBuf;
+    msg.msg_iovlen = 1;
+    msg.msg_flags = 0;
+    msg.msg_control = (void*)cmsg_buffer;
+    msg.msg_controllen = sizeof(cmsg_buffer);
+
+    bytes_recv = recvmsg(fd, &msg, flags);
+
+    if (bytes_recv <= 0) {
+        addr_from->ss_family = 0;
+    } else {
+        picoquic_socks_cmsg_parse_ex(&msg, addr_dest, dest_if, received_ecn, NULL, receive_time);
+    }
+
+    return bytes_recv;
+}
+#endif
+
+int picoquic_recvmsg_ex(SOCKET_TYPE fd,
+    struct sockaddr_storage* addr_from,
+    struct sockaddr_storage* addr_dest,
+    int* dest_if,
+    unsigned char* received_ecn,
+    uint8_t* buffer, int buffer_max,
+    uint64_t* receive_time)
 #ifdef _WINDOWS
 {
     GUID WSARecvMsg_GUID = WSAID_WSARECVMSG;
@@ -955,7 +1062,7 @@ int picoquic_recvmsg(SOCKET_TYPE fd,
             bytes_recv = -1;
         } else {
             bytes_recv = NumberOfBytes;
-            picoquic_socks_cmsg_parse(&msg, addr_dest, dest_if, received_ecn, NULL);
+            picoquic_socks_cmsg_parse_ex(&msg, addr_dest, dest_if, received_ecn, NULL, receive_time);
         }
     }
 
@@ -963,38 +1070,20 @@ int picoquic_recvmsg(SOCKET_TYPE fd,
 }
 #else
 {
-    int bytes_recv = 0;
-    struct msghdr msg;
-    struct iovec dataBuf;
-    char cmsg_buffer[1024];
-
-    if (dest_if != NULL) {
-        *dest_if = 0;
-    }
-
-    dataBuf.iov_base = (char*)buffer;
-    dataBuf.iov_len = buffer_max;
-
-    msg.msg_name = (struct sockaddr*)addr_from;
-    msg.msg_namelen = sizeof(struct sockaddr_storage);
-    msg.msg_iov = &dataBuf;
-    msg.msg_iovlen = 1;
-    msg.msg_flags = 0;
-    msg.msg_control = (void*)cmsg_buffer;
-    msg.msg_controllen = sizeof(cmsg_buffer);
-
-    bytes_recv = recvmsg(fd, &msg, 0);
-
-    if (bytes_recv <= 0) {
-        addr_from->ss_family = 0;
-    } else {
-        picoquic_socks_cmsg_parse(&msg, addr_dest, dest_if, received_ecn, NULL);
-    }
-
-    return bytes_recv;
+    return picoquic_recvmsg_flags(fd, addr_from, addr_dest, dest_if, received_ecn, buffer, buffer_max, receive_time, 0);
 }
 #endif
 
+int picoquic_recvmsg(SOCKET_TYPE fd,
+    struct sockaddr_storage* addr_from,
+    struct sockaddr_storage* addr_dest,
+    int* dest_if,
+    unsigned char* received_ecn,
+    uint8_t* buffer, int buffer_max)
+{
+    return picoquic_recvmsg_ex(fd, addr_from, addr_dest, dest_if, received_ecn, buffer, buffer_max, NULL);
+}
+
 int picoquic_sendmsg(SOCKET_TYPE fd,
     struct sockaddr* addr_dest,
     struct sockaddr* addr_from,
@@ -1117,6 +1206,25 @@ int picoquic_select_ex(SOCKET_TYPE* sockets,
     int64_t delta_t,
     int * socket_rank,
     uint64_t* current_time)
+{
+    return picoquic_select_ex2(sockets, nb_sockets, addr_from, addr_dest, dest_if, received_ecn,
+        buffer, buffer_max, delta_t, socket_rank, current_time, NULL);
+}
+
+/* Same as picoquic_select_ex, but also returns the time at which the kernel received
+ * the packet, if the socket was configured with picoquic_socket_set_timestamp_options
+ * and the platform supports it. Otherwise, the receive time is set to zero. */
+int picoquic_select_ex2(SOCKET_TYPE* sockets,
+    int nb_sockets,
+    struct sockaddr_storage* addr_from,
+    struct sockaddr_storage* addr_dest,
+    int* dest_if,
+    unsigned char * received_ecn,
+    uint8_t* buffer, int buffer_max,
+    int64_t delta_t,
+    int * socket_rank,
+    uint64_t* current_time,
+    uint64_t* receive_time)
 {
     fd_set readfds;
     struct timeval tv;
@@ -1128,6 +1236,10 @@ int picoquic_select_ex(SOCKET_TYPE* sockets,
         *received_ecn = 0;
     }
 
+    if (receive_time != NULL) {
+        *receive_time = 0;
+    }
+
     FD_ZERO(&readfds);
 
     for (int i = 0; i < nb_sockets; i++) {
@@ -1159,9 +1271,9 @@ int picoquic_select_ex(SOCKET_TYPE* sockets,
         for (int i = 0; i < nb_sockets; i++) {
             if (FD_ISSET(sockets[i], &readfds)) {
                 *socket_rank = i;
-                bytes_recv = picoquic_recvmsg(sockets[i], addr_from,
+                bytes_recv = picoquic_recvmsg_ex(sockets[i], addr_from,
                     addr_dest, dest_if, received_ecn,
-                    buffer, buffer_max);
+                    buffer, buffer_max, receive_time);
 
                 if (bytes_recv <= 0) {
 #ifdef _WINDOWS
@@ -1188,6 +1300,69 @@ int picoquic_select_ex(SOCKET_TYPE* sockets,
     return bytes_recv;
 }
 
+/* Same as picoquic_select_ex2 with a null delay, but without the select system call.
+ * The sockets are checked in order with a non blocking receive, and the first packet
+ * found is returned. This is meant for busy polling loops, which would otherwise
+ * perform one select and one receive call per spin. */
+int picoquic_select_nowait(SOCKET_TYPE* sockets,
+    int nb_sockets,
+    struct sockaddr_storage* addr_from,
+    struct sockaddr_storage* addr_dest,
+    int* dest_if,
+    unsigned char* received_ecn,
+    uint8_t* buffer, int buffer_max,
+    int* socket_rank,
+    uint64_t* current_time,
+    uint64_t* receive_time)
+{
+    int bytes_recv = 0;
+
+    if (received_ecn != NULL) {
+        *received_ecn = 0;
+    }
+
+    if (receive_time != NULL) {
+        *receive_time = 0;
+    }
+
+    for (int i = 0; i < nb_sockets && bytes_recv == 0; i++) {
+#ifdef _WINDOWS
+        u_long nb_bytes_ready = 0;
+
+        if (ioctlsocket(sockets[i], FIONREAD, &nb_bytes_ready) != 0 || nb_bytes_ready == 0) {
+            continue;
+        }
+        bytes_recv = picoquic_recvmsg_ex(sockets[i], addr_from, addr_dest, dest_if, received_ecn,
+            buffer, buffer_max, receive_time);
+        if (bytes_recv <= 0) {
+            int last_error = WSAGetLastError();
+
+            if (last_error == WSAECONNRESET || last_error == WSAEMSGSIZE) {
+                bytes_recv = 0;
+                continue;
+            }
+        }
+#else
+        bytes_recv = picoquic_recvmsg_flags(sockets[i], addr_from, addr_dest, dest_if, received_ecn,
+            buffer, buffer_max, receive_time, MSG_DONTWAIT);
+        if (bytes_recv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            bytes_recv = 0;
+            continue;
+        }
+#endif
+        *socket_rank = i;
+        if (bytes_recv <= 0) {
+            DBG_PRINTF("Could not receive packet on UDP socket[%d]= %d!\n",
+                i, (int)sockets[i]);
+            break;
+        }
+    }
+
+    *current_time = picoquic_current_time();
+
+    return bytes_recv;
+}
+
 int picoquic_select(SOCKET_TYPE* sockets,
     int nb_sockets,
     struct sockaddr_storage* addr_from,
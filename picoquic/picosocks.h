@@ -183,6 +183,8 @@ int picoquic_open_server_sockets(picoquic_server_sockets_t* sockets, int port);
 void picoquic_close_server_sockets(picoquic_server_sockets_t* sockets);
 
 int picoquic_socket_set_pkt_info(SOCKET_TYPE sd, int af);
+int picoquic_socket_set_reuse_port(SOCKET_TYPE sd);
+int picoquic_socket_set_timestamp_options(SOCKET_TYPE sd);
 int picoquic_socket_set_ecn_options(SOCKET_TYPE sd, int af, int * recv_set, int * send_set);
 
 int picoquic_select(SOCKET_TYPE* sockets, int nb_sockets,
@@ -205,6 +207,29 @@ int picoquic_select_ex(SOCKET_TYPE* sockets,
     int* socket_rank,
     uint64_t* current_time);
 
+int picoquic_select_ex2(SOCKET_TYPE* sockets,
+    int nb_sockets,
+    struct sockaddr_storage* addr_from,
+    struct sockaddr_storage* addr_dest,
+    int* dest_if,
+    unsigned char* received_ecn,
+    uint8_t* buffer, int buffer_max,
+    int64_t delta_t,
+    int* socket_rank,
+    uint64_t* current_time,
+    uint64_t* receive_time);
+
+int picoquic_select_nowait(SOCKET_TYPE* sockets,
+    int nb_sockets,
+    struct sockaddr_storage* addr_from,
+    struct sockaddr_storage* addr_dest,
+    int* dest_if,
+    unsigned char* received_ecn,
+    uint8_t* buffer, int buffer_max,
+    int* socket_rank,
+    uint64_t* current_time,
+    uint64_t* receive_time);
+
 int picoquic_sendmsg(SOCKET_TYPE fd,
     struct sockaddr* addr_dest,
     struct sockaddr* addr_from,
@@ -250,6 +275,14 @@ void picoquic_socks_cmsg_parse(
     unsigned char* received_ecn,
     size_t* udp_coalesced_size);
 
+void picoquic_socks_cmsg_parse_ex(
+    void* vmsg,
+    struct sockaddr_storage* addr_dest,
+    int* dest_if,
+    unsigned char* received_ecn,
+    size_t* udp_coalesced_size,
+    uint64_t* receive_time);
+
 void picoquic_socks_cmsg_format(
     void* vmsg,
     size_t message_length,
@@ -0,0 +1,249 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2022, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stddef.h>
+#include <string.h>
+#include "picowheel.h"
+
+/* Index of the lowest bit set in a non zero 64 bit word, using a de Bruijn sequence */
+static int picowheel_lowest_bit(uint64_t x)
+{
+    static const int debruijn_index[64] = {
+        0, 47, 1, 56, 48, 27, 2, 60, 57, 49, 41, 37, 28, 16, 3, 61,
+        54, 58, 35, 52, 50, 42, 21, 44, 38, 32, 29, 23, 17, 11, 4, 62,
+        46, 55, 26, 59, 40, 36, 15, 53, 34, 51, 20, 43, 31, 22, 10, 45,
+        25, 39, 14, 33, 19, 30, 9, 24, 13, 18, 8, 12, 7, 6, 5, 63
+    };
+
+    return debruijn_index[((x ^ (x - 1)) * 0x03f79d71b4cb0a89ull) >> 58];
+}
+
+/* First non empty slot of a level, or -1 if the level is empty */
+static int picowheel_first_slot(picowheel_t* wheel, int level)
+{
+    for (int i = 0; i < PICOWHEEL_SLOTS / 64; i++) {
+        if (wheel->slot_bits[level][i] != 0) {
+            return 64 * i + picowheel_lowest_bit(wheel->slot_bits[level][i]);
+        }
+    }
+    return -1;
+}
+
+static int picowheel_is_before(picowheel_node_t* a, picowheel_node_t* b)
+{
+    return (a->wake_time < b->wake_time || (a->wake_time == b->wake_time && a->sequence < b->sequence));
+}
+
+static void picowheel_list_append(picowheel_list_t* list, picowheel_node_t* node)
+{
+    node->next = NULL;
+    node->previous = list->last;
+    if (list->last == NULL) {
+        list->first = node;
+    }
+    else {
+        list->last->next = node;
+    }
+    list->last = node;
+}
+
+/* Insert in a list sorted by wake time and sequence. The search starts from the
+ * end, since new nodes usually have the highest sequence number. */
+static void picowheel_list_insert_sorted(picowheel_list_t* list, picowheel_node_t* node)
+{
+    picowheel_node_t* previous = list->last;
+
+    while (previous != NULL && (previous->wake_time > node->wake_time ||
+        (previous->wake_time == node->wake_time && previous->sequence > node->sequence))) {
+        previous = previous->previous;
+    }
+
+    node->previous = previous;
+    if (previous == NULL) {
+        node->next = list->first;
+        list->first = node;
+    }
+    else {
+        node->next = previous->next;
+        previous->next = node;
+    }
+    if (node->next == NULL) {
+        list->last = node;
+    }
+    else {
+        node->next->previous = node;
+    }
+}
+
+static void picowheel_list_unlink(picowheel_list_t* list, picowheel_node_t* node)
+{
+    if (node->previous == NULL) {
+        list->first = node->next;
+    }
+    else {
+        node->previous->next = node->next;
+    }
+    if (node->next == NULL) {
+        list->last = node->previous;
+    }
+    else {
+        node->next->previous = node->previous;
+    }
+    node->next = NULL;
+    node->previous = NULL;
+}
+
+static void picowheel_place(picowheel_t* wheel, picowheel_node_t* node)
+{
+    if (node->wake_time < wheel->base_time) {
+        node->level = PICOWHEEL_LEVELS;
+        node->slot = 0;
+        picowheel_list_insert_sorted(&wheel->late, node);
+    }
+    else {
+        uint64_t diff = node->wake_time ^ wheel->base_time;
+        int level = 0;
+
+        while (diff > 0xFF) {
+            diff >>= 8;
+            level++;
+        }
+        node->level = level;
+        node->slot = (int)((node->wake_time >> (8 * level)) & 0xFF);
+        if (level == 0) {
+            /* All the nodes in a level 0 slot have the same wake time */
+            picowheel_list_insert_sorted(&wheel->slots[0][node->slot], node);
+        }
+        else {
+            picowheel_list_append(&wheel->slots[level][node->slot], node);
+            if (wheel->future_first != NULL && wheel->future_first->level == level &&
+                wheel->future_first->slot == node->slot && picowheel_is_before(node, wheel->future_first)) {
+                wheel->future_first = node;
+            }
+        }
+        wheel->slot_bits[level][node->slot / 64] |= (1ull << (node->slot % 64));
+    }
+}
+
+void picowheel_init(picowheel_t* wheel)
+{
+    memset(wheel, 0, sizeof(picowheel_t));
+}
+
+void picowheel_insert(picowheel_t* wheel, picowheel_node_t* node, uint64_t wake_time)
+{
+    node->wake_time = wake_time;
+    node->sequence = wheel->next_sequence++;
+    node->is_inserted = 1;
+    picowheel_place(wheel, node);
+    wheel->size++;
+}
+
+void picowheel_remove(picowheel_t* wheel, picowheel_node_t* node)
+{
+    if (node->is_inserted) {
+        if (node == wheel->future_first) {
+            wheel->future_first = NULL;
+        }
+        if (node->level == PICOWHEEL_LEVELS) {
+            picowheel_list_unlink(&wheel->late, node);
+        }
+        else {
+            picowheel_list_t* list = &wheel->slots[node->level][node->slot];
+
+            picowheel_list_unlink(list, node);
+            if (list->first == NULL) {
+                wheel->slot_bits[node->level][node->slot / 64] &= ~(1ull << (node->slot % 64));
+            }
+        }
+        node->is_inserted = 0;
+        wheel->size--;
+    }
+}
+
+picowheel_node_t* picowheel_first(picowheel_t* wheel)
+{
+    picowheel_node_t* node = NULL;
+
+    while (node == NULL && wheel->size > 0) {
+        int slot;
+
+        if (wheel->late.first != NULL) {
+            node = wheel->late.first;
+        }
+        else if ((slot = picowheel_first_slot(wheel, 0)) >= 0) {
+            node = wheel->slots[0][slot].first;
+        }
+        else {
+            /* Move the base time to the first non empty slot of the upper levels,
+             * and spread the nodes of that slot to the lower levels, unless that
+             * slot starts after the current time */
+            for (int level = 1; level < PICOWHEEL_LEVELS; level++) {
+                if ((slot = picowheel_first_slot(wheel, level)) >= 0) {
+                    uint64_t upper_mask = (level + 1 < PICOWHEEL_LEVELS) ? (UINT64_MAX << (8 * (level + 1))) : 0;
+                    uint64_t slot_time = (wheel->base_time & upper_mask) | ((uint64_t)slot << (8 * level));
+
+                    if (slot_time <= wheel->current_time) {
+                        picowheel_node_t* next = wheel->slots[level][slot].first;
+
+                        wheel->base_time = slot_time;
+                        wheel->future_first = NULL;
+                        wheel->slots[level][slot].first = NULL;
+                        wheel->slots[level][slot].last = NULL;
+                        wheel->slot_bits[level][slot / 64] &= ~(1ull << (slot % 64));
+                        while (next != NULL) {
+                            picowheel_node_t* moved = next;
+                            next = next->next;
+                            picowheel_place(wheel, moved);
+                        }
+                    }
+                    else {
+                        if (wheel->future_first == NULL || wheel->future_first->level != level ||
+                            wheel->future_first->slot != slot) {
+                            picowheel_node_t* next = wheel->slots[level][slot].first;
+
+                            wheel->future_first = next;
+                            while ((next = next->next) != NULL) {
+                                if (picowheel_is_before(next, wheel->future_first)) {
+                                    wheel->future_first = next;
+                                }
+                            }
+                        }
+                        node = wheel->future_first;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    return node;
+}
+
+void picowheel_advance(picowheel_t* wheel, uint64_t current_time)
+{
+    if (current_time > wheel->current_time) {
+        wheel->current_time = current_time;
+        if (wheel->size == 0) {
+            wheel->base_time = current_time;
+        }
+    }
+}
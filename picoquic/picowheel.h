@@ -0,0 +1,93 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2022, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Hierarchical timing wheel.
+ *
+ * Nodes are scheduled by wake time, in microseconds. The wheel has 8 levels of
+ * 256 slots, one per octet of the 64 bit wake time. A node is placed at the level
+ * of the highest octet in which its wake time differs from the wheel base time,
+ * so nodes due soon land in the one microsecond slots of level 0, and far away
+ * timers in the coarse slots of the upper levels. Inserting and removing a node
+ * is O(1). When the lower levels are empty, the first non empty slot of the
+ * upper levels is spread to the lower levels, which makes finding the first node
+ * amortized O(1), since each node moves down at most 7 times.
+ *
+ * The base time never moves past the current time, as set by picowheel_advance.
+ * If the first non empty slot starts after the current time, for example when
+ * all connections are idle, it is not spread. Its first node is found by
+ * scanning it once and is then cached, so that timers set later for the near
+ * future still land in the lower levels.
+ *
+ * Nodes scheduled before the base time, which only happens for timers that
+ * are already due, are kept in a sorted "late" list. Nodes with the same wake
+ * time are returned in the order of insertion.
+ */
+
+#ifndef PICOWHEEL_H
+#define PICOWHEEL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PICOWHEEL_LEVELS 8
+#define PICOWHEEL_SLOTS 256
+
+typedef struct st_picowheel_node_t {
+    struct st_picowheel_node_t* next;
+    struct st_picowheel_node_t* previous;
+    uint64_t wake_time;
+    uint64_t sequence; /* Insertion order, used to sort nodes with the same wake time */
+    int is_inserted;
+    int level; /* PICOWHEEL_LEVELS for the late list */
+    int slot;
+} picowheel_node_t;
+
+typedef struct st_picowheel_list_t {
+    picowheel_node_t* first;
+    picowheel_node_t* last;
+} picowheel_list_t;
+
+typedef struct st_picowheel_t {
+    uint64_t base_time;
+    uint64_t current_time;
+    picowheel_node_t* future_first; /* First node of the future slot last scanned */
+    uint64_t next_sequence;
+    int size;
+    picowheel_list_t late;
+    picowheel_list_t slots[PICOWHEEL_LEVELS][PICOWHEEL_SLOTS];
+    uint64_t slot_bits[PICOWHEEL_LEVELS][PICOWHEEL_SLOTS / 64];
+} picowheel_t;
+
+void picowheel_init(picowheel_t* wheel);
+void picowheel_insert(picowheel_t* wheel, picowheel_node_t* node, uint64_t wake_time);
+void picowheel_remove(picowheel_t* wheel, picowheel_node_t* node);
+picowheel_node_t* picowheel_first(picowheel_t* wheel);
+void picowheel_advance(picowheel_t* wheel, uint64_t current_time);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PICOWHEEL_H */
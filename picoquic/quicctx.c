@@ -772,8 +772,22 @@ void picoquic_free(picoquic_quic_t* quic)
             picoquic_delete_cnx(quic->cnx_list);
         }
 
+        /* No TLS job remains once the connections are deleted */
+        (void)picoquic_set_tls_worker_threads(quic, 0);
+
+        /* The conversion jobs may wait for the binary log writer */
+        picoquic_collect_qlog_jobs(quic, 1);
+        if (quic->qlog_worker_pool != NULL) {
+            picoquic_worker_pool_delete(quic->qlog_worker_pool);
+            quic->qlog_worker_pool = NULL;
+        }
+
+        /* The logs of the deleted connections are written before the writer stops */
+        (void)picoquic_set_binlog_writer_thread(quic, 0, 0);
+
         /* Delete TLS and AEAD cntexts */
         picoquic_delete_retry_protection_contexts(quic);
+        picoquic_delete_initial_salt_contexts(quic);
 
         if (quic->aead_encrypt_ticket_ctx != NULL) {
             picoquic_aead_free(quic->aead_encrypt_ticket_ctx);
@@ -800,13 +814,7 @@ void picoquic_free(picoquic_quic_t* quic)
         picosplay_empty_tree(&quic->token_reuse_tree);
 
         /* delete packets in pool */
-        while (quic->p_first_packet != NULL) {
-            picoquic_packet_t * p = quic->p_first_packet->next_packet;
-            free(quic->p_first_packet);
-            quic->p_first_packet = p;
-            quic->nb_packets_allocated--;
-            quic->nb_packets_in_pool--;
-        }
+        picoquic_packet_pool_free(quic);
 
         /* delete data nodes in pool */
         while (quic->p_first_data_node != NULL) {
@@ -817,6 +825,13 @@ void picoquic_free(picoquic_quic_t* quic)
             quic->nb_data_nodes_in_pool--;
         }
 
+        while (quic->p_first_data_ref != NULL) {
+            picoquic_stream_data_node_t* p = quic->p_first_data_ref->next_stream_data;
+            free(quic->p_first_data_ref);
+            quic->p_first_data_ref = p;
+            quic->nb_data_refs_in_pool--;
+        }
+
         /* delete all pending stateless packets */
         while (quic->pending_stateless_packet != NULL) {
             picoquic_stateless_packet_t* to_delete = quic->pending_stateless_packet;
@@ -1175,6 +1190,139 @@ picoquic_cnx_t* picoquic_get_next_cnx(picoquic_cnx_t* cnx)
     return cnx->next_in_table;
 }
 
+/* Memory accounting */
+
+void picoquic_memory_charge(picoquic_cnx_t* cnx, size_t bytes)
+{
+    cnx->memory_used += bytes;
+    cnx->quic->memory_used += bytes;
+}
+
+void picoquic_memory_refund(picoquic_cnx_t* cnx, size_t bytes)
+{
+    if (bytes > cnx->memory_used) {
+        bytes = cnx->memory_used;
+    }
+    cnx->memory_used -= bytes;
+    cnx->quic->memory_used = (cnx->quic->memory_used > bytes) ? cnx->quic->memory_used - bytes : 0;
+}
+
+int picoquic_is_memory_constrained(picoquic_cnx_t* cnx)
+{
+    return (cnx->quic->memory_limit_per_cnx > 0 && cnx->memory_used > cnx->quic->memory_limit_per_cnx) ||
+        (cnx->quic->memory_limit > 0 && cnx->quic->memory_used > cnx->quic->memory_limit);
+}
+
+int picoquic_is_memory_shedding_needed(picoquic_cnx_t* cnx)
+{
+    return cnx->quic->memory_limit_per_cnx > 0 && cnx->memory_used > cnx->quic->memory_limit_per_cnx &&
+        cnx->quic->memory_limit > 0 && cnx->quic->memory_used > cnx->quic->memory_limit;
+}
+
+void picoquic_set_memory_limits(picoquic_quic_t* quic, size_t memory_limit_per_cnx, size_t memory_limit)
+{
+    quic->memory_limit_per_cnx = memory_limit_per_cnx;
+    quic->memory_limit = memory_limit;
+}
+
+size_t picoquic_get_cnx_memory_used(picoquic_cnx_t* cnx)
+{
+    return cnx->memory_used;
+}
+
+size_t picoquic_get_quic_memory_used(picoquic_quic_t* quic)
+{
+    return quic->memory_used;
+}
+
+int picoquic_set_tls_worker_threads(picoquic_quic_t* quic, int nb_threads)
+{
+    int ret = 0;
+
+    if (quic->nb_tls_jobs > 0) {
+        ret = -1;
+    }
+    else {
+        if (quic->tls_worker_pool != NULL) {
+            picoquic_worker_pool_delete(quic->tls_worker_pool);
+            quic->tls_worker_pool = NULL;
+            (void)picoquic_delete_mutex(&quic->tls_ticket_mutex);
+        }
+        if (nb_threads > 0) {
+            if ((ret = picoquic_create_mutex(&quic->tls_ticket_mutex)) == 0 &&
+                (quic->tls_worker_pool = picoquic_worker_pool_create(nb_threads)) == NULL) {
+                (void)picoquic_delete_mutex(&quic->tls_ticket_mutex);
+                ret = PICOQUIC_ERROR_MEMORY;
+            }
+        }
+    }
+
+    return ret;
+}
+
+int picoquic_set_binlog_writer_thread(picoquic_quic_t* quic, size_t nb_records_max, int block_if_full)
+{
+    int ret = 0;
+
+    if (quic->binlog_writer != NULL) {
+        /* Pending qlog conversions may wait for the writer */
+        picoquic_collect_qlog_jobs(quic, 1);
+        picoquic_file_writer_delete(quic->binlog_writer);
+        quic->binlog_writer = NULL;
+    }
+    if (nb_records_max > 0 &&
+        (quic->binlog_writer = picoquic_file_writer_create(nb_records_max, block_if_full)) == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+
+    return ret;
+}
+
+uint64_t picoquic_get_binlog_writer_drops(picoquic_quic_t* quic)
+{
+    return (quic->binlog_writer == NULL) ? 0 : picoquic_file_writer_nb_dropped(quic->binlog_writer);
+}
+
+void picoquic_collect_qlog_jobs(picoquic_quic_t* quic, int wait_all)
+{
+    while (quic->nb_qlog_jobs > 0) {
+        picoquic_worker_job_t* job = picoquic_worker_pool_next_done(quic->qlog_worker_pool);
+
+        if (job != NULL) {
+            free(job);
+            quic->nb_qlog_jobs--;
+        }
+        else if (wait_all) {
+            (void)picoquic_worker_pool_wait_done(quic->qlog_worker_pool, 1000);
+        }
+        else {
+            break;
+        }
+    }
+}
+
+size_t picoquic_get_top_memory_consumers(picoquic_quic_t* quic, picoquic_cnx_t** cnx_list, size_t nb_max)
+{
+    size_t nb_found = 0;
+    picoquic_cnx_t* cnx = quic->cnx_list;
+
+    /* Insertion sort in the list provided by the caller */
+    while (cnx != NULL && nb_max > 0) {
+        if (nb_found < nb_max || cnx->memory_used > cnx_list[nb_max - 1]->memory_used) {
+            size_t i = (nb_found < nb_max) ? nb_found++ : nb_max - 1;
+
+            while (i > 0 && cnx_list[i - 1]->memory_used < cnx->memory_used) {
+                cnx_list[i] = cnx_list[i - 1];
+                i--;
+            }
+            cnx_list[i] = cnx;
+        }
+        cnx = cnx->next_in_table;
+    }
+
+    return nb_found;
+}
+
 static void picoquic_insert_cnx_in_list(picoquic_quic_t* quic, picoquic_cnx_t* cnx)
 {
     if (quic->cnx_list != NULL) {
@@ -1216,44 +1364,26 @@ static void picoquic_remove_cnx_from_list(picoquic_cnx_t* cnx)
     cnx->quic->current_number_connections--;
 }
 
-/* Management of the list of connections, sorted by wake time */
-
-static void* picoquic_wake_list_node_value(picosplay_node_t* cnx_wake_node)
-{
-    return (cnx_wake_node == NULL)?NULL:(void*)((char*)cnx_wake_node - offsetof(struct st_picoquic_cnx_t, cnx_wake_node));
-}
-
-static int64_t picoquic_wake_list_compare(void* l, void* r) {
-    return (int64_t)((picoquic_cnx_t*)l)->next_wake_time - ((picoquic_cnx_t*)r)->next_wake_time;
-}
+/* Management of the list of connections, sorted by wake time, using a timing wheel */
 
-static picosplay_node_t* picoquic_wake_list_create_node(void* v_cnx)
+static picoquic_cnx_t* picoquic_wake_list_node_value(picowheel_node_t* cnx_wake_node)
 {
-    return &((picoquic_cnx_t*)v_cnx)->cnx_wake_node;
-}
-
-static void picoquic_wake_list_delete_node(void* tree, picosplay_node_t* node)
-{
-#ifdef _WINDOWS
-    UNREFERENCED_PARAMETER(tree);
-#endif
-    memset(node, 0, sizeof(picosplay_node_t));
+    return (cnx_wake_node == NULL)?NULL:(picoquic_cnx_t*)((char*)cnx_wake_node - offsetof(struct st_picoquic_cnx_t, cnx_wake_node));
 }
 
 static void picoquic_wake_list_init(picoquic_quic_t * quic)
 {
-    picosplay_init_tree(&quic->cnx_wake_tree, picoquic_wake_list_compare,
-        picoquic_wake_list_create_node, picoquic_wake_list_delete_node, picoquic_wake_list_node_value);
+    picowheel_init(&quic->cnx_wake_wheel);
 }
 
 static void picoquic_remove_cnx_from_wake_list(picoquic_cnx_t* cnx)
 {
-    picosplay_delete_hint(&cnx->quic->cnx_wake_tree, &cnx->cnx_wake_node);
+    picowheel_remove(&cnx->quic->cnx_wake_wheel, &cnx->cnx_wake_node);
 }
 
 static void picoquic_insert_cnx_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx)
 {
-    picosplay_insert(&quic->cnx_wake_tree, cnx);
+    picowheel_insert(&quic->cnx_wake_wheel, &cnx->cnx_wake_node, cnx->next_wake_time);
 }
 
 void picoquic_reinsert_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx, uint64_t next_time)
@@ -1265,7 +1395,12 @@ void picoquic_reinsert_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx,
 
 picoquic_cnx_t* picoquic_get_earliest_cnx_to_wake(picoquic_quic_t* quic, uint64_t max_wake_time)
 {
-    picoquic_cnx_t* cnx = (picoquic_cnx_t *)picoquic_wake_list_node_value(picosplay_first(&quic->cnx_wake_tree));
+    picoquic_cnx_t* cnx;
+
+    if (max_wake_time != 0) {
+        picowheel_advance(&quic->cnx_wake_wheel, max_wake_time);
+    }
+    cnx = picoquic_wake_list_node_value(picowheel_first(&quic->cnx_wake_wheel));
     if (cnx != NULL && max_wake_time != 0 && cnx->next_wake_time > max_wake_time)
     {
         cnx = NULL;
@@ -1282,14 +1417,21 @@ uint64_t picoquic_get_next_wake_time(picoquic_quic_t* quic, uint64_t current_tim
         wake_time = current_time;
     }
     else{
-        picoquic_cnx_t* cnx_wake_first = (picoquic_cnx_t*)picoquic_wake_list_node_value(
-            picosplay_first(&quic->cnx_wake_tree));
+        picoquic_cnx_t* cnx_wake_first;
+
+        picowheel_advance(&quic->cnx_wake_wheel, current_time);
+        cnx_wake_first = picoquic_wake_list_node_value(picowheel_first(&quic->cnx_wake_wheel));
 
         if (cnx_wake_first != NULL) {
             wake_time = cnx_wake_first->next_wake_time;
         }
     }
 
+    if (quic->nb_tls_jobs > 0 && wake_time > current_time + PICOQUIC_TLS_JOB_POLL_INTERVAL) {
+        /* Come back soon to collect the results of the TLS workers */
+        wake_time = current_time + PICOQUIC_TLS_JOB_POLL_INTERVAL;
+    }
+
     return wake_time;
 }
 
@@ -2030,6 +2172,8 @@ void picoquic_init_packet_ctx(picoquic_cnx_t* cnx, picoquic_packet_context_t* pk
     }
     pkt_ctx->retransmit_newest = NULL;
     pkt_ctx->retransmit_oldest = NULL;
+    pkt_ctx->retransmit_index = NULL;
+    pkt_ctx->retransmit_index_size = 0;
     pkt_ctx->highest_acknowledged = pkt_ctx->send_sequence - 1;
     pkt_ctx->latest_time_acknowledged = cnx->start_time;
     pkt_ctx->highest_acknowledged_time = cnx->start_time;
@@ -2207,6 +2351,7 @@ picoquic_remote_cnxid_t* picoquic_remove_stashed_cnxid(picoquic_cnx_t* cnx, pico
             while (pkt_ctx->retransmit_newest != NULL) {
                 (void)picoquic_dequeue_retransmit_packet(cnx, pkt_ctx, pkt_ctx->retransmit_newest, 1);
             }
+            picoquic_retransmit_index_free(pkt_ctx);
 
             while (pkt_ctx->retransmitted_newest != NULL) {
                 picoquic_dequeue_retransmitted_packet(cnx, pkt_ctx, pkt_ctx->retransmitted_newest);
@@ -2397,9 +2542,34 @@ void* picoquic_stream_data_node_value(picosplay_node_t* node)
     return (void*)((char*)node - offsetof(struct st_picoquic_stream_data_node_t, stream_data_node));
 }
 
+/* Release one hold on the node. When the last hold is released, the node
+ * is returned to the pool, and reference nodes release their hold on the
+ * node that owns the data.
+ */
 void picoquic_stream_data_node_recycle(picoquic_stream_data_node_t* stream_data)
 {
-    if (stream_data->quic->nb_data_nodes_in_pool < PICOQUIC_MAX_PACKETS_IN_POOL) {
+    if (--stream_data->nb_data_refs > 0) {
+        return;
+    }
+
+    if (stream_data->data_owner != NULL) {
+        picoquic_stream_data_node_recycle(stream_data->data_owner);
+        stream_data->data_owner = NULL;
+    }
+
+    if (stream_data->is_compact) {
+        /* Reference nodes are pooled separately, copy nodes are freed */
+        stream_data->quic->nb_data_nodes_compact--;
+        if (stream_data->data_capacity == 0 && stream_data->quic->nb_data_refs_in_pool < PICOQUIC_MAX_PACKETS_IN_POOL) {
+            stream_data->next_stream_data = stream_data->quic->p_first_data_ref;
+            stream_data->quic->p_first_data_ref = stream_data;
+            stream_data->quic->nb_data_refs_in_pool++;
+        }
+        else {
+            free(stream_data);
+        }
+    }
+    else if (stream_data->quic->nb_data_nodes_in_pool < PICOQUIC_MAX_PACKETS_IN_POOL) {
         stream_data->next_stream_data = stream_data->quic->p_first_data_node;
         stream_data->quic->p_first_data_node = stream_data;
         stream_data->quic->nb_data_nodes_in_pool++;
@@ -2414,6 +2584,11 @@ void picoquic_stream_data_node_delete(void* tree, picosplay_node_t* node)
 {
     picoquic_stream_data_node_t* stream_data = (picoquic_stream_data_node_t*)picoquic_stream_data_node_value(node);
 
+    if (stream_data->charged_cnx != NULL) {
+        picoquic_memory_refund(stream_data->charged_cnx, stream_data->charged_bytes);
+        stream_data->charged_cnx = NULL;
+        stream_data->charged_bytes = 0;
+    }
     picoquic_stream_data_node_recycle(stream_data);
 }
 
@@ -2431,6 +2606,7 @@ picoquic_stream_data_node_t* picoquic_stream_data_node_alloc(picoquic_quic_t* qu
              */
             memset(stream_data, 0, sizeof(picoquic_stream_data_node_t));
             stream_data->quic = quic;
+            stream_data->data_capacity = PICOQUIC_MAX_PACKET_SIZE;
             quic->nb_data_nodes_allocated++;
         }
     }
@@ -2441,9 +2617,87 @@ picoquic_stream_data_node_t* picoquic_stream_data_node_alloc(picoquic_quic_t* qu
         quic->nb_data_nodes_in_pool--;
     }
 
+    if (stream_data != NULL) {
+        stream_data->nb_data_refs = 1;
+    }
+
+    return stream_data;
+}
+
+/* Allocate a compact node, with only "capacity" octets allocated for "data".
+ * Reference nodes have no data capacity, and are kept in their own pool.
+ */
+static picoquic_stream_data_node_t* picoquic_stream_data_node_alloc_compact(picoquic_quic_t* quic, size_t capacity)
+{
+    const size_t header_size = offsetof(picoquic_stream_data_node_t, data);
+    picoquic_stream_data_node_t* stream_data = NULL;
+
+    if (capacity == 0 && quic->p_first_data_ref != NULL) {
+        stream_data = quic->p_first_data_ref;
+        quic->p_first_data_ref = stream_data->next_stream_data;
+        quic->nb_data_refs_in_pool--;
+    }
+    else {
+        stream_data = (picoquic_stream_data_node_t*)malloc(header_size + capacity);
+    }
+
+    if (stream_data != NULL) {
+        memset(stream_data, 0, header_size);
+        stream_data->quic = quic;
+        stream_data->is_compact = 1;
+        stream_data->data_capacity = capacity;
+        stream_data->nb_data_refs = 1;
+        quic->nb_data_nodes_compact++;
+    }
+
+    return stream_data;
+}
+
+/* Allocate a reference node, pointing to data held in the owner node. */
+picoquic_stream_data_node_t* picoquic_stream_data_node_alloc_ref(picoquic_stream_data_node_t* data_owner)
+{
+    picoquic_stream_data_node_t* stream_data = picoquic_stream_data_node_alloc_compact(data_owner->quic, 0);
+
+    if (stream_data != NULL) {
+        stream_data->data_owner = data_owner;
+        data_owner->nb_data_refs++;
+    }
+
     return stream_data;
 }
 
+/* Allocate a copy node, holding up to "capacity" octets of stream data. */
+picoquic_stream_data_node_t* picoquic_stream_data_node_alloc_copy(picoquic_quic_t* quic, size_t capacity)
+{
+    picoquic_stream_data_node_t* stream_data = picoquic_stream_data_node_alloc_compact(quic, capacity);
+
+    if (stream_data != NULL) {
+        stream_data->bytes = stream_data->data;
+    }
+
+    return stream_data;
+}
+
+
+/* Stream management.
+ * Streams are found by stream ID in the stream table, an open addressing
+ * hash created with the first stream of the connection. Lookups do not
+ * modify the table. The splay of streams is only used to walk through
+ * the streams in stream ID order.
+ */
+
+#define PICOQUIC_STREAM_TABLE_MIN 16
+
+static uint64_t picoquic_stream_table_hash(const void* key)
+{
+    /* The table mixes the bits of the hash when computing the bin */
+    return ((const picoquic_stream_head_t*)key)->stream_id;
+}
+
+static int picoquic_stream_table_compare(const void* key1, const void* key2)
+{
+    return (((const picoquic_stream_head_t*)key1)->stream_id == ((const picoquic_stream_head_t*)key2)->stream_id) ? 0 : -1;
+}
 
 /* Stream splay management */
 
@@ -2482,6 +2736,16 @@ void picoquic_clear_stream(picoquic_stream_head_t* stream)
 }
 
 
+/* Release a node of the stream send queue, refunding its memory */
+void picoquic_free_stream_queue_node(picoquic_cnx_t* cnx, picoquic_stream_queue_node_t* stream_data)
+{
+    picoquic_memory_refund(cnx, sizeof(picoquic_stream_queue_node_t) + stream_data->length);
+    if (stream_data->bytes != NULL) {
+        free(stream_data->bytes);
+    }
+    free(stream_data);
+}
+
 static void picoquic_stream_node_delete(void * tree, picosplay_node_t * node)
 {
     picoquic_stream_head_t * stream = picoquic_stream_node_value(node);
@@ -2520,37 +2784,93 @@ picoquic_stream_head_t * picoquic_last_stream(picoquic_cnx_t* cnx)
 #endif
 }
 
-void picoquic_insert_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t * stream)
+/* Output stream scheduling.
+ * The output list holds the streams that may have something to send, sorted
+ * by urgency. For each urgency level, the connection remembers the last
+ * stream of that level, so a stream can be added at the tail of its level
+ * without walking the list. Incremental streams are moved back to the tail
+ * of their level after each frame, FIFO streams stay in place until they
+ * have nothing more to send. Output streams that have nothing to send, or
+ * are blocked by stream flow control, are parked in a separate list until
+ * the application or the peer makes them ready again, so that the ready
+ * stream is normally found at the head of the output list.
+ */
+
+static uint8_t picoquic_output_stream_urgency(picoquic_stream_head_t* stream)
 {
-    if (stream->is_output_stream == 0) {
-        if (stream->stream_id == cnx->high_priority_stream_id) {
-            /* insert in front */
-            stream->previous_output_stream = NULL;
+    uint8_t urgency = stream->stream_priority >> 1;
+
+    return (urgency < PICOQUIC_NB_STREAM_URGENCY) ? urgency : (PICOQUIC_NB_STREAM_URGENCY - 1);
+}
+
+static void picoquic_link_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    if (stream->stream_id == cnx->high_priority_stream_id) {
+        /* insert in front */
+        stream->output_urgency = 0;
+        stream->previous_output_stream = NULL;
+        stream->next_output_stream = cnx->first_output_stream;
+        if (cnx->first_output_stream != NULL) {
+            cnx->first_output_stream->previous_output_stream = stream;
+        }
+        else {
+            cnx->last_output_stream = stream;
+        }
+        cnx->first_output_stream = stream;
+        if (cnx->last_output_of_urgency[0] == NULL) {
+            cnx->last_output_of_urgency[0] = stream;
+        }
+    }
+    else {
+        /* insert after the last stream of the same or a more urgent level */
+        picoquic_stream_head_t* previous_stream = NULL;
+        int urgency = picoquic_output_stream_urgency(stream);
+
+        stream->output_urgency = (uint8_t)urgency;
+        while (urgency >= 0 && (previous_stream = cnx->last_output_of_urgency[urgency]) == NULL) {
+            urgency--;
+        }
+
+        stream->previous_output_stream = previous_stream;
+        if (previous_stream == NULL) {
             stream->next_output_stream = cnx->first_output_stream;
-            if (cnx->first_output_stream != NULL) {
-                cnx->first_output_stream->previous_output_stream = stream;
-            }
             cnx->first_output_stream = stream;
-        } else {
-            stream->previous_output_stream = cnx->last_output_stream;
-            stream->next_output_stream = NULL;
-            if (cnx->last_output_stream == NULL) {
-                cnx->first_output_stream = stream;
-                cnx->last_output_stream = stream;
-            }
-            else {
-                cnx->last_output_stream->next_output_stream = stream;
-                cnx->last_output_stream = stream;
-            }
         }
-        stream->is_output_stream = 1;
+        else {
+            stream->next_output_stream = previous_stream->next_output_stream;
+            previous_stream->next_output_stream = stream;
+        }
+        if (stream->next_output_stream == NULL) {
+            cnx->last_output_stream = stream;
+        }
+        else {
+            stream->next_output_stream->previous_output_stream = stream;
+        }
+        cnx->last_output_of_urgency[stream->output_urgency] = stream;
     }
 }
 
-void picoquic_remove_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t * stream, picoquic_stream_head_t * previous_stream)
+static void picoquic_unlink_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
 {
-    if (stream->is_output_stream) {
-        stream->is_output_stream = 0;
+    if (stream->is_output_parked) {
+        if (stream->previous_output_stream == NULL) {
+            cnx->first_parked_stream = stream->next_output_stream;
+        }
+        else {
+            stream->previous_output_stream->next_output_stream = stream->next_output_stream;
+        }
+        if (stream->next_output_stream != NULL) {
+            stream->next_output_stream->previous_output_stream = stream->previous_output_stream;
+        }
+        stream->is_output_parked = 0;
+    }
+    else {
+        if (cnx->last_output_of_urgency[stream->output_urgency] == stream) {
+            picoquic_stream_head_t* previous_stream = stream->previous_output_stream;
+
+            cnx->last_output_of_urgency[stream->output_urgency] =
+                (previous_stream != NULL && previous_stream->output_urgency == stream->output_urgency) ? previous_stream : NULL;
+        }
 
         if (stream->previous_output_stream == NULL) {
             cnx->first_output_stream = stream->next_output_stream;
@@ -2566,6 +2886,73 @@ void picoquic_remove_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t *
             stream->next_output_stream->previous_output_stream = stream->previous_output_stream;
         }
     }
+    stream->next_output_stream = NULL;
+    stream->previous_output_stream = NULL;
+}
+
+void picoquic_insert_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t * stream)
+{
+    if (stream->is_output_stream == 0) {
+        picoquic_link_output_stream(cnx, stream);
+        stream->is_output_stream = 1;
+    }
+    else {
+        picoquic_wake_output_stream(cnx, stream);
+    }
+}
+
+void picoquic_remove_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t * stream, picoquic_stream_head_t * previous_stream)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(previous_stream);
+#endif
+    if (stream->is_output_stream) {
+        picoquic_unlink_output_stream(cnx, stream);
+        stream->is_output_stream = 0;
+    }
+}
+
+/* Move an output stream that cannot send anything to the parked list */
+void picoquic_park_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    if (stream->is_output_stream && !stream->is_output_parked) {
+        picoquic_unlink_output_stream(cnx, stream);
+        stream->next_output_stream = cnx->first_parked_stream;
+        if (cnx->first_parked_stream != NULL) {
+            cnx->first_parked_stream->previous_output_stream = stream;
+        }
+        cnx->first_parked_stream = stream;
+        stream->is_output_parked = 1;
+    }
+}
+
+/* Bring a parked stream back to the output list if it may have something to send.
+ * This is called when the application queues data, marks the stream active,
+ * or requests a reset, and when the peer raises the stream flow control limit.
+ */
+void picoquic_wake_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    if (stream->is_output_parked &&
+        ((stream->sent_offset < stream->maxdata_remote && (stream->is_active ||
+        (stream->send_queue != NULL && stream->send_queue->length > stream->send_queue->offset) ||
+        (stream->fin_requested && !stream->fin_sent))) ||
+        (stream->reset_requested && !stream->reset_sent) ||
+        (stream->stop_sending_requested && !stream->stop_sending_sent))) {
+        picoquic_unlink_output_stream(cnx, stream);
+        picoquic_link_output_stream(cnx, stream);
+    }
+}
+
+/* After a frame was sent, move an incremental stream behind the other
+ * streams of the same urgency */
+void picoquic_requeue_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    if (stream->is_output_stream && !stream->is_output_parked && (stream->stream_priority & 1) == 0 &&
+        stream->stream_id != cnx->high_priority_stream_id &&
+        cnx->last_output_of_urgency[stream->output_urgency] != stream) {
+        picoquic_unlink_output_stream(cnx, stream);
+        picoquic_link_output_stream(cnx, stream);
+    }
 }
 
 picoquic_stream_head_t * picoquic_next_stream(picoquic_stream_head_t * stream)
@@ -2575,10 +2962,20 @@ picoquic_stream_head_t * picoquic_next_stream(picoquic_stream_head_t * stream)
 
 picoquic_stream_head_t* picoquic_find_stream(picoquic_cnx_t* cnx, uint64_t stream_id)
 {
-    picoquic_stream_head_t target;
-    target.stream_id = stream_id;
+    picoquic_stream_head_t* stream = NULL;
+
+    if (cnx->stream_table != NULL) {
+        picoquic_stream_head_t target;
+        picohash_item* item;
+
+        target.stream_id = stream_id;
+        item = picohash_retrieve(cnx->stream_table, &target);
+        if (item != NULL) {
+            stream = (picoquic_stream_head_t*)item->key;
+        }
+    }
 
-    return (picoquic_stream_head_t *)picosplay_find(&cnx->stream_tree, (void*)&target);
+    return stream;
 }
 
 void picoquic_add_output_streams(picoquic_cnx_t* cnx, uint64_t old_limit, uint64_t new_limit, unsigned int is_bidir)
@@ -2611,6 +3008,7 @@ picoquic_stream_head_t* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t str
     if (stream != NULL){
         int is_output_stream = 0;
         stream->stream_id = stream_id;
+        stream->stream_priority = PICOQUIC_DEFAULT_STREAM_PRIORITY;
 
         if (IS_LOCAL_STREAM_ID(stream_id, cnx->client_mode)) {
             if (IS_BIDIR_STREAM_ID(stream_id)) {
@@ -2640,17 +3038,26 @@ picoquic_stream_head_t* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t str
 
         picosplay_init_tree(&stream->stream_data_tree, picoquic_stream_data_node_compare, picoquic_stream_data_node_create, picoquic_stream_data_node_delete, picoquic_stream_data_node_value);
 
-        picosplay_insert(&cnx->stream_tree, stream);
-        if (is_output_stream) {
-            picoquic_insert_output_stream(cnx, stream);
+        if ((cnx->stream_table == NULL &&
+            (cnx->stream_table = picohash_create(PICOQUIC_STREAM_TABLE_MIN, picoquic_stream_table_hash, picoquic_stream_table_compare)) == NULL) ||
+            picohash_insert(cnx->stream_table, stream) != 0) {
+            free(stream);
+            stream = NULL;
         }
         else {
-            picoquic_remove_output_stream(cnx, stream, NULL);
-            picoquic_delete_stream_if_closed(cnx, stream);
-        }
+            picoquic_memory_charge(cnx, sizeof(picoquic_stream_head_t));
+            picosplay_insert(&cnx->stream_tree, stream);
+            if (is_output_stream) {
+                picoquic_insert_output_stream(cnx, stream);
+            }
+            else {
+                picoquic_remove_output_stream(cnx, stream, NULL);
+                picoquic_delete_stream_if_closed(cnx, stream);
+            }
 
-        if (stream_id >= cnx->next_stream_id[STREAM_TYPE_FROM_ID(stream_id)]) {
-            cnx->next_stream_id[STREAM_TYPE_FROM_ID(stream_id)] = NEXT_STREAM_ID_FOR_TYPE(stream_id);
+            if (stream_id >= cnx->next_stream_id[STREAM_TYPE_FROM_ID(stream_id)]) {
+                cnx->next_stream_id[STREAM_TYPE_FROM_ID(stream_id)] = NEXT_STREAM_ID_FOR_TYPE(stream_id);
+            }
         }
     }
 
@@ -2659,7 +3066,22 @@ picoquic_stream_head_t* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t str
 
 void picoquic_delete_stream(picoquic_cnx_t * cnx, picoquic_stream_head_t* stream)
 {
-    picosplay_delete(&cnx->stream_tree, stream);
+    /* Streams are in the splay if and only if they are in the table */
+    if (cnx->stream_table != NULL) {
+        picohash_item* item = picohash_retrieve(cnx->stream_table, stream);
+        if (item != NULL) {
+            picoquic_stream_queue_node_t* next = stream->send_queue;
+            size_t released = sizeof(picoquic_stream_head_t);
+
+            while (next != NULL) {
+                released += sizeof(picoquic_stream_queue_node_t) + next->length;
+                next = next->next_stream_data;
+            }
+            picoquic_memory_refund(cnx, released);
+            picohash_delete_item(cnx->stream_table, item, 0);
+            picosplay_delete_hint(&cnx->stream_tree, &stream->stream_node);
+        }
+    }
 }
 
 int picoquic_mark_direct_receive_stream(picoquic_cnx_t* cnx, uint64_t stream_id, picoquic_stream_direct_receive_fn direct_receive_fn, void* direct_receive_ctx)
@@ -2719,6 +3141,32 @@ int picoquic_mark_direct_receive_stream(picoquic_cnx_t* cnx, uint64_t stream_id,
     return ret;
 }
 
+int picoquic_mark_iovec_receive_stream(picoquic_cnx_t* cnx, uint64_t stream_id, picoquic_stream_iovec_receive_fn iovec_receive_fn, void* iovec_receive_ctx)
+{
+    int ret = 0;
+    picoquic_stream_head_t* stream = picoquic_find_stream(cnx, stream_id);
+
+    if (stream == NULL) {
+        ret = PICOQUIC_ERROR_INVALID_STREAM_ID;
+    }
+    else if (!IS_BIDIR_STREAM_ID(stream_id) && IS_LOCAL_STREAM_ID(stream_id, cnx->client_mode)) {
+        ret = PICOQUIC_ERROR_INVALID_STREAM_ID;
+    }
+    else if (iovec_receive_fn == NULL) {
+        ret = PICOQUIC_ERROR_NO_CALLBACK_PROVIDED;
+    }
+    else {
+        stream->iovec_receive_fn = iovec_receive_fn;
+        stream->iovec_receive_ctx = iovec_receive_ctx;
+        /* If there is pending data, pass it. */
+        if (stream->direct_receive_fn == NULL) {
+            picoquic_stream_data_callback(cnx, stream);
+        }
+    }
+
+    return ret;
+}
+
 
 /* Management of local CID.
  * Local CID are created and registered on demand.
@@ -2972,6 +3420,7 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
         }
         cnx->initial_cnxid = initial_cnx_id;
         cnx->quic = quic;
+        picoquic_memory_charge(cnx, sizeof(picoquic_cnx_t));
         cnx->pmtud_policy = quic->default_pmtud_policy;
         /* Create the connection ID number 0 */
         cnxid0 = picoquic_create_local_cnxid(cnx, NULL, start_time);
@@ -3617,6 +4066,7 @@ int picoquic_queue_misc_or_dg_frame(picoquic_cnx_t * cnx, picoquic_misc_frame_he
     if (misc_frame == NULL) {
         ret = PICOQUIC_ERROR_MEMORY;
     } else {
+        picoquic_memory_charge(cnx, sizeof(picoquic_misc_frame_header_t) + length);
         if (*last == NULL) {
             *first = misc_frame;
             *last = misc_frame;
@@ -3638,7 +4088,7 @@ int picoquic_queue_misc_frame(picoquic_cnx_t* cnx, const uint8_t* bytes, size_t
     return picoquic_queue_misc_or_dg_frame(cnx, &cnx->first_misc_frame, &cnx->last_misc_frame, bytes, length, is_pure_ack);
 }
 
-void picoquic_delete_misc_or_dg(picoquic_misc_frame_header_t** first, picoquic_misc_frame_header_t** last, picoquic_misc_frame_header_t* frame)
+void picoquic_delete_misc_or_dg(picoquic_cnx_t* cnx, picoquic_misc_frame_header_t** first, picoquic_misc_frame_header_t** last, picoquic_misc_frame_header_t* frame)
 {
     if (frame->next_misc_frame) {
         frame->next_misc_frame->previous_misc_frame = frame->previous_misc_frame;
@@ -3654,6 +4104,7 @@ void picoquic_delete_misc_or_dg(picoquic_misc_frame_header_t** first, picoquic_m
         *first = frame->next_misc_frame;
     }
 
+    picoquic_memory_refund(cnx, sizeof(picoquic_misc_frame_header_t) + frame->length);
     free(frame);
 }
 
@@ -3672,6 +4123,7 @@ void picoquic_reset_packet_context(picoquic_cnx_t* cnx,
     while (pkt_ctx->retransmit_newest != NULL) {
         (void)picoquic_dequeue_retransmit_packet(cnx, pkt_ctx, pkt_ctx->retransmit_newest, 1);
     }
+    picoquic_retransmit_index_free(pkt_ctx);
     
     while (pkt_ctx->retransmitted_newest != NULL) {
         picoquic_dequeue_retransmitted_packet(cnx, pkt_ctx, pkt_ctx->retransmitted_newest);
@@ -3840,6 +4292,11 @@ void picoquic_delete_sooner_packets(picoquic_cnx_t* cnx)
 void picoquic_delete_cnx(picoquic_cnx_t* cnx)
 {
     if (cnx != NULL) {
+        if (cnx->tls_job != NULL) {
+            /* Wait for the worker thread to release the connection */
+            picoquic_tls_job_cancel(cnx);
+        }
+
         if (cnx->quic->perflog_fn != NULL) {
             (void)(cnx->quic->perflog_fn)(cnx->quic, cnx, 0);
         }
@@ -3889,15 +4346,15 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
         }
 
         while (cnx->first_misc_frame != NULL) {
-            picoquic_delete_misc_or_dg(&cnx->first_misc_frame, &cnx->last_misc_frame, cnx->first_misc_frame);
+            picoquic_delete_misc_or_dg(cnx, &cnx->first_misc_frame, &cnx->last_misc_frame, cnx->first_misc_frame);
         }
 
         while (cnx->first_datagram != NULL) {
-            picoquic_delete_misc_or_dg(&cnx->first_datagram, &cnx->last_datagram, cnx->first_datagram);
+            picoquic_delete_misc_or_dg(cnx, &cnx->first_datagram, &cnx->last_datagram, cnx->first_datagram);
         }
 
         while (cnx->stream_frame_retransmit_queue != NULL) {
-            picoquic_delete_misc_or_dg(&cnx->stream_frame_retransmit_queue,
+            picoquic_delete_misc_or_dg(cnx, &cnx->stream_frame_retransmit_queue,
                 &cnx->stream_frame_retransmit_queue_last, cnx->stream_frame_retransmit_queue);
         }
 
@@ -3905,6 +4362,10 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
             picoquic_clear_stream(&cnx->tls_stream[epoch]);
         }
 
+        if (cnx->stream_table != NULL) {
+            picohash_delete(cnx->stream_table, 0);
+            cnx->stream_table = NULL;
+        }
         picosplay_empty_tree(&cnx->stream_tree);
 
         if (cnx->tls_ctx != NULL) {
@@ -3931,6 +4392,9 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
             (void)picoquic_remove_stashed_cnxid(cnx, cnx->cnxid_stash_first, NULL, 0);
         }
 
+        /* Refund what is still charged, e.g., the context itself */
+        picoquic_memory_refund(cnx, cnx->memory_used);
+
         free(cnx);
     }
 }
@@ -32,26 +32,39 @@
 * Maintain the list of ACK
 */
 
-/* Procedures to manage the list of ack ranges as a splay
+/* Procedures to manage the list of ack ranges.
+ * The ranges are normally held in the sorted vector inside the list.
+ * When the vector overflows, they are moved to a splay, in which each
+ * item is held in an allocated node.
  */
+typedef struct st_picoquic_sack_node_t {
+    picosplay_node_t node;
+    picoquic_sack_item_t item;
+} picoquic_sack_node_t;
+
 static void* picoquic_sack_node_value(picosplay_node_t* node)
 {
-    return (void*)((char*)node - offsetof(struct st_picoquic_sack_item_t, node));
+    return (void*)((char*)node - offsetof(struct st_picoquic_sack_node_t, node));
 }
 
 static picoquic_sack_item_t* picoquic_sack_item_value(picosplay_node_t* node)
 {
-    return (node == NULL) ? NULL : (picoquic_sack_item_t*)picoquic_sack_node_value(node);
+    return (node == NULL) ? NULL : &((picoquic_sack_node_t*)picoquic_sack_node_value(node))->item;
+}
+
+static picoquic_sack_node_t* picoquic_sack_node_from_item(picoquic_sack_item_t* sack)
+{
+    return (picoquic_sack_node_t*)((char*)sack - offsetof(struct st_picoquic_sack_node_t, item));
 }
 
 static int64_t picoquic_sack_item_compare(void* l, void* r) {
-    int64_t delta = ((picoquic_sack_item_t*)l)->start_of_sack_range - ((picoquic_sack_item_t*)r)->start_of_sack_range;
+    int64_t delta = ((picoquic_sack_node_t*)l)->item.start_of_sack_range - ((picoquic_sack_node_t*)r)->item.start_of_sack_range;
     return delta;
 }
 
 static picosplay_node_t* picoquic_sack_node_create(void* value)
 {
-    return &((picoquic_sack_item_t*)value)->node;
+    return &((picoquic_sack_node_t*)value)->node;
 }
 
 static void picoquic_sack_node_delete(void* tree, picosplay_node_t* node)
@@ -62,47 +75,146 @@ static void picoquic_sack_node_delete(void* tree, picosplay_node_t* node)
     free(picoquic_sack_node_value(node));
 }
 
+/* Move the content of the vector to the splay, when the vector is full.
+ * The nodes are all allocated before changing the list, so that the list
+ * remains unchanged if an allocation fails.
+ */
+static int picoquic_sack_list_to_tree(picoquic_sack_list_t* sack_list)
+{
+    int ret = 0;
+    picoquic_sack_node_t* nodes[PICOQUIC_SACK_VECTOR_MAX];
+    int nb_nodes = 0;
+
+    while (nb_nodes < sack_list->nb_sack_vector) {
+        if ((nodes[nb_nodes] = (picoquic_sack_node_t*)malloc(sizeof(picoquic_sack_node_t))) == NULL) {
+            ret = -1;
+            break;
+        }
+        nb_nodes++;
+    }
+
+    if (ret != 0) {
+        for (int i = 0; i < nb_nodes; i++) {
+            free(nodes[i]);
+        }
+    }
+    else {
+        for (int i = 0; i < nb_nodes; i++) {
+            memset(&nodes[i]->node, 0, sizeof(picosplay_node_t));
+            nodes[i]->item = sack_list->sack_vector[i];
+            (void)picosplay_insert(&sack_list->ack_tree, nodes[i]);
+        }
+        sack_list->nb_sack_vector = 0;
+        sack_list->is_tree = 1;
+    }
+
+    return ret;
+}
+
+/* Move the content of the splay back to the vector once the number
+ * of ranges is small enough. This is only called when no item pointer
+ * is held by the caller, since all the items are moved.
+ */
+static void picoquic_sack_list_compact(picoquic_sack_list_t* sack_list)
+{
+    if (sack_list->is_tree && sack_list->ack_tree.size <= PICOQUIC_SACK_VECTOR_MAX / 2) {
+        picoquic_sack_item_t* sack = picoquic_sack_item_value(picosplay_first(&sack_list->ack_tree));
+        int nb_sack_vector = 0;
+
+        while (sack != NULL) {
+            sack_list->sack_vector[nb_sack_vector++] = *sack;
+            sack = picoquic_sack_item_value(picosplay_next(&picoquic_sack_node_from_item(sack)->node));
+        }
+        picosplay_empty_tree(&sack_list->ack_tree);
+        sack_list->nb_sack_vector = nb_sack_vector;
+        sack_list->is_tree = 0;
+    }
+}
+
 /* Return the first ACK item in the list */
 picoquic_sack_item_t* picoquic_sack_first_item(picoquic_sack_list_t* sack_list)
 {
-    return picoquic_sack_item_value(picosplay_first(&sack_list->ack_tree));
+    if (sack_list->is_tree) {
+        return picoquic_sack_item_value(picosplay_first(&sack_list->ack_tree));
+    }
+    return (sack_list->nb_sack_vector > 0) ? &sack_list->sack_vector[0] : NULL;
 }
 
 picoquic_sack_item_t* picoquic_sack_last_item(picoquic_sack_list_t* sack_list)
 {
-    return picoquic_sack_item_value(picosplay_last(&sack_list->ack_tree));
+    if (sack_list->is_tree) {
+        return picoquic_sack_item_value(picosplay_last(&sack_list->ack_tree));
+    }
+    return (sack_list->nb_sack_vector > 0) ? &sack_list->sack_vector[sack_list->nb_sack_vector - 1] : NULL;
 }
 
-picoquic_sack_item_t* picoquic_sack_next_item(picoquic_sack_item_t* sack)
+picoquic_sack_item_t* picoquic_sack_next_item(picoquic_sack_list_t* sack_list, picoquic_sack_item_t* sack)
 {
-    return picoquic_sack_item_value(picosplay_next(&sack->node));
+    if (sack_list->is_tree) {
+        return picoquic_sack_item_value(picosplay_next(&picoquic_sack_node_from_item(sack)->node));
+    }
+    return (sack + 1 < &sack_list->sack_vector[sack_list->nb_sack_vector]) ? sack + 1 : NULL;
 }
 
-picoquic_sack_item_t* picoquic_sack_previous_item(picoquic_sack_item_t* sack)
+picoquic_sack_item_t* picoquic_sack_previous_item(picoquic_sack_list_t* sack_list, picoquic_sack_item_t* sack)
 {
-    return picoquic_sack_item_value(picosplay_previous(&sack->node));
+    if (sack_list->is_tree) {
+        return picoquic_sack_item_value(picosplay_previous(&picoquic_sack_node_from_item(sack)->node));
+    }
+    return (sack > &sack_list->sack_vector[0]) ? sack - 1 : NULL;
 }
 
 int picoquic_sack_insert_item(picoquic_sack_list_t* sack_list, uint64_t range_min, uint64_t range_max, uint64_t current_time)
 {
     int ret = 0;
-    picoquic_sack_item_t* sack_new = (picoquic_sack_item_t*)malloc(sizeof(picoquic_sack_item_t));
-    if (sack_new == NULL) {
-        ret = -1;
+
+    if (!sack_list->is_tree && sack_list->nb_sack_vector >= PICOQUIC_SACK_VECTOR_MAX) {
+        ret = picoquic_sack_list_to_tree(sack_list);
     }
-    else
-    {
-        memset(sack_new, 0, sizeof(picoquic_sack_item_t));
-        sack_new->start_of_sack_range = range_min;
-        sack_new->end_of_sack_range = range_max;
-        sack_new->time_created = current_time;
-        sack_list->rc[0].range_counts[0] += 1;
-        sack_list->rc[1].range_counts[0] += 1;
-        (void)picosplay_insert(&sack_list->ack_tree, sack_new);
+
+    if (ret == 0) {
+        picoquic_sack_item_t* sack_new = NULL;
+
+        if (sack_list->is_tree) {
+            picoquic_sack_node_t* node_new = (picoquic_sack_node_t*)malloc(sizeof(picoquic_sack_node_t));
+            if (node_new == NULL) {
+                ret = -1;
+            }
+            else {
+                memset(node_new, 0, sizeof(picoquic_sack_node_t));
+                sack_new = &node_new->item;
+            }
+        }
+        else {
+            /* Ranges are mostly added at the top, so search from the end */
+            int i = sack_list->nb_sack_vector;
+            while (i > 0 && sack_list->sack_vector[i - 1].start_of_sack_range > range_min) {
+                i--;
+            }
+            if (i < sack_list->nb_sack_vector) {
+                memmove(&sack_list->sack_vector[i + 1], &sack_list->sack_vector[i],
+                    (sack_list->nb_sack_vector - i) * sizeof(picoquic_sack_item_t));
+            }
+            sack_list->nb_sack_vector++;
+            sack_new = &sack_list->sack_vector[i];
+            memset(sack_new, 0, sizeof(picoquic_sack_item_t));
+        }
+
+        if (sack_new != NULL) {
+            sack_new->start_of_sack_range = range_min;
+            sack_new->end_of_sack_range = range_max;
+            sack_new->time_created = current_time;
+            sack_list->rc[0].range_counts[0] += 1;
+            sack_list->rc[1].range_counts[0] += 1;
+            if (sack_list->is_tree) {
+                (void)picosplay_insert(&sack_list->ack_tree, picoquic_sack_node_from_item(sack_new));
+            }
+        }
     }
 
     return ret;
 }
+
 void picoquic_sack_delete_item(picoquic_sack_list_t* sack_list, picoquic_sack_item_t* sack)
 {
     /* Accounting of deleted values */
@@ -111,15 +223,26 @@ void picoquic_sack_delete_item(picoquic_sack_list_t* sack_list, picoquic_sack_it
             sack_list->rc[r].range_counts[sack->nb_times_sent[r]] -= 1;
         }
     }
-    /* Delete the item in the splay */
-    picosplay_delete_hint(&sack_list->ack_tree, &sack->node);
+    if (sack_list->is_tree) {
+        /* Delete the item in the splay */
+        picosplay_delete_hint(&sack_list->ack_tree, &picoquic_sack_node_from_item(sack)->node);
+    }
+    else {
+        /* Remove the item from the vector. Items above it are moved down */
+        int i = (int)(sack - &sack_list->sack_vector[0]);
+        sack_list->nb_sack_vector--;
+        if (i < sack_list->nb_sack_vector) {
+            memmove(&sack_list->sack_vector[i], &sack_list->sack_vector[i + 1],
+                (sack_list->nb_sack_vector - i) * sizeof(picoquic_sack_item_t));
+        }
+    }
 }
 
 /* Check whether the sack list is empty
  */
 int picoquic_sack_list_is_empty(picoquic_sack_list_t* sack_list)
 {
-    return (sack_list->ack_tree.size == 0);
+    return (sack_list->is_tree) ? (sack_list->ack_tree.size == 0) : (sack_list->nb_sack_vector == 0);
 }
 
 /* Find the sack list for the context
@@ -140,10 +263,20 @@ picoquic_sack_item_t* picoquic_sack_find_range_below_number(picoquic_sack_list_t
 #ifdef _WINDOWS
     UNREFERENCED_PARAMETER(previous);
 #endif
-    picoquic_sack_item_t v = { 0 };
-    v.start_of_sack_range = pn64;
-    v.end_of_sack_range = pn64;
-    return(picoquic_sack_item_value(picosplay_find_previous(&sack_list->ack_tree, &v)));
+    if (sack_list->is_tree) {
+        picoquic_sack_node_t v = { 0 };
+        v.item.start_of_sack_range = pn64;
+        v.item.end_of_sack_range = pn64;
+        return(picoquic_sack_item_value(picosplay_find_previous(&sack_list->ack_tree, &v)));
+    }
+    else {
+        /* Most packets arrive close to the top of the list, so search from the end */
+        int i = sack_list->nb_sack_vector - 1;
+        while (i >= 0 && sack_list->sack_vector[i].start_of_sack_range > pn64) {
+            i--;
+        }
+        return (i >= 0) ? &sack_list->sack_vector[i] : NULL;
+    }
 }
 
 /*
@@ -182,7 +315,7 @@ int picoquic_update_sack_list(picoquic_sack_list_t* sack_list,
     if (previous == NULL || previous->end_of_sack_range + 1 < pn64_min) {
         /* No overlap with a range below */
         picoquic_sack_item_t* next = (previous == NULL) ?
-            picoquic_sack_first_item(sack_list) : picoquic_sack_next_item(previous);
+            picoquic_sack_first_item(sack_list) : picoquic_sack_next_item(sack_list, previous);
         if (next == NULL || next->start_of_sack_range - 1 > pn64_max) {
             /* create a new item in the list */
             ret = picoquic_sack_insert_item(sack_list, pn64_min, pn64_max, current_time);
@@ -203,7 +336,7 @@ int picoquic_update_sack_list(picoquic_sack_list_t* sack_list,
     while (previous != NULL && previous->end_of_sack_range < pn64_max) {
         /* we found or created an item that includes the beginning
          * of the acked range. Check the next one */
-        picoquic_sack_item_t* next = picoquic_sack_next_item(previous);
+        picoquic_sack_item_t* next = picoquic_sack_next_item(sack_list, previous);
         if (next == NULL || next->start_of_sack_range - 1 > pn64_max) {
             /* No overlap. Extend the previous item up to the max of the range */
             previous->end_of_sack_range = pn64_max;
@@ -230,6 +363,9 @@ int picoquic_update_sack_list(picoquic_sack_list_t* sack_list,
     if (sack_list->horizon_delay > 0) {
         picoquic_update_ack_horizon(sack_list, current_time);
     }
+    else {
+        picoquic_sack_list_compact(sack_list);
+    }
 
     return ret;
 }
@@ -328,7 +464,7 @@ picoquic_sack_item_t* picoquic_process_ack_of_ack_range(picoquic_sack_list_t* sa
     previous = picoquic_sack_find_range_below_number(sack_list, NULL, start_of_range);
 
     if (previous != NULL && previous->start_of_sack_range == start_of_range){
-        picoquic_sack_item_t* next = picoquic_sack_item_value(picosplay_next(&previous->node));
+        picoquic_sack_item_t* next = picoquic_sack_next_item(sack_list, previous);
         if (next == NULL) {
             /* Matching the highest range, which shall not be deleted */
             if (end_of_range < previous->end_of_sack_range) {
@@ -364,19 +500,18 @@ void picoquic_update_ack_horizon(picoquic_sack_list_t* sack_list, uint64_t curre
 
     while (first_sack != NULL && first_sack->nb_times_sent[0] >= PICOQUIC_MAX_ACK_RANGE_REPEAT) {
         int64_t delay = current_time - first_sack->time_created;
-        if (delay > sack_list->horizon_delay) {
-            picoquic_sack_item_t* next_sack = picoquic_sack_next_item(first_sack);
-            if (next_sack != NULL) {
-                /* Always keep the last range */
-                sack_list->ack_horizon = first_sack->end_of_sack_range + 1;
-                picoquic_sack_delete_item(sack_list, first_sack);
-            }
-            first_sack = next_sack;
+        /* Always keep the last range */
+        if (delay > sack_list->horizon_delay && picoquic_sack_next_item(sack_list, first_sack) != NULL) {
+            sack_list->ack_horizon = first_sack->end_of_sack_range + 1;
+            picoquic_sack_delete_item(sack_list, first_sack);
+            first_sack = picoquic_sack_first_item(sack_list);
         }
         else {
             break;
         }
     }
+
+    picoquic_sack_list_compact(sack_list);
 }
 
 
@@ -401,7 +536,7 @@ uint64_t picoquic_sack_list_last(picoquic_sack_list_t* sack_list)
 picoquic_sack_item_t * picoquic_sack_list_first_range(picoquic_sack_list_t* sack_list)
 {
     picoquic_sack_item_t* first = picoquic_sack_first_item(sack_list);
-    return(first == NULL) ? NULL : picoquic_sack_item_value(picosplay_next(&first->node));
+    return(first == NULL) ? NULL : picoquic_sack_next_item(sack_list, first);
 }
 
 /* Initialize a sack list
@@ -428,6 +563,8 @@ int picoquic_sack_list_reset(picoquic_sack_list_t* sack_list, uint64_t range_min
 void picoquic_sack_list_free(picoquic_sack_list_t* sack_list)
 {
     picosplay_empty_tree(&sack_list->ack_tree);
+    sack_list->nb_sack_vector = 0;
+    sack_list->is_tree = 0;
     for (int r = 0; r < 2; r++) {
         memset(sack_list->rc[r].range_counts, 0, sizeof(sack_list->rc[r].range_counts));
     }
@@ -474,5 +611,5 @@ void picoquic_sack_item_record_reset(picoquic_sack_list_t* sack_list, picoquic_s
 
 size_t picoquic_sack_list_size(picoquic_sack_list_t* sack_list)
 {
-    return (size_t)sack_list->ack_tree.size;
+    return (size_t)((sack_list->is_tree) ? sack_list->ack_tree.size : sack_list->nb_sack_vector);
 }
\ No newline at end of file
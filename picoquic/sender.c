@@ -107,6 +107,7 @@ int picoquic_mark_active_stream(picoquic_cnx_t* cnx,
                 stream->app_stream_ctx = app_stream_ctx;
                 if (!stream->is_active) {
                     stream->is_active = 1;
+                    picoquic_wake_output_stream(cnx, stream);
                     picoquic_reinsert_by_wake_time(cnx->quic, cnx, picoquic_get_quic_time(cnx->quic));
                 }
             }
@@ -135,6 +136,23 @@ int picoquic_mark_high_priority_stream(picoquic_cnx_t * cnx, uint64_t stream_id,
     return 0;
 }
 
+int picoquic_set_stream_priority(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_t stream_priority)
+{
+    int ret = 0;
+    picoquic_stream_head_t* stream = picoquic_find_stream_for_writing(cnx, stream_id, &ret);
+
+    if (ret == 0 && stream->stream_priority != stream_priority) {
+        stream->stream_priority = stream_priority;
+        if (stream->is_output_stream && !stream->is_output_parked) {
+            /* Move the stream to the tail of its new urgency level */
+            picoquic_remove_output_stream(cnx, stream, NULL);
+            picoquic_insert_output_stream(cnx, stream);
+        }
+    }
+
+    return ret;
+}
+
 int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
     const uint8_t* data, size_t length, int set_fin, void * app_stream_ctx)
 {
@@ -174,6 +192,7 @@ int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
                 picoquic_stream_queue_node_t* next = stream->send_queue;
 
                 memcpy(stream_data->bytes, data, length);
+                picoquic_memory_charge(cnx, sizeof(picoquic_stream_queue_node_t) + length);
                 stream_data->length = length;
                 stream_data->offset = 0;
                 stream_data->next_stream_data = NULL;
@@ -194,6 +213,7 @@ int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
         cnx->nb_bytes_queued += length;
         stream->is_active = 0;
         stream->app_stream_ctx = app_stream_ctx;
+        picoquic_wake_output_stream(cnx, stream);
     }
 
     return ret;
@@ -267,6 +287,7 @@ int picoquic_reset_stream(picoquic_cnx_t* cnx,
         else if (!stream->reset_requested) {
             stream->local_error = local_stream_error;
             stream->reset_requested = 1;
+            picoquic_wake_output_stream(cnx, stream);
         }
     }
 
@@ -386,51 +407,6 @@ size_t picoquic_pad_to_policy(picoquic_cnx_t * cnx, uint8_t * bytes, size_t leng
 }
 
 
-/*
- * Packet management
- */
-
-picoquic_packet_t* picoquic_create_packet(picoquic_quic_t * quic)
-{
-    picoquic_packet_t* packet = quic->p_first_packet;
-    
-    if (packet == NULL) {
-        packet = (picoquic_packet_t*)malloc(sizeof(picoquic_packet_t));
-        if (packet != NULL) {
-            quic->nb_packets_allocated++;
-        }
-    }
-    else {
-        quic->p_first_packet = packet->next_packet;
-        quic->nb_packets_in_pool--;
-    }
-
-    if (packet != NULL) {
-        /* It might be sufficient to zero the metadata, but zeroing everything
-         * appears safer, and does not confuse checkers like valgrind.
-         */
-        memset(packet, 0, sizeof(picoquic_packet_t));
-    }
-
-    return packet;
-}
-
-void picoquic_recycle_packet(picoquic_quic_t * quic, picoquic_packet_t* packet)
-{
-    if (packet != NULL) {
-        if (quic->nb_packets_in_pool >= PICOQUIC_MAX_PACKETS_IN_POOL) {
-            free(packet);
-            quic->nb_packets_allocated--;
-        }
-        else {
-            memset(packet, 0, offsetof(struct st_picoquic_packet_t, bytes));
-            packet->next_packet = quic->p_first_packet;
-            quic->p_first_packet = packet;
-            quic->nb_packets_in_pool++;
-        }
-    }
-}
-
 void picoquic_update_payload_length(
     uint8_t* bytes, size_t pnum_index, size_t header_length, size_t packet_length)
 {
@@ -696,13 +672,104 @@ size_t picoquic_get_checksum_length(picoquic_cnx_t* cnx, picoquic_epoch_enum epo
     return ret;
 }
 
+/* Header protection of packet trains.
+ * When preparing a train of packets for GSO, the header protection of each
+ * packet is deferred until all the packets in the train are encrypted. The
+ * masks of packets protected with the same key are then computed in a single
+ * multi-block call of the block cipher, instead of one cipher call per packet.
+ * Only 1-RTT packets are deferred: the Initial and Handshake contexts can be
+ * freed while the train is being prepared, e.g., when the handshake completes.
+ */
+#define PICOQUIC_HP_BATCH_MAX 64
+
+typedef struct st_picoquic_hp_batch_packet_t {
+    void* pn_enc;
+    void* pn_ecb;
+    uint8_t* send_buffer;
+    size_t pn_offset;
+    uint8_t first_mask;
+} picoquic_hp_batch_packet_t;
+
+typedef struct st_picoquic_hp_batch_t {
+    size_t nb_packets;
+    picoquic_hp_batch_packet_t packet[PICOQUIC_HP_BATCH_MAX];
+    uint8_t samples[PICOQUIC_HP_BATCH_MAX * PICOQUIC_HP_SAMPLE_SIZE];
+    uint8_t masks[PICOQUIC_HP_BATCH_MAX * PICOQUIC_HP_SAMPLE_SIZE];
+} picoquic_hp_batch_t;
+
+static void picoquic_apply_header_protection(uint8_t* send_buffer, size_t pn_offset, uint8_t first_mask, const uint8_t* mask_bytes)
+{
+    /* Encode the first byte */
+    uint8_t pn_l = (send_buffer[0] & 3) + 1;
+    send_buffer[0] ^= (mask_bytes[0] & first_mask);
+
+    /* Packet encoding is 1 to 4 bytes */
+    for (uint8_t i = 0; i < pn_l; i++) {
+        send_buffer[pn_offset + i] ^= mask_bytes[i + 1];
+    }
+}
+
+static void picoquic_apply_header_protection_batch(picoquic_hp_batch_t* hp_batch)
+{
+    size_t first = 0;
+
+    while (first < hp_batch->nb_packets) {
+        /* Compute the masks of consecutive packets that use the same key in one call */
+        size_t last = first + 1;
+
+        while (last < hp_batch->nb_packets && hp_batch->packet[last].pn_enc == hp_batch->packet[first].pn_enc) {
+            last++;
+        }
+
+        picoquic_pn_encrypt_batch(hp_batch->packet[first].pn_enc, hp_batch->packet[first].pn_ecb,
+            hp_batch->samples + first * PICOQUIC_HP_SAMPLE_SIZE,
+            hp_batch->masks + first * PICOQUIC_HP_SAMPLE_SIZE, last - first);
+
+        for (size_t i = first; i < last; i++) {
+            picoquic_apply_header_protection(hp_batch->packet[i].send_buffer, hp_batch->packet[i].pn_offset,
+                hp_batch->packet[i].first_mask, hp_batch->masks + i * PICOQUIC_HP_SAMPLE_SIZE);
+        }
+        first = last;
+    }
+
+    hp_batch->nb_packets = 0;
+}
+
+static void picoquic_defer_header_protection(picoquic_hp_batch_t* hp_batch, void* pn_enc, void* pn_ecb,
+    uint8_t* send_buffer, size_t pn_offset, size_t sample_offset, uint8_t first_mask)
+{
+    picoquic_hp_batch_packet_t* hp_packet;
+
+    if (hp_batch->nb_packets >= PICOQUIC_HP_BATCH_MAX) {
+        picoquic_apply_header_protection_batch(hp_batch);
+    }
+    hp_packet = &hp_batch->packet[hp_batch->nb_packets];
+    hp_packet->pn_enc = pn_enc;
+    hp_packet->pn_ecb = pn_ecb;
+    hp_packet->send_buffer = send_buffer;
+    hp_packet->pn_offset = pn_offset;
+    hp_packet->first_mask = first_mask;
+    memcpy(hp_batch->samples + hp_batch->nb_packets * PICOQUIC_HP_SAMPLE_SIZE, send_buffer + sample_offset,
+        PICOQUIC_HP_SAMPLE_SIZE);
+    hp_batch->nb_packets++;
+}
+
+/* Protect a packet built in cleartext in "bytes", writing the encrypted packet
+ * in "send_buffer". The packet is not sealed in place in the send buffer: the
+ * cleartext of in flight packets is kept in the packet, because it is parsed
+ * again when the packet is acknowledged (picoquic_process_ack_of_frames) and
+ * when it is lost or probed (picoquic_copy_before_retransmit). Building the
+ * frames in the send buffer would then require copying them back to the packet
+ * before sealing, while the AEAD already reads the cleartext and writes the
+ * ciphertext to the send buffer in a single pass.
+ */
 static size_t picoquic_protect_packet(picoquic_cnx_t* cnx, 
     picoquic_packet_type_enum ptype,
     uint8_t * bytes, 
     uint64_t sequence_number,
     size_t length, size_t header_length,
     uint8_t* send_buffer, size_t send_buffer_max,
-    void * aead_context, void* pn_enc,
+    picoquic_crypto_context_t* crypto_context,
     picoquic_path_t* path_x, uint64_t current_time)
 {
     size_t send_length;
@@ -710,6 +777,7 @@ static size_t picoquic_protect_packet(picoquic_cnx_t* cnx,
     size_t pn_offset = 0;
     size_t sample_offset = 0;
     size_t pn_length = 0;
+    void* aead_context = crypto_context->aead_encrypt;
     size_t aead_checksum_length = picoquic_aead_get_checksum_length(aead_context);
     uint8_t first_mask = 0x0F;
 
@@ -784,17 +852,17 @@ static size_t picoquic_protect_packet(picoquic_cnx_t* cnx,
     if (pn_offset < sample_offset)
     {
         /* This is always true, as use pn_length = 4 */
-        uint8_t mask_bytes[5] = { 0, 0, 0, 0, 0 };
-        uint8_t pn_l;
-
-        picoquic_pn_encrypt(pn_enc, send_buffer + sample_offset, mask_bytes, mask_bytes, 5);
-        /* Encode the first byte */
-        pn_l = (send_buffer[0] & 3) + 1;
-        send_buffer[0] ^= (mask_bytes[0] & first_mask);
+        if (cnx->hp_batch != NULL && ptype == picoquic_packet_1rtt_protected &&
+            crypto_context->pn_enc_ecb != NULL) {
+            /* Part of a train: the mask will be computed with those of the other packets */
+            picoquic_defer_header_protection(cnx->hp_batch, crypto_context->pn_enc, crypto_context->pn_enc_ecb,
+                send_buffer, pn_offset, sample_offset, first_mask);
+        }
+        else {
+            uint8_t mask_bytes[5] = { 0, 0, 0, 0, 0 };
 
-        /* Packet encoding is 1 to 4 bytes */
-        for (uint8_t i = 0; i < pn_l; i++) {
-            send_buffer[pn_offset+i] ^= mask_bytes[i+1];
+            picoquic_pn_encrypt(crypto_context->pn_enc, send_buffer + sample_offset, mask_bytes, mask_bytes, 5);
+            picoquic_apply_header_protection(send_buffer, pn_offset, first_mask, mask_bytes);
         }
     }
 
@@ -972,6 +1040,87 @@ void picoquic_update_pacing_after_send(picoquic_path_t * path_x, uint64_t curren
     path_x->pacing_bucket_nanosec -= path_x->pacing_packet_time_nanosec;
 }
 
+/*
+ * Index of the retransmit queue by sequence number.
+ * Packets are queued in increasing sequence number order, so the queued
+ * numbers are all between the oldest and the newest packet. The index is
+ * a ring at least as large as that span, so that each queued packet has
+ * its own slot. When the span grows past the size of the ring, the ring
+ * is reallocated and filled again from the queue. If that allocation
+ * fails, the index is dropped and the lookups return NULL, in which case
+ * the callers fall back to walking the queue.
+ */
+static void picoquic_retransmit_index_add(picoquic_packet_context_t* pkt_ctx, picoquic_packet_t* packet)
+{
+    uint64_t span = packet->sequence_number - pkt_ctx->retransmit_oldest->sequence_number;
+
+    if (span >= pkt_ctx->retransmit_index_size) {
+        uint64_t new_size = (pkt_ctx->retransmit_index_size == 0) ? PICOQUIC_RETRANSMIT_INDEX_MIN : pkt_ctx->retransmit_index_size;
+        picoquic_packet_t** new_index;
+
+        while (new_size <= span) {
+            new_size *= 2;
+        }
+        new_index = (picoquic_packet_t**)malloc((size_t)new_size * sizeof(picoquic_packet_t*));
+        picoquic_retransmit_index_free(pkt_ctx);
+
+        if (new_index != NULL) {
+            picoquic_packet_t* p = pkt_ctx->retransmit_oldest;
+
+            memset(new_index, 0, (size_t)new_size * sizeof(picoquic_packet_t*));
+            pkt_ctx->retransmit_index = new_index;
+            pkt_ctx->retransmit_index_size = new_size;
+            while (p != NULL) {
+                new_index[p->sequence_number & (new_size - 1)] = p;
+                p = p->previous_packet;
+            }
+        }
+    }
+    else {
+        pkt_ctx->retransmit_index[packet->sequence_number & (pkt_ctx->retransmit_index_size - 1)] = packet;
+    }
+}
+
+static void picoquic_retransmit_index_remove(picoquic_packet_context_t* pkt_ctx, picoquic_packet_t* packet)
+{
+    if (pkt_ctx->retransmit_index != NULL) {
+        if (pkt_ctx->retransmit_newest == NULL && pkt_ctx->retransmit_index_size > PICOQUIC_RETRANSMIT_INDEX_MIN) {
+            /* Release the memory used by a large window once the queue is empty */
+            picoquic_retransmit_index_free(pkt_ctx);
+        }
+        else {
+            picoquic_packet_t** slot = &pkt_ctx->retransmit_index[packet->sequence_number & (pkt_ctx->retransmit_index_size - 1)];
+            if (*slot == packet) {
+                *slot = NULL;
+            }
+        }
+    }
+}
+
+/* Return the packet of the specified number if it is in the retransmit queue,
+ * or NULL if it is not or if the index is not available. */
+picoquic_packet_t* picoquic_retransmit_index_get(picoquic_packet_context_t* pkt_ctx, uint64_t sequence_number)
+{
+    picoquic_packet_t* p = NULL;
+
+    if (pkt_ctx->retransmit_index != NULL) {
+        p = pkt_ctx->retransmit_index[sequence_number & (pkt_ctx->retransmit_index_size - 1)];
+        if (p != NULL && p->sequence_number != sequence_number) {
+            p = NULL;
+        }
+    }
+    return p;
+}
+
+void picoquic_retransmit_index_free(picoquic_packet_context_t* pkt_ctx)
+{
+    if (pkt_ctx->retransmit_index != NULL) {
+        free(pkt_ctx->retransmit_index);
+        pkt_ctx->retransmit_index = NULL;
+    }
+    pkt_ctx->retransmit_index_size = 0;
+}
+
 /*
  * Final steps in packet transmission: queue for retransmission, etc
  */
@@ -998,6 +1147,11 @@ void picoquic_queue_for_retransmit(picoquic_cnx_t* cnx, picoquic_path_t * path_x
     }
     pkt_ctx->retransmit_newest = packet;
     packet->is_queued_for_retransmit = 1;
+    picoquic_retransmit_index_add(pkt_ctx, packet);
+    if (!packet->is_memory_charged) {
+        picoquic_memory_charge(cnx, sizeof(picoquic_packet_t));
+        packet->is_memory_charged = 1;
+    }
 
     /* Add at last position of packet per path list
      */
@@ -1012,6 +1166,46 @@ void picoquic_queue_for_retransmit(picoquic_cnx_t* cnx, picoquic_path_t * path_x
     }
 }
 
+/* Size of the memory charged for a packet, accounting for compact copies */
+static size_t picoquic_packet_charged_size(picoquic_packet_t* p)
+{
+    return (p->is_compacted) ? offsetof(struct st_picoquic_packet_t, bytes) + p->compact_length : sizeof(picoquic_packet_t);
+}
+
+/* Replace a lost packet by a compact copy before placing it in the retransmitted
+ * queue. The frames that needed repeating have already been copied to new
+ * packets or to the retransmission queues, and the packet is only kept to
+ * process late acknowledgements. The compact copy holds the metadata and the
+ * frames processed by picoquic_process_ack_of_frames, with stream frames
+ * reduced to descriptors. The packet is left as is if its frames cannot be
+ * parsed, or if the copy cannot be allocated. The packet must not be listed
+ * in any queue when this function is called.
+ */
+picoquic_packet_t* picoquic_compact_retransmitted_packet(picoquic_cnx_t* cnx, picoquic_packet_t* p)
+{
+    uint8_t compact[PICOQUIC_MAX_PACKET_SIZE];
+    size_t compact_length = 0;
+    picoquic_packet_t* compact_p = NULL;
+
+    if (!p->is_compacted && p->offset <= p->length &&
+        picoquic_compact_frames_for_ack(p->bytes + p->offset, p->length - p->offset,
+            compact, sizeof(compact), &compact_length) == 0 &&
+        compact_length < p->length &&
+        (compact_p = picoquic_create_compact_packet(p, compact, compact_length)) != NULL) {
+        compact_p->offset = 0;
+        compact_p->compact_length = compact_length;
+        compact_p->is_compacted = 1;
+        if (p->is_memory_charged) {
+            picoquic_memory_refund(cnx, sizeof(picoquic_packet_t));
+            picoquic_memory_charge(cnx, picoquic_packet_charged_size(compact_p));
+        }
+        picoquic_recycle_packet(cnx->quic, p);
+        p = compact_p;
+    }
+
+    return p;
+}
+
 picoquic_packet_t* picoquic_dequeue_retransmit_packet(picoquic_cnx_t* cnx, 
     picoquic_packet_context_t * pkt_ctx, picoquic_packet_t* p, int should_free)
 {
@@ -1033,6 +1227,7 @@ picoquic_packet_t* picoquic_dequeue_retransmit_packet(picoquic_cnx_t* cnx,
             p->next_packet->previous_packet = p->previous_packet;
         }
         p->is_queued_for_retransmit = 0;
+        picoquic_retransmit_index_remove(pkt_ctx, p);
     }
 
     /* Account for bytes in transit, for congestion control */
@@ -1051,10 +1246,14 @@ picoquic_packet_t* picoquic_dequeue_retransmit_packet(picoquic_cnx_t* cnx,
     picoquic_dequeue_packet_from_path(p);
 
     if (should_free || p->is_ack_trap) {
+        if (p->is_memory_charged) {
+            picoquic_memory_refund(cnx, picoquic_packet_charged_size(p));
+        }
         picoquic_recycle_packet(cnx->quic, p);
         p = NULL;
     }
     else {
+        p = picoquic_compact_retransmitted_packet(cnx, p);
         p->next_packet = NULL;
         /* add this packet to the retransmitted list */
         if (pkt_ctx->retransmitted_oldest == NULL) {
@@ -1099,6 +1298,9 @@ void picoquic_dequeue_retransmitted_packet(picoquic_cnx_t* cnx, picoquic_packet_
         p->previous_packet->next_packet = p->next_packet;
     }
 
+    if (p->is_memory_charged) {
+        picoquic_memory_refund(cnx, picoquic_packet_charged_size(p));
+    }
     picoquic_recycle_packet(cnx->quic, p);
 }
 
@@ -1176,32 +1378,32 @@ void picoquic_finalize_and_protect_packet(picoquic_cnx_t *cnx,
         case picoquic_packet_initial:
             length = picoquic_protect_packet(cnx, packet->ptype, packet->bytes, packet->sequence_number,
                 length, header_length,
-                send_buffer, send_buffer_max, cnx->crypto_context[picoquic_epoch_initial].aead_encrypt, cnx->crypto_context[picoquic_epoch_initial].pn_enc,
+                send_buffer, send_buffer_max, &cnx->crypto_context[picoquic_epoch_initial],
                 path_x, current_time);
             break;
         case picoquic_packet_handshake:
             length = picoquic_protect_packet(cnx, packet->ptype, packet->bytes, packet->sequence_number,
                 length, header_length,
-                send_buffer, send_buffer_max, cnx->crypto_context[picoquic_epoch_handshake].aead_encrypt, cnx->crypto_context[picoquic_epoch_handshake].pn_enc,
+                send_buffer, send_buffer_max, &cnx->crypto_context[picoquic_epoch_handshake],
                 path_x, current_time);
             break;
         case picoquic_packet_retry:
             length = picoquic_protect_packet(cnx, packet->ptype, packet->bytes, packet->sequence_number,
                 length, header_length,
-                send_buffer, send_buffer_max, cnx->crypto_context[picoquic_epoch_0rtt].aead_encrypt, cnx->crypto_context[picoquic_epoch_0rtt].pn_enc,
+                send_buffer, send_buffer_max, &cnx->crypto_context[picoquic_epoch_0rtt],
                 path_x, current_time);
             break;
         case picoquic_packet_0rtt_protected:
             length = picoquic_protect_packet(cnx, packet->ptype, packet->bytes, packet->sequence_number,
                 length, header_length,
-                send_buffer, send_buffer_max, cnx->crypto_context[picoquic_epoch_0rtt].aead_encrypt, cnx->crypto_context[picoquic_epoch_0rtt].pn_enc,
+                send_buffer, send_buffer_max, &cnx->crypto_context[picoquic_epoch_0rtt],
                 path_x, current_time);
             break;
         case picoquic_packet_1rtt_protected:
             /* TODO: if multipath, use 96 bit nonce */
             length = picoquic_protect_packet(cnx, packet->ptype, packet->bytes, packet->sequence_number,
                 length, header_length,
-                send_buffer, send_buffer_max, cnx->crypto_context[picoquic_epoch_1rtt].aead_encrypt, cnx->crypto_context[picoquic_epoch_1rtt].pn_enc,
+                send_buffer, send_buffer_max, &cnx->crypto_context[picoquic_epoch_1rtt],
                 path_x, current_time);
             break;
         default:
@@ -1378,6 +1580,7 @@ int picoquic_queue_stream_frame_for_retransmit(picoquic_cnx_t* cnx, uint8_t * by
         ret = PICOQUIC_ERROR_MEMORY;
     }
     else {
+        picoquic_memory_charge(cnx, sizeof(picoquic_misc_frame_header_t) + length);
         misc->next_misc_frame = NULL;
         if (cnx->stream_frame_retransmit_queue_last == NULL) {
             cnx->stream_frame_retransmit_queue = misc;
@@ -3758,6 +3961,7 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
     int more_data = 0;
     int ack_sent = 0;
     int is_challenge_padding_needed = 0;
+    int is_memory_constrained = 0;
     int is_nominal_ack_path = (cnx->is_multipath_enabled || cnx->is_simple_multipath_enabled) ?
         path_x->is_nominal_ack_path : path_x == cnx->path[0];
 
@@ -3928,13 +4132,16 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
                     ack_sent = (bytes_next > bytes_ack);
                 }
 
+                /* Credits are not extended while the connection is above its memory limits */
+                is_memory_constrained = picoquic_is_memory_constrained(cnx);
+
                 /* if necessary, prepare the MAX STREAM frames */
-                if (ret == 0) {
+                if (ret == 0 && !is_memory_constrained) {
                     bytes_next = picoquic_format_max_streams_frame_if_needed(cnx, bytes_next, bytes_max, &more_data, &is_pure_ack);
                 }
 
                 /* If necessary, encode the max data frame */
-                if (ret == 0) {
+                if (ret == 0 && !is_memory_constrained) {
                     if (cnx->is_flow_control_limited) {
                         if (cnx->data_received + (cnx->local_parameters.initial_max_data / 2) > cnx->maxdata_local) {
                             bytes_next = picoquic_format_max_data_frame(cnx, bytes_next, bytes_max, &more_data, &is_pure_ack,
@@ -3948,7 +4155,7 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
                 }
 
                 /* If necessary, encode the max stream data frames */
-                if (ret == 0 && cnx->max_stream_data_needed) {
+                if (ret == 0 && cnx->max_stream_data_needed && !is_memory_constrained) {
                     bytes_next = picoquic_format_required_max_stream_data_frames(cnx, bytes_next, bytes_max, &more_data, &is_pure_ack);
                 }
 
@@ -4640,9 +4847,21 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
     struct sockaddr_storage addr_from_log;
     uint64_t next_wake_time = cnx->latest_progress_time + 2*PICOQUIC_MICROSEC_SILENCE_MAX;
     uint64_t initial_next_time;
+    picoquic_hp_batch_t hp_batch;
 
     SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
 
+    if (cnx->tls_job != NULL) {
+        /* Collect the TLS job if it is complete. Otherwise, leave the connection
+         * to the worker thread and check again later. */
+        picoquic_tls_jobs_collect(cnx->quic, current_time);
+        if (cnx->tls_job != NULL) {
+            *send_length = 0;
+            picoquic_reinsert_by_wake_time(cnx->quic, cnx, current_time + PICOQUIC_TLS_JOB_POLL_INTERVAL);
+            return 0;
+        }
+    }
+
     if (cnx->recycle_sooner_needed) {
         picoquic_process_sooner_packets(cnx, current_time);
     }
@@ -4653,6 +4872,13 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
 
     ret = picoquic_check_idle_timer(cnx, &next_wake_time, current_time);
 
+    /* Shed the connection if it is above its own memory limit while the
+     * context is above the global limit */
+    if (ret == 0 && cnx->cnx_state < picoquic_state_disconnecting && picoquic_is_memory_shedding_needed(cnx)) {
+        picoquic_log_app_message(cnx, "Memory used %zu above limits, closing the connection", cnx->memory_used);
+        (void)picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_INTERNAL_ERROR, 0);
+    }
+
     if (send_buffer_max < PICOQUIC_ENFORCED_INITIAL_MTU) {
         DBG_PRINTF("Invalid buffer size: %zu", send_buffer_max);
         ret = -1;
@@ -4697,6 +4923,11 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
             cnx->is_sending_large_buffer = 1;
         }
 
+        if (send_msg_size != NULL) {
+            hp_batch.nb_packets = 0;
+            cnx->hp_batch = &hp_batch;
+        }
+
         while (ret == 0)
         {
             /* Create a new packet, which may include several segments */
@@ -4833,6 +5064,11 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
                 break;
             }
         }
+        if (cnx->hp_batch != NULL) {
+            /* Protect the headers of all the packets in the train before they leave */
+            picoquic_apply_header_protection_batch(cnx->hp_batch);
+            cnx->hp_batch = NULL;
+        }
         if (*send_length > 0) {
             cnx->nb_trains_sent++;
         }
@@ -4898,7 +5134,13 @@ int picoquic_prepare_next_packet_ex(picoquic_quic_t* quic,
     picoquic_connection_id_t * log_cid, picoquic_cnx_t** p_last_cnx, size_t * send_msg_size)
 {
     int ret = 0;
-    picoquic_stateless_packet_t* sp = picoquic_dequeue_stateless_packet(quic);
+    picoquic_stateless_packet_t* sp;
+
+    if (quic->nb_tls_jobs > 0) {
+        picoquic_tls_jobs_collect(quic, current_time);
+    }
+
+    sp = picoquic_dequeue_stateless_packet(quic);
 
     if (p_last_cnx) {
         *p_last_cnx = NULL;
@@ -4947,7 +5189,8 @@ int picoquic_prepare_next_packet_ex(picoquic_quic_t* quic,
                     fflush(quic->F_log);
                 }
 
-                if (cnx->f_binlog != NULL) {
+                if (cnx->f_binlog != NULL && quic->binlog_writer == NULL) {
+                    /* With a writer thread, the file is only accessed by that thread */
                     fflush(cnx->f_binlog);
                 }
 
@@ -4982,3 +5225,91 @@ int picoquic_prepare_next_packet(picoquic_quic_t* quic,
     return picoquic_prepare_next_packet_ex(quic, current_time, send_buffer, send_buffer_max, send_length,
         p_addr_to, p_addr_from, if_index, log_cid, p_last_cnx, NULL);
 }
+
+/* Batch version of picoquic_prepare_next_packet_ex.
+ * Trains are prepared back to back in the send buffer until the batch is full,
+ * the buffer is exhausted, or no connection is ready to send. A connection that
+ * has nothing to send does not end the batch: the next connection in the wake
+ * list is polled instead, so a single call serves all the connections that
+ * are due. If use_gso is not set, each train is split into individual
+ * datagrams, and the size of the trains is bounded so that all the datagrams
+ * fit in the remaining entries.
+ */
+int picoquic_prepare_next_packet_batch(picoquic_quic_t* quic, uint64_t current_time,
+    uint8_t* send_buffer, size_t send_buffer_max, picoquic_prepared_packet_t* packets,
+    size_t nb_packets_max, size_t* nb_packets, int use_gso)
+{
+    int ret = 0;
+    size_t used = 0;
+    size_t nb_empty = 0;
+
+    *nb_packets = 0;
+
+    while (ret == 0 && *nb_packets < nb_packets_max && nb_empty < nb_packets_max) {
+        picoquic_prepared_packet_t* pp = &packets[*nb_packets];
+        size_t train_max = send_buffer_max - used;
+        size_t send_length = 0;
+        size_t send_msg_size = 0;
+
+        if (!use_gso && train_max > (nb_packets_max - *nb_packets) * PICOQUIC_ENFORCED_INITIAL_MTU) {
+            train_max = (nb_packets_max - *nb_packets) * PICOQUIC_ENFORCED_INITIAL_MTU;
+        }
+        if (train_max < PICOQUIC_ENFORCED_INITIAL_MTU) {
+            break;
+        }
+
+        pp->if_index = 0;
+        ret = picoquic_prepare_next_packet_ex(quic, current_time, send_buffer + used, train_max, &send_length,
+            &pp->addr_to, &pp->addr_from, &pp->if_index, &pp->log_cid, &pp->cnx, &send_msg_size);
+
+        if (ret != 0) {
+            break;
+        }
+        else if (send_length == 0) {
+            picoquic_cnx_t* next_cnx = picoquic_get_earliest_cnx_to_wake(quic, current_time);
+
+            if (next_cnx == NULL || next_cnx == pp->cnx) {
+                /* Nothing else is due at this time */
+                break;
+            }
+            nb_empty++;
+        }
+        else if (use_gso || send_msg_size == 0 || send_length <= send_msg_size) {
+            pp->bytes = send_buffer + used;
+            pp->length = send_length;
+            pp->send_msg_size = (send_length > send_msg_size) ? send_msg_size : 0;
+            used += send_length;
+            *nb_packets += 1;
+        }
+        else {
+            /* Split the train in datagrams that share the addresses of the first one */
+            size_t consumed = 0;
+            picoquic_prepared_packet_t* first = pp;
+
+            while (consumed < send_length) {
+                pp = &packets[*nb_packets];
+                if (pp != first) {
+                    *pp = *first;
+                }
+                pp->bytes = send_buffer + used + consumed;
+                pp->length = send_length - consumed;
+                pp->send_msg_size = 0;
+                if (pp->length > send_msg_size) {
+                    if (*nb_packets + 1 < nb_packets_max) {
+                        pp->length = send_msg_size;
+                    }
+                    else {
+                        /* Should not happen, since the train size is bounded. Leave the
+                         * rest of the train in the last entry. */
+                        pp->send_msg_size = send_msg_size;
+                    }
+                }
+                consumed += pp->length;
+                *nb_packets += 1;
+            }
+            used += send_length;
+        }
+    }
+
+    return ret;
+}
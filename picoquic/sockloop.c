@@ -59,6 +59,14 @@
 
 #else /* Linux */
 
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -98,6 +106,8 @@
 #include "picoquic_internal.h"
 #include "picoquic_packet_loop.h"
 #include "picoquic_unified_log.h"
+#include "picoquic_utils.h"
+#include "picoquic_lb.h"
 
 #if defined(_WINDOWS)
 static int udp_gso_available = 0;
@@ -109,12 +119,12 @@ static int udp_gso_available = 0;
 #endif
 #endif
 
-int picoquic_packet_loop_open_sockets(int local_port, int local_af, SOCKET_TYPE * s_socket, int * sock_af, 
-    uint16_t * sock_ports, int socket_buffer_size, int nb_sockets_max)
+int picoquic_packet_loop_open_sockets_ex(int local_port, int local_af, SOCKET_TYPE * s_socket, int * sock_af, 
+    uint16_t * sock_ports, int socket_buffer_size, int nb_sockets_max, int reuse_port)
 {
     const char* congestion_control = getenv("CONGESTION_CONTROL");
     int nb_sockets = (local_af == AF_UNSPEC) ? 2 : 1;
-    if (strstr(congestion_control, "tonopah") && local_port == 4433) {
+    if (congestion_control != NULL && strstr(congestion_control, "tonopah") && local_port == 4433) {
         puts("Doubling sockets");
         nb_sockets *= 2;
     }
@@ -151,6 +161,7 @@ int picoquic_packet_loop_open_sockets(int local_port, int local_af, SOCKET_TYPE
         if ((s_socket[i] = socket(sock_af[i], SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET ||
             picoquic_socket_set_ecn_options(s_socket[i], sock_af[i], &recv_set, &send_set) != 0 ||
             picoquic_socket_set_pkt_info(s_socket[i], sock_af[i]) != 0 ||
+            (reuse_port && picoquic_socket_set_reuse_port(s_socket[i]) != 0) ||
             picoquic_bind_to_port(s_socket[i], sock_af[i], local_port) != 0 ||
             picoquic_get_local_address(s_socket[i], &local_address) != 0)
         {
@@ -165,6 +176,9 @@ int picoquic_packet_loop_open_sockets(int local_port, int local_af, SOCKET_TYPE
             break;
         }
         else {
+            /* Kernel receive time stamps are optional. If not available, the loop uses the time of reading */
+            (void)picoquic_socket_set_timestamp_options(s_socket[i]);
+
             if (local_address.ss_family == AF_INET6) {
                 sock_ports[i] = ntohs(((struct sockaddr_in6*)&local_address)->sin6_port);
             }
@@ -211,17 +225,407 @@ int picoquic_packet_loop_open_sockets(int local_port, int local_af, SOCKET_TYPE
     return nb_sockets;
 }
 
-int picoquic_packet_loop(picoquic_quic_t* quic,
+int picoquic_packet_loop_open_sockets(int local_port, int local_af, SOCKET_TYPE * s_socket, int * sock_af,
+    uint16_t * sock_ports, int socket_buffer_size, int nb_sockets_max)
+{
+    return picoquic_packet_loop_open_sockets_ex(local_port, local_af, s_socket, sock_af,
+        sock_ports, socket_buffer_size, nb_sockets_max, 0);
+}
+
+/* Wake up sockets are UDP sockets bound to the loopback address. A thread polls
+ * its wake up socket together with the regular sockets, and other threads wake
+ * it up by sending a one byte datagram to it. Pending datagrams are kept by the
+ * socket, so wake up signals are never lost.
+ */
+static int picoquic_packet_loop_open_wake_socket(SOCKET_TYPE* wake_socket, struct sockaddr_storage* wake_addr)
+{
+    int ret = 0;
+    struct sockaddr_in* a4 = (struct sockaddr_in*)wake_addr;
+
+    memset(wake_addr, 0, sizeof(struct sockaddr_storage));
+    a4->sin_family = AF_INET;
+    a4->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    a4->sin_port = 0;
+
+    if ((*wake_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET ||
+        bind(*wake_socket, (struct sockaddr*)a4, sizeof(struct sockaddr_in)) != 0 ||
+        picoquic_get_local_address(*wake_socket, wake_addr) != 0) {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+
+    return ret;
+}
+
+static void picoquic_packet_loop_wake(SOCKET_TYPE wake_socket, struct sockaddr_storage* target_addr)
+{
+    uint8_t wake_byte = 0;
+
+    (void)sendto(wake_socket, (const char*)&wake_byte, 1, 0,
+        (struct sockaddr*)target_addr, sizeof(struct sockaddr_in));
+}
+
+/* Find the socket matching the address family and the local port of an outgoing packet */
+static SOCKET_TYPE picoquic_packet_loop_get_send_socket(SOCKET_TYPE* s_socket, int* sock_af, uint16_t* sock_ports,
+    int nb_sockets, struct sockaddr_storage* peer_addr, struct sockaddr_storage* local_addr)
+{
+    for (int i = 0; i < nb_sockets; i++) {
+        if (sock_af[i] == peer_addr->ss_family && (nb_sockets != 4 || (((struct sockaddr_in*)local_addr)->sin_port == sock_ports[i]))) {
+            return s_socket[i];
+        }
+    }
+    printf("Didn't find match with %d sockets, local_addr_in4->sin_port: %hu\n", nb_sockets, ((struct sockaddr_in*)local_addr)->sin_port);
+
+    return s_socket[0];
+}
+
+/* Send a coalesced buffer packet by packet, after the sendmsg with UDP GSO failed.
+ * Returns the result of the last call to sendmsg, and the index reached in the buffer.
+ */
+static int picoquic_packet_loop_send_by_chunks(SOCKET_TYPE send_socket, struct sockaddr_storage* peer_addr,
+    struct sockaddr_storage* local_addr, int if_index, const uint8_t* send_buffer, size_t send_length,
+    size_t send_msg_size, size_t* packet_index, int* sock_err)
+{
+    int sock_ret = 0;
+    size_t packet_size = send_msg_size;
+
+    *packet_index = 0;
+    while (*packet_index < send_length) {
+        if (*packet_index + packet_size > send_length) {
+            packet_size = send_length - *packet_index;
+        }
+        sock_ret = picoquic_sendmsg(send_socket,
+            (struct sockaddr*)peer_addr, (struct sockaddr*)local_addr, if_index,
+            (const char*)(send_buffer + *packet_index), (int)packet_size, 0, sock_err);
+        if (sock_ret > 0) {
+            *packet_index += packet_size;
+        }
+        else {
+            break;
+        }
+    }
+
+    return sock_ret;
+}
+
+/* Multi-threaded server support.
+ *
+ * Each worker thread runs its own instance of the packet loop, with its own QUIC
+ * context and its own set of sockets, all bound to the same port using SO_REUSEPORT.
+ * The kernel spreads incoming flows between workers based on the address tuple, so
+ * the Initial packets of a connection all arrive at the same worker, which creates
+ * the connection. The CID chosen by the worker encode the worker ID, using the
+ * "server ID" of the load balancer CID encoding. If the client address changes,
+ * for example after a NAT rebinding, the packets may arrive at a different worker.
+ * That worker decodes the server ID from the destination CID and forwards the packet
+ * to the owner through a single producer, single consumer queue. There is one queue
+ * per ordered pair of workers, so the queues do not need locks.
+ *
+ * The owner is woken up by a one byte datagram sent to its "wake" socket, a UDP
+ * socket bound to the loopback address and polled together with the regular
+ * sockets. The wake up is only sent when the queue was empty, since otherwise
+ * the owner will find the new packet when it empties the queue, so a burst of
+ * forwarded packets costs a single wake up. The wake socket is polled before the
+ * regular sockets, so a busy regular socket cannot delay the forwarded packets.
+ * Forwarding is expected to be rare, so the forwarded packets are simply
+ * allocated by the sender and freed by the receiver.
+ */
+#define PICOQUIC_PACKET_LOOP_FORWARD_QUEUE_SIZE 256
+
+typedef struct st_picoquic_packet_loop_forwarded_t {
+    struct sockaddr_storage addr_from;
+    struct sockaddr_storage addr_to;
+    int if_index_to;
+    unsigned char received_ecn;
+    uint64_t receive_time;
+    size_t length;
+    uint8_t bytes[PICOQUIC_MAX_PACKET_SIZE];
+} picoquic_packet_loop_forwarded_t;
+
+typedef struct st_picoquic_packet_loop_worker_t {
+    struct st_picoquic_packet_loop_mt_ctx_t* mt_ctx;
+    int worker_id;
+    picoquic_quic_t* quic;
+    void* loop_callback_ctx;
+    picoquic_thread_t thread;
+    int thread_started;
+    SOCKET_TYPE wake_socket;
+    struct sockaddr_storage wake_addr;
+    int loop_ret;
+} picoquic_packet_loop_worker_t;
+
+typedef struct st_picoquic_packet_loop_mt_ctx_t {
+    picoquic_packet_loop_mt_param_t* param;
+    picoquic_packet_loop_cb_fn loop_callback;
+    picoquic_packet_loop_worker_t* workers;
+    picoquic_spsc_queue_t* queues; /* queue from i to j at rank i*nb_workers + j */
+    volatile int is_stopping;
+} picoquic_packet_loop_mt_ctx_t;
+
+static void picoquic_packet_loop_worker_wake(picoquic_packet_loop_worker_t* worker, picoquic_packet_loop_worker_t* target)
+{
+    picoquic_packet_loop_wake(worker->wake_socket, &target->wake_addr);
+}
+
+/* Check whether an incoming packet belongs to another worker, and if it does
+ * queue it to that worker. Returns 0 if the packet was consumed, either queued
+ * or dropped because the queue is full, -1 if it shall be processed locally.
+ */
+static int picoquic_packet_loop_worker_forward(picoquic_packet_loop_worker_t* worker, picoquic_quic_t* quic,
+    uint8_t* bytes, size_t length, struct sockaddr_storage* addr_from, struct sockaddr_storage* addr_to,
+    int if_index_to, unsigned char received_ecn, uint64_t receive_time)
+{
+    int ret = -1;
+    picoquic_packet_loop_mt_ctx_t* mt_ctx = worker->mt_ctx;
+    int nb_workers = mt_ctx->param->nb_workers;
+    uint64_t owner = picoquic_lb_compat_packet_server_id(quic, bytes, length);
+
+    if (owner < (uint64_t)nb_workers && owner != (uint64_t)worker->worker_id &&
+        length <= PICOQUIC_MAX_PACKET_SIZE) {
+        picoquic_packet_loop_forwarded_t* fwd = (picoquic_packet_loop_forwarded_t*)malloc(sizeof(picoquic_packet_loop_forwarded_t));
+
+        ret = 0;
+        if (fwd != NULL) {
+            int was_empty = 0;
+
+            picoquic_store_addr(&fwd->addr_from, (struct sockaddr*)addr_from);
+            picoquic_store_addr(&fwd->addr_to, (struct sockaddr*)addr_to);
+            fwd->if_index_to = if_index_to;
+            fwd->received_ecn = received_ecn;
+            fwd->receive_time = receive_time;
+            fwd->length = length;
+            memcpy(fwd->bytes, bytes, length);
+            if (picoquic_spsc_queue_push_ex(&mt_ctx->queues[worker->worker_id * nb_workers + (int)owner], fwd, &was_empty) != 0) {
+                /* Queue is full, drop the packet and let the peer repeat it */
+                free(fwd);
+            }
+            else if (was_empty) {
+                picoquic_packet_loop_worker_wake(worker, &mt_ctx->workers[owner]);
+            }
+        }
+    }
+
+    return ret;
+}
+
+/* Process the packets forwarded by other workers. Returns -1 if the workers are stopping */
+static int picoquic_packet_loop_worker_poll(picoquic_packet_loop_worker_t* worker, picoquic_quic_t* quic,
+    picoquic_cnx_t** last_cnx, uint64_t current_time)
+{
+    picoquic_packet_loop_mt_ctx_t* mt_ctx = worker->mt_ctx;
+    int nb_workers = mt_ctx->param->nb_workers;
+
+    for (int i = 0; i < nb_workers; i++) {
+        picoquic_spsc_queue_t* queue = &mt_ctx->queues[i * nb_workers + worker->worker_id];
+
+        if (i == worker->worker_id) {
+            continue;
+        }
+        do {
+            picoquic_packet_loop_forwarded_t* fwd;
+
+            while ((fwd = (picoquic_packet_loop_forwarded_t*)picoquic_spsc_queue_pop(queue)) != NULL) {
+                (void)picoquic_incoming_packet_ex2(quic, fwd->bytes, fwd->length,
+                    (struct sockaddr*)&fwd->addr_from, (struct sockaddr*)&fwd->addr_to,
+                    fwd->if_index_to, fwd->received_ecn, last_cnx, current_time, fwd->receive_time);
+                free(fwd);
+            }
+            /* Producers do not wake up the worker for packets queued while the queue is not empty */
+        } while (!picoquic_spsc_queue_is_drained(queue));
+    }
+
+    return (mt_ctx->is_stopping) ? -1 : 0;
+}
+
+static int picoquic_packet_loop_worker(picoquic_quic_t* quic,
     int local_port,
     int local_af,
     int dest_if,
     int socket_buffer_size,
     int do_not_use_gso,
     picoquic_packet_loop_cb_fn loop_callback,
-    void* loop_callback_ctx)
+    void* loop_callback_ctx,
+    picoquic_packet_loop_worker_t* worker);
+
+static picoquic_thread_return_t picoquic_packet_loop_worker_thread(void* v_worker)
+{
+    picoquic_packet_loop_worker_t* worker = (picoquic_packet_loop_worker_t*)v_worker;
+    picoquic_packet_loop_mt_ctx_t* mt_ctx = worker->mt_ctx;
+    picoquic_packet_loop_mt_param_t* param = mt_ctx->param;
+
+#ifdef __linux__
+    if (param->do_pin_threads) {
+        cpu_set_t cpu_set;
+        long nb_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (nb_cpu > 0) {
+            CPU_ZERO(&cpu_set);
+            CPU_SET((int)(worker->worker_id % nb_cpu), &cpu_set);
+            if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set) != 0) {
+                DBG_PRINTF("Cannot pin worker %d to CPU %d", worker->worker_id, (int)(worker->worker_id % nb_cpu));
+            }
+        }
+    }
+#endif
+
+    worker->loop_ret = picoquic_packet_loop_worker(worker->quic, param->local_port, param->local_af, param->dest_if,
+        param->socket_buffer_size, param->do_not_use_gso, mt_ctx->loop_callback, worker->loop_callback_ctx, worker);
+
+    /* When one worker stops, all workers stop */
+    mt_ctx->is_stopping = 1;
+    for (int i = 0; i < param->nb_workers; i++) {
+        if (i != worker->worker_id) {
+            picoquic_packet_loop_worker_wake(worker, &mt_ctx->workers[i]);
+        }
+    }
+
+    picoquic_thread_do_return;
+}
+
+static int picoquic_packet_loop_worker_open_wake_socket(picoquic_packet_loop_worker_t* worker)
+{
+    int ret = picoquic_packet_loop_open_wake_socket(&worker->wake_socket, &worker->wake_addr);
+
+    if (ret != 0) {
+        DBG_PRINTF("Cannot open the wake up socket of worker %d", worker->worker_id);
+    }
+
+    return ret;
+}
+
+int picoquic_packet_loop_mt(picoquic_packet_loop_mt_param_t* param,
+    picoquic_quic_t** worker_quic,
+    picoquic_packet_loop_cb_fn loop_callback,
+    void** loop_callback_ctx)
+{
+    int ret = 0;
+    int nb_workers = param->nb_workers;
+    int nb_queues = 0;
+    picoquic_packet_loop_mt_ctx_t mt_ctx;
+    picoquic_load_balancer_config_t lb_config;
+#ifdef _WINDOWS
+    WSADATA wsaData = { 0 };
+    (void)WSA_START(MAKEWORD(2, 2), &wsaData);
+#endif
+
+    memset(&mt_ctx, 0, sizeof(mt_ctx));
+    mt_ctx.param = param;
+    mt_ctx.loop_callback = loop_callback;
+
+    if (param->lb_config.server_id_length == 0) {
+        /* Default to clear text encoding of a one byte worker ID */
+        memset(&lb_config, 0, sizeof(lb_config));
+        lb_config.method = picoquic_load_balancer_cid_clear;
+        lb_config.server_id_length = 1;
+        lb_config.connection_id_length = 8;
+    }
+    else {
+        lb_config = param->lb_config;
+    }
+
+#ifndef SO_REUSEPORT
+    DBG_PRINTF("%s", "Cannot run multiple workers, SO_REUSEPORT is not supported");
+    ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+#endif
+
+    if (ret == 0 && (nb_workers <= 0 || worker_quic == NULL)) {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+    else if (ret == 0) {
+        nb_queues = nb_workers * nb_workers;
+        mt_ctx.workers = (picoquic_packet_loop_worker_t*)malloc(nb_workers * sizeof(picoquic_packet_loop_worker_t));
+        mt_ctx.queues = (picoquic_spsc_queue_t*)malloc(nb_queues * sizeof(picoquic_spsc_queue_t));
+        if (mt_ctx.workers == NULL || mt_ctx.queues == NULL) {
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+        else {
+            memset(mt_ctx.workers, 0, nb_workers * sizeof(picoquic_packet_loop_worker_t));
+            memset(mt_ctx.queues, 0, nb_queues * sizeof(picoquic_spsc_queue_t));
+            for (int i = 0; i < nb_workers; i++) {
+                mt_ctx.workers[i].wake_socket = INVALID_SOCKET;
+            }
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < nb_queues; i++) {
+        if (i / nb_workers != i % nb_workers) {
+            ret = picoquic_spsc_queue_init(&mt_ctx.queues[i], PICOQUIC_PACKET_LOOP_FORWARD_QUEUE_SIZE);
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < nb_workers; i++) {
+        picoquic_packet_loop_worker_t* worker = &mt_ctx.workers[i];
+
+        worker->mt_ctx = &mt_ctx;
+        worker->worker_id = i;
+        worker->quic = worker_quic[i];
+        worker->loop_callback_ctx = (loop_callback_ctx == NULL) ? NULL : loop_callback_ctx[i];
+        lb_config.server_id64 = (uint64_t)i;
+        if ((ret = picoquic_lb_compat_cid_config(worker->quic, &lb_config)) != 0) {
+            DBG_PRINTF("Cannot configure the CID encoding of worker %d", i);
+        }
+        else {
+            ret = picoquic_packet_loop_worker_open_wake_socket(worker);
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < nb_workers; i++) {
+        if ((ret = picoquic_create_thread(&mt_ctx.workers[i].thread, picoquic_packet_loop_worker_thread, &mt_ctx.workers[i])) == 0) {
+            mt_ctx.workers[i].thread_started = 1;
+        }
+        else {
+            DBG_PRINTF("Cannot start worker thread %d, ret = %d", i, ret);
+            mt_ctx.is_stopping = 1;
+        }
+    }
+
+    if (mt_ctx.workers != NULL) {
+        for (int i = 0; i < nb_workers; i++) {
+            picoquic_packet_loop_worker_t* worker = &mt_ctx.workers[i];
+
+            if (worker->thread_started) {
+                picoquic_delete_thread(&worker->thread);
+                if (ret == 0) {
+                    ret = worker->loop_ret;
+                }
+            }
+            if (worker->wake_socket != INVALID_SOCKET) {
+                SOCKET_CLOSE(worker->wake_socket);
+            }
+            if (worker->quic != NULL) {
+                picoquic_lb_compat_cid_config_free(worker->quic);
+            }
+        }
+        free(mt_ctx.workers);
+    }
+
+    if (mt_ctx.queues != NULL) {
+        for (int i = 0; i < nb_queues; i++) {
+            picoquic_packet_loop_forwarded_t* fwd;
+            while (mt_ctx.queues[i].items != NULL &&
+                (fwd = (picoquic_packet_loop_forwarded_t*)picoquic_spsc_queue_pop(&mt_ctx.queues[i])) != NULL) {
+                free(fwd);
+            }
+            picoquic_spsc_queue_release(&mt_ctx.queues[i]);
+        }
+        free(mt_ctx.queues);
+    }
+
+    return ret;
+}
+
+static int picoquic_packet_loop_worker(picoquic_quic_t* quic,
+    int local_port,
+    int local_af,
+    int dest_if,
+    int socket_buffer_size,
+    int do_not_use_gso,
+    picoquic_packet_loop_cb_fn loop_callback,
+    void* loop_callback_ctx,
+    picoquic_packet_loop_worker_t* worker)
 {
     int ret = 0;
     uint64_t current_time = picoquic_get_quic_time(quic);
+    uint64_t receive_time = 0;
     int64_t delay_max = 10000000;
     struct sockaddr_storage addr_from;
     struct sockaddr_storage addr_to;
@@ -235,6 +639,7 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
     int bytes_recv;
     picoquic_connection_id_t log_cid;
     SOCKET_TYPE s_socket[PICOQUIC_PACKET_LOOP_SOCKETS_MAX];
+    SOCKET_TYPE s_select[PICOQUIC_PACKET_LOOP_SOCKETS_MAX + 1];
     int sock_af[PICOQUIC_PACKET_LOOP_SOCKETS_MAX];
     uint16_t sock_ports[PICOQUIC_PACKET_LOOP_SOCKETS_MAX];
     int nb_sockets = 0;
@@ -250,8 +655,8 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
     memset(sock_af, 0, sizeof(sock_af));
     memset(sock_ports, 0, sizeof(sock_ports));
 
-    if ((nb_sockets = picoquic_packet_loop_open_sockets(local_port, local_af, s_socket, sock_af, 
-        sock_ports, socket_buffer_size, PICOQUIC_PACKET_LOOP_SOCKETS_MAX)) == 0) {
+    if ((nb_sockets = picoquic_packet_loop_open_sockets_ex(local_port, local_af, s_socket, sock_af, 
+        sock_ports, socket_buffer_size, PICOQUIC_PACKET_LOOP_SOCKETS_MAX, worker != NULL)) == 0) {
         ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
     }
     else if (loop_callback != NULL) {
@@ -297,20 +702,69 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
         }
         loop_immediate = 0;
 
-        bytes_recv = picoquic_select_ex(s_socket, nb_sockets,
-            &addr_from,
-            &addr_to, &if_index_to, &received_ecn,
-            buffer, sizeof(buffer),
-            delta_t, &socket_rank, &current_time);
+        /* Workers also listen to their wake up socket, placed before the regular sockets */
+        if (worker != NULL) {
+            s_select[0] = worker->wake_socket;
+            memcpy(s_select + 1, s_socket, nb_sockets * sizeof(SOCKET_TYPE));
+        }
+        else {
+            memcpy(s_select, s_socket, nb_sockets * sizeof(SOCKET_TYPE));
+        }
+
+        if (options.busy_poll_delay > 0 && delta_t > 0 && delta_t <= options.busy_poll_delay) {
+            /* Short wait: spin on non blocking receive checks until the wake time */
+            uint64_t wait_start = picoquic_current_time();
+            uint64_t wake_time = wait_start + delta_t;
+
+            do {
+                bytes_recv = picoquic_select_nowait(s_select, nb_sockets + ((worker != NULL) ? 1 : 0),
+                    &addr_from,
+                    &addr_to, &if_index_to, &received_ecn,
+                    buffer, sizeof(buffer),
+                    &socket_rank, &current_time, &receive_time);
+            } while (bytes_recv == 0 && current_time < wake_time);
+
+            if (options.wait_stats != NULL) {
+                options.wait_stats->nb_spin_waits++;
+                options.wait_stats->spin_time += (current_time > wait_start) ? current_time - wait_start : 0;
+            }
+        }
+        else {
+            uint64_t wait_start = picoquic_current_time();
+
+            bytes_recv = picoquic_select_ex2(s_select, nb_sockets + ((worker != NULL) ? 1 : 0),
+                &addr_from,
+                &addr_to, &if_index_to, &received_ecn,
+                buffer, sizeof(buffer),
+                delta_t, &socket_rank, &current_time, &receive_time);
+
+            if (options.wait_stats != NULL && delta_t > 0) {
+                options.wait_stats->nb_sleep_waits++;
+                options.wait_stats->sleep_time += (current_time > wait_start) ? current_time - wait_start : 0;
+            }
+        }
         if (bytes_recv < 0) {
             ret = -1;
         }
+        else if (worker != NULL && picoquic_packet_loop_worker_poll(worker, quic, &last_cnx, current_time) != 0) {
+            ret = PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP;
+        }
+        else if (worker != NULL && bytes_recv > 0 && socket_rank == 0) {
+            /* Wake up signal. The forwarded packets were just processed, check whether there is more */
+            loop_immediate = 1;
+            continue;
+        }
         else {
             uint64_t loop_time = current_time;
 
             if (bytes_recv > 0) {
                 uint16_t current_recv_port = 0;
 
+                if (worker != NULL) {
+                    /* Skip the wake up socket */
+                    socket_rank--;
+                }
+
                 if (testing_migration && socket_rank == 0) {
                     current_recv_port = next_port;
                 } else {
@@ -323,11 +777,17 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
                 else if (addr_to.ss_family == AF_INET) {
                     ((struct sockaddr_in*) & addr_to)->sin_port = current_recv_port;
                 }
+                if (worker != NULL && picoquic_packet_loop_worker_forward(worker, quic, buffer, (size_t)bytes_recv,
+                    &addr_from, &addr_to, if_index_to, received_ecn, receive_time) == 0) {
+                    /* The packet belongs to a connection owned by another worker */
+                    loop_immediate = 1;
+                    continue;
+                }
                 /* Submit the packet to the server */
-                (void)picoquic_incoming_packet_ex(quic, buffer,
+                (void)picoquic_incoming_packet_ex2(quic, buffer,
                     (size_t)bytes_recv, (struct sockaddr*) & addr_from,
                     (struct sockaddr*) & addr_to, if_index_to, received_ecn,
-                    &last_cnx, current_time);
+                    &last_cnx, current_time, receive_time);
 
                 if (loop_callback != NULL) {
                     size_t b_recvd = (size_t)bytes_recv;
@@ -354,22 +814,10 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
                         send_msg_ptr);
 
                     if (ret == 0 && send_length > 0) {
-                        SOCKET_TYPE send_socket = INVALID_SOCKET;
+                        SOCKET_TYPE send_socket = picoquic_packet_loop_get_send_socket(s_socket, sock_af, sock_ports,
+                            nb_sockets, &peer_addr, &local_addr);
                         bytes_sent += send_length;
 
-                        int found_match = 0;
-                        for (int i = 0; i < nb_sockets; i++) {
-                            if (sock_af[i] == peer_addr.ss_family && (nb_sockets != 4 || (((struct sockaddr_in*) & local_addr)->sin_port == sock_ports[i]))) {
-                                found_match = 1;
-                                send_socket = s_socket[i];
-                                break;
-                            }
-                        }
-                        if (!found_match) {
-                            printf("Didn't find match with %d sockets, local_addr_in4->sin_port: %hu\n", nb_sockets, ((struct sockaddr_in*) & addr_to)->sin_port);
-                            send_socket = s_socket[0];
-                        }
-
                         if (send_socket == INVALID_SOCKET) {
                             sock_ret = -1;
                             sock_err = -1;
@@ -407,25 +855,14 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
                                 }
                                 else if (sock_err == EIO) {
                                     size_t packet_index = 0;
-                                    size_t packet_size = send_msg_size;
-
-                                    while (packet_index < send_length) {
-                                        if (packet_index + packet_size > send_length) {
-                                            packet_size = send_length - packet_index;
-                                        }
-                                        sock_ret = picoquic_sendmsg(send_socket,
-                                            (struct sockaddr*)&peer_addr, (struct sockaddr*)&local_addr, if_index,
-                                            (const char*)(send_buffer + packet_index), (int)packet_size, 0, &sock_err);
-                                        if (sock_ret > 0) {
-                                            packet_index += packet_size;
-                                        }
-                                        else {
-                                            picoquic_log_app_message(last_cnx, "Retry with packet size=%zu fails at index %zu, ret=%d, err=%d.",
-                                                packet_size, packet_index, sock_ret, sock_err);
-                                            break;
-                                        }
+
+                                    sock_ret = picoquic_packet_loop_send_by_chunks(send_socket, &peer_addr, &local_addr,
+                                        if_index, send_buffer, send_length, send_msg_size, &packet_index, &sock_err);
+                                    if (sock_ret <= 0) {
+                                        picoquic_log_app_message(last_cnx, "Retry with packet size=%zu fails at index %zu, ret=%d, err=%d.",
+                                            send_msg_size, packet_index, sock_ret, sock_err);
                                     }
-                                    if (sock_ret > 0) {
+                                    else {
                                         picoquic_log_app_message(last_cnx, "Retry of %zu bytes by chunks of %zu bytes succeeds.",
                                             send_length, send_msg_size);
                                     }
@@ -525,3 +962,523 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
 
     return ret;
 }
+
+int picoquic_packet_loop(picoquic_quic_t* quic,
+    int local_port,
+    int local_af,
+    int dest_if,
+    int socket_buffer_size,
+    int do_not_use_gso,
+    picoquic_packet_loop_cb_fn loop_callback,
+    void* loop_callback_ctx)
+{
+    return picoquic_packet_loop_worker(quic, local_port, local_af, dest_if, socket_buffer_size,
+        do_not_use_gso, loop_callback, loop_callback_ctx, NULL);
+}
+
+/* Pipelined packet loop.
+ *
+ * The socket I/O runs in a dedicated thread, while the calling thread runs the
+ * protocol: decryption and processing of incoming packets, preparation and
+ * encryption of outgoing packets, and the application callbacks. The two threads
+ * exchange fixed size descriptors through single producer, single consumer
+ * queues: received packets flow from the I/O thread to the protocol thread,
+ * packets to send flow the other way, and each direction has a queue returning
+ * the used descriptors to the producer. The send descriptors come back with the
+ * result of the send call, so that errors are logged by the protocol thread.
+ *
+ * A thread that finds no work sets its "sleeping" flag, checks its queues one
+ * more time, and then waits on its wake up socket. The other thread sends a wake
+ * up datagram after queuing work if the flag is set.
+ */
+#define PICOQUIC_PACKET_LOOP_PIPE_RX_SIZE 256
+#define PICOQUIC_PACKET_LOOP_PIPE_TX_SIZE 64
+#define PICOQUIC_PACKET_LOOP_PIPE_RX_BATCH 32
+#define PICOQUIC_PACKET_LOOP_PIPE_IO_WAIT 100000
+
+#ifdef _WINDOWS
+#define PICOQUIC_PACKET_LOOP_FENCE() MemoryBarrier()
+#else
+#define PICOQUIC_PACKET_LOOP_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+typedef struct st_picoquic_packet_loop_desc_t {
+    struct sockaddr_storage peer_addr;
+    struct sockaddr_storage local_addr;
+    int if_index;
+    unsigned char received_ecn;
+    uint64_t receive_time;
+    picoquic_connection_id_t log_cid;
+    size_t length;
+    size_t send_msg_size;
+    int sock_ret;
+    int sock_err;
+    uint8_t* bytes;
+} picoquic_packet_loop_desc_t;
+
+typedef struct st_picoquic_packet_loop_pipe_t {
+    picoquic_spsc_queue_t rx_queue; /* Received packets, from I/O to protocol */
+    picoquic_spsc_queue_t rx_free; /* Processed descriptors, from protocol to I/O */
+    picoquic_spsc_queue_t tx_queue; /* Packets to send, from protocol to I/O */
+    picoquic_spsc_queue_t tx_free; /* Sent descriptors, from I/O to protocol */
+    picoquic_packet_loop_desc_t* descs;
+    uint8_t* buffers;
+    SOCKET_TYPE s_socket[PICOQUIC_PACKET_LOOP_SOCKETS_MAX];
+    int sock_af[PICOQUIC_PACKET_LOOP_SOCKETS_MAX];
+    uint16_t sock_ports[PICOQUIC_PACKET_LOOP_SOCKETS_MAX];
+    int nb_sockets;
+    SOCKET_TYPE io_wake_socket;
+    struct sockaddr_storage io_wake_addr;
+    SOCKET_TYPE proto_wake_socket;
+    struct sockaddr_storage proto_wake_addr;
+    volatile int io_sleeping; /* 1 if waiting for packets, 2 if also waiting for descriptors */
+    volatile int proto_sleeping;
+    volatile int is_stopping;
+    volatile int gso_failed;
+    picoquic_thread_t io_thread;
+    int io_thread_started;
+    int io_ret;
+} picoquic_packet_loop_pipe_t;
+
+static void picoquic_packet_loop_pipe_send(picoquic_packet_loop_pipe_t* pipe, picoquic_packet_loop_desc_t* desc)
+{
+    SOCKET_TYPE send_socket = picoquic_packet_loop_get_send_socket(pipe->s_socket, pipe->sock_af, pipe->sock_ports,
+        pipe->nb_sockets, &desc->peer_addr, &desc->local_addr);
+
+    desc->sock_err = 0;
+    desc->sock_ret = picoquic_sendmsg(send_socket,
+        (struct sockaddr*)&desc->peer_addr, (struct sockaddr*)&desc->local_addr, desc->if_index,
+        (const char*)desc->bytes, (int)desc->length, (int)desc->send_msg_size, &desc->sock_err);
+
+    if (desc->sock_ret <= 0 && desc->sock_err == EIO && desc->send_msg_size > 0) {
+        size_t packet_index = 0;
+
+        desc->sock_ret = picoquic_packet_loop_send_by_chunks(send_socket, &desc->peer_addr, &desc->local_addr,
+            desc->if_index, desc->bytes, desc->length, desc->send_msg_size, &packet_index, &desc->sock_err);
+        /* Make sure that we do not use GSO anymore in this run */
+        pipe->gso_failed = 1;
+    }
+
+    (void)picoquic_spsc_queue_push(&pipe->tx_free, desc);
+}
+
+static picoquic_thread_return_t picoquic_packet_loop_io_thread(void* v_pipe)
+{
+    picoquic_packet_loop_pipe_t* pipe = (picoquic_packet_loop_pipe_t*)v_pipe;
+    picoquic_packet_loop_desc_t* rx_desc = NULL;
+    picoquic_packet_loop_desc_t* tx_desc;
+    SOCKET_TYPE s_select[PICOQUIC_PACKET_LOOP_SOCKETS_MAX + 1];
+    uint8_t wake_buffer[16];
+    int64_t delta_t = 0;
+
+    while (!pipe->is_stopping) {
+        struct sockaddr_storage addr_from;
+        struct sockaddr_storage addr_to;
+        int if_index_to = 0;
+        unsigned char received_ecn = 0;
+        int socket_rank = -1;
+        uint64_t current_time = 0;
+        uint64_t receive_time = 0;
+        int bytes_recv;
+        int nb_select;
+        int nb_sent = 0;
+
+        /* Send all the packets queued by the protocol thread */
+        while ((tx_desc = (picoquic_packet_loop_desc_t*)picoquic_spsc_queue_pop(&pipe->tx_queue)) != NULL) {
+            picoquic_packet_loop_pipe_send(pipe, tx_desc);
+            nb_sent++;
+        }
+        if (nb_sent > 0) {
+            PICOQUIC_PACKET_LOOP_FENCE();
+            if (pipe->proto_sleeping) {
+                picoquic_packet_loop_wake(pipe->io_wake_socket, &pipe->proto_wake_addr);
+            }
+        }
+
+        if (rx_desc == NULL) {
+            rx_desc = (picoquic_packet_loop_desc_t*)picoquic_spsc_queue_pop(&pipe->rx_free);
+        }
+
+        if (delta_t > 0) {
+            /* Nothing happened in the previous round, prepare to sleep */
+            pipe->io_sleeping = (rx_desc == NULL) ? 2 : 1;
+            PICOQUIC_PACKET_LOOP_FENCE();
+            if (!picoquic_spsc_queue_is_empty(&pipe->tx_queue) ||
+                (rx_desc == NULL && !picoquic_spsc_queue_is_empty(&pipe->rx_free))) {
+                pipe->io_sleeping = 0;
+                delta_t = 0;
+                continue;
+            }
+        }
+
+        /* Without a free descriptor, only the wake up socket is polled */
+        if (rx_desc == NULL) {
+            s_select[0] = pipe->io_wake_socket;
+            nb_select = 1;
+        }
+        else {
+            memcpy(s_select, pipe->s_socket, pipe->nb_sockets * sizeof(SOCKET_TYPE));
+            s_select[pipe->nb_sockets] = pipe->io_wake_socket;
+            nb_select = pipe->nb_sockets + 1;
+        }
+
+        bytes_recv = picoquic_select_ex2(s_select, nb_select, &addr_from, &addr_to, &if_index_to, &received_ecn,
+            (rx_desc == NULL) ? wake_buffer : rx_desc->bytes,
+            (rx_desc == NULL) ? (int)sizeof(wake_buffer) : PICOQUIC_MAX_PACKET_SIZE,
+            delta_t, &socket_rank, &current_time, &receive_time);
+        pipe->io_sleeping = 0;
+
+        if (bytes_recv < 0) {
+            pipe->io_ret = -1;
+            break;
+        }
+        else if (bytes_recv > 0 && rx_desc != NULL && socket_rank < pipe->nb_sockets) {
+            /* Document incoming port */
+            if (addr_to.ss_family == AF_INET6) {
+                ((struct sockaddr_in6*)&addr_to)->sin6_port = pipe->sock_ports[socket_rank];
+            }
+            else if (addr_to.ss_family == AF_INET) {
+                ((struct sockaddr_in*)&addr_to)->sin_port = pipe->sock_ports[socket_rank];
+            }
+            picoquic_store_addr(&rx_desc->peer_addr, (struct sockaddr*)&addr_from);
+            picoquic_store_addr(&rx_desc->local_addr, (struct sockaddr*)&addr_to);
+            rx_desc->if_index = if_index_to;
+            rx_desc->received_ecn = received_ecn;
+            rx_desc->receive_time = receive_time;
+            rx_desc->length = (size_t)bytes_recv;
+            (void)picoquic_spsc_queue_push(&pipe->rx_queue, rx_desc);
+            rx_desc = NULL;
+            PICOQUIC_PACKET_LOOP_FENCE();
+            if (pipe->proto_sleeping) {
+                picoquic_packet_loop_wake(pipe->io_wake_socket, &pipe->proto_wake_addr);
+            }
+            /* Try to receive more packets if possible */
+            delta_t = 0;
+        }
+        else {
+            /* Wait if nothing was received or sent in this round */
+            delta_t = (bytes_recv > 0 || nb_sent > 0) ? 0 : PICOQUIC_PACKET_LOOP_PIPE_IO_WAIT;
+        }
+    }
+
+    picoquic_thread_do_return;
+}
+
+/* Reclaim the descriptors of sent packets, and report the send errors */
+static void picoquic_packet_loop_pipe_reclaim(picoquic_quic_t* quic, picoquic_packet_loop_desc_t* desc, uint64_t current_time)
+{
+    if (desc->sock_ret <= 0) {
+        picoquic_cnx_t* cnx = picoquic_get_first_cnx(quic);
+
+        while (cnx != NULL && picoquic_compare_connection_id(&desc->log_cid, &cnx->initial_cnxid) != 0) {
+            cnx = picoquic_get_next_cnx(cnx);
+        }
+
+        if (cnx == NULL) {
+            picoquic_log_context_free_app_message(quic, &desc->log_cid, "Could not send message to AF_to=%d, AF_from=%d, if=%d, ret=%d, err=%d",
+                desc->peer_addr.ss_family, desc->local_addr.ss_family, desc->if_index, desc->sock_ret, desc->sock_err);
+        }
+        else {
+            picoquic_log_app_message(cnx, "Could not send message to AF_to=%d, AF_from=%d, if=%d, ret=%d, err=%d",
+                desc->peer_addr.ss_family, desc->local_addr.ss_family, desc->if_index, desc->sock_ret, desc->sock_err);
+
+            if (picoquic_socket_error_implies_unreachable(desc->sock_err)) {
+                picoquic_notify_destination_unreachable(cnx, current_time,
+                    (struct sockaddr*)&desc->peer_addr, (struct sockaddr*)&desc->local_addr, desc->if_index,
+                    desc->sock_err);
+            }
+        }
+    }
+}
+
+static int picoquic_packet_loop_pipe_init(picoquic_packet_loop_pipe_t* pipe, size_t tx_buffer_size)
+{
+    int ret = 0;
+    size_t nb_descs = PICOQUIC_PACKET_LOOP_PIPE_RX_SIZE + PICOQUIC_PACKET_LOOP_PIPE_TX_SIZE;
+
+    if ((ret = picoquic_spsc_queue_init(&pipe->rx_queue, PICOQUIC_PACKET_LOOP_PIPE_RX_SIZE)) != 0 ||
+        (ret = picoquic_spsc_queue_init(&pipe->rx_free, PICOQUIC_PACKET_LOOP_PIPE_RX_SIZE)) != 0 ||
+        (ret = picoquic_spsc_queue_init(&pipe->tx_queue, PICOQUIC_PACKET_LOOP_PIPE_TX_SIZE)) != 0 ||
+        (ret = picoquic_spsc_queue_init(&pipe->tx_free, PICOQUIC_PACKET_LOOP_PIPE_TX_SIZE)) != 0) {
+        return ret;
+    }
+
+    pipe->descs = (picoquic_packet_loop_desc_t*)malloc(nb_descs * sizeof(picoquic_packet_loop_desc_t));
+    pipe->buffers = (uint8_t*)malloc(PICOQUIC_PACKET_LOOP_PIPE_RX_SIZE * PICOQUIC_MAX_PACKET_SIZE +
+        PICOQUIC_PACKET_LOOP_PIPE_TX_SIZE * tx_buffer_size);
+    if (pipe->descs == NULL || pipe->buffers == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        uint8_t* next_buffer = pipe->buffers;
+
+        memset(pipe->descs, 0, nb_descs * sizeof(picoquic_packet_loop_desc_t));
+        for (size_t i = 0; i < nb_descs; i++) {
+            pipe->descs[i].bytes = next_buffer;
+            if (i < PICOQUIC_PACKET_LOOP_PIPE_RX_SIZE) {
+                next_buffer += PICOQUIC_MAX_PACKET_SIZE;
+                (void)picoquic_spsc_queue_push(&pipe->rx_free, &pipe->descs[i]);
+            }
+            else {
+                next_buffer += tx_buffer_size;
+                pipe->descs[i].sock_ret = 1;
+                (void)picoquic_spsc_queue_push(&pipe->tx_free, &pipe->descs[i]);
+            }
+        }
+    }
+
+    return ret;
+}
+
+static void picoquic_packet_loop_pipe_release(picoquic_packet_loop_pipe_t* pipe)
+{
+    picoquic_spsc_queue_release(&pipe->rx_queue);
+    picoquic_spsc_queue_release(&pipe->rx_free);
+    picoquic_spsc_queue_release(&pipe->tx_queue);
+    picoquic_spsc_queue_release(&pipe->tx_free);
+    if (pipe->descs != NULL) {
+        free(pipe->descs);
+    }
+    if (pipe->buffers != NULL) {
+        free(pipe->buffers);
+    }
+    for (int i = 0; i < pipe->nb_sockets; i++) {
+        if (pipe->s_socket[i] != INVALID_SOCKET) {
+            SOCKET_CLOSE(pipe->s_socket[i]);
+        }
+    }
+    if (pipe->io_wake_socket != INVALID_SOCKET) {
+        SOCKET_CLOSE(pipe->io_wake_socket);
+    }
+    if (pipe->proto_wake_socket != INVALID_SOCKET) {
+        SOCKET_CLOSE(pipe->proto_wake_socket);
+    }
+}
+
+int picoquic_packet_loop_pipelined(picoquic_quic_t* quic,
+    int local_port,
+    int local_af,
+    int dest_if,
+    int socket_buffer_size,
+    int do_not_use_gso,
+    picoquic_packet_loop_cb_fn loop_callback,
+    void* loop_callback_ctx)
+{
+    int ret = 0;
+    uint64_t current_time = picoquic_get_quic_time(quic);
+    int64_t delay_max = 10000000;
+    size_t send_buffer_size = PICOQUIC_MAX_PACKET_SIZE;
+    size_t send_msg_size = 0;
+    size_t* send_msg_ptr = NULL;
+    picoquic_cnx_t* last_cnx = NULL;
+    picoquic_packet_loop_desc_t* tx_desc = NULL;
+    picoquic_packet_loop_options_t options = { 0 };
+    picoquic_packet_loop_pipe_t* pipe = (picoquic_packet_loop_pipe_t*)malloc(sizeof(picoquic_packet_loop_pipe_t));
+#ifdef _WINDOWS
+    WSADATA wsaData = { 0 };
+    (void)WSA_START(MAKEWORD(2, 2), &wsaData);
+#endif
+
+    if (pipe == NULL) {
+        return PICOQUIC_ERROR_MEMORY;
+    }
+    memset(pipe, 0, sizeof(picoquic_packet_loop_pipe_t));
+    pipe->io_wake_socket = INVALID_SOCKET;
+    pipe->proto_wake_socket = INVALID_SOCKET;
+
+    if (udp_gso_available && !do_not_use_gso) {
+        send_buffer_size = 0xFFFF;
+        send_msg_ptr = &send_msg_size;
+    }
+
+    if ((pipe->nb_sockets = picoquic_packet_loop_open_sockets(local_port, local_af, pipe->s_socket, pipe->sock_af,
+        pipe->sock_ports, socket_buffer_size, PICOQUIC_PACKET_LOOP_SOCKETS_MAX)) == 0 ||
+        picoquic_packet_loop_open_wake_socket(&pipe->io_wake_socket, &pipe->io_wake_addr) != 0 ||
+        picoquic_packet_loop_open_wake_socket(&pipe->proto_wake_socket, &pipe->proto_wake_addr) != 0) {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+    else {
+        ret = picoquic_packet_loop_pipe_init(pipe, send_buffer_size);
+    }
+
+    if (ret == 0 && loop_callback != NULL) {
+        struct sockaddr_storage l_addr;
+        ret = loop_callback(quic, picoquic_packet_loop_ready, loop_callback_ctx, &options);
+
+        if (picoquic_store_loopback_addr(&l_addr, pipe->sock_af[0], pipe->sock_ports[0]) == 0) {
+            ret = loop_callback(quic, picoquic_packet_loop_port_update, loop_callback_ctx, &l_addr);
+        }
+    }
+
+    if (ret == 0) {
+        if ((ret = picoquic_create_thread(&pipe->io_thread, picoquic_packet_loop_io_thread, pipe)) == 0) {
+            pipe->io_thread_started = 1;
+        }
+        else {
+            DBG_PRINTF("Cannot start the I/O thread, ret = %d", ret);
+        }
+    }
+
+    while (ret == 0) {
+        picoquic_packet_loop_desc_t* rx_desc[PICOQUIC_PACKET_LOOP_PIPE_RX_BATCH];
+        picoquic_received_packet_t rx_packet[PICOQUIC_PACKET_LOOP_PIPE_RX_BATCH];
+        size_t nb_rx_batch = 0;
+        int64_t delta_t;
+        size_t bytes_sent = 0;
+        int nb_received = 0;
+        int is_tx_blocked = 0;
+
+        current_time = picoquic_get_quic_time(quic);
+
+        /* Process the received packets, in batches so header protection can be removed in one pass */
+        do {
+            nb_rx_batch = 0;
+            while (nb_rx_batch < PICOQUIC_PACKET_LOOP_PIPE_RX_BATCH &&
+                (rx_desc[nb_rx_batch] = (picoquic_packet_loop_desc_t*)picoquic_spsc_queue_pop(&pipe->rx_queue)) != NULL) {
+                rx_packet[nb_rx_batch].bytes = rx_desc[nb_rx_batch]->bytes;
+                rx_packet[nb_rx_batch].length = rx_desc[nb_rx_batch]->length;
+                rx_packet[nb_rx_batch].addr_from = (struct sockaddr*)&rx_desc[nb_rx_batch]->peer_addr;
+                rx_packet[nb_rx_batch].addr_to = (struct sockaddr*)&rx_desc[nb_rx_batch]->local_addr;
+                rx_packet[nb_rx_batch].if_index_to = rx_desc[nb_rx_batch]->if_index;
+                rx_packet[nb_rx_batch].received_ecn = rx_desc[nb_rx_batch]->received_ecn;
+                rx_packet[nb_rx_batch].receive_time = rx_desc[nb_rx_batch]->receive_time;
+                nb_rx_batch++;
+            }
+            if (nb_rx_batch > 0) {
+                (void)picoquic_incoming_packet_batch(quic, rx_packet, nb_rx_batch, &last_cnx, current_time);
+            }
+            for (size_t i = 0; i < nb_rx_batch; i++) {
+                if (ret == 0 && loop_callback != NULL) {
+                    size_t b_recvd = rx_desc[i]->length;
+                    ret = loop_callback(quic, picoquic_packet_loop_after_receive, loop_callback_ctx, &b_recvd);
+                }
+                (void)picoquic_spsc_queue_push(&pipe->rx_free, rx_desc[i]);
+                nb_received++;
+            }
+        } while (ret == 0 && nb_rx_batch == PICOQUIC_PACKET_LOOP_PIPE_RX_BATCH);
+        if (nb_received > 0) {
+            PICOQUIC_PACKET_LOOP_FENCE();
+            if (pipe->io_sleeping == 2) {
+                picoquic_packet_loop_wake(pipe->proto_wake_socket, &pipe->io_wake_addr);
+            }
+        }
+
+        /* Prepare packets until there is nothing to send or no descriptor available */
+        if (pipe->gso_failed && send_msg_ptr != NULL) {
+            /* Make sure that we do not use GSO anymore in this run */
+            send_msg_ptr = NULL;
+            if (last_cnx != NULL) {
+                picoquic_log_app_message(last_cnx, "%s", "UDP GSO was disabled");
+            }
+        }
+        while (ret == 0) {
+            if (tx_desc == NULL) {
+                if ((tx_desc = (picoquic_packet_loop_desc_t*)picoquic_spsc_queue_pop(&pipe->tx_free)) == NULL) {
+                    is_tx_blocked = 1;
+                    break;
+                }
+                picoquic_packet_loop_pipe_reclaim(quic, tx_desc, current_time);
+            }
+            tx_desc->if_index = dest_if;
+            send_msg_size = 0;
+            ret = picoquic_prepare_next_packet_ex(quic, current_time,
+                tx_desc->bytes, send_buffer_size, &tx_desc->length,
+                &tx_desc->peer_addr, &tx_desc->local_addr, &tx_desc->if_index, &tx_desc->log_cid, &last_cnx,
+                send_msg_ptr);
+            if (ret == 0 && tx_desc->length > 0) {
+                tx_desc->send_msg_size = send_msg_size;
+                bytes_sent += tx_desc->length;
+                (void)picoquic_spsc_queue_push(&pipe->tx_queue, tx_desc);
+                tx_desc = NULL;
+                PICOQUIC_PACKET_LOOP_FENCE();
+                if (pipe->io_sleeping) {
+                    picoquic_packet_loop_wake(pipe->proto_wake_socket, &pipe->io_wake_addr);
+                }
+            }
+            else {
+                break;
+            }
+        }
+
+        if (ret == 0 && loop_callback != NULL) {
+            ret = loop_callback(quic, picoquic_packet_loop_after_send, loop_callback_ctx, &bytes_sent);
+        }
+
+        if (ret == 0 && pipe->io_ret != 0) {
+            ret = pipe->io_ret;
+        }
+
+        if (ret == 0) {
+            delta_t = picoquic_get_next_wake_delay(quic, current_time, delay_max);
+            if (options.do_time_check) {
+                packet_loop_time_check_arg_t time_check_arg;
+                time_check_arg.current_time = current_time;
+                time_check_arg.delta_t = delta_t;
+                ret = loop_callback(quic, picoquic_packet_loop_time_check, loop_callback_ctx, &time_check_arg);
+                if (time_check_arg.delta_t < delta_t) {
+                    delta_t = time_check_arg.delta_t;
+                }
+            }
+            if (ret == 0 && delta_t > 0 && options.busy_poll_delay > 0 && delta_t <= options.busy_poll_delay) {
+                /* Short wait: spin on the queues until the wake time, without involving the I/O thread */
+                uint64_t wait_start = picoquic_current_time();
+                uint64_t wake_time = wait_start + delta_t;
+
+                do {
+                    current_time = picoquic_current_time();
+                } while (current_time < wake_time && picoquic_spsc_queue_is_empty(&pipe->rx_queue) &&
+                    (!is_tx_blocked || picoquic_spsc_queue_is_empty(&pipe->tx_free)));
+
+                if (options.wait_stats != NULL) {
+                    options.wait_stats->nb_spin_waits++;
+                    options.wait_stats->spin_time += (current_time > wait_start) ? current_time - wait_start : 0;
+                }
+            }
+            else if (ret == 0 && delta_t > 0) {
+                uint64_t wait_start = picoquic_current_time();
+
+                /* Wait for incoming packets, sent descriptors or the next timer */
+                pipe->proto_sleeping = 1;
+                PICOQUIC_PACKET_LOOP_FENCE();
+                if (picoquic_spsc_queue_is_empty(&pipe->rx_queue) &&
+                    (!is_tx_blocked || picoquic_spsc_queue_is_empty(&pipe->tx_free))) {
+                    struct sockaddr_storage addr_from;
+                    struct sockaddr_storage addr_to;
+                    int if_index_to = 0;
+                    unsigned char received_ecn = 0;
+                    int socket_rank = -1;
+                    uint64_t receive_time = 0;
+                    uint8_t wake_buffer[16];
+
+                    if (picoquic_select_ex2(&pipe->proto_wake_socket, 1, &addr_from, &addr_to, &if_index_to,
+                        &received_ecn, wake_buffer, (int)sizeof(wake_buffer), delta_t, &socket_rank,
+                        &current_time, &receive_time) < 0) {
+                        ret = -1;
+                    }
+                }
+                pipe->proto_sleeping = 0;
+
+                if (options.wait_stats != NULL) {
+                    current_time = picoquic_current_time();
+                    options.wait_stats->nb_sleep_waits++;
+                    options.wait_stats->sleep_time += (current_time > wait_start) ? current_time - wait_start : 0;
+                }
+            }
+        }
+    }
+
+    if (ret == PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP) {
+        /* Normal termination requested by the application, returns no error */
+        ret = 0;
+    }
+
+    if (pipe->io_thread_started) {
+        pipe->is_stopping = 1;
+        picoquic_packet_loop_wake(pipe->proto_wake_socket, &pipe->io_wake_addr);
+        picoquic_delete_thread(&pipe->io_thread);
+    }
+    picoquic_packet_loop_pipe_release(pipe);
+    free(pipe);
+
+    return ret;
+}
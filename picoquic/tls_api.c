@@ -94,8 +94,31 @@ typedef struct st_picoquic_tls_ctx_t {
     uint8_t esni_nonce[PICOQUIC_ESNI_NONCE_SIZE];
     uint8_t app_secret_enc[PTLS_MAX_DIGEST_SIZE];
     uint8_t app_secret_dec[PTLS_MAX_DIGEST_SIZE];
+    /* Framing of the handshake messages in the Initial crypto stream, used
+     * to only hand complete messages to the TLS workers */
+    uint64_t initial_message_start;
+    uint8_t initial_message_header[4];
+    size_t initial_message_header_length;
 } picoquic_tls_ctx_t;
 
+/* TLS job, running one call to ptls_handle_message on a worker thread.
+ * The input points to the data in the crypto stream, which is not modified
+ * until the job completes. */
+typedef struct st_picoquic_tls_job_t {
+    picoquic_worker_job_t worker_job;
+    struct st_picoquic_tls_job_t* next_ready;
+    picoquic_cnx_t* cnx;
+    size_t epoch;
+    const uint8_t* input;
+    size_t input_length;
+    ptls_buffer_t sendbuf;
+    size_t send_offset[PICOQUIC_NUMBER_OF_EPOCH_OFFSETS];
+    int ret;
+    unsigned int is_dispatched : 1;
+    unsigned int is_collected : 1;
+    unsigned int is_ticket_resumed : 1;
+} picoquic_tls_job_t;
+
 struct st_picoquic_log_event_t {
     ptls_log_event_t super;
     FILE* fp;
@@ -1033,14 +1056,15 @@ int picoquic_client_hello_call_back(ptls_on_client_hello_t* on_hello_cb_ctx,
     int ret = 0;
     picoquic_quic_t** ppquic = (picoquic_quic_t**)(((char*)on_hello_cb_ctx) + sizeof(ptls_on_client_hello_t));
     picoquic_quic_t* quic = *ppquic;
+    picoquic_cnx_t* cnx = (picoquic_cnx_t*)*ptls_get_data_ptr(tls);
 
     /* Save the server name */
     ptls_set_server_name(tls, (const char *)params->server_name.base, params->server_name.len);
 
 #ifdef PTLS_ESNI_NONCE_SIZE
-    if (params->esni && quic->cnx_in_progress != NULL) {
+    if (params->esni && cnx != NULL) {
         /* Find the ESNI secret if any, and copy key values to picoquic tls context */
-        picoquic_tls_ctx_t* tls_ctx = (picoquic_tls_ctx_t*)quic->cnx_in_progress->tls_ctx;
+        picoquic_tls_ctx_t* tls_ctx = (picoquic_tls_ctx_t*)cnx->tls_ctx;
         struct st_ptls_esni_secret_t * esni = ptls_get_esni_secret(tls_ctx->tls);
         if (esni != NULL) {
             tls_ctx->esni_version = esni->version;
@@ -1055,8 +1079,8 @@ int picoquic_client_hello_call_back(ptls_on_client_hello_t* on_hello_cb_ctx,
 
         for (size_t i = 0; i < params->negotiated_protocols.count; i++) {
             if (params->negotiated_protocols.list[i].len == len && memcmp(params->negotiated_protocols.list[i].base, quic->default_alpn, len) == 0) {
-                if (quic->cnx_in_progress != NULL) {
-                    picoquic_log_app_message(quic->cnx_in_progress, "ALPN[%d] matches default alpn (%s)", (int)i, quic->default_alpn);
+                if (cnx != NULL) {
+                    picoquic_log_app_message(cnx, "ALPN[%d] matches default alpn (%s)", (int)i, quic->default_alpn);
                 }
                 alpn_found = (const uint8_t *)quic->default_alpn;
                 alpn_found_length = len;
@@ -1075,11 +1099,11 @@ int picoquic_client_hello_call_back(ptls_on_client_hello_t* on_hello_cb_ctx,
         }
     }
 
-    if (quic->cnx_in_progress != NULL) {
-        if (quic->cnx_in_progress->alpn == NULL && alpn_found_length > 0) {
-            quic->cnx_in_progress->alpn = picoquic_string_create((const char *)alpn_found, alpn_found_length);
+    if (cnx != NULL) {
+        if (cnx->alpn == NULL && alpn_found_length > 0) {
+            cnx->alpn = picoquic_string_create((const char *)alpn_found, alpn_found_length);
         }
-        picoquic_log_negotiated_alpn(quic->cnx_in_progress,
+        picoquic_log_negotiated_alpn(cnx,
             0, params->server_name.base, params->server_name.len, alpn_found, alpn_found_length,
             params->negotiated_protocols.list, params->negotiated_protocols.count);
     }
@@ -1089,8 +1113,8 @@ int picoquic_client_hello_call_back(ptls_on_client_hello_t* on_hello_cb_ctx,
         ret = PTLS_ALERT_NO_APPLICATION_PROTOCOL;
     }
 
-    if (ret != 0 && quic->cnx_in_progress != NULL) {
-        picoquic_log_app_message(quic->cnx_in_progress, "Client Hello call back returns %d (0x%x)", ret, ret);
+    if (ret != 0 && cnx != NULL) {
+        picoquic_log_app_message(cnx, "Client Hello call back returns %d (0x%x)", ret, ret);
     }
 
     return ret;
@@ -1108,15 +1132,29 @@ int picoquic_client_hello_call_back(ptls_on_client_hello_t* on_hello_cb_ctx,
  * The call to decrypt is:
  * tls->ctx->encrypt_ticket->cb(tls->ctx->encrypt_ticket, tls, 0, &decbuf, identity->identity)
  * Should return 0 if the ticket is good, etc.
+ *
+ * If TLS worker threads are used, tickets may be decrypted on a worker thread.
+ * The ticket AEAD contexts are then protected by a mutex, and the lookup of the
+ * issued ticket is deferred until the TLS job is collected.
  */
 
+static void picoquic_seed_from_issued_ticket(picoquic_cnx_t* cnx, uint64_t seq_num)
+{
+    /* Remember rtt and cwin from ticket */
+    picoquic_issued_ticket_t* server_ticket = picoquic_retrieve_issued_ticket(cnx->quic, seq_num);
+
+    if (server_ticket != NULL && server_ticket->cwin > 0) {
+        picoquic_seed_bandwidth(cnx,
+            server_ticket->rtt,
+            server_ticket->cwin,
+            server_ticket->ip_addr,
+            server_ticket->ip_addr_length);
+    }
+}
+
 int picoquic_server_encrypt_ticket_call_back(ptls_encrypt_ticket_t* encrypt_ticket_ctx,
     ptls_t* tls, int is_encrypt, ptls_buffer_t* dst, ptls_iovec_t src)
 {
-#ifdef _WINDOWS
-    UNREFERENCED_PARAMETER(tls);
-#endif
-
     /* Assume that the keys are in the quic context 
      * The tickets are composed of a 64 bit "sequence number" 
      * followed by the result of the clear text encryption.
@@ -1124,6 +1162,12 @@ int picoquic_server_encrypt_ticket_call_back(ptls_encrypt_ticket_t* encrypt_tick
     int ret = 0;
     picoquic_quic_t** ppquic = (picoquic_quic_t**)(((char*)encrypt_ticket_ctx) + sizeof(ptls_encrypt_ticket_t));
     picoquic_quic_t* quic = *ppquic;
+    picoquic_cnx_t* cnx = (picoquic_cnx_t*)*ptls_get_data_ptr(tls);
+    int is_locked = 0;
+
+    if (quic->tls_worker_pool != NULL) {
+        is_locked = (picoquic_lock_mutex(&quic->tls_ticket_mutex) == 0);
+    }
 
     if (is_encrypt != 0) {
         ptls_aead_context_t* aead_enc = (ptls_aead_context_t*)quic->aead_encrypt_ticket_ctx;
@@ -1132,7 +1176,7 @@ int picoquic_server_encrypt_ticket_call_back(ptls_encrypt_ticket_t* encrypt_tick
             ret = -1;
         } else if ((ret = ptls_buffer_reserve(dst, 8 + 4 + src.len + aead_enc->algo->tag_size)) == 0) {
             /* Create and store the ticket sequence number */
-            uint32_t version_number = picoquic_supported_versions[quic->cnx_in_progress->version_index].version;
+            uint32_t version_number = picoquic_supported_versions[cnx->version_index].version;
             uint64_t seq_num = picoquic_public_random_64();
             size_t start_off;
             size_t data_length;
@@ -1150,7 +1194,7 @@ int picoquic_server_encrypt_ticket_call_back(ptls_encrypt_ticket_t* encrypt_tick
             dst->off += ptls_aead_encrypt(aead_enc, dst->base + dst->off,
                 dst->base + start_off, data_length, seq_num, NULL, 0);
             /* Remember issued ticket ID in connection context */
-            quic->cnx_in_progress->issued_ticket_id = seq_num;
+            cnx->issued_ticket_id = seq_num;
         }
     } else {
         ptls_aead_context_t* aead_dec = (ptls_aead_context_t*)quic->aead_decrypt_ticket_ctx;
@@ -1169,39 +1213,38 @@ int picoquic_server_encrypt_ticket_call_back(ptls_encrypt_ticket_t* encrypt_tick
             if (decrypted > src.len - 8) {
                 /* decryption error */
                 ret = -1;
-                picoquic_log_app_message(quic->cnx_in_progress, "%s",
+                picoquic_log_app_message(cnx, "%s",
                     "Session ticket could not be decrypted");
             } else {
                 /* decode and verify the version number */
                 uint32_t version_number = PICOPARSE_32(dst->base + dst->off + decrypted - 4);
-                if (version_number != picoquic_supported_versions[quic->cnx_in_progress->version_index].version) {
+                if (version_number != picoquic_supported_versions[cnx->version_index].version) {
                     /* wrong version error */
                     ret = -1;
-                    picoquic_log_app_message(quic->cnx_in_progress, "Ticket version mismatch, expected 0x%x, got 0x%x",
-                        picoquic_supported_versions[quic->cnx_in_progress->version_index].version, version_number);
+                    picoquic_log_app_message(cnx, "Ticket version mismatch, expected 0x%x, got 0x%x",
+                        picoquic_supported_versions[cnx->version_index].version, version_number);
                 }
                 else {
-                    picoquic_issued_ticket_t* server_ticket;
                     dst->off += decrypted - 4;
-                    picoquic_log_app_message(quic->cnx_in_progress, "%s",
+                    picoquic_log_app_message(cnx, "%s",
                         "Session ticket properly decrypted");
                     /* Remember resumed ticket ID in connection context */
-                    quic->cnx_in_progress->resumed_ticket_id = seq_num;
-                    /* Remember rtt and cwin from ticket */
-                    server_ticket = picoquic_retrieve_issued_ticket(quic, seq_num);
-                    if (server_ticket != NULL && server_ticket->cwin > 0) {
-                        picoquic_seed_bandwidth(
-                            quic->cnx_in_progress,
-                            server_ticket->rtt,
-                            server_ticket->cwin,
-                            server_ticket->ip_addr,
-                            server_ticket->ip_addr_length);
+                    cnx->resumed_ticket_id = seq_num;
+                    if (cnx->tls_job == NULL) {
+                        picoquic_seed_from_issued_ticket(cnx, seq_num);
+                    }
+                    else {
+                        cnx->tls_job->is_ticket_resumed = 1;
                     }
                 }
             }
         }
     }
 
+    if (is_locked) {
+        (void)picoquic_unlock_mutex(&quic->tls_ticket_mutex);
+    }
+
     return ret;
 }
 
@@ -1303,7 +1346,26 @@ static int picoquic_set_aead_from_secret(void ** v_aead,ptls_cipher_suite_t * ci
     return ret;
 }
 
-static int picoquic_set_pn_enc_from_secret(void ** v_pn_enc, ptls_cipher_suite_t * cipher, int is_enc, const void *secret, const char *prefix_label)
+/* With AES based suites, the header protection mask is the first bytes of
+ * the AES-ECB encryption of the sample. The sending and receiving code can
+ * thus compute the masks of several packets in a single call to an ECB context
+ * keyed with the header protection key. There is no such shortcut for ChaCha20.
+ */
+static ptls_cipher_algorithm_t* picoquic_pn_ecb_algo(ptls_cipher_suite_t* cipher)
+{
+    ptls_cipher_algorithm_t* ecb_algo = NULL;
+
+    if (cipher->id == PTLS_CIPHER_SUITE_AES_128_GCM_SHA256) {
+        ecb_algo = &ptls_openssl_aes128ecb;
+    }
+    else if (cipher->id == PTLS_CIPHER_SUITE_AES_256_GCM_SHA384) {
+        ecb_algo = &ptls_openssl_aes256ecb;
+    }
+
+    return ecb_algo;
+}
+
+static int picoquic_set_pn_enc_from_secret(void ** v_pn_enc, void ** v_pn_ecb, ptls_cipher_suite_t * cipher, int is_enc, const void *secret, const char *prefix_label)
 {
     uint8_t pnekey[PTLS_MAX_SECRET_SIZE];
     int ret;
@@ -1313,12 +1375,24 @@ static int picoquic_set_pn_enc_from_secret(void ** v_pn_enc, ptls_cipher_suite_t
         *v_pn_enc = NULL;
     }
 
+    if (v_pn_ecb != NULL && *v_pn_ecb != NULL) {
+        ptls_cipher_free((ptls_cipher_context_t*)*v_pn_ecb);
+        *v_pn_ecb = NULL;
+    }
+
     if ((ret = ptls_hkdf_expand_label(cipher->hash, pnekey, 
         cipher->aead->ctr_cipher->key_size, ptls_iovec_init(secret, cipher->hash->digest_size), 
         PICOQUIC_LABEL_HP, ptls_iovec_init(NULL, 0), prefix_label)) == 0) {
         if ((*v_pn_enc = ptls_cipher_new(cipher->aead->ctr_cipher, is_enc, pnekey)) == NULL) {
             ret = PTLS_ERROR_NO_MEMORY;
         }
+        else if (v_pn_ecb != NULL) {
+            ptls_cipher_algorithm_t* ecb_algo = picoquic_pn_ecb_algo(cipher);
+
+            if (ecb_algo != NULL && (*v_pn_ecb = ptls_cipher_new(ecb_algo, 1, pnekey)) == NULL) {
+                ret = PTLS_ERROR_NO_MEMORY;
+            }
+        }
     }
     
     return ret;
@@ -1342,13 +1416,13 @@ static int picoquic_set_key_from_secret(ptls_cipher_suite_t * cipher, int is_enc
         ret = picoquic_set_aead_from_secret(&ctx->aead_encrypt, cipher, is_enc, secret, prefix_label);
         
         if (ret == 0 && !is_rotation) {
-            ret = picoquic_set_pn_enc_from_secret(&ctx->pn_enc, cipher, is_enc, secret, prefix_label);
+            ret = picoquic_set_pn_enc_from_secret(&ctx->pn_enc, &ctx->pn_enc_ecb, cipher, is_enc, secret, prefix_label);
         }
     } else {
         ret = picoquic_set_aead_from_secret(&ctx->aead_decrypt, cipher, is_enc, secret, prefix_label);
         
         if (ret == 0 && !is_rotation) {
-            ret = picoquic_set_pn_enc_from_secret(&ctx->pn_dec, cipher, is_enc, secret, prefix_label);
+            ret = picoquic_set_pn_enc_from_secret(&ctx->pn_dec, &ctx->pn_dec_ecb, cipher, is_enc, secret, prefix_label);
         }
     }
 
@@ -1444,6 +1518,81 @@ int picoquic_setup_initial_master_secret(
     return ret;
 }
 
+/* The salt used to extract the initial master secret only depends on the version.
+ * The HMAC context keyed with that salt is created once per version and kept in
+ * the Quic context. Each new connection clones it and only hashes its CID, instead
+ * of redoing the HKDF key schedule from scratch.
+ */
+static ptls_hash_context_t* picoquic_find_initial_salt_context(picoquic_quic_t* quic, ptls_cipher_suite_t* cipher, int version_index)
+{
+    ptls_hash_context_t* salt_ctx = NULL;
+
+    if (quic->initial_salt_hmac_ctx == NULL) {
+        quic->initial_salt_hmac_ctx = (void**)malloc(sizeof(void*) * picoquic_nb_supported_versions);
+        if (quic->initial_salt_hmac_ctx != NULL) {
+            memset(quic->initial_salt_hmac_ctx, 0, sizeof(void*) * picoquic_nb_supported_versions);
+        }
+    }
+
+    if (quic->initial_salt_hmac_ctx != NULL) {
+        salt_ctx = (ptls_hash_context_t*)quic->initial_salt_hmac_ctx[version_index];
+        if (salt_ctx == NULL) {
+            ptls_iovec_t salt;
+
+            picoquic_setup_cleartext_aead_salt(version_index, &salt);
+            salt_ctx = ptls_hmac_create(cipher->hash, salt.base, salt.len);
+            quic->initial_salt_hmac_ctx[version_index] = (void*)salt_ctx;
+        }
+    }
+
+    return salt_ctx;
+}
+
+int picoquic_setup_initial_master_secret_cached(
+    picoquic_quic_t* quic,
+    ptls_cipher_suite_t* cipher,
+    int version_index,
+    picoquic_connection_id_t initial_cnxid,
+    uint8_t* master_secret)
+{
+    int ret = 0;
+    ptls_hash_context_t* salt_ctx = picoquic_find_initial_salt_context(quic, cipher, version_index);
+    ptls_hash_context_t* hmac_ctx = (salt_ctx == NULL) ? NULL : salt_ctx->clone_(salt_ctx);
+
+    if (hmac_ctx == NULL) {
+        ptls_iovec_t salt;
+
+        picoquic_setup_cleartext_aead_salt(version_index, &salt);
+        ret = picoquic_setup_initial_master_secret(cipher, salt, initial_cnxid, master_secret);
+    }
+    else {
+        /* HKDF-Extract(salt, CID) is HMAC(salt, CID) */
+        uint8_t cnx_id_serialized[PICOQUIC_CONNECTION_ID_MAX_SIZE];
+        size_t cnx_id_length = picoquic_format_connection_id(cnx_id_serialized, PICOQUIC_CONNECTION_ID_MAX_SIZE,
+            initial_cnxid);
+
+        hmac_ctx->update(hmac_ctx, cnx_id_serialized, cnx_id_length);
+        hmac_ctx->final(hmac_ctx, master_secret, PTLS_HASH_FINAL_MODE_FREE);
+    }
+
+    return ret;
+}
+
+void picoquic_delete_initial_salt_contexts(picoquic_quic_t* quic)
+{
+    if (quic->initial_salt_hmac_ctx != NULL) {
+        for (size_t i = 0; i < picoquic_nb_supported_versions; i++) {
+            ptls_hash_context_t* salt_ctx = (ptls_hash_context_t*)quic->initial_salt_hmac_ctx[i];
+
+            if (salt_ctx != NULL) {
+                salt_ctx->final(salt_ctx, NULL, PTLS_HASH_FINAL_MODE_FREE);
+            }
+        }
+        free(quic->initial_salt_hmac_ctx);
+        quic->initial_salt_hmac_ctx = NULL;
+    }
+}
+
 int picoquic_setup_initial_secrets(
     ptls_cipher_suite_t * cipher,
     uint8_t * master_secret,
@@ -1474,7 +1623,6 @@ int picoquic_setup_initial_traffic_keys(picoquic_cnx_t* cnx)
     int ret = 0;
     uint8_t master_secret[256]; /* secret_max */
     ptls_cipher_suite_t * cipher = picoquic_get_aes128gcm_sha256(cnx->quic->use_low_memory);
-    ptls_iovec_t salt;
     uint8_t client_secret[256];
     uint8_t server_secret[256];
     uint8_t *secret1, *secret2;
@@ -1484,10 +1632,9 @@ int picoquic_setup_initial_traffic_keys(picoquic_cnx_t* cnx)
         ret = -1;
     }
     else {
-        picoquic_setup_cleartext_aead_salt(cnx->version_index, &salt);
-
         /* Extract the master key -- key length will be 32 per SHA256 */
-        ret = picoquic_setup_initial_master_secret(cipher, salt, cnx->initial_cnxid, master_secret);
+        ret = picoquic_setup_initial_master_secret_cached(cnx->quic, cipher, cnx->version_index,
+            cnx->initial_cnxid, master_secret);
     }
 
     /* set up client and server secrets */
@@ -1672,6 +1819,16 @@ void picoquic_crypto_context_free(picoquic_crypto_context_t * ctx)
         ptls_cipher_free((ptls_cipher_context_t *)ctx->pn_dec);
         ctx->pn_dec = NULL;
     }
+
+    if (ctx->pn_enc_ecb != NULL) {
+        ptls_cipher_free((ptls_cipher_context_t*)ctx->pn_enc_ecb);
+        ctx->pn_enc_ecb = NULL;
+    }
+
+    if (ctx->pn_dec_ecb != NULL) {
+        ptls_cipher_free((ptls_cipher_context_t*)ctx->pn_dec_ecb);
+        ctx->pn_dec_ecb = NULL;
+    }
 }
 
 /*
@@ -2387,11 +2544,25 @@ void * picoquic_pn_enc_create_for_test(const uint8_t * secret, const char *prefi
     ptls_cipher_suite_t *cipher = picoquic_get_aes128gcm_sha256(1);
     void *v_pn_enc = NULL;
     
-    (void)picoquic_set_pn_enc_from_secret(&v_pn_enc, cipher, 1, secret, prefix_label);
+    (void)picoquic_set_pn_enc_from_secret(&v_pn_enc, NULL, cipher, 1, secret, prefix_label);
 
     return v_pn_enc;
 }
 
+void * picoquic_pn_ecb_create_for_test(const uint8_t * secret, const char *prefix_label)
+{
+    ptls_cipher_suite_t *cipher = picoquic_get_aes128gcm_sha256(1);
+    void *v_pn_enc = NULL;
+    void *v_pn_ecb = NULL;
+
+    (void)picoquic_set_pn_enc_from_secret(&v_pn_enc, &v_pn_ecb, cipher, 1, secret, prefix_label);
+    if (v_pn_enc != NULL) {
+        ptls_cipher_free((ptls_cipher_context_t*)v_pn_enc);
+    }
+
+    return v_pn_ecb;
+}
+
 size_t picoquic_pn_iv_size(void *pn_enc)
 {
     return ((ptls_cipher_context_t *)pn_enc)->algo->iv_size;
@@ -2403,6 +2574,27 @@ void picoquic_pn_encrypt(void *pn_enc, const void * iv, void *output, const void
     ptls_cipher_encrypt((ptls_cipher_context_t *) pn_enc, output, input, len);
 }
 
+/* Compute the header protection masks of several packets protected with the
+ * same key. Samples and masks are stored as consecutive blocks of
+ * PICOQUIC_HP_SAMPLE_SIZE bytes. If an ECB context is available, all the masks
+ * are produced by a single multi-block call; otherwise, they are computed one
+ * by one with the regular header protection context.
+ */
+void picoquic_pn_encrypt_batch(void* pn_enc, void* pn_ecb, const uint8_t* samples, uint8_t* masks, size_t nb_samples)
+{
+    if (pn_ecb != NULL) {
+        ptls_cipher_encrypt((ptls_cipher_context_t*)pn_ecb, masks, samples, nb_samples * PICOQUIC_HP_SAMPLE_SIZE);
+    }
+    else {
+        for (size_t i = 0; i < nb_samples; i++) {
+            uint8_t* mask = masks + i * PICOQUIC_HP_SAMPLE_SIZE;
+
+            memset(mask, 0, PICOQUIC_HP_SAMPLE_SIZE);
+            picoquic_pn_encrypt(pn_enc, samples + i * PICOQUIC_HP_SAMPLE_SIZE, mask, mask, PICOQUIC_HP_SAMPLE_SIZE);
+        }
+    }
+}
+
 /* Utility functions, so applications do not have to load picotls.h */
 
 void picoquic_aead_free(void* aead_context)
@@ -2431,6 +2623,29 @@ void * picoquic_setup_test_aead_context(int is_encrypt, const uint8_t * secret,
     return v_aead;
 }
 
+/* Setting of both directions of a crypto context from a single secret, for the
+ * selected cipher suite. This is used by tests and benchmarks that exercise
+ * the packet protection code without running a handshake.
+ */
+int picoquic_set_crypto_context_for_test(picoquic_crypto_context_t* ctx, int cipher_suite_id, int use_low_memory,
+    const uint8_t* secret, const char* prefix_label)
+{
+    int ret = 0;
+    ptls_cipher_suite_t* cipher = picoquic_get_cipher_suite_by_id(cipher_suite_id, use_low_memory);
+
+    if (cipher == NULL) {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+    else {
+        ret = picoquic_set_key_from_secret(cipher, 1, 0, ctx, secret, prefix_label);
+        if (ret == 0) {
+            ret = picoquic_set_key_from_secret(cipher, 0, 0, ctx, secret, prefix_label);
+        }
+    }
+
+    return ret;
+}
+
 int picoquic_server_setup_ticket_aead_contexts(picoquic_quic_t* quic,
     ptls_context_t* tls_ctx,
     const uint8_t* secret, size_t secret_length)
@@ -2589,6 +2804,182 @@ int picoquic_compare_cleartext_aead_contexts(picoquic_cnx_t* cnx1, picoquic_cnx_
 }
 #endif
 
+/* TLS jobs.
+ * On servers with TLS worker threads, the processing of the client's Initial
+ * messages is handed to a worker, since this is where the key exchange and the
+ * certificate signature happen. Jobs are created while processing the incoming
+ * packet, and only submitted to the pool once the packet is processed. Until
+ * the job is collected, the packets of the connection are dropped, and the
+ * connection does not send. The callbacks of the TLS stack find the connection
+ * from the TLS context, so they can run on the worker: the client hello
+ * callback with the application's ALPN selection, the transport parameters
+ * callback, the key log, and the logging of the connection. The threading
+ * contract is documented with picoquic_set_tls_worker_threads.
+ * When the job is collected, picoquic_tls_stream_process is called again, and
+ * uses the result of the job instead of calling ptls_handle_message.
+ */
+
+static void picoquic_tls_job_run(picoquic_worker_job_t* worker_job)
+{
+    picoquic_tls_job_t* job = (picoquic_tls_job_t*)worker_job;
+    picoquic_tls_ctx_t* ctx = (picoquic_tls_ctx_t*)job->cnx->tls_ctx;
+
+    picoquic_clear_crypto_errors();
+
+    job->ret = ptls_handle_message(ctx->tls, &job->sendbuf, job->send_offset, job->epoch,
+        job->input, job->input_length, &ctx->handshake_properties);
+}
+
+static int picoquic_tls_job_create(picoquic_cnx_t* cnx, size_t epoch, const uint8_t* input, size_t input_length)
+{
+    int ret = 0;
+    picoquic_tls_job_t* job = (picoquic_tls_job_t*)malloc(sizeof(picoquic_tls_job_t));
+
+    if (job == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        memset(job, 0, sizeof(picoquic_tls_job_t));
+        job->worker_job.job_fn = picoquic_tls_job_run;
+        job->cnx = cnx;
+        job->epoch = epoch;
+        job->input = input;
+        job->input_length = input_length;
+        ptls_buffer_init(&job->sendbuf, "", 0);
+        job->next_ready = cnx->quic->first_tls_job_ready;
+        cnx->quic->first_tls_job_ready = job;
+        cnx->quic->nb_tls_jobs++;
+        cnx->tls_job = job;
+    }
+
+    return ret;
+}
+
+static void picoquic_tls_job_free(picoquic_cnx_t* cnx)
+{
+    picoquic_tls_job_t* job = cnx->tls_job;
+
+    ptls_buffer_dispose(&job->sendbuf);
+    free(job);
+    cnx->tls_job = NULL;
+    cnx->quic->nb_tls_jobs--;
+}
+
+/* Use the result of a collected job as the result of ptls_handle_message */
+static int picoquic_tls_job_take_result(picoquic_cnx_t* cnx, ptls_buffer_t* sendbuf, size_t* send_offset)
+{
+    picoquic_tls_job_t* job = cnx->tls_job;
+    int ret = job->ret;
+
+    ptls_buffer_dispose(sendbuf);
+    *sendbuf = job->sendbuf;
+    ptls_buffer_init(&job->sendbuf, "", 0);
+    memcpy(send_offset, job->send_offset, sizeof(job->send_offset));
+
+    if (job->is_ticket_resumed) {
+        picoquic_seed_from_issued_ticket(cnx, cnx->resumed_ticket_id);
+    }
+
+    picoquic_tls_job_free(cnx);
+
+    return ret;
+}
+
+void picoquic_tls_jobs_dispatch(picoquic_quic_t* quic)
+{
+    while (quic->first_tls_job_ready != NULL) {
+        picoquic_tls_job_t* job = quic->first_tls_job_ready;
+
+        quic->first_tls_job_ready = job->next_ready;
+        job->next_ready = NULL;
+        job->is_dispatched = 1;
+        picoquic_worker_pool_submit(quic->tls_worker_pool, &job->worker_job);
+    }
+}
+
+void picoquic_tls_jobs_collect(picoquic_quic_t* quic, uint64_t current_time)
+{
+    picoquic_worker_job_t* worker_job;
+
+    while (quic->tls_worker_pool != NULL &&
+        (worker_job = picoquic_worker_pool_next_done(quic->tls_worker_pool)) != NULL) {
+        picoquic_tls_job_t* job = (picoquic_tls_job_t*)worker_job;
+        picoquic_cnx_t* cnx = job->cnx;
+
+        job->is_collected = 1;
+        if (picoquic_tls_stream_process(cnx, NULL, current_time) != 0) {
+            (void)picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_INTERNAL_ERROR, 0);
+        }
+        picoquic_reinsert_by_wake_time(quic, cnx, current_time);
+    }
+
+    if (quic->first_tls_job_ready != NULL) {
+        picoquic_tls_jobs_dispatch(quic);
+    }
+}
+
+/* Track the handshake messages in the Initial crypto stream, which is consumed in
+ * order, and check whether the chunk at "offset" completes at least one message.
+ * A ClientHello can span several packets, e.g., with large key shares. The first
+ * fragments are passed to the TLS stack on the owner thread, which only buffers
+ * them, and the job is only created for the chunk that completes the message.
+ */
+static int picoquic_tls_job_is_message_complete(picoquic_tls_ctx_t* ctx, uint64_t offset,
+    const uint8_t* bytes, size_t length)
+{
+    int is_complete = 0;
+    size_t consumed = 0;
+
+    for (;;) {
+        uint64_t message_end;
+
+        while (ctx->initial_message_header_length < 4 && consumed < length) {
+            ctx->initial_message_header[ctx->initial_message_header_length++] = bytes[consumed++];
+        }
+        if (ctx->initial_message_header_length < 4) {
+            break;
+        }
+        message_end = ctx->initial_message_start + 4 +
+            (((uint64_t)ctx->initial_message_header[1]) << 16) +
+            (((uint64_t)ctx->initial_message_header[2]) << 8) +
+            (uint64_t)ctx->initial_message_header[3];
+        if (message_end > offset + length) {
+            break;
+        }
+        is_complete = 1;
+        consumed = (size_t)(message_end - offset);
+        ctx->initial_message_start = message_end;
+        ctx->initial_message_header_length = 0;
+        if (consumed >= length) {
+            break;
+        }
+    }
+
+    return is_complete;
+}
+
+/* Called when deleting a connection before its job is collected */
+void picoquic_tls_job_cancel(picoquic_cnx_t* cnx)
+{
+    picoquic_tls_job_t* job = cnx->tls_job;
+
+    if (!job->is_dispatched) {
+        picoquic_tls_job_t** pprevious = &cnx->quic->first_tls_job_ready;
+
+        while (*pprevious != NULL && *pprevious != job) {
+            pprevious = &(*pprevious)->next_ready;
+        }
+        if (*pprevious == job) {
+            *pprevious = job->next_ready;
+        }
+    }
+    else if (!job->is_collected) {
+        picoquic_worker_pool_wait_job(cnx->quic->tls_worker_pool, &job->worker_job);
+    }
+
+    picoquic_tls_job_free(cnx);
+}
+
 /* Input stream zero data to TLS context.
  *
  * Processing  depends on the "epoch" in which packets have been received. That
@@ -2602,11 +2993,14 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx, int * data_consumed, uint64
     int ret = 0;
     picoquic_tls_ctx_t* ctx = (picoquic_tls_ctx_t*)cnx->tls_ctx;
     size_t next_epoch = 0;
+    int is_job_created = 0;
 
-    /* Provide indication of current connection for later callbacks */
-    cnx->quic->cnx_in_progress = cnx;
+    if (cnx->tls_job != NULL && !cnx->tls_job->is_collected) {
+        /* A worker thread is using the TLS context */
+        return 0;
+    }
 
-    for (size_t epoch = 0; epoch < PICOQUIC_NUMBER_OF_EPOCHS && ret == 0; epoch++) {
+    for (size_t epoch = 0; epoch < PICOQUIC_NUMBER_OF_EPOCHS && ret == 0 && !is_job_created; epoch++) {
         picoquic_stream_head_t* stream = &cnx->tls_stream[epoch];
         picoquic_stream_data_node_t* data = (picoquic_stream_data_node_t*)picosplay_first(&stream->stream_data_tree);
         size_t processed = 0;
@@ -2614,7 +3008,13 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx, int * data_consumed, uint64
 
         next_epoch = ptls_get_read_epoch(ctx->tls);
 
-        if (epoch != next_epoch) {
+        if (cnx->tls_job != NULL) {
+            /* The read epoch was already updated by the worker thread */
+            if (epoch != cnx->tls_job->epoch) {
+                continue;
+            }
+        }
+        else if (epoch != next_epoch) {
             if (epoch > next_epoch) {
                 break;
             } else {
@@ -2648,8 +3048,21 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx, int * data_consumed, uint64
              * This allows detection of errors during processing. */
             picoquic_clear_crypto_errors();
 
-            ret = ptls_handle_message(ctx->tls, &sendbuf, send_offset, epoch,
-                data->bytes + start, epoch_data, &ctx->handshake_properties);
+            if (cnx->tls_job != NULL) {
+                ret = picoquic_tls_job_take_result(cnx, &sendbuf, send_offset);
+            }
+            else if (cnx->quic->tls_worker_pool != NULL && !cnx->client_mode && epoch == picoquic_epoch_initial &&
+                picoquic_tls_job_is_message_complete(ctx, stream->consumed_offset, data->bytes + start, epoch_data) &&
+                picoquic_tls_job_create(cnx, epoch, data->bytes + start, epoch_data) == 0) {
+                /* The data is consumed when the job is collected */
+                ptls_buffer_dispose(&sendbuf);
+                is_job_created = 1;
+                break;
+            }
+            else {
+                ret = ptls_handle_message(ctx->tls, &sendbuf, send_offset, epoch,
+                    data->bytes + start, epoch_data, &ctx->handshake_properties);
+            }
 
             if ((ret == 0 || ret == PTLS_ERROR_IN_PROGRESS ||
                 ret == PTLS_ERROR_STATELESS_RETRY)) {
@@ -2704,7 +3117,7 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx, int * data_consumed, uint64
             ptls_buffer_dispose(&sendbuf);
         }
 
-        if (processed > 0) {
+        if (processed > 0 && !is_job_created) {
             if (ret == 0) {
                 switch (cnx->cnx_state) {
                 case picoquic_state_client_retry_received:
@@ -2797,8 +3210,10 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx, int * data_consumed, uint64
         }
     }
 
-    /* Reset indication of current connection */
-    cnx->quic->cnx_in_progress = NULL;
+    if (cnx->tls_job != NULL && cnx->tls_job->is_collected) {
+        /* The data processed by the job is no longer in the stream */
+        picoquic_tls_job_free(cnx);
+    }
 
     return ret;
 }
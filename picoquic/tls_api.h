@@ -60,6 +60,11 @@ void picoquic_tlscontext_remove_ticket(picoquic_cnx_t* cnx);
 int picoquic_tls_stream_process(picoquic_cnx_t* cnx, int* data_consumed, uint64_t current_time);
 int picoquic_is_tls_complete(picoquic_cnx_t* cnx);
 
+/* TLS jobs run on worker threads, see picoquic_set_tls_worker_threads */
+void picoquic_tls_jobs_dispatch(picoquic_quic_t* quic);
+void picoquic_tls_jobs_collect(picoquic_quic_t* quic, uint64_t current_time);
+void picoquic_tls_job_cancel(picoquic_cnx_t* cnx);
+
 int picoquic_initialize_tls_stream(picoquic_cnx_t* cnx, uint64_t current_time);
 
 uint64_t picoquic_get_tls_time(picoquic_quic_t* quic);
@@ -94,6 +99,9 @@ size_t picoquic_pn_iv_size(void *pn_enc);
 
 void picoquic_pn_encrypt(void *pn_enc, const void * iv, void *output, const void *input, size_t len);
 
+#define PICOQUIC_HP_SAMPLE_SIZE 16
+void picoquic_pn_encrypt_batch(void* pn_enc, void* pn_ecb, const uint8_t* samples, uint8_t* masks, size_t nb_samples);
+
 typedef const struct st_ptls_cipher_suite_t ptls_cipher_suite_t;
 
 int picoquic_setup_initial_master_secret(
@@ -102,6 +110,15 @@ int picoquic_setup_initial_master_secret(
     picoquic_connection_id_t initial_cnxid,
     uint8_t * master_secret);
 
+int picoquic_setup_initial_master_secret_cached(
+    picoquic_quic_t* quic,
+    ptls_cipher_suite_t* cipher,
+    int version_index,
+    picoquic_connection_id_t initial_cnxid,
+    uint8_t* master_secret);
+
+void picoquic_delete_initial_salt_contexts(picoquic_quic_t* quic);
+
 int picoquic_setup_initial_secrets(
     ptls_cipher_suite_t * cipher,
     uint8_t * master_secret,
@@ -120,6 +137,9 @@ void picoquic_crypto_context_free(picoquic_crypto_context_t * ctx);
 
 void * picoquic_setup_test_aead_context(int is_encrypt, const uint8_t * secret, const char *prefix_label);
 void * picoquic_pn_enc_create_for_test(const uint8_t * secret, const char *prefix_label);
+void * picoquic_pn_ecb_create_for_test(const uint8_t * secret, const char *prefix_label);
+int picoquic_set_crypto_context_for_test(picoquic_crypto_context_t* ctx, int cipher_suite_id, int use_low_memory,
+    const uint8_t* secret, const char* prefix_label);
 
 #if 0
 /* TODO: find replacement for this test */
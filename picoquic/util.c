@@ -1031,6 +1031,72 @@ int picoquic_unlock_mutex(picoquic_mutex_t * mutex)
     return ret;
 }
 
+int picoquic_create_rwlock(picoquic_rwlock_t* rwlock)
+{
+#ifdef _WINDOWS
+    int ret = 0;
+    InitializeSRWLock(rwlock);
+#else
+    int ret = pthread_rwlock_init(rwlock, NULL);
+#endif
+    return ret;
+}
+
+int picoquic_delete_rwlock(picoquic_rwlock_t* rwlock)
+{
+#ifdef _WINDOWS
+    /* Slim reader/writer locks do not need to be destroyed */
+    int ret = 0;
+#else
+    int ret = pthread_rwlock_destroy(rwlock);
+#endif
+    return ret;
+}
+
+int picoquic_lock_rwlock_read(picoquic_rwlock_t* rwlock)
+{
+#ifdef _WINDOWS
+    int ret = 0;
+    AcquireSRWLockShared(rwlock);
+#else
+    int ret = pthread_rwlock_rdlock(rwlock);
+#endif
+    return ret;
+}
+
+int picoquic_unlock_rwlock_read(picoquic_rwlock_t* rwlock)
+{
+#ifdef _WINDOWS
+    int ret = 0;
+    ReleaseSRWLockShared(rwlock);
+#else
+    int ret = pthread_rwlock_unlock(rwlock);
+#endif
+    return ret;
+}
+
+int picoquic_lock_rwlock_write(picoquic_rwlock_t* rwlock)
+{
+#ifdef _WINDOWS
+    int ret = 0;
+    AcquireSRWLockExclusive(rwlock);
+#else
+    int ret = pthread_rwlock_wrlock(rwlock);
+#endif
+    return ret;
+}
+
+int picoquic_unlock_rwlock_write(picoquic_rwlock_t* rwlock)
+{
+#ifdef _WINDOWS
+    int ret = 0;
+    ReleaseSRWLockExclusive(rwlock);
+#else
+    int ret = pthread_rwlock_unlock(rwlock);
+#endif
+    return ret;
+}
+
 int picoquic_create_event(picoquic_event_t* event)
 {
 #ifdef _WINDOWS
@@ -1108,6 +1174,584 @@ int picoquic_wait_for_event(picoquic_event_t* event, uint64_t microsec_wait)
 }
 
 
+/* Single producer, single consumer queue.
+ * The indices grow monotonically and are masked when accessing the slots.
+ * The producer publishes the slot content before the tail with release semantics,
+ * and the consumer reads the tail with acquire semantics before reading the slot.
+ */
+#ifdef _WINDOWS
+#define PICOQUIC_SPSC_LOAD(x) ((uint64_t)InterlockedCompareExchange64((volatile LONG64*)&(x), 0, 0))
+#define PICOQUIC_SPSC_STORE(x, v) ((void)InterlockedExchange64((volatile LONG64*)&(x), (LONG64)(v)))
+#define PICOQUIC_SPSC_FENCE() MemoryBarrier()
+#else
+#define PICOQUIC_SPSC_LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define PICOQUIC_SPSC_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define PICOQUIC_SPSC_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+int picoquic_spsc_queue_init(picoquic_spsc_queue_t* queue, size_t nb_items_min)
+{
+    int ret = 0;
+    size_t nb_items = 2;
+
+    while (nb_items < nb_items_min) {
+        nb_items *= 2;
+    }
+
+    memset(queue, 0, sizeof(picoquic_spsc_queue_t));
+    queue->items = (void**)malloc(nb_items * sizeof(void*));
+    if (queue->items == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        memset(queue->items, 0, nb_items * sizeof(void*));
+        queue->mask = (uint64_t)(nb_items - 1);
+    }
+
+    return ret;
+}
+
+void picoquic_spsc_queue_release(picoquic_spsc_queue_t* queue)
+{
+    if (queue->items != NULL) {
+        free(queue->items);
+    }
+    memset(queue, 0, sizeof(picoquic_spsc_queue_t));
+}
+
+int picoquic_spsc_queue_push(picoquic_spsc_queue_t* queue, void* item)
+{
+    int ret = 0;
+    uint64_t tail = queue->tail;
+
+    if (tail - PICOQUIC_SPSC_LOAD(queue->head) > queue->mask) {
+        ret = -1;
+    }
+    else {
+        queue->items[tail & queue->mask] = item;
+        PICOQUIC_SPSC_STORE(queue->tail, tail + 1);
+    }
+
+    return ret;
+}
+
+void* picoquic_spsc_queue_pop(picoquic_spsc_queue_t* queue)
+{
+    void* item = NULL;
+    uint64_t head = queue->head;
+
+    if (head != PICOQUIC_SPSC_LOAD(queue->tail)) {
+        item = queue->items[head & queue->mask];
+        PICOQUIC_SPSC_STORE(queue->head, head + 1);
+    }
+
+    return item;
+}
+
+/* Only reliable when called by the consumer */
+int picoquic_spsc_queue_is_empty(picoquic_spsc_queue_t* queue)
+{
+    return queue->head == PICOQUIC_SPSC_LOAD(queue->tail);
+}
+
+int picoquic_spsc_queue_push_ex(picoquic_spsc_queue_t* queue, void* item, int* was_empty)
+{
+    int ret = picoquic_spsc_queue_push(queue, item);
+
+    *was_empty = 0;
+    if (ret == 0) {
+        uint64_t tail = queue->tail;
+
+        /* The consumer may already have popped the new item */
+        PICOQUIC_SPSC_FENCE();
+        *was_empty = (tail - PICOQUIC_SPSC_LOAD(queue->head) <= 1);
+    }
+
+    return ret;
+}
+
+/* Only called by the consumer, after popping all the items */
+int picoquic_spsc_queue_is_drained(picoquic_spsc_queue_t* queue)
+{
+    PICOQUIC_SPSC_FENCE();
+    return picoquic_spsc_queue_is_empty(queue);
+}
+
+/* Pool of worker threads.
+ * Queued and completed jobs are kept in two lists protected by the same mutex.
+ * Idle workers wait on the queue event, with a short time out in case a signal
+ * is missed between the test of the queue and the wait. The done event is
+ * signalled after each completion.
+ */
+#define PICOQUIC_WORKER_POOL_IDLE_WAIT 1000
+
+struct st_picoquic_worker_pool_t {
+    picoquic_mutex_t mutex;
+    picoquic_event_t queue_event;
+    picoquic_event_t done_event;
+    picoquic_worker_job_t* first_queued;
+    picoquic_worker_job_t* last_queued;
+    picoquic_worker_job_t* first_done;
+    picoquic_worker_job_t* last_done;
+    int nb_threads;
+    picoquic_thread_t* threads;
+    volatile int is_closing;
+};
+
+static picoquic_thread_return_t picoquic_worker_pool_thread(void* v_pool)
+{
+    picoquic_worker_pool_t* pool = (picoquic_worker_pool_t*)v_pool;
+
+    while (!pool->is_closing) {
+        picoquic_worker_job_t* job;
+
+        (void)picoquic_lock_mutex(&pool->mutex);
+        job = pool->first_queued;
+        if (job != NULL) {
+            pool->first_queued = job->next_job;
+            if (pool->first_queued == NULL) {
+                pool->last_queued = NULL;
+            }
+        }
+        (void)picoquic_unlock_mutex(&pool->mutex);
+
+        if (job == NULL) {
+            (void)picoquic_wait_for_event(&pool->queue_event, PICOQUIC_WORKER_POOL_IDLE_WAIT);
+        }
+        else {
+            job->job_fn(job);
+
+            (void)picoquic_lock_mutex(&pool->mutex);
+            job->next_job = NULL;
+            job->is_done = 1;
+            if (pool->last_done == NULL) {
+                pool->first_done = job;
+            }
+            else {
+                pool->last_done->next_job = job;
+            }
+            pool->last_done = job;
+            (void)picoquic_unlock_mutex(&pool->mutex);
+            (void)picoquic_signal_event(&pool->done_event);
+        }
+    }
+
+    picoquic_thread_do_return;
+}
+
+picoquic_worker_pool_t* picoquic_worker_pool_create(int nb_threads)
+{
+    picoquic_worker_pool_t* pool = NULL;
+
+    if (nb_threads > 0 && (pool = (picoquic_worker_pool_t*)malloc(sizeof(picoquic_worker_pool_t))) != NULL) {
+        int ret = 0;
+
+        memset(pool, 0, sizeof(picoquic_worker_pool_t));
+        if (picoquic_create_mutex(&pool->mutex) != 0) {
+            free(pool);
+            pool = NULL;
+        }
+        else if (picoquic_create_event(&pool->queue_event) != 0) {
+            (void)picoquic_delete_mutex(&pool->mutex);
+            free(pool);
+            pool = NULL;
+        }
+        else if (picoquic_create_event(&pool->done_event) != 0) {
+            picoquic_delete_event(&pool->queue_event);
+            (void)picoquic_delete_mutex(&pool->mutex);
+            free(pool);
+            pool = NULL;
+        }
+        else if ((pool->threads = (picoquic_thread_t*)malloc(nb_threads * sizeof(picoquic_thread_t))) == NULL) {
+            ret = -1;
+        }
+        else {
+            while (pool->nb_threads < nb_threads && ret == 0) {
+                if ((ret = picoquic_create_thread(&pool->threads[pool->nb_threads], picoquic_worker_pool_thread, pool)) == 0) {
+                    pool->nb_threads++;
+                }
+            }
+        }
+
+        if (ret != 0) {
+            picoquic_worker_pool_delete(pool);
+            pool = NULL;
+        }
+    }
+
+    return pool;
+}
+
+/* The pool shall only be deleted when no job is queued or running. */
+void picoquic_worker_pool_delete(picoquic_worker_pool_t* pool)
+{
+    pool->is_closing = 1;
+    for (int i = 0; i < pool->nb_threads; i++) {
+        (void)picoquic_signal_event(&pool->queue_event);
+    }
+    for (int i = 0; i < pool->nb_threads; i++) {
+        picoquic_delete_thread(&pool->threads[i]);
+    }
+    if (pool->threads != NULL) {
+        free(pool->threads);
+    }
+    picoquic_delete_event(&pool->done_event);
+    picoquic_delete_event(&pool->queue_event);
+    (void)picoquic_delete_mutex(&pool->mutex);
+    free(pool);
+}
+
+void picoquic_worker_pool_submit(picoquic_worker_pool_t* pool, picoquic_worker_job_t* job)
+{
+    job->next_job = NULL;
+    job->is_done = 0;
+
+    (void)picoquic_lock_mutex(&pool->mutex);
+    if (pool->last_queued == NULL) {
+        pool->first_queued = job;
+    }
+    else {
+        pool->last_queued->next_job = job;
+    }
+    pool->last_queued = job;
+    (void)picoquic_unlock_mutex(&pool->mutex);
+    (void)picoquic_signal_event(&pool->queue_event);
+}
+
+/* Remove the oldest completed job from the list of completed jobs, or return NULL. */
+picoquic_worker_job_t* picoquic_worker_pool_next_done(picoquic_worker_pool_t* pool)
+{
+    picoquic_worker_job_t* job;
+
+    (void)picoquic_lock_mutex(&pool->mutex);
+    job = pool->first_done;
+    if (job != NULL) {
+        pool->first_done = job->next_job;
+        if (pool->first_done == NULL) {
+            pool->last_done = NULL;
+        }
+        job->next_job = NULL;
+    }
+    (void)picoquic_unlock_mutex(&pool->mutex);
+
+    return job;
+}
+
+/* Wait until a submitted job is complete, then remove it from the list of
+ * completed jobs. Used when the owner must release the job's resources
+ * before the completion is processed, e.g., when deleting a connection.
+ */
+void picoquic_worker_pool_wait_job(picoquic_worker_pool_t* pool, picoquic_worker_job_t* job)
+{
+    int is_removed = 0;
+
+    while (!is_removed) {
+        (void)picoquic_lock_mutex(&pool->mutex);
+        if (job->is_done) {
+            picoquic_worker_job_t* previous = NULL;
+            picoquic_worker_job_t* next = pool->first_done;
+
+            while (next != NULL && next != job) {
+                previous = next;
+                next = next->next_job;
+            }
+            if (next != NULL) {
+                if (previous == NULL) {
+                    pool->first_done = job->next_job;
+                }
+                else {
+                    previous->next_job = job->next_job;
+                }
+                if (pool->last_done == job) {
+                    pool->last_done = previous;
+                }
+                job->next_job = NULL;
+            }
+            is_removed = 1;
+        }
+        (void)picoquic_unlock_mutex(&pool->mutex);
+
+        if (!is_removed) {
+            (void)picoquic_wait_for_event(&pool->done_event, PICOQUIC_WORKER_POOL_IDLE_WAIT);
+        }
+    }
+}
+
+/* Wait until at least one job is complete, or until the delay expires.
+ * Returns 0 if a completed job is available. */
+int picoquic_worker_pool_wait_done(picoquic_worker_pool_t* pool, uint64_t microsec_wait)
+{
+    int ret;
+
+    (void)picoquic_lock_mutex(&pool->mutex);
+    ret = (pool->first_done == NULL) ? -1 : 0;
+    (void)picoquic_unlock_mutex(&pool->mutex);
+
+    if (ret != 0) {
+        (void)picoquic_wait_for_event(&pool->done_event, microsec_wait);
+
+        (void)picoquic_lock_mutex(&pool->mutex);
+        ret = (pool->first_done == NULL) ? -1 : 0;
+        (void)picoquic_unlock_mutex(&pool->mutex);
+    }
+
+    return ret;
+}
+
+/* Background writer for log files.
+ * The owner thread pushes records through a single producer, single consumer
+ * queue, and the writer thread appends them to their files. Once a file has been
+ * handed to the writer, it is only accessed by the writer thread, including when
+ * it is closed. Records of the default size are returned to the owner through a
+ * second queue and reused, so the logging path does not allocate memory in the
+ * steady state. The writer polls the queue when idle; the owner only signals it
+ * when the queue is filling up, or when waiting for it.
+ * Records may be produced by several threads, e.g., the owner and the TLS
+ * workers, so the producer side of the queues is serialized by a mutex. The
+ * writer thread does not take the mutex.
+ */
+#define PICOQUIC_FILE_WRITER_IDLE_WAIT 1000
+#define PICOQUIC_FILE_WRITER_RECORD_SIZE 512
+
+typedef struct st_picoquic_file_record_t {
+    FILE* F;
+    size_t length;
+    size_t capacity;
+    int is_close;
+} picoquic_file_record_t;
+
+struct st_picoquic_file_writer_t {
+    picoquic_spsc_queue_t queue;
+    picoquic_spsc_queue_t free_queue;
+    picoquic_event_t queue_event;
+    picoquic_event_t done_event;
+    picoquic_mutex_t producer_mutex;
+    picoquic_thread_t thread;
+    size_t nb_records_max;
+    uint64_t nb_queued;
+    volatile uint64_t nb_written;
+    uint64_t nb_dropped;
+    int block_if_full;
+    int is_mutex_created;
+    int is_thread_created;
+    volatile int is_closing;
+};
+
+static void picoquic_file_writer_process(picoquic_file_writer_t* writer, picoquic_file_record_t* record)
+{
+    if (record->length > 0) {
+        (void)fwrite((uint8_t*)(record + 1), record->length, 1, record->F);
+    }
+    if (record->is_close) {
+        (void)picoquic_file_close(record->F);
+    }
+    if (record->capacity != PICOQUIC_FILE_WRITER_RECORD_SIZE ||
+        picoquic_spsc_queue_push(&writer->free_queue, record) != 0) {
+        free(record);
+    }
+    writer->nb_written++;
+}
+
+static picoquic_thread_return_t picoquic_file_writer_thread(void* v_writer)
+{
+    picoquic_file_writer_t* writer = (picoquic_file_writer_t*)v_writer;
+    int is_closing = 0;
+
+    while (!is_closing) {
+        picoquic_file_record_t* record;
+
+        is_closing = writer->is_closing;
+        while ((record = (picoquic_file_record_t*)picoquic_spsc_queue_pop(&writer->queue)) != NULL) {
+            picoquic_file_writer_process(writer, record);
+        }
+        (void)picoquic_signal_event(&writer->done_event);
+        if (!is_closing) {
+            (void)picoquic_wait_for_event(&writer->queue_event, PICOQUIC_FILE_WRITER_IDLE_WAIT);
+        }
+    }
+
+    picoquic_thread_do_return;
+}
+
+picoquic_file_writer_t* picoquic_file_writer_create(size_t nb_records_max, int block_if_full)
+{
+    picoquic_file_writer_t* writer = NULL;
+
+    if (nb_records_max > 0 && (writer = (picoquic_file_writer_t*)malloc(sizeof(picoquic_file_writer_t))) != NULL) {
+        memset(writer, 0, sizeof(picoquic_file_writer_t));
+        writer->nb_records_max = nb_records_max;
+        writer->block_if_full = block_if_full;
+
+        if (picoquic_create_event(&writer->queue_event) != 0) {
+            free(writer);
+            writer = NULL;
+        }
+        else if (picoquic_create_event(&writer->done_event) != 0) {
+            picoquic_delete_event(&writer->queue_event);
+            free(writer);
+            writer = NULL;
+        }
+        else if (picoquic_create_mutex(&writer->producer_mutex) != 0) {
+            picoquic_delete_event(&writer->done_event);
+            picoquic_delete_event(&writer->queue_event);
+            free(writer);
+            writer = NULL;
+        }
+        else {
+            writer->is_mutex_created = 1;
+            if (picoquic_spsc_queue_init(&writer->queue, nb_records_max) != 0 ||
+                picoquic_spsc_queue_init(&writer->free_queue, nb_records_max) != 0 ||
+                picoquic_create_thread(&writer->thread, picoquic_file_writer_thread, writer) != 0) {
+                picoquic_file_writer_delete(writer);
+                writer = NULL;
+            }
+            else {
+                writer->is_thread_created = 1;
+            }
+        }
+    }
+
+    return writer;
+}
+
+/* Stop the thread, then write the records that are still queued. */
+void picoquic_file_writer_delete(picoquic_file_writer_t* writer)
+{
+    picoquic_file_record_t* record;
+
+    if (writer->is_thread_created) {
+        writer->is_closing = 1;
+        (void)picoquic_signal_event(&writer->queue_event);
+        picoquic_delete_thread(&writer->thread);
+    }
+    if (writer->queue.items != NULL) {
+        while ((record = (picoquic_file_record_t*)picoquic_spsc_queue_pop(&writer->queue)) != NULL) {
+            picoquic_file_writer_process(writer, record);
+        }
+    }
+    if (writer->free_queue.items != NULL) {
+        while ((record = (picoquic_file_record_t*)picoquic_spsc_queue_pop(&writer->free_queue)) != NULL) {
+            free(record);
+        }
+    }
+    picoquic_spsc_queue_release(&writer->free_queue);
+    picoquic_spsc_queue_release(&writer->queue);
+    picoquic_delete_event(&writer->done_event);
+    picoquic_delete_event(&writer->queue_event);
+    if (writer->is_mutex_created) {
+        (void)picoquic_delete_mutex(&writer->producer_mutex);
+    }
+    free(writer);
+}
+
+static int picoquic_file_writer_push(picoquic_file_writer_t* writer, FILE* F, const uint8_t* bytes, size_t length, int is_close)
+{
+    int ret = 0;
+    picoquic_file_record_t* record = NULL;
+
+    (void)picoquic_lock_mutex(&writer->producer_mutex);
+
+    if (length <= PICOQUIC_FILE_WRITER_RECORD_SIZE) {
+        record = (picoquic_file_record_t*)picoquic_spsc_queue_pop(&writer->free_queue);
+    }
+    if (record == NULL) {
+        size_t capacity = (length > PICOQUIC_FILE_WRITER_RECORD_SIZE) ? length : PICOQUIC_FILE_WRITER_RECORD_SIZE;
+
+        if ((record = (picoquic_file_record_t*)malloc(sizeof(picoquic_file_record_t) + capacity)) != NULL) {
+            record->capacity = capacity;
+        }
+    }
+
+    if (record == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+        if (is_close) {
+            /* The file must be closed anyway. Do it here once the writer is done with it. */
+            picoquic_file_writer_wait_mark(writer, writer->nb_queued);
+            if (length > 0) {
+                (void)fwrite(bytes, length, 1, F);
+            }
+            (void)picoquic_file_close(F);
+        }
+        else {
+            writer->nb_dropped++;
+        }
+    }
+    else {
+        record->F = F;
+        record->length = length;
+        record->is_close = is_close;
+        if (length > 0) {
+            memcpy((uint8_t*)(record + 1), bytes, length);
+        }
+
+        while (picoquic_spsc_queue_push(&writer->queue, record) != 0) {
+            if (!writer->block_if_full && !is_close) {
+                free(record);
+                record = NULL;
+                writer->nb_dropped++;
+                ret = -1;
+                break;
+            }
+            (void)picoquic_signal_event(&writer->queue_event);
+            (void)picoquic_wait_for_event(&writer->done_event, PICOQUIC_FILE_WRITER_IDLE_WAIT);
+        }
+
+        if (record != NULL) {
+            writer->nb_queued++;
+            if ((writer->nb_queued & 15) == 0 && writer->nb_queued - writer->nb_written >= writer->nb_records_max / 2) {
+                (void)picoquic_signal_event(&writer->queue_event);
+            }
+        }
+    }
+
+    (void)picoquic_unlock_mutex(&writer->producer_mutex);
+
+    return ret;
+}
+
+int picoquic_file_writer_write(picoquic_file_writer_t* writer, FILE* F, const uint8_t* bytes, size_t length)
+{
+    return picoquic_file_writer_push(writer, F, bytes, length, 0);
+}
+
+int picoquic_file_writer_close(picoquic_file_writer_t* writer, FILE* F, const uint8_t* bytes, size_t length)
+{
+    return picoquic_file_writer_push(writer, F, bytes, length, 1);
+}
+
+/* Wait until all the queued records are written */
+void picoquic_file_writer_flush(picoquic_file_writer_t* writer)
+{
+    picoquic_file_writer_wait_mark(writer, picoquic_file_writer_mark(writer));
+}
+
+/* The mark is the number of records queued so far. It can be passed to
+ * another thread, which waits until all the records queued before the mark
+ * have been written. */
+uint64_t picoquic_file_writer_mark(picoquic_file_writer_t* writer)
+{
+    uint64_t mark;
+
+    (void)picoquic_lock_mutex(&writer->producer_mutex);
+    mark = writer->nb_queued;
+    (void)picoquic_unlock_mutex(&writer->producer_mutex);
+
+    return mark;
+}
+
+void picoquic_file_writer_wait_mark(picoquic_file_writer_t* writer, uint64_t mark)
+{
+    while (writer->nb_written < mark) {
+        (void)picoquic_signal_event(&writer->queue_event);
+        (void)picoquic_wait_for_event(&writer->done_event, PICOQUIC_FILE_WRITER_IDLE_WAIT);
+    }
+}
+
+uint64_t picoquic_file_writer_nb_dropped(picoquic_file_writer_t* writer)
+{
+    return writer->nb_dropped;
+}
+
 /* Pseudo random generation suitable for tests. Guaranties that the
 * same seed will produce the same sequence, allows for specific
 * random sequence for a given test.
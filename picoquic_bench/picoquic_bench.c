@@ -0,0 +1,503 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2024, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Micro benchmark of the per packet processing functions: AEAD encryption and
+ * decryption, header protection, creation of packet headers, and parsing and
+ * decryption of incoming packets. Each function is measured for each of the
+ * supported cipher suites, with and without the "low memory" option, and for
+ * several packet sizes. The results are written as CSV lines, with one line
+ * per measurement:
+ *
+ *     function,suite,low_memory,packet_size,nb_iterations,ns_per_packet,cycles_per_byte
+ *
+ * The cycle count is only available on x86 platforms, where it is read with
+ * the time stamp counter. It is reported as 0 on other platforms.
+ *
+ * The benchmark does not run a handshake. It creates a client connection,
+ * installs 1-RTT keys derived from a fixed secret in both directions, and
+ * sets the remote CID equal to the local CID, so that the packets created by
+ * the connection can be parsed and decrypted by the same connection.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+#include "tls_api.h"
+#ifdef _WINDOWS
+#include "../picoquicfirst/getopt.h"
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define PICOQUIC_BENCH_HAS_CYCLES
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PICOQUIC_BENCH_HAS_CYCLES
+#endif
+
+#define PICOQUIC_BENCH_DEFAULT_ITERATIONS 100000
+#define PICOQUIC_BENCH_MP_PATH_ID 1
+#define PICOQUIC_BENCH_SECRET_SIZE 64
+
+typedef struct st_picoquic_bench_suite_t {
+    int cipher_suite_id;
+    char const* name;
+} picoquic_bench_suite_t;
+
+static const picoquic_bench_suite_t bench_suites[] = {
+    { 128, "aes128gcm" },
+    { 256, "aes256gcm" },
+    { 20, "chacha20" }
+};
+
+static const size_t nb_bench_suites = sizeof(bench_suites) / sizeof(picoquic_bench_suite_t);
+
+static const size_t bench_packet_sizes[] = { 64, 256, 1252, 1440 };
+
+static const size_t nb_bench_packet_sizes = sizeof(bench_packet_sizes) / sizeof(size_t);
+
+typedef struct st_picoquic_bench_ctx_t {
+    FILE* F;
+    uint64_t nb_iterations;
+    picoquic_quic_t* quic;
+    picoquic_cnx_t* cnx;
+    picoquic_crypto_context_t* crypto_context;
+    struct sockaddr_in addr;
+    char const* suite_name;
+    int use_low_memory;
+    size_t packet_size;
+    size_t header_length;
+    size_t pn_offset;
+    size_t packet_length;
+    size_t packet_length_mp;
+    picoquic_packet_header ph;
+    picoquic_stream_data_node_t* decrypted;
+    uint8_t plain[PICOQUIC_MAX_PACKET_SIZE];
+    uint8_t output[PICOQUIC_MAX_PACKET_SIZE];
+    uint8_t encrypted[PICOQUIC_MAX_PACKET_SIZE];
+    uint8_t encrypted_mp[PICOQUIC_MAX_PACKET_SIZE];
+    uint8_t decoded[PICOQUIC_MAX_PACKET_SIZE];
+    uint8_t packet[PICOQUIC_MAX_PACKET_SIZE];
+    uint8_t packet_mp[PICOQUIC_MAX_PACKET_SIZE];
+    uint8_t header[PICOQUIC_MAX_PACKET_SIZE];
+} picoquic_bench_ctx_t;
+
+/* Each benchmark function processes one packet, and returns a value that is
+ * accumulated by the caller, so the compiler cannot optimize the call away.
+ */
+typedef size_t (*picoquic_bench_fn)(picoquic_bench_ctx_t* bench_ctx, uint64_t i);
+
+static uint64_t picoquic_bench_cycles()
+{
+#ifdef PICOQUIC_BENCH_HAS_CYCLES
+    return (uint64_t)__rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static size_t picoquic_bench_payload_length(picoquic_bench_ctx_t* bench_ctx)
+{
+    return bench_ctx->packet_size - bench_ctx->header_length -
+        picoquic_aead_get_checksum_length(bench_ctx->crypto_context->aead_encrypt);
+}
+
+static size_t picoquic_bench_aead_encrypt(picoquic_bench_ctx_t* bench_ctx, uint64_t i)
+{
+    return picoquic_aead_encrypt_generic(bench_ctx->output + bench_ctx->header_length,
+        bench_ctx->plain + bench_ctx->header_length, picoquic_bench_payload_length(bench_ctx),
+        i, bench_ctx->plain, bench_ctx->header_length, bench_ctx->crypto_context->aead_encrypt);
+}
+
+static size_t picoquic_bench_aead_encrypt_mp(picoquic_bench_ctx_t* bench_ctx, uint64_t i)
+{
+    return picoquic_aead_encrypt_mp(bench_ctx->output + bench_ctx->header_length,
+        bench_ctx->plain + bench_ctx->header_length, picoquic_bench_payload_length(bench_ctx),
+        PICOQUIC_BENCH_MP_PATH_ID, i, bench_ctx->plain, bench_ctx->header_length,
+        bench_ctx->crypto_context->aead_encrypt);
+}
+
+static size_t picoquic_bench_aead_decrypt(picoquic_bench_ctx_t* bench_ctx, uint64_t i)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(i);
+#endif
+    return picoquic_aead_decrypt_generic(bench_ctx->decoded + bench_ctx->header_length,
+        bench_ctx->encrypted + bench_ctx->header_length, bench_ctx->packet_size - bench_ctx->header_length,
+        0, bench_ctx->plain, bench_ctx->header_length, bench_ctx->crypto_context->aead_decrypt);
+}
+
+static size_t picoquic_bench_aead_decrypt_mp(picoquic_bench_ctx_t* bench_ctx, uint64_t i)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(i);
+#endif
+    return picoquic_aead_decrypt_mp(bench_ctx->decoded + bench_ctx->header_length,
+        bench_ctx->encrypted_mp + bench_ctx->header_length, bench_ctx->packet_size - bench_ctx->header_length,
+        PICOQUIC_BENCH_MP_PATH_ID, 0, bench_ctx->plain, bench_ctx->header_length,
+        bench_ctx->crypto_context->aead_decrypt);
+}
+
+static size_t picoquic_bench_pn_encrypt(picoquic_bench_ctx_t* bench_ctx, uint64_t i)
+{
+    uint8_t mask_bytes[5] = { 0, 0, 0, 0, 0 };
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(i);
+#endif
+
+    picoquic_pn_encrypt(bench_ctx->crypto_context->pn_enc, bench_ctx->packet + bench_ctx->pn_offset + 4,
+        mask_bytes, mask_bytes, sizeof(mask_bytes));
+
+    return mask_bytes[0];
+}
+
+static size_t picoquic_bench_create_packet_header(picoquic_bench_ctx_t* bench_ctx, uint64_t i)
+{
+    size_t pn_offset = 0;
+    size_t pn_length = 0;
+
+    return picoquic_create_packet_header(bench_ctx->cnx, picoquic_packet_1rtt_protected, i,
+        bench_ctx->cnx->path[0], bench_ctx->header_length, bench_ctx->header, &pn_offset, &pn_length);
+}
+
+static size_t picoquic_bench_remove_header_protection(picoquic_bench_ctx_t* bench_ctx, uint64_t i)
+{
+    picoquic_packet_header ph = bench_ctx->ph;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(i);
+#endif
+
+    (void)picoquic_remove_header_protection(bench_ctx->cnx, bench_ctx->packet, bench_ctx->decoded, &ph);
+
+    return (size_t)ph.pn;
+}
+
+static size_t picoquic_bench_parse_and_decrypt(picoquic_bench_ctx_t* bench_ctx, uint8_t* packet, size_t packet_length)
+{
+    picoquic_packet_header ph;
+    picoquic_cnx_t* cnx = NULL;
+    size_t consumed = 0;
+    int new_ctx_created = 0;
+    int ret = picoquic_parse_header_and_decrypt(bench_ctx->quic, packet, packet_length, packet_length,
+        (struct sockaddr*)&bench_ctx->addr, 0, bench_ctx->decrypted, &ph, &cnx, &consumed, &new_ctx_created);
+
+    return (ret == 0) ? ph.payload_length : 0;
+}
+
+static size_t picoquic_bench_parse_header_and_decrypt(picoquic_bench_ctx_t* bench_ctx, uint64_t i)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(i);
+#endif
+    return picoquic_bench_parse_and_decrypt(bench_ctx, bench_ctx->packet, bench_ctx->packet_length);
+}
+
+static size_t picoquic_bench_parse_header_and_decrypt_mp(picoquic_bench_ctx_t* bench_ctx, uint64_t i)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(i);
+#endif
+    return picoquic_bench_parse_and_decrypt(bench_ctx, bench_ctx->packet_mp, bench_ctx->packet_length_mp);
+}
+
+/* Run a benchmark function for the specified number of iterations, after a
+ * shorter warm up run, and write the result line. The number of bytes is
+ * used to compute the cycles per byte.
+ */
+static void picoquic_bench_run(picoquic_bench_ctx_t* bench_ctx, char const* fn_name, picoquic_bench_fn fn, size_t nb_bytes)
+{
+    uint64_t nb_warm_up = bench_ctx->nb_iterations / 10;
+    uint64_t start_time;
+    uint64_t start_cycles;
+    uint64_t elapsed_time;
+    uint64_t elapsed_cycles;
+    size_t check = 0;
+    double ns_per_packet;
+    double cycles_per_byte = 0;
+
+    for (uint64_t i = 0; i < nb_warm_up; i++) {
+        check += fn(bench_ctx, i);
+    }
+
+    start_time = picoquic_current_time();
+    start_cycles = picoquic_bench_cycles();
+    for (uint64_t i = 0; i < bench_ctx->nb_iterations; i++) {
+        check += fn(bench_ctx, i);
+    }
+    elapsed_cycles = picoquic_bench_cycles() - start_cycles;
+    elapsed_time = picoquic_current_time() - start_time;
+
+    ns_per_packet = ((double)elapsed_time * 1000.0) / (double)bench_ctx->nb_iterations;
+    if (nb_bytes > 0) {
+        cycles_per_byte = (double)elapsed_cycles / ((double)bench_ctx->nb_iterations * (double)nb_bytes);
+    }
+
+    fprintf(bench_ctx->F, "%s,%s,%d,%zu,%" PRIu64 ",%.2f,%.3f\n", fn_name, bench_ctx->suite_name,
+        bench_ctx->use_low_memory, nb_bytes, bench_ctx->nb_iterations, ns_per_packet, cycles_per_byte);
+    if (check == 0) {
+        /* Keep the result alive. Only useful if all calls failed. */
+        fflush(bench_ctx->F);
+    }
+}
+
+/* Prepare a protected 1-RTT packet, as the sender would, so that it can be
+ * used as input by the header protection and decryption benchmarks.
+ */
+static size_t picoquic_bench_protect_packet(picoquic_bench_ctx_t* bench_ctx, uint8_t* packet, uint64_t sequence_number)
+{
+    size_t pn_offset = 0;
+    size_t pn_length = 0;
+    size_t h_length = picoquic_create_packet_header(bench_ctx->cnx, picoquic_packet_1rtt_protected, sequence_number,
+        bench_ctx->cnx->path[0], bench_ctx->header_length, packet, &pn_offset, &pn_length);
+    size_t length;
+    uint8_t mask_bytes[5] = { 0, 0, 0, 0, 0 };
+
+    if (bench_ctx->cnx->is_multipath_enabled) {
+        length = picoquic_aead_encrypt_mp(packet + h_length, bench_ctx->plain + h_length,
+            picoquic_bench_payload_length(bench_ctx), bench_ctx->cnx->path[0]->p_remote_cnxid->sequence,
+            sequence_number, packet, h_length, bench_ctx->crypto_context->aead_encrypt);
+    }
+    else {
+        length = picoquic_aead_encrypt_generic(packet + h_length, bench_ctx->plain + h_length,
+            picoquic_bench_payload_length(bench_ctx), sequence_number, packet, h_length,
+            bench_ctx->crypto_context->aead_encrypt);
+    }
+    length += h_length;
+
+    picoquic_pn_encrypt(bench_ctx->crypto_context->pn_enc, packet + pn_offset + 4, mask_bytes, mask_bytes, sizeof(mask_bytes));
+    packet[0] ^= (mask_bytes[0] & 0x1F);
+    for (size_t i = 0; i < pn_length; i++) {
+        packet[pn_offset + i] ^= mask_bytes[i + 1];
+    }
+    bench_ctx->pn_offset = pn_offset;
+
+    return length;
+}
+
+static int picoquic_bench_prepare(picoquic_bench_ctx_t* bench_ctx, size_t packet_size)
+{
+    int ret = 0;
+    picoquic_cnx_t* cnx_found = NULL;
+    size_t pn_length = 0;
+    size_t payload_length;
+
+    bench_ctx->packet_size = packet_size;
+    bench_ctx->header_length = picoquic_create_packet_header(bench_ctx->cnx, picoquic_packet_1rtt_protected, 0,
+        bench_ctx->cnx->path[0], 0, bench_ctx->plain, &bench_ctx->pn_offset, &pn_length);
+    for (size_t i = bench_ctx->header_length; i < packet_size; i++) {
+        bench_ctx->plain[i] = (uint8_t)i;
+    }
+    /* Prepare the input of the decryption benchmarks, using sequence number 0 */
+    payload_length = picoquic_bench_payload_length(bench_ctx);
+    (void)picoquic_aead_encrypt_generic(bench_ctx->encrypted + bench_ctx->header_length,
+        bench_ctx->plain + bench_ctx->header_length, payload_length, 0,
+        bench_ctx->plain, bench_ctx->header_length, bench_ctx->crypto_context->aead_encrypt);
+    (void)picoquic_aead_encrypt_mp(bench_ctx->encrypted_mp + bench_ctx->header_length,
+        bench_ctx->plain + bench_ctx->header_length, payload_length, PICOQUIC_BENCH_MP_PATH_ID, 0,
+        bench_ctx->plain, bench_ctx->header_length, bench_ctx->crypto_context->aead_encrypt);
+    /* Prepare protected packets for the single path and multipath variants */
+    bench_ctx->packet_length = picoquic_bench_protect_packet(bench_ctx, bench_ctx->packet, 1);
+    bench_ctx->cnx->is_multipath_enabled = 1;
+    bench_ctx->packet_length_mp = picoquic_bench_protect_packet(bench_ctx, bench_ctx->packet_mp, 1);
+    bench_ctx->cnx->is_multipath_enabled = 0;
+    /* Parse the clear text part of the header, as done before removing the header protection */
+    memset(&bench_ctx->ph, 0, sizeof(picoquic_packet_header));
+    if (picoquic_parse_packet_header(bench_ctx->quic, bench_ctx->packet, bench_ctx->packet_length,
+        (struct sockaddr*)&bench_ctx->addr, &bench_ctx->ph, &cnx_found, 1) != 0 || cnx_found != bench_ctx->cnx) {
+        ret = -1;
+    }
+    else if (picoquic_bench_parse_header_and_decrypt(bench_ctx, 0) == 0) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static int picoquic_bench_suite(picoquic_bench_ctx_t* bench_ctx, const picoquic_bench_suite_t* suite, int use_low_memory)
+{
+    int ret = 0;
+    uint8_t secret[PICOQUIC_BENCH_SECRET_SIZE];
+
+    for (size_t i = 0; i < sizeof(secret); i++) {
+        secret[i] = (uint8_t)(i + 1);
+    }
+    bench_ctx->suite_name = suite->name;
+    bench_ctx->use_low_memory = use_low_memory;
+    picoquic_crypto_context_free(bench_ctx->crypto_context);
+    ret = picoquic_set_crypto_context_for_test(bench_ctx->crypto_context, suite->cipher_suite_id, use_low_memory,
+        secret, picoquic_supported_versions[bench_ctx->cnx->version_index].tls_prefix_label);
+
+    if (ret != 0) {
+        fprintf(stderr, "Cipher suite %s is not available, low memory = %d\n", suite->name, use_low_memory);
+    }
+    else {
+        for (size_t i = 0; ret == 0 && i < nb_bench_packet_sizes; i++) {
+            size_t packet_size = bench_packet_sizes[i];
+
+            if ((ret = picoquic_bench_prepare(bench_ctx, packet_size)) != 0) {
+                fprintf(stderr, "Cannot prepare %zu bytes packets with %s\n", packet_size, suite->name);
+            }
+            else {
+                picoquic_bench_run(bench_ctx, "aead_encrypt_generic", picoquic_bench_aead_encrypt, packet_size);
+                picoquic_bench_run(bench_ctx, "aead_encrypt_mp", picoquic_bench_aead_encrypt_mp, packet_size);
+                picoquic_bench_run(bench_ctx, "aead_decrypt_generic", picoquic_bench_aead_decrypt, packet_size);
+                picoquic_bench_run(bench_ctx, "aead_decrypt_mp", picoquic_bench_aead_decrypt_mp, packet_size);
+                picoquic_bench_run(bench_ctx, "parse_header_and_decrypt", picoquic_bench_parse_header_and_decrypt, packet_size);
+                bench_ctx->cnx->is_multipath_enabled = 1;
+                picoquic_bench_run(bench_ctx, "parse_header_and_decrypt_mp", picoquic_bench_parse_header_and_decrypt_mp, packet_size);
+                bench_ctx->cnx->is_multipath_enabled = 0;
+            }
+        }
+        if (ret == 0) {
+            /* The cost of these functions does not depend on the packet size.
+             * The size reported is that of the header, or of the protection mask. */
+            picoquic_bench_run(bench_ctx, "pn_encrypt", picoquic_bench_pn_encrypt, 5);
+            picoquic_bench_run(bench_ctx, "create_packet_header", picoquic_bench_create_packet_header, bench_ctx->header_length);
+            picoquic_bench_run(bench_ctx, "remove_header_protection", picoquic_bench_remove_header_protection, bench_ctx->header_length);
+        }
+    }
+
+    return ret;
+}
+
+static int picoquic_bench_init(picoquic_bench_ctx_t* bench_ctx)
+{
+    int ret = 0;
+    uint64_t current_time = picoquic_current_time();
+
+    bench_ctx->addr.sin_family = AF_INET;
+    bench_ctx->addr.sin_port = htons(4433);
+    bench_ctx->quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, current_time, NULL, NULL, NULL, 0);
+
+    if (bench_ctx->quic == NULL) {
+        fprintf(stderr, "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else if ((bench_ctx->cnx = picoquic_create_cnx(bench_ctx->quic, picoquic_null_connection_id, picoquic_null_connection_id,
+        (struct sockaddr*)&bench_ctx->addr, current_time, 0, "test-sni", "test-alpn", 1)) == NULL) {
+        fprintf(stderr, "Cannot create connection\n");
+        ret = -1;
+    }
+    else if ((bench_ctx->decrypted = picoquic_stream_data_node_alloc(bench_ctx->quic)) == NULL) {
+        fprintf(stderr, "Cannot allocate decryption buffer\n");
+        ret = -1;
+    }
+    else {
+        /* Loop the connection onto itself: packets sent to the remote CID are received on the local CID */
+        bench_ctx->cnx->cnx_state = picoquic_state_ready;
+        bench_ctx->cnx->path[0]->p_remote_cnxid->cnx_id = bench_ctx->cnx->path[0]->p_local_cnxid->cnx_id;
+        bench_ctx->crypto_context = &bench_ctx->cnx->crypto_context[picoquic_epoch_1rtt];
+    }
+
+    return ret;
+}
+
+static void picoquic_bench_release(picoquic_bench_ctx_t* bench_ctx)
+{
+    if (bench_ctx->decrypted != NULL) {
+        picoquic_stream_data_node_recycle(bench_ctx->decrypted);
+        bench_ctx->decrypted = NULL;
+    }
+    if (bench_ctx->quic != NULL) {
+        picoquic_free(bench_ctx->quic);
+        bench_ctx->quic = NULL;
+    }
+}
+
+static int usage(char const* argv0)
+{
+    fprintf(stderr, "Micro benchmark of the packet protection functions\n");
+    fprintf(stderr, "Usage: %s [-n nb_iterations] [-o output.csv]\n", argv0);
+    fprintf(stderr, "  -n nb_iterations   Number of packets per measurement, default %d\n", PICOQUIC_BENCH_DEFAULT_ITERATIONS);
+    fprintf(stderr, "  -o output.csv      Write the results to the file instead of stdout\n");
+    fprintf(stderr, "  -h                 Print this help message\n");
+    return -1;
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 0;
+    int opt;
+    char const* out_file_name = NULL;
+    picoquic_bench_ctx_t* bench_ctx = (picoquic_bench_ctx_t*)malloc(sizeof(picoquic_bench_ctx_t));
+
+    if (bench_ctx == NULL) {
+        fprintf(stderr, "Fatal: cannot allocate the benchmark context.\n");
+        return -1;
+    }
+    memset(bench_ctx, 0, sizeof(picoquic_bench_ctx_t));
+    bench_ctx->nb_iterations = PICOQUIC_BENCH_DEFAULT_ITERATIONS;
+
+    while ((opt = getopt(argc, argv, "n:o:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            if ((bench_ctx->nb_iterations = (uint64_t)atoll(optarg)) == 0) {
+                fprintf(stderr, "Invalid number of iterations: %s\n", optarg);
+                ret = usage(argv[0]);
+            }
+            break;
+        case 'o':
+            out_file_name = optarg;
+            break;
+        case 'h':
+        default:
+            ret = usage(argv[0]);
+            break;
+        }
+    }
+
+    if (ret == 0) {
+        if (out_file_name == NULL) {
+            bench_ctx->F = stdout;
+        }
+        else if ((bench_ctx->F = picoquic_file_open(out_file_name, "w")) == NULL) {
+            fprintf(stderr, "Cannot open %s\n", out_file_name);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = picoquic_bench_init(bench_ctx);
+    }
+
+    if (ret == 0) {
+        fprintf(bench_ctx->F, "function,suite,low_memory,packet_size,nb_iterations,ns_per_packet,cycles_per_byte\n");
+        for (size_t i = 0; i < nb_bench_suites; i++) {
+            for (int use_low_memory = 0; use_low_memory <= 1; use_low_memory++) {
+                /* Suites that are not available on this platform are skipped */
+                (void)picoquic_bench_suite(bench_ctx, &bench_suites[i], use_low_memory);
+            }
+        }
+    }
+
+    picoquic_bench_release(bench_ctx);
+    if (bench_ctx->F != NULL && bench_ctx->F != stdout) {
+        (void)picoquic_file_close(bench_ctx->F);
+    }
+    free(bench_ctx);
+
+    return ret;
+}
@@ -46,10 +46,19 @@ static const picoquic_test_def_t test_table[] = {
     { "sprintf", util_sprintf_test },
     { "memcmp", util_memcmp_test },
     { "threading", util_threading_test },
+    { "spsc_queue", util_spsc_queue_test },
+    { "worker_pool", util_worker_pool_test },
+    { "file_writer", util_file_writer_test },
     { "picohash", picohash_test },
+    { "picohash_resize", picohash_resize_test },
+    { "picohash_shared", picohash_shared_test },
+    { "picohash_shared_bench", picohash_shared_bench_test },
     { "bytestream", bytestream_test },
     { "splay", splay_test },
+    { "wheel", wheel_test },
+    { "wheel_bench", wheel_bench_test },
     { "cnxcreation", cnxcreation_test },
+    { "packet_pool", packet_pool_test },
     { "parseheader", parseheadertest },
     { "incoming_initial", incoming_initial_test },
     { "header_length", header_length_test },
@@ -66,21 +75,28 @@ static const picoquic_test_def_t test_table[] = {
     { "StreamZeroFrame", StreamZeroFrameTest },
     { "stream_splay", stream_splay_test },
     { "stream_output", stream_output_test },
+    { "stream_priority", stream_priority_test },
+    { "memory_accounting", memory_accounting_test },
     { "stream_retransmit_copy", test_copy_for_retransmit },
     { "stream_retransmit_format", test_format_for_retransmit },
+    { "stream_retransmit_compact", test_compact_for_retransmitted },
     { "stateless_blowback", test_stateless_blowback },
     { "ack_send", sendacktest },
     { "ack_range", ackrange_test },
+    { "ack_vector", ackvector_test },
     { "ack_disorder", ack_disorder_test },
     { "ack_horizon", ack_horizon_test },
     { "ack_of_ack", ack_of_ack_test },
+    { "ack_index", ack_index_test },
     { "sim_link", sim_link_test },
     { "clear_text_aead", cleartext_aead_test },
     { "pn_ctr", pn_ctr_test },
     { "cleartext_pn_enc", cleartext_pn_enc_test },
     { "cid_for_lb", cid_for_lb_test },
     { "cid_for_lb_cli", cid_for_lb_cli_test },
+    { "cid_for_lb_packet", cid_for_lb_packet_test },
     { "retry_protection_vector", retry_protection_vector_test },
+    { "initial_salt_cache", initial_salt_cache_test },
     { "draft17_vector", draft17_vector_test },
     { "esni", esni_test },
     { "pn_enc_1rtt", pn_enc_1rtt_test },
@@ -89,6 +105,11 @@ static const picoquic_test_def_t test_table[] = {
     { "pacing", pacing_test },
     { "tls_api", tls_api_test },
     { "tls_api_inject_hs_ack", tls_api_inject_hs_ack_test },
+    { "incoming_batch", incoming_batch_test },
+    { "prepare_batch", prepare_batch_test },
+    { "prepare_batch_multi", prepare_batch_multi_test },
+    { "tls_worker", tls_worker_test },
+    { "tls_worker_large_hello", tls_worker_large_hello_test },
     { "null_sni", null_sni_test },
     { "silence_test", tls_api_silence_test },
     { "version_negotiation", tls_api_version_negotiation_test },
@@ -147,6 +168,10 @@ static const picoquic_test_def_t test_table[] = {
     { "nat_attack", nat_attack_test },
     { "sockets", socket_test },
     { "socket_ecn", socket_ecn_test },
+    { "socket_timestamp", socket_timestamp_test },
+    { "sockloop_mt", sockloop_mt_test },
+    { "sockloop_pipelined", sockloop_pipelined_test },
+    { "sockloop_busy_poll", sockloop_busy_poll_test },
     { "ticket_store", ticket_store_test },
     { "ticket_seed", ticket_seed_test },
     { "ticket_seed_from_bdp_frame", ticket_seed_from_bdp_frame_test },
@@ -189,6 +214,7 @@ static const picoquic_test_def_t test_table[] = {
     { "client_only", client_only_test },
     { "packet_enc_dec", packet_enc_dec_test},
     { "pn_vector", cleartext_pn_vector_test },
+    { "pn_enc_batch", pn_enc_batch_test },
     { "zero_rtt_spurious", zero_rtt_spurious_test },
     { "zero_rtt_retry", zero_rtt_retry_test },
     { "zero_rtt_no_coal", zero_rtt_no_coal_test },
@@ -233,7 +259,9 @@ static const picoquic_test_def_t test_table[] = {
     { "qlog_trace_auto", qlog_trace_auto_test },
     { "qlog_trace_only", qlog_trace_only_test },
     { "qlog_trace_ecn", qlog_trace_ecn_test },
+    { "qlog_trace_threads", qlog_trace_threads_test },
     { "path_packet_queue", path_packet_queue_test },
+    { "gso_handshake", gso_handshake_test },
     { "perflog", perflog_test },
     { "nat_rebinding_stress", rebinding_stress_test },
     { "random_padding", random_padding_test },
@@ -297,6 +325,8 @@ static const picoquic_test_def_t test_table[] = {
     { "send_stream_blocked", send_stream_blocked_test },
     { "stream_ack", stream_ack_test },
     { "queue_network_input", queue_network_input_test },
+    { "queue_network_input_ref", queue_network_input_ref_test },
+    { "queue_network_input_slice", queue_network_input_slice_test },
     { "pacing_update", pacing_update_test },
     { "direct_receive", direct_receive_test },
     { "app_limit_cc", app_limit_cc_test },
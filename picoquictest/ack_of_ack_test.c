@@ -21,6 +21,7 @@
 
 #include "picoquic_internal.h"
 #include <stdlib.h>
+#include <string.h>
 
 /*
  * The purpose of the ACK of ACK logic is to prune the sack list from blocks that
@@ -144,7 +145,7 @@ static int cmp_test_sack_list(picoquic_sack_list_t* sack_list,
 
         nb_compared++;
 
-        next = picoquic_sack_previous_item(next);
+        next = picoquic_sack_previous_item(sack_list, next);
 
         if (next == NULL) {
             break;
@@ -232,4 +233,210 @@ int ack_of_ack_test()
     }
 
     return ret;
-}
\ No newline at end of file
+}
+
+/*
+ * Verify that the acknowledged packets are found through the index of the
+ * retransmit queue, and that the queue, the index and the per path lists
+ * remain consistent after ranges of packets are removed.
+ */
+typedef struct st_ack_index_range_t {
+    uint64_t range_min;
+    uint64_t range_max;
+} ack_index_range_t;
+
+typedef struct st_ack_index_test_step_t {
+    uint64_t nb_sent; /* Number of packets queued before the ACK */
+    ack_index_range_t const* ranges; /* Ranges in the ACK, from highest to lowest */
+    size_t nb_ranges;
+    ack_index_range_t const* queued; /* Expected queue after the ACK, in increasing order */
+    size_t nb_queued;
+} ack_index_test_step_t;
+
+static const ack_index_range_t ack_index_ranges_1[] = {
+    { 900, 999 }, { 500, 799 }, { 0, 99 } };
+static const ack_index_range_t ack_index_queued_1[] = {
+    { 100, 499 }, { 800, 899 } };
+static const ack_index_range_t ack_index_ranges_2[] = {
+    { 1050, 1099 }, { 850, 1010 }, { 0, 450 } };
+static const ack_index_range_t ack_index_queued_2[] = {
+    { 451, 499 }, { 800, 849 }, { 1011, 1049 } };
+static const ack_index_range_t ack_index_ranges_3[] = {
+    { 0, 1100 } };
+
+static const ack_index_test_step_t ack_index_test_steps[] = {
+    { 1000, ack_index_ranges_1, 3, ack_index_queued_1, 2 },
+    { 1100, ack_index_ranges_2, 3, ack_index_queued_2, 3 },
+    { 1101, ack_index_ranges_3, 1, NULL, 0 }
+};
+
+static size_t ack_index_test_format(uint8_t* bytes, size_t bytes_max, uint64_t base,
+    ack_index_range_t const* ranges, size_t nb_ranges)
+{
+    uint8_t* bytes_next = bytes;
+    uint8_t* bytes_end = bytes + bytes_max;
+
+    if ((bytes_next = picoquic_frames_varint_encode(bytes_next, bytes_end, picoquic_frame_type_ack)) != NULL &&
+        (bytes_next = picoquic_frames_varint_encode(bytes_next, bytes_end, base + ranges[0].range_max)) != NULL &&
+        (bytes_next = picoquic_frames_varint_encode(bytes_next, bytes_end, 0)) != NULL &&
+        (bytes_next = picoquic_frames_varint_encode(bytes_next, bytes_end, nb_ranges - 1)) != NULL) {
+        bytes_next = picoquic_frames_varint_encode(bytes_next, bytes_end, ranges[0].range_max - ranges[0].range_min);
+        for (size_t i = 1; bytes_next != NULL && i < nb_ranges; i++) {
+            if ((bytes_next = picoquic_frames_varint_encode(bytes_next, bytes_end,
+                ranges[i - 1].range_min - ranges[i].range_max - 2)) != NULL) {
+                bytes_next = picoquic_frames_varint_encode(bytes_next, bytes_end, ranges[i].range_max - ranges[i].range_min);
+            }
+        }
+    }
+
+    return (bytes_next == NULL) ? 0 : bytes_next - bytes;
+}
+
+static int ack_index_test_check(picoquic_cnx_t* cnx, picoquic_packet_context_t* pkt_ctx, uint64_t base,
+    uint64_t nb_sent, ack_index_test_step_t const* step)
+{
+    int ret = 0;
+    picoquic_packet_t* p = pkt_ctx->retransmit_oldest;
+    uint64_t bytes_in_transit = 0;
+    size_t nb_queued = 0;
+    size_t nb_path_queued = 0;
+
+    /* The largest acknowledged packet was found */
+    if (pkt_ctx->latest_time_acknowledged != step->ranges[0].range_max) {
+        DBG_PRINTF("Latest time acknowledged %" PRIu64 ", expected %" PRIu64,
+            pkt_ctx->latest_time_acknowledged, step->ranges[0].range_max);
+        ret = -1;
+    }
+
+    /* The queue holds exactly the expected packets, in order */
+    for (size_t i = 0; ret == 0 && i < step->nb_queued; i++) {
+        for (uint64_t seq = step->queued[i].range_min; ret == 0 && seq <= step->queued[i].range_max; seq++) {
+            if (p == NULL || p->sequence_number != base + seq) {
+                DBG_PRINTF("Expected packet %" PRIu64 " in queue", seq);
+                ret = -1;
+            }
+            else {
+                bytes_in_transit += p->length + p->checksum_overhead;
+                nb_queued++;
+                p = p->previous_packet;
+            }
+        }
+    }
+    if (ret == 0 && p != NULL) {
+        DBG_PRINTF("Unexpected packet %" PRIu64 " in queue", p->sequence_number - base);
+        ret = -1;
+    }
+    /* The index finds the queued packets, and only them */
+    for (uint64_t seq = 0; ret == 0 && seq < nb_sent; seq++) {
+        picoquic_packet_t* p_indexed = picoquic_retransmit_index_get(pkt_ctx, base + seq);
+        int is_queued = 0;
+        for (size_t i = 0; i < step->nb_queued; i++) {
+            if (seq >= step->queued[i].range_min && seq <= step->queued[i].range_max) {
+                is_queued = 1;
+                break;
+            }
+        }
+        if (is_queued != (p_indexed != NULL) || (p_indexed != NULL && p_indexed->sequence_number != base + seq)) {
+            DBG_PRINTF("Index mismatch for packet %" PRIu64, seq);
+            ret = -1;
+        }
+    }
+    /* The per path list and the bytes in transit match the queue */
+    if (ret == 0) {
+        p = cnx->path[0]->path_packet_first;
+        while (p != NULL) {
+            nb_path_queued++;
+            p = p->path_packet_next;
+        }
+        if (nb_path_queued != nb_queued || cnx->path[0]->bytes_in_transit != bytes_in_transit) {
+            DBG_PRINTF("Path has %zu packets, %" PRIu64 " bytes, expected %zu, %" PRIu64,
+                nb_path_queued, cnx->path[0]->bytes_in_transit, nb_queued, bytes_in_transit);
+            ret = -1;
+        }
+    }
+    if (ret == 0 && nb_queued == 0 && pkt_ctx->retransmit_index != NULL) {
+        DBG_PRINTF("%s", "Index not released after queue emptied");
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int ack_index_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    struct sockaddr_in saddr;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time, &simulated_time, NULL, NULL, 0);
+    picoquic_cnx_t* cnx = NULL;
+    picoquic_packet_context_t* pkt_ctx = NULL;
+    uint64_t base = 0;
+    uint64_t nb_sent = 0;
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else if ((cnx = picoquic_create_cnx(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+        (struct sockaddr*)&saddr, simulated_time, 0, "test-sni", "test-alpn", 1)) == NULL) {
+        DBG_PRINTF("%s", "Cannot create connection\n");
+        ret = -1;
+    }
+    else {
+        cnx->cnx_state = picoquic_state_ready;
+        pkt_ctx = &cnx->pkt_ctx[picoquic_packet_context_application];
+        base = pkt_ctx->send_sequence;
+    }
+
+    for (size_t i = 0; ret == 0 && i < sizeof(ack_index_test_steps) / sizeof(ack_index_test_step_t); i++) {
+        ack_index_test_step_t const* step = &ack_index_test_steps[i];
+        uint8_t bytes[256];
+        size_t length;
+
+        while (ret == 0 && nb_sent < step->nb_sent) {
+            picoquic_packet_t* packet = picoquic_create_packet(quic);
+            if (packet == NULL) {
+                ret = -1;
+            }
+            else {
+                packet->ptype = picoquic_packet_1rtt_protected;
+                packet->pc = picoquic_packet_context_application;
+                packet->sequence_number = pkt_ctx->send_sequence++;
+                packet->length = 100;
+                packet->offset = packet->length;
+                /* Each packet has its own send time, to verify which packet is the largest acknowledged */
+                packet->send_time = nb_sent;
+                packet->send_path = cnx->path[0];
+                picoquic_queue_for_retransmit(cnx, cnx->path[0], packet, packet->length, simulated_time);
+                nb_sent++;
+            }
+        }
+
+        simulated_time += 1000;
+
+        if (ret == 0) {
+            length = ack_index_test_format(bytes, sizeof(bytes), base, step->ranges, step->nb_ranges);
+            if (length == 0) {
+                ret = -1;
+            }
+            else if (picoquic_decode_frames(cnx, cnx->path[0], bytes, length, NULL, picoquic_epoch_1rtt,
+                NULL, NULL, 0, 0, simulated_time) != 0) {
+                DBG_PRINTF("Cannot decode ACK #%zu", i);
+                ret = -1;
+            }
+            else {
+                ret = ack_index_test_check(cnx, pkt_ctx, base, nb_sent, step);
+            }
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
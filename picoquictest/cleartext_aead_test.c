@@ -613,6 +613,59 @@ int cleartext_pn_vector_test()
     return ret;
 }
 
+/*
+ * Test that the header protection masks computed in batch for a train of
+ * packets are the same as those computed one packet at a time, both with
+ * the multi-block ECB context and with the fallback to the regular context.
+ */
+
+#define PN_ENC_BATCH_TEST_NB 11
+
+int pn_enc_batch_test()
+{
+    int ret = 0;
+    uint8_t secret[32];
+    uint8_t samples[PN_ENC_BATCH_TEST_NB * PICOQUIC_HP_SAMPLE_SIZE];
+    uint8_t masks[PN_ENC_BATCH_TEST_NB * PICOQUIC_HP_SAMPLE_SIZE];
+    uint64_t random_context = 0xba7c4ed;
+    char const* prefix_label = picoquic_supported_versions[0].tls_prefix_label;
+    void* pn_enc = NULL;
+    void* pn_ecb = NULL;
+
+    picoquic_test_random_bytes(&random_context, secret, sizeof(secret));
+    picoquic_test_random_bytes(&random_context, samples, sizeof(samples));
+
+    if ((pn_enc = picoquic_pn_enc_create_for_test(secret, prefix_label)) == NULL ||
+        (pn_ecb = picoquic_pn_ecb_create_for_test(secret, prefix_label)) == NULL) {
+        DBG_PRINTF("%s", "Cannot create the header protection contexts.\n");
+        ret = -1;
+    }
+
+    for (int use_ecb = 1; ret == 0 && use_ecb >= 0; use_ecb--) {
+        picoquic_pn_encrypt_batch(pn_enc, (use_ecb) ? pn_ecb : NULL, samples, masks, PN_ENC_BATCH_TEST_NB);
+
+        for (size_t i = 0; ret == 0 && i < PN_ENC_BATCH_TEST_NB; i++) {
+            uint8_t mask_bytes[5] = { 0, 0, 0, 0, 0 };
+
+            picoquic_pn_encrypt(pn_enc, samples + i * PICOQUIC_HP_SAMPLE_SIZE, mask_bytes, mask_bytes, 5);
+            if (memcmp(mask_bytes, masks + i * PICOQUIC_HP_SAMPLE_SIZE, 5) != 0) {
+                DBG_PRINTF("Batch mask %zu differs, ecb = %d\n", i, use_ecb);
+                ret = -1;
+            }
+        }
+    }
+
+    if (pn_enc != NULL) {
+        ptls_cipher_free((ptls_cipher_context_t*)pn_enc);
+    }
+
+    if (pn_ecb != NULL) {
+        ptls_cipher_free((ptls_cipher_context_t*)pn_ecb);
+    }
+
+    return ret;
+}
+
 /*
  * draft-17 vectors copied from Tatsuhiro's data. We do not have a complete message.
  */
@@ -1162,6 +1215,56 @@ static uint8_t retry_protection_packet_draft25[36] = {
 };
 
 
+/*
+ * Verify that the initial master secret obtained from the per version salt
+ * context matches the one computed from scratch, both when the context is
+ * created and when it is reused.
+ */
+int initial_salt_cache_test()
+{
+    int ret = 0;
+    ptls_cipher_suite_t* cipher = (ptls_cipher_suite_t*)picoquic_get_aes128gcm_sha256_v(0);
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, 0, NULL, NULL, NULL, 0);
+
+    if (quic == NULL || cipher == NULL) {
+        DBG_PRINTF("%s", "Could not create Quic context or cipher suite.\n");
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < (int)picoquic_nb_supported_versions; i++) {
+        ptls_iovec_t salt;
+        uint8_t expected[PTLS_MAX_DIGEST_SIZE];
+
+        if (picoquic_supported_versions[i].version_aead_key == NULL) {
+            continue;
+        }
+        salt.base = picoquic_supported_versions[i].version_aead_key;
+        salt.len = picoquic_supported_versions[i].version_aead_key_length;
+        ret = picoquic_setup_initial_master_secret(cipher, salt, draft17_test_cnx_id, expected);
+
+        for (int pass = 0; ret == 0 && pass < 2; pass++) {
+            uint8_t master_secret[PTLS_MAX_DIGEST_SIZE];
+
+            ret = picoquic_setup_initial_master_secret_cached(quic, cipher, i, draft17_test_cnx_id, master_secret);
+            if (ret == 0 && memcmp(master_secret, expected, cipher->hash->digest_size) != 0) {
+                DBG_PRINTF("Master secret mismatch for version %x, pass %d\n", picoquic_supported_versions[i].version, pass);
+                ret = -1;
+            }
+            else if (ret == 0 && (quic->initial_salt_hmac_ctx == NULL || quic->initial_salt_hmac_ctx[i] == NULL)) {
+                DBG_PRINTF("Salt context not cached for version %x\n", picoquic_supported_versions[i].version);
+                ret = -1;
+            }
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
 extern uint8_t picoquic_retry_protection_key_25[16];
 
 int retry_protection_vector_test()
@@ -20,6 +20,7 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 #ifdef _WINDOWS
 #include <malloc.h>
 #endif
@@ -173,3 +174,356 @@ int picohash_test()
 
     return ret;
 }
+
+/* Check that the table grows, with lookups and deletes working while the
+ * items are moved from the previous table, and that iteration visits
+ * every item exactly once. */
+static int picohash_resize_test_one(uint64_t(*hash_fn)(const void*), uint64_t nb_keys)
+{
+    int ret = 0;
+    picohash_table* t = picohash_create(8, hash_fn, hashtest_compare);
+
+    if (t == NULL) {
+        DBG_PRINTF("%s", "picohash_create() failed\n");
+        ret = -1;
+    }
+    else {
+        struct hashtestkey hk;
+        size_t nb_visited = 0;
+        uint64_t sum_visited = 0;
+        uint64_t sum_expected = 0;
+
+        /* Insert all keys, delete every third key shortly after it was inserted */
+        for (uint64_t i = 0; ret == 0 && i < nb_keys; i++) {
+            if (picohash_insert(t, hashtest_item(i)) != 0) {
+                DBG_PRINTF("picohash_insert(%"PRId64") failed\n", i);
+                ret = -1;
+            }
+            else if (i >= 5 && (i - 5) % 3 == 0) {
+                picohash_item* pi;
+
+                hk.x = i - 5;
+                if ((pi = picohash_retrieve(t, &hk)) == NULL) {
+                    DBG_PRINTF("picohash_retrieve(%"PRId64") failed\n", i - 5);
+                    ret = -1;
+                }
+                else {
+                    picohash_delete_item(t, pi, 1);
+                }
+            }
+        }
+
+        /* Check that the deleted keys are gone and the others present */
+        for (uint64_t i = 0; ret == 0 && i < nb_keys; i++) {
+            picohash_item* pi;
+            int is_deleted = (i + 5 < nb_keys && i % 3 == 0);
+
+            hk.x = i;
+            pi = picohash_retrieve(t, &hk);
+            if (is_deleted && pi != NULL) {
+                DBG_PRINTF("picohash_retrieve(%"PRId64") deleted value still found\n", i);
+                ret = -1;
+            }
+            else if (!is_deleted) {
+                if (pi == NULL) {
+                    DBG_PRINTF("picohash_retrieve(%"PRId64") failed\n", i);
+                    ret = -1;
+                }
+                else {
+                    sum_expected += i;
+                }
+            }
+        }
+
+        for (picohash_item* item = picohash_first(t); ret == 0 && item != NULL; item = picohash_next(t, item)) {
+            nb_visited++;
+            sum_visited += ((const struct hashtestkey*)item->key)->x;
+        }
+
+        if (ret == 0 && (nb_visited != t->count || sum_visited != sum_expected)) {
+            DBG_PRINTF("Iteration visits %"PRIst" items, count=%"PRIst"\n", nb_visited, t->count);
+            ret = -1;
+        }
+
+        if (ret == 0 && t->nb_bin < t->count) {
+            DBG_PRINTF("Table did not grow, %"PRIst" bins for %"PRIst" items\n", t->nb_bin, t->count);
+            ret = -1;
+        }
+
+        picohash_delete(t, 1);
+    }
+
+    return ret;
+}
+
+static uint64_t hashtest_hash_collide(const void* v)
+{
+    const struct hashtestkey* k = (const struct hashtestkey*)v;
+    return k->x & 0x3;
+}
+
+int picohash_resize_test()
+{
+    int ret = picohash_resize_test_one(hashtest_hash, 10000);
+
+    if (ret == 0) {
+        ret = picohash_resize_test_one(hashtest_hash_collide, 300);
+    }
+
+    return ret;
+}
+
+/* Shared table tests. Readers look up keys that are always present, and
+ * keys that a writer keeps inserting and removing in the same shards.
+ */
+#define PICOHASH_SHARED_TEST_NB_STABLE 1024
+#define PICOHASH_SHARED_TEST_NB_VOLATILE 256
+#define PICOHASH_SHARED_TEST_NB_READERS 4
+#define PICOHASH_SHARED_TEST_NB_LOOKUPS 200000
+
+typedef struct st_picohash_shared_test_ctx_t {
+    picohash_shared_table* table;
+    struct hashtestkey* stable;
+    struct hashtestkey* volatile_keys;
+    volatile int is_done;
+    uint64_t nb_lookups;
+    uint64_t nb_errors;
+    uint64_t nb_writer_errors;
+    uint64_t nb_volatile_found;
+} picohash_shared_test_ctx_t;
+
+static void picohash_shared_test_visit(const void* key, void* visit_ctx)
+{
+    *((uint64_t*)visit_ctx) = ((const struct hashtestkey*)key)->x;
+}
+
+static picoquic_thread_return_t picohash_shared_test_reader(void* arg)
+{
+    picohash_shared_test_ctx_t* ctx = (picohash_shared_test_ctx_t*)arg;
+    uint64_t nb_errors = 0;
+    uint64_t nb_volatile_found = 0;
+    uint64_t random_ctx = (uint64_t)((uintptr_t)&nb_errors);
+
+    for (uint64_t i = 0; i < ctx->nb_lookups; i++) {
+        struct hashtestkey hk;
+        const struct hashtestkey* found;
+
+        random_ctx = random_ctx * 6364136223846793005ull + 1442695040888963407ull;
+        if ((i & 7) == 0) {
+            hk.x = PICOHASH_SHARED_TEST_NB_STABLE + ((random_ctx >> 33) % PICOHASH_SHARED_TEST_NB_VOLATILE);
+            found = (const struct hashtestkey*)picohash_shared_retrieve(ctx->table, &hk);
+            if (found != NULL) {
+                nb_volatile_found++;
+                if (found != &ctx->volatile_keys[hk.x - PICOHASH_SHARED_TEST_NB_STABLE]) {
+                    nb_errors++;
+                }
+            }
+        }
+        else if ((i & 7) == 1) {
+            uint64_t visited = UINT64_MAX;
+
+            hk.x = (random_ctx >> 33) % PICOHASH_SHARED_TEST_NB_STABLE;
+            if (picohash_shared_visit(ctx->table, &hk, picohash_shared_test_visit, &visited) != 0 || visited != hk.x) {
+                nb_errors++;
+            }
+        }
+        else {
+            hk.x = (random_ctx >> 33) % PICOHASH_SHARED_TEST_NB_STABLE;
+            found = (const struct hashtestkey*)picohash_shared_retrieve(ctx->table, &hk);
+            if (found != &ctx->stable[hk.x]) {
+                nb_errors++;
+            }
+        }
+    }
+
+    ctx->nb_errors = nb_errors;
+    ctx->nb_volatile_found = nb_volatile_found;
+
+    picoquic_thread_do_return;
+}
+
+static picoquic_thread_return_t picohash_shared_test_writer(void* arg)
+{
+    picohash_shared_test_ctx_t* ctx = (picohash_shared_test_ctx_t*)arg;
+    uint64_t nb_errors = 0;
+
+    while (!ctx->is_done) {
+        for (size_t i = 0; i < PICOHASH_SHARED_TEST_NB_VOLATILE; i++) {
+            if (picohash_shared_insert(ctx->table, &ctx->volatile_keys[i]) != 0) {
+                nb_errors++;
+            }
+        }
+        for (size_t i = 0; i < PICOHASH_SHARED_TEST_NB_VOLATILE; i++) {
+            if (picohash_shared_remove(ctx->table, &ctx->volatile_keys[i], 0) != 0) {
+                nb_errors++;
+            }
+        }
+    }
+    ctx->nb_writer_errors = nb_errors;
+
+    picoquic_thread_do_return;
+}
+
+/* Run the readers, with or without a concurrent writer, and set "duration"
+ * to the time in microseconds until all readers are done */
+static int picohash_shared_test_run(picohash_shared_test_ctx_t* ctx, int nb_readers, int with_writer, uint64_t* duration)
+{
+    int ret = 0;
+    picoquic_thread_t readers[PICOHASH_SHARED_TEST_NB_READERS];
+    picohash_shared_test_ctx_t reader_ctx[PICOHASH_SHARED_TEST_NB_READERS];
+    picoquic_thread_t writer;
+    int nb_started = 0;
+    int writer_started = 0;
+    uint64_t start_time = picoquic_current_time();
+
+    ctx->is_done = 0;
+    if (with_writer) {
+        if ((ret = picoquic_create_thread(&writer, picohash_shared_test_writer, ctx)) != 0) {
+            DBG_PRINTF("Create writer thread returns %d", ret);
+        }
+        else {
+            writer_started = 1;
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < nb_readers; i++) {
+        reader_ctx[i] = *ctx;
+        if ((ret = picoquic_create_thread(&readers[i], picohash_shared_test_reader, &reader_ctx[i])) != 0) {
+            DBG_PRINTF("Create reader thread returns %d", ret);
+        }
+        else {
+            nb_started++;
+        }
+    }
+
+    for (int i = 0; i < nb_started; i++) {
+        picoquic_delete_thread(&readers[i]);
+        ctx->nb_errors += reader_ctx[i].nb_errors;
+        ctx->nb_volatile_found += reader_ctx[i].nb_volatile_found;
+    }
+    *duration = picoquic_current_time() - start_time;
+
+    ctx->is_done = 1;
+    if (writer_started) {
+        picoquic_delete_thread(&writer);
+        ctx->nb_errors += ctx->nb_writer_errors;
+    }
+
+    return ret;
+}
+
+static int picohash_shared_test_init(picohash_shared_test_ctx_t* ctx, size_t nb_shards)
+{
+    int ret = 0;
+
+    memset(ctx, 0, sizeof(picohash_shared_test_ctx_t));
+    ctx->nb_lookups = PICOHASH_SHARED_TEST_NB_LOOKUPS;
+    ctx->stable = (struct hashtestkey*)malloc(PICOHASH_SHARED_TEST_NB_STABLE * sizeof(struct hashtestkey));
+    ctx->volatile_keys = (struct hashtestkey*)malloc(PICOHASH_SHARED_TEST_NB_VOLATILE * sizeof(struct hashtestkey));
+    ctx->table = picohash_shared_create(nb_shards, 64, hashtest_hash, hashtest_compare);
+
+    if (ctx->stable == NULL || ctx->volatile_keys == NULL || ctx->table == NULL) {
+        DBG_PRINTF("%s", "Cannot create the shared table\n");
+        ret = -1;
+    }
+    else {
+        for (uint64_t i = 0; i < PICOHASH_SHARED_TEST_NB_VOLATILE; i++) {
+            ctx->volatile_keys[i].x = PICOHASH_SHARED_TEST_NB_STABLE + i;
+        }
+        for (uint64_t i = 0; ret == 0 && i < PICOHASH_SHARED_TEST_NB_STABLE; i++) {
+            ctx->stable[i].x = i;
+            ret = picohash_shared_insert(ctx->table, &ctx->stable[i]);
+        }
+    }
+
+    return ret;
+}
+
+static void picohash_shared_test_release(picohash_shared_test_ctx_t* ctx)
+{
+    if (ctx->table != NULL) {
+        picohash_shared_delete(ctx->table, 0);
+    }
+    if (ctx->stable != NULL) {
+        free(ctx->stable);
+    }
+    if (ctx->volatile_keys != NULL) {
+        free(ctx->volatile_keys);
+    }
+}
+
+int picohash_shared_test()
+{
+    picohash_shared_test_ctx_t ctx;
+    struct hashtestkey hk;
+    uint64_t duration = 0;
+    int ret = picohash_shared_test_init(&ctx, 12);
+
+    if (ret == 0 && (picohash_shared_nb_shards(ctx.table) != 16 ||
+        picohash_shared_count(ctx.table) != PICOHASH_SHARED_TEST_NB_STABLE)) {
+        DBG_PRINTF("Shared table has %zu shards, %zu items\n",
+            picohash_shared_nb_shards(ctx.table), picohash_shared_count(ctx.table));
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        /* Remove and insert again in a single thread */
+        hk.x = 17;
+        if (picohash_shared_remove(ctx.table, &hk, 0) != 0 || picohash_shared_retrieve(ctx.table, &hk) != NULL ||
+            picohash_shared_remove(ctx.table, &hk, 0) == 0 ||
+            picohash_shared_insert(ctx.table, &ctx.stable[17]) != 0 ||
+            picohash_shared_retrieve(ctx.table, &hk) != &ctx.stable[17]) {
+            DBG_PRINTF("%s", "Single thread remove and insert failed\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = picohash_shared_test_run(&ctx, PICOHASH_SHARED_TEST_NB_READERS, 1, &duration);
+        if (ret == 0 && ctx.nb_errors != 0) {
+            DBG_PRINTF("%" PRIu64 " errors in concurrent lookups\n", ctx.nb_errors);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && picohash_shared_count(ctx.table) != PICOHASH_SHARED_TEST_NB_STABLE) {
+        DBG_PRINTF("Shared table has %zu items after the test\n", picohash_shared_count(ctx.table));
+        ret = -1;
+    }
+
+    picohash_shared_test_release(&ctx);
+
+    return ret;
+}
+
+/* Throughput of lookups, with 1 and 4 readers, with a single shard and with
+ * 16 shards, while a writer updates the table. */
+int picohash_shared_bench_test()
+{
+    int ret = 0;
+    size_t nb_shards[2] = { 1, 16 };
+    int nb_readers[2] = { 1, PICOHASH_SHARED_TEST_NB_READERS };
+
+    for (int s = 0; ret == 0 && s < 2; s++) {
+        for (int r = 0; ret == 0 && r < 2; r++) {
+            picohash_shared_test_ctx_t ctx;
+            uint64_t duration = 0;
+
+            if ((ret = picohash_shared_test_init(&ctx, nb_shards[s])) == 0 &&
+                (ret = picohash_shared_test_run(&ctx, nb_readers[r], 1, &duration)) == 0) {
+                if (ctx.nb_errors != 0) {
+                    DBG_PRINTF("%" PRIu64 " errors in concurrent lookups\n", ctx.nb_errors);
+                    ret = -1;
+                }
+                else {
+                    DBG_PRINTF("%zu shards, %d readers: %" PRIu64 " lookups in %" PRIu64 "us, %" PRIu64 " per second\n",
+                        nb_shards[s], nb_readers[r], ctx.nb_lookups * nb_readers[r], duration,
+                        (duration == 0) ? 0 : (ctx.nb_lookups * nb_readers[r] * 1000000) / duration);
+                }
+            }
+            picohash_shared_test_release(&ctx);
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,208 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2022, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+/*
+ * Test the packet pool: packets are carved from arenas within the memory
+ * budget, their metadata is zero when created, recycled packets are
+ * reused, and the arenas are released when the packets are recycled.
+ */
+
+#define PACKET_POOL_TEST_BUDGET_PACKETS 100
+
+static int packet_pool_test_check_stats(picoquic_quic_t* quic, uint64_t nb_in_use)
+{
+    int ret = 0;
+    picoquic_packet_pool_stats_t stats;
+
+    picoquic_get_packet_pool_stats(quic, &stats);
+
+    if (stats.nb_packets_in_use != nb_in_use ||
+        stats.nb_packets_in_use + stats.nb_packets_in_pool != stats.nb_packets_allocated ||
+        stats.arena_bytes < stats.nb_packets_allocated * stats.packet_size ||
+        (stats.memory_budget != 0 && stats.arena_bytes > stats.memory_budget)) {
+        DBG_PRINTF("Pool stats: %" PRIu64 " in use (expected %" PRIu64 "), %" PRIu64 " in pool, %" PRIu64 " allocated, %zu bytes, budget %zu",
+            stats.nb_packets_in_use, nb_in_use, stats.nb_packets_in_pool, stats.nb_packets_allocated,
+            stats.arena_bytes, stats.memory_budget);
+        ret = -1;
+    }
+    return ret;
+}
+
+static int packet_pool_test_is_zero(picoquic_packet_t* packet)
+{
+    uint8_t* x = (uint8_t*)packet;
+    int is_zero = 1;
+
+    for (size_t i = 0; i < offsetof(struct st_picoquic_packet_t, bytes); i++) {
+        if (x[i] != 0) {
+            is_zero = 0;
+            break;
+        }
+    }
+    return is_zero;
+}
+
+int packet_pool_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time, &simulated_time, NULL, NULL, 0);
+    picoquic_packet_t* first_packet = NULL;
+    uint64_t nb_created = 0;
+    picoquic_packet_pool_stats_t stats;
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else {
+        picoquic_set_packet_memory_budget(quic, PACKET_POOL_TEST_BUDGET_PACKETS * sizeof(picoquic_packet_t));
+    }
+
+    /* Create packets until the budget is exhausted */
+    while (ret == 0) {
+        picoquic_packet_t* packet = picoquic_create_packet(quic);
+        if (packet == NULL) {
+            break;
+        }
+        else if (!packet_pool_test_is_zero(packet)) {
+            DBG_PRINTF("Packet %" PRIu64 " metadata is not zero", nb_created);
+            ret = -1;
+        }
+        else {
+            /* Dirty the metadata to check that recycling clears it */
+            packet->sequence_number = nb_created;
+            packet->length = PICOQUIC_MAX_PACKET_SIZE;
+            packet->is_pure_ack = 1;
+            packet->previous_packet = first_packet;
+            first_packet = packet;
+            nb_created++;
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_get_packet_pool_stats(quic, &stats);
+        if (nb_created == 0 || nb_created >= PACKET_POOL_TEST_BUDGET_PACKETS || stats.nb_packets_refused != 1) {
+            DBG_PRINTF("Created %" PRIu64 " packets, refused %" PRIu64, nb_created, stats.nb_packets_refused);
+            ret = -1;
+        }
+        else {
+            ret = packet_pool_test_check_stats(quic, nb_created);
+        }
+    }
+
+    /* Recycle all packets, then create them again within the budget */
+    if (ret == 0) {
+        uint64_t nb_arenas = stats.nb_arenas;
+
+        while (first_packet != NULL) {
+            picoquic_packet_t* packet = first_packet;
+            first_packet = packet->previous_packet;
+            picoquic_recycle_packet(quic, packet);
+        }
+        ret = packet_pool_test_check_stats(quic, 0);
+
+        if (ret == 0) {
+            picoquic_get_packet_pool_stats(quic, &stats);
+            if (nb_arenas > 1 && stats.nb_arenas >= nb_arenas) {
+                DBG_PRINTF("Arenas: %" PRIu64 ", expected less than %" PRIu64, stats.nb_arenas, nb_arenas);
+                ret = -1;
+            }
+        }
+
+        for (uint64_t i = 0; ret == 0 && i < nb_created; i++) {
+            picoquic_packet_t* packet = picoquic_create_packet(quic);
+            if (packet == NULL || !packet_pool_test_is_zero(packet)) {
+                DBG_PRINTF("Cannot reuse packet %" PRIu64, i);
+                ret = -1;
+            }
+            else {
+                packet->previous_packet = first_packet;
+                first_packet = packet;
+            }
+        }
+
+        if (ret == 0) {
+            ret = packet_pool_test_check_stats(quic, nb_created);
+        }
+    }
+
+    /* Without budget, the pool grows as needed */
+    if (ret == 0) {
+        picoquic_set_packet_memory_budget(quic, 0);
+
+        for (int i = 0; ret == 0 && i < 2000; i++) {
+            picoquic_packet_t* packet = picoquic_create_packet(quic);
+            if (packet == NULL) {
+                DBG_PRINTF("Cannot create packet %d without budget", i);
+                ret = -1;
+            }
+            else {
+                packet->previous_packet = first_packet;
+                first_packet = packet;
+                nb_created++;
+            }
+        }
+        if (ret == 0) {
+            ret = packet_pool_test_check_stats(quic, nb_created);
+        }
+    }
+
+    /* Once the burst is over, the idle arenas are released */
+    if (ret == 0) {
+        size_t peak_bytes;
+
+        picoquic_get_packet_pool_stats(quic, &stats);
+        peak_bytes = stats.arena_bytes;
+
+        while (first_packet != NULL) {
+            picoquic_packet_t* packet = first_packet;
+            first_packet = packet->previous_packet;
+            picoquic_recycle_packet(quic, packet);
+        }
+        ret = packet_pool_test_check_stats(quic, 0);
+
+        if (ret == 0) {
+            picoquic_get_packet_pool_stats(quic, &stats);
+            if (stats.arena_bytes * 2 > peak_bytes) {
+                DBG_PRINTF("Arena bytes: %zu, peak %zu", stats.arena_bytes, peak_bytes);
+                ret = -1;
+            }
+        }
+    }
+
+    while (first_packet != NULL) {
+        picoquic_packet_t* packet = first_packet;
+        first_packet = packet->previous_packet;
+        picoquic_recycle_packet(quic, packet);
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
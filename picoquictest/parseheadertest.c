@@ -653,7 +653,7 @@ int test_packet_encrypt_one(
     picoquic_path_t * path_x = cnx_client->path[0];
     uint64_t current_time = 0;
     picoquic_packet_header expected_header;
-    picoquic_packet_t * packet = (picoquic_packet_t *) malloc(sizeof(picoquic_packet_t));
+    picoquic_packet_t * packet = picoquic_create_packet(cnx_client->quic);
     picoquic_packet_context_enum pc = 0;
     picoquic_packet_context_t* pkt_ctx;
 
@@ -1219,4 +1219,93 @@ int cid_for_lb_cli_test()
     }
     /* Done */
     return ret;
-}
\ No newline at end of file
+}
+/* Verify that the server ID can be retrieved from incoming packets,
+ * as done when steering packets between the workers of a multi-threaded
+ * server. Only Handshake and 1-RTT packets shall be decoded.
+ */
+static int cid_for_lb_packet_test_one(picoquic_quic_t* quic, int test_id, picoquic_load_balancer_config_t* config,
+    picoquic_connection_id_t* init_cid)
+{
+    int ret = 0;
+    picoquic_connection_id_t cid = *init_cid;
+    uint8_t packet[64];
+    size_t length;
+    uint64_t server_id64;
+
+    if ((ret = picoquic_lb_compat_cid_config(quic, config)) != 0) {
+        DBG_PRINTF("CID packet test #%d fails, could not configure the context.\n", test_id);
+    }
+    else {
+        quic->cnx_id_callback_fn(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+            quic->cnx_id_callback_ctx, &cid);
+        memset(packet, 0, sizeof(packet));
+
+        /* Short header packet */
+        packet[0] = 0x41;
+        memcpy(packet + 1, cid.id, cid.id_len);
+        length = 1 + cid.id_len + 20;
+        if ((server_id64 = picoquic_lb_compat_packet_server_id(quic, packet, length)) != config->server_id64) {
+            DBG_PRINTF("CID packet test #%d fails, short header returns %" PRIu64, test_id, server_id64);
+            ret = -1;
+        }
+        else if (picoquic_lb_compat_packet_server_id(quic, packet, cid.id_len) != UINT64_MAX) {
+            DBG_PRINTF("CID packet test #%d fails, truncated packet is decoded", test_id);
+            ret = -1;
+        }
+        else {
+            /* Handshake packet, version 1 */
+            packet[0] = 0xe1;
+            picoformat_32(packet + 1, PICOQUIC_V1_VERSION);
+            packet[5] = cid.id_len;
+            memcpy(packet + 6, cid.id, cid.id_len);
+            length = 6 + cid.id_len + 20;
+            if ((server_id64 = picoquic_lb_compat_packet_server_id(quic, packet, length)) != config->server_id64) {
+                DBG_PRINTF("CID packet test #%d fails, handshake returns %" PRIu64, test_id, server_id64);
+                ret = -1;
+            }
+            else {
+                /* Initial packet, version 1. The CID would be chosen by the client. */
+                packet[0] = 0xc1;
+                if (picoquic_lb_compat_packet_server_id(quic, packet, length) != UINT64_MAX) {
+                    DBG_PRINTF("CID packet test #%d fails, initial packet is decoded", test_id);
+                    ret = -1;
+                }
+            }
+        }
+    }
+
+    picoquic_lb_compat_cid_config_free(quic);
+
+    return ret;
+}
+
+int cid_for_lb_packet_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Could not create the quic context.");
+        ret = -1;
+    }
+    else {
+        uint8_t packet[8] = { 0x41, 1, 2, 3, 4, 5, 6, 7 };
+
+        /* Without load balancer configuration, nothing is decoded */
+        if (picoquic_lb_compat_packet_server_id(quic, packet, sizeof(packet)) != UINT64_MAX) {
+            DBG_PRINTF("%s", "Packet decoded without configuration");
+            ret = -1;
+        }
+
+        for (int i = 0; i < NB_LB_CONFIG_TEST && ret == 0; i++) {
+            ret = cid_for_lb_packet_test_one(quic, i, &cid_for_lb_test_config[i], &cid_for_lb_test_init[i]);
+        }
+
+        picoquic_free(quic);
+    }
+    return ret;
+}
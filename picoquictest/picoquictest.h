@@ -39,7 +39,13 @@ int util_connection_id_parse_test();
 int util_sprintf_test();
 int util_memcmp_test();
 int util_threading_test();
+int util_spsc_queue_test();
+int util_worker_pool_test();
+int util_file_writer_test();
 int picohash_test();
+int picohash_resize_test();
+int picohash_shared_test();
+int picohash_shared_bench_test();
 int bytestream_test();
 int cnxcreation_test();
 int parseheadertest();
@@ -52,6 +58,11 @@ int StreamZeroFrameTest();
 int sendacktest();
 int tls_api_test();
 int tls_api_inject_hs_ack_test();
+int incoming_batch_test();
+int prepare_batch_test();
+int prepare_batch_multi_test();
+int tls_worker_test();
+int tls_worker_large_hello_test();
 int tls_api_silence_test();
 int tls_api_loss_test(uint64_t mask);
 int tls_api_client_first_loss_test();
@@ -81,7 +92,9 @@ int tls_api_very_long_congestion_test();
 int tls_api_retry_test();
 int tls_api_retry_large_test();
 int ackrange_test();
+int ackvector_test();
 int ack_of_ack_test();
+int ack_index_test();
 int ack_disorder_test();
 int ack_horizon_test();
 int tls_api_two_connections_test();
@@ -140,6 +153,7 @@ int client_error_test();
 int client_only_test();
 int packet_enc_dec_test();
 int cleartext_pn_vector_test();
+int pn_enc_batch_test();
 int zero_rtt_spurious_test();
 int zero_rtt_retry_test();
 int zero_rtt_no_coal_test();
@@ -153,6 +167,9 @@ int cnx_stress_do_test(uint64_t duration, int nb_clients, int do_report);
 int cnx_ddos_unit_test();
 int cnx_ddos_test_loop(int nb_connections, uint64_t ddos_interval, const char* qlogdir);
 int splay_test();
+int wheel_test();
+int wheel_bench_test();
+int packet_pool_test();
 int TlsStreamFrameTest();
 int draft17_vector_test();
 int fuzz_test();
@@ -193,7 +210,9 @@ int qlog_trace_test();
 int qlog_trace_auto_test();
 int qlog_trace_only_test();
 int qlog_trace_ecn_test();
+int qlog_trace_threads_test();
 int path_packet_queue_test();
+int gso_handshake_test();
 int perflog_test();
 int rebinding_stress_test();
 int many_short_loss_test();
@@ -258,24 +277,35 @@ int optimistic_ack_test();
 int optimistic_hole_test();
 int document_addresses_test();
 int socket_ecn_test();
+int socket_timestamp_test();
+int sockloop_mt_test();
+int sockloop_pipelined_test();
+int sockloop_busy_poll_test();
 int null_sni_test();
 int preferred_address_test();
 int preferred_address_dis_mig_test();
 int preferred_address_zero_test();
 int cid_for_lb_test();
 int cid_for_lb_cli_test();
+int cid_for_lb_packet_test();
 int retry_protection_vector_test();
+int initial_salt_cache_test();
 int test_copy_for_retransmit();
 int test_format_for_retransmit();
+int test_compact_for_retransmitted();
 int bad_coalesce_test();
 int bad_cnxid_test();
 int stream_splay_test();
 int stream_output_test();
+int stream_priority_test();
+int memory_accounting_test();
 int stream_rank_test();
 int not_before_cnxid_test();
 int send_stream_blocked_test();
 int stream_ack_test();
 int queue_network_input_test();
+int queue_network_input_ref_test();
+int queue_network_input_slice_test();
 int fastcc_test();
 int fastcc_jitter_test();
 int bbr_test();
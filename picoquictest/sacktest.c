@@ -81,7 +81,7 @@ int check_ack_ranges(picoquic_sack_list_t* sack_list)
             else if (sack->nb_times_sent[r] < PICOQUIC_MAX_ACK_RANGE_REPEAT) {
                 range_sum[sack->nb_times_sent[r]] += 1;
             }
-            sack = picoquic_sack_next_item(sack);
+            sack = picoquic_sack_next_item(sack_list, sack);
         }
 
         for (int i = 0; ret == 0 && i < PICOQUIC_MAX_ACK_RANGE_REPEAT; i++) {
@@ -434,6 +434,89 @@ int ackrange_test()
 }
 
 
+/* Verify the switch between the inline vector of ranges and the
+ * splay. Receive only the even numbers until the vector overflows,
+ * then fill the holes and verify that the list comes back to the
+ * vector, with the expected ranges.
+ */
+#define ACK_VECTOR_TEST_NB_RANGES (4*PICOQUIC_SACK_VECTOR_MAX)
+
+static int ackvector_test_check(picoquic_sack_list_t* sack_list, uint64_t pn_max, int is_hole_filled)
+{
+    int ret = check_ack_ranges(sack_list);
+
+    for (uint64_t pn = 0; ret == 0 && pn <= pn_max; pn++) {
+        int expected = ((pn & 1) == 0 || pn < 2 * (uint64_t)is_hole_filled);
+        picoquic_sack_item_t* sack = picoquic_sack_first_item(sack_list);
+        int found = 0;
+        while (sack != NULL) {
+            if (pn >= sack->start_of_sack_range && pn <= sack->end_of_sack_range) {
+                found = 1;
+                break;
+            }
+            sack = picoquic_sack_next_item(sack_list, sack);
+        }
+        if (found != expected || (picoquic_check_sack_list(sack_list, pn, pn) != 0) != expected) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+int ackvector_test()
+{
+    int ret = 0;
+    picoquic_sack_list_t sack0;
+    uint64_t pn_max = 2 * (ACK_VECTOR_TEST_NB_RANGES - 1);
+
+    picoquic_sack_list_init(&sack0);
+
+    /* Create ranges in reverse order to exercise insertion below the top */
+    for (int i = ACK_VECTOR_TEST_NB_RANGES - 1; ret == 0 && i >= 0; i--) {
+        ret = picoquic_update_sack_list(&sack0, 2 * (uint64_t)i, 2 * (uint64_t)i, 0);
+        if (ret == 0 && ACK_VECTOR_TEST_NB_RANGES - i > PICOQUIC_SACK_VECTOR_MAX && !sack0.is_tree) {
+            DBG_PRINTF("Not a tree after %d ranges", ACK_VECTOR_TEST_NB_RANGES - i);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && picoquic_sack_list_size(&sack0) != ACK_VECTOR_TEST_NB_RANGES) {
+        DBG_PRINTF("Expected %d ranges, got %zu", ACK_VECTOR_TEST_NB_RANGES, picoquic_sack_list_size(&sack0));
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = ackvector_test_check(&sack0, pn_max, 0);
+    }
+
+    /* Fill the holes from the bottom */
+    for (int i = 0; ret == 0 && i < ACK_VECTOR_TEST_NB_RANGES - 1; i++) {
+        size_t nb_ranges = ACK_VECTOR_TEST_NB_RANGES - i - 1;
+        ret = picoquic_update_sack_list(&sack0, 2 * (uint64_t)i + 1, 2 * (uint64_t)i + 1, 0);
+        if (ret == 0 && picoquic_sack_list_size(&sack0) != nb_ranges) {
+            DBG_PRINTF("Expected %zu ranges, got %zu", nb_ranges, picoquic_sack_list_size(&sack0));
+            ret = -1;
+        }
+        else if (ret == 0 && (nb_ranges <= PICOQUIC_SACK_VECTOR_MAX / 2) == sack0.is_tree) {
+            DBG_PRINTF("Unexpected representation with %zu ranges", nb_ranges);
+            ret = -1;
+        }
+        else if (ret == 0) {
+            ret = ackvector_test_check(&sack0, pn_max, i + 1);
+        }
+    }
+
+    if (ret == 0 && (picoquic_sack_list_first(&sack0) != 0 || picoquic_sack_list_last(&sack0) != pn_max ||
+        picoquic_sack_list_first_range(&sack0) != NULL)) {
+        ret = -1;
+    }
+
+    picoquic_sack_list_free(&sack0);
+
+    return ret;
+}
+
+
 /* Examine what happens when the packets are received in disorder. In this test, even packets (0, 2..)
  * are received through a high latency path, odd packets (1..3) through a low latency path, and the
  * ack-of-ack is sent after 32 packets are received. The goal is to verify that ack ranges are
@@ -2297,6 +2297,112 @@ int test_format_for_retransmit()
     return ret;
 }
 
+/* Test of the compaction of lost packets kept for the detection of
+ * spurious retransmissions. The compact copy should only keep the frames
+ * that matter for the processing of acknowledgements, with stream frames
+ * reduced to descriptors, and processing the acknowledgement of the copy
+ * should have the same effect as processing that of the original packet.
+ */
+static uint8_t compact_test_frames[] = {
+    picoquic_frame_type_ping,
+    picoquic_frame_type_max_data, 0x44, 0x00,
+    picoquic_frame_type_stream_range_min | 6, 0x00, 0x10, 0x20,
+    1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+    17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+static uint8_t compact_test_expected[] = {
+    picoquic_frame_type_max_data, 0x44, 0x00,
+    picoquic_frame_type_stream_range_min | 6, 0x00, 0x10, 0x20
+};
+
+int test_compact_for_retransmitted()
+{
+    picoquic_quic_t* qtest = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    picoquic_packet_t* p = NULL;
+    picoquic_stream_head_t* stream = NULL;
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    struct sockaddr_in saddr;
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+
+    qtest = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+    if (qtest == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else if ((cnx = picoquic_create_cnx(qtest,
+        picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*)&saddr,
+        simulated_time, 0, "test-sni", "test-alpn", 1)) == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC CNX context\n");
+        ret = -1;
+    }
+    else if (picoquic_add_to_stream(cnx, 0, ct_stream0_data, sizeof(ct_stream0_data), 0) != 0 ||
+        (stream = picoquic_find_stream(cnx, 0)) == NULL) {
+        DBG_PRINTF("%s", "Cannot initialize stream 0\n");
+        ret = -1;
+    }
+    else if ((p = picoquic_create_packet(qtest)) == NULL) {
+        DBG_PRINTF("%s", "Cannot create packet\n");
+        ret = -1;
+    }
+    else {
+        size_t length;
+
+        p->ptype = picoquic_packet_1rtt_protected;
+        p->pc = picoquic_packet_context_application;
+        p->offset = SIZEOF_1RTT_HEADER;
+        memset(p->bytes, 0, p->offset);
+        memcpy(p->bytes + p->offset, compact_test_frames, sizeof(compact_test_frames));
+        p->length = p->offset + sizeof(compact_test_frames);
+        length = p->length;
+
+        p = picoquic_compact_retransmitted_packet(cnx, p);
+
+        if (!p->is_compacted || p->length != length || p->offset != 0) {
+            DBG_PRINTF("%s", "Packet was not compacted\n");
+            ret = -1;
+        }
+        else if (p->compact_length != sizeof(compact_test_expected) ||
+            memcmp(p->bytes, compact_test_expected, sizeof(compact_test_expected)) != 0) {
+            DBG_PRINTF("Unexpected compact copy, length %zu\n", p->compact_length);
+            ret = -1;
+        }
+        else if (picoquic_check_sack_list(&stream->sack_list, 0x10, 0x2f) != 0) {
+            DBG_PRINTF("%s", "Stream data acked too soon\n");
+            ret = -1;
+        }
+        else {
+            picoquic_process_ack_of_frames(cnx, p, 1, simulated_time);
+
+            if (cnx->maxdata_local_acked != 0x400) {
+                DBG_PRINTF("Max data acked: 0x%" PRIx64 " instead of 0x400\n", cnx->maxdata_local_acked);
+                ret = -1;
+            }
+            else if (picoquic_check_sack_list(&stream->sack_list, 0x10, 0x2f) == 0) {
+                DBG_PRINTF("%s", "Stream data not acked\n");
+                ret = -1;
+            }
+        }
+        picoquic_recycle_packet(qtest, p);
+    }
+
+    if (cnx != NULL) {
+        picoquic_delete_cnx(cnx);
+    }
+
+    if (qtest != NULL) {
+        picoquic_free(qtest);
+    }
+
+    return ret;
+}
+
 /* Testing the sending of blocked frames */
 struct st_stream_blocked_test_t {
     uint64_t stream_id;
@@ -2456,10 +2562,10 @@ int queue_network_input_test()
         NULL, NULL, NULL, NULL, simulated_time,
         &simulated_time, NULL, NULL, 0);
 
-    const size_t expected_length[3] = { 4, 2, 4 };
-    const uint8_t expected[3][4] = {
-        { 0, 1, 2, 3 },
-        { 4, 5 },
+    /* The chunk 4..5 is appended to the copy of the adjacent chunk 0..3 */
+    const size_t expected_length[2] = { 6, 4 };
+    const uint8_t expected[2][6] = {
+        { 0, 1, 2, 3, 4, 5 },
         { 6, 7, 8, 9 }
     };
 
@@ -2526,9 +2632,9 @@ int queue_network_input_test()
 
     if (ret == 0) {
         picoquic_stream_data_node_t* next = (picoquic_stream_data_node_t*)picosplay_first(tree);
-        for (int i = 0; i < 3; ++i) {
+        for (int i = 0; i < 2; ++i) {
             if (next == NULL) {
-                DBG_PRINTF("tree does not contain enough data (%d chunks vs 3 exptected)", i);
+                DBG_PRINTF("tree does not contain enough data (%d chunks vs 2 exptected)", i);
                 ret = 1;
                 break;
             }
@@ -2556,6 +2662,292 @@ int queue_network_input_test()
     return ret;
 }
 
+/* Verify that chunks of stream data received in the same packet are queued
+ * as references to the packet data, and that the packet node is only
+ * recycled when the last reference is released.
+ */
+int queue_network_input_ref_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+    uint8_t data[1000];
+    picoquic_stream_data_node_t* packet = NULL;
+    picosplay_tree_t* tree = picosplay_new_tree(
+        picoquic_stream_data_node_compare,
+        picoquic_stream_data_node_create,
+        picoquic_stream_data_node_delete,
+        picoquic_stream_data_node_value);
+    int new_data_available = 0;
+
+    if (quic == NULL || tree == NULL) {
+        ret = -1;
+    }
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)i;
+    }
+
+    /* Fill 400..599 with a copied chunk */
+    if (ret == 0 && (ret = picoquic_queue_network_input(quic, tree, 0, 400, data + 400, 200, NULL,
+        &new_data_available)) != 0) {
+        DBG_PRINTF("picoquic_queue_network_input(0, 400, 200) failed (%d)", ret);
+    }
+
+    /* Simulate a packet carrying two frames, 200..799 and 800..999 */
+    if (ret == 0) {
+        if ((packet = picoquic_stream_data_node_alloc(quic)) == NULL) {
+            ret = -1;
+        }
+        else {
+            memcpy(packet->data, data + 200, 800);
+            if ((ret = picoquic_queue_network_input(quic, tree, 0, 200, packet->data, 600, packet,
+                &new_data_available)) != 0 ||
+                (ret = picoquic_queue_network_input(quic, tree, 0, 800, packet->data + 600, 200, packet,
+                &new_data_available)) != 0) {
+                DBG_PRINTF("picoquic_queue_network_input with packet data failed (%d)", ret);
+            }
+            else if (packet->nb_data_refs != 4) {
+                DBG_PRINTF("Expected 4 holds on packet, got %d", packet->nb_data_refs);
+                ret = -1;
+            }
+        }
+    }
+
+    /* Verify the content of the tree, and that packet chunks were not copied */
+    if (ret == 0) {
+        picoquic_stream_data_node_t* next = (picoquic_stream_data_node_t*)picosplay_first(tree);
+        uint64_t expected_offset = 200;
+
+        while (ret == 0 && next != NULL) {
+            if (next->offset != expected_offset ||
+                memcmp(next->bytes, data + next->offset, next->length) != 0) {
+                DBG_PRINTF("Unexpected chunk at offset %" PRIu64, next->offset);
+                ret = -1;
+            }
+            else if (next->offset != 400 &&
+                (next->bytes < packet->data || next->bytes + next->length > packet->data + 800)) {
+                DBG_PRINTF("Chunk at offset %" PRIu64 " was copied", next->offset);
+                ret = -1;
+            }
+            expected_offset += next->length;
+            next = (picoquic_stream_data_node_t*)picosplay_next(&next->stream_data_node);
+        }
+        if (ret == 0 && expected_offset != 1000) {
+            DBG_PRINTF("Tree covers up to %" PRIu64 " instead of 1000", expected_offset);
+            ret = -1;
+        }
+    }
+
+    /* Release the packet processing hold, then empty the tree */
+    if (packet != NULL) {
+        picoquic_stream_data_node_recycle(packet);
+        if (ret == 0 && packet->nb_data_refs != 3) {
+            DBG_PRINTF("%s", "Packet recycled while still referenced");
+            ret = -1;
+        }
+    }
+
+    if (tree != NULL) {
+        picosplay_empty_tree(tree);
+        free(tree);
+    }
+
+    if (ret == 0 && quic->nb_data_nodes_in_pool != quic->nb_data_nodes_allocated) {
+        DBG_PRINTF("%d nodes in pool, %d allocated", quic->nb_data_nodes_in_pool, quic->nb_data_nodes_allocated);
+        ret = -1;
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/* Verify that small chunks are copied into compact nodes instead of holding
+ * their packet, that adjacent small chunks share a node, and that queued
+ * chunks are delivered in a single scatter gather call.
+ */
+typedef struct st_queue_network_input_slice_ctx_t {
+    const uint8_t* data;
+    const uint8_t* packet_data;
+    size_t packet_length;
+    int nb_calls;
+    int nb_errors;
+    int fin;
+    size_t nb_iov;
+    size_t nb_iov_in_packet;
+    uint64_t offset;
+    uint64_t length;
+} queue_network_input_slice_ctx_t;
+
+static int queue_network_input_slice_callback(picoquic_cnx_t* cnx,
+    uint64_t stream_id, int fin, const picoquic_iovec_t* iov, size_t nb_iov, uint64_t offset,
+    void* iovec_receive_ctx)
+{
+    queue_network_input_slice_ctx_t* ctx = (queue_network_input_slice_ctx_t*)iovec_receive_ctx;
+    uint64_t current_offset = offset;
+
+    ctx->nb_calls++;
+    ctx->fin = fin;
+    ctx->nb_iov = nb_iov;
+    ctx->nb_iov_in_packet = 0;
+    ctx->offset = offset;
+    for (size_t i = 0; i < nb_iov; i++) {
+        if (memcmp(iov[i].base, ctx->data + current_offset, iov[i].len) != 0) {
+            ctx->nb_errors++;
+        }
+        if (iov[i].base >= ctx->packet_data && iov[i].base + iov[i].len <= ctx->packet_data + ctx->packet_length) {
+            ctx->nb_iov_in_packet++;
+        }
+        current_offset += iov[i].len;
+    }
+    ctx->length = current_offset - offset;
+
+    return 0;
+}
+
+int queue_network_input_slice_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    struct sockaddr_in saddr;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+    picoquic_cnx_t* cnx = NULL;
+    picoquic_stream_head_t* stream = NULL;
+    picoquic_stream_data_node_t* packet[3] = { NULL, NULL, NULL };
+    uint8_t data[1100];
+    queue_network_input_slice_ctx_t ctx;
+    int new_data_available = 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 7);
+    }
+    ctx.data = data;
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    if (quic == NULL ||
+        (cnx = picoquic_create_cnx(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*) & saddr, simulated_time, 0, "test-sni", "test-alpn", 1)) == NULL ||
+        (stream = picoquic_create_stream(cnx, 0)) == NULL) {
+        DBG_PRINTF("%s", "Cannot create context, connection or stream");
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < 3; i++) {
+        if ((packet[i] = picoquic_stream_data_node_alloc(quic)) == NULL) {
+            ret = -1;
+        }
+    }
+
+    /* Three packets, each carrying a small frame: 150..209, 210..269, 270..329 */
+    for (int i = 0; ret == 0 && i < 3; i++) {
+        memcpy(packet[i]->data, data + 150 + 60 * i, 60);
+        if ((ret = picoquic_queue_network_input(quic, &stream->stream_data_tree, stream->consumed_offset,
+            150 + 60 * i, packet[i]->data, 60, packet[i], &new_data_available)) != 0) {
+            DBG_PRINTF("Queue small chunk %d failed (%d)", i, ret);
+        }
+        else if (packet[i]->nb_data_refs != 1) {
+            DBG_PRINTF("Packet %d is held by the small chunk", i);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_stream_data_node_t* first = (picoquic_stream_data_node_t*)picosplay_first(&stream->stream_data_tree);
+
+        if (first == NULL || first->offset != 150 || first->length != 180 || !first->is_compact ||
+            picosplay_next(&first->stream_data_node) != NULL || quic->nb_data_nodes_compact != 1) {
+            DBG_PRINTF("%s", "Adjacent small chunks were not merged");
+            ret = -1;
+        }
+    }
+
+    /* A packet carrying 0..149 and 330..999, and a later chunk 1050..1099 */
+    if (ret == 0) {
+        picoquic_stream_data_node_recycle(packet[0]);
+        packet[0] = NULL;
+        if ((packet[0] = picoquic_stream_data_node_alloc(quic)) == NULL) {
+            ret = -1;
+        }
+        else {
+            memcpy(packet[0]->data, data, 150);
+            memcpy(packet[0]->data + 150, data + 330, 670);
+            ctx.packet_data = packet[0]->data;
+            ctx.packet_length = 820;
+            if ((ret = picoquic_queue_network_input(quic, &stream->stream_data_tree, stream->consumed_offset,
+                0, packet[0]->data, 150, packet[0], &new_data_available)) != 0 ||
+                (ret = picoquic_queue_network_input(quic, &stream->stream_data_tree, stream->consumed_offset,
+                    330, packet[0]->data + 150, 670, packet[0], &new_data_available)) != 0 ||
+                (ret = picoquic_queue_network_input(quic, &stream->stream_data_tree, stream->consumed_offset,
+                    1050, data + 1050, 50, NULL, &new_data_available)) != 0) {
+                DBG_PRINTF("Queue packet chunks failed (%d)", ret);
+            }
+        }
+    }
+
+    /* Marking the stream delivers 0..999 in one call, without the final chunk */
+    if (ret == 0 && (ret = picoquic_mark_iovec_receive_stream(cnx, 0, queue_network_input_slice_callback, &ctx)) != 0) {
+        DBG_PRINTF("Mark iovec receive failed (%d)", ret);
+    }
+
+    if (ret == 0 && (ctx.nb_calls != 1 || ctx.nb_errors != 0 || ctx.nb_iov != 3 || ctx.nb_iov_in_packet != 2 ||
+        ctx.offset != 0 || ctx.length != 1000 || ctx.fin || stream->consumed_offset != 1000)) {
+        DBG_PRINTF("Unexpected delivery: %d calls, %d errors, %zu iov (%zu in packet), length %" PRIu64,
+            ctx.nb_calls, ctx.nb_errors, ctx.nb_iov, ctx.nb_iov_in_packet, ctx.length);
+        ret = -1;
+    }
+
+    /* Fill the gap and receive the fin, then deliver the last chunks */
+    if (ret == 0 && (ret = picoquic_queue_network_input(quic, &stream->stream_data_tree, stream->consumed_offset,
+        1000, data + 1000, 50, NULL, &new_data_available)) != 0) {
+        DBG_PRINTF("Queue final chunk failed (%d)", ret);
+    }
+
+    if (ret == 0) {
+        stream->fin_received = 1;
+        stream->fin_offset = 1100;
+        picoquic_stream_data_callback(cnx, stream);
+        if (ctx.nb_calls != 2 || ctx.nb_errors != 0 || ctx.nb_iov != 2 || ctx.offset != 1000 ||
+            ctx.length != 100 || !ctx.fin || !stream->fin_signalled ||
+            picosplay_first(&stream->stream_data_tree) != NULL) {
+            DBG_PRINTF("%s", "Unexpected delivery of final chunk");
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; i < 3; i++) {
+        if (packet[i] != NULL) {
+            picoquic_stream_data_node_recycle(packet[i]);
+        }
+    }
+
+    if (cnx != NULL) {
+        picoquic_delete_cnx(cnx);
+    }
+
+    if (ret == 0 && (quic->nb_data_nodes_compact != 0 || quic->nb_data_nodes_in_pool != quic->nb_data_nodes_allocated)) {
+        DBG_PRINTF("%d compact nodes, %d nodes in pool, %d allocated", quic->nb_data_nodes_compact,
+            quic->nb_data_nodes_in_pool, quic->nb_data_nodes_allocated);
+        ret = -1;
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
 #define QLOG_OVERFLOW_REF "picoquictest" PICOQUIC_FILE_SEPARATOR "app_msg_overflow_ref.qlog"
 static char const* qlog_overflow_bin = "0809000102030405.client.log";
 static char const* qlog_overflow_file = "0809000102030405.qlog";
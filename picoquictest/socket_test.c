@@ -240,3 +240,79 @@ int socket_ecn_test()
 
     return ret;
 }
+
+/*
+ * Test that kernel receive time stamps are parsed, if the platform supports them.
+ * The socket sends a datagram to itself, and waits before reading it. The receive
+ * time shall then precede the time at which select returns.
+ */
+
+int socket_timestamp_test()
+{
+    int ret = 0;
+    SOCKET_TYPE fd = picoquic_open_client_socket(AF_INET);
+
+    if (fd == INVALID_SOCKET) {
+        ret = -1;
+    }
+    else {
+        struct sockaddr_storage local_addr;
+        struct sockaddr_storage addr_from;
+        struct sockaddr_storage addr_dest;
+        int dest_if = 0;
+        int socket_rank = -1;
+        unsigned char received_ecn;
+        uint8_t message[16];
+        uint8_t buffer[512];
+        uint64_t current_time = 0;
+        uint64_t receive_time = 0;
+        int is_supported = (picoquic_socket_set_timestamp_options(fd) == 0);
+        int bytes_recv;
+
+        memset(message, 0x5a, sizeof(message));
+        if (picoquic_bind_to_port(fd, AF_INET, 0) != 0 || picoquic_get_local_address(fd, &local_addr) != 0) {
+            DBG_PRINTF("%s", "Cannot bind the socket");
+            ret = -1;
+        }
+        else {
+            ((struct sockaddr_in*)&local_addr)->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (sendto(fd, (const char*)message, (int)sizeof(message), 0, (struct sockaddr*)&local_addr,
+                sizeof(struct sockaddr_in)) != (int)sizeof(message)) {
+                DBG_PRINTF("%s", "Cannot send the test message");
+                ret = -1;
+            }
+        }
+
+        if (ret == 0) {
+            uint64_t wait_start = picoquic_current_time();
+
+            while (picoquic_current_time() < wait_start + 10000);
+
+            bytes_recv = picoquic_select_ex2(&fd, 1, &addr_from, &addr_dest, &dest_if, &received_ecn,
+                buffer, sizeof(buffer), 1000000, &socket_rank, &current_time, &receive_time);
+
+            if (bytes_recv != (int)sizeof(message)) {
+                DBG_PRINTF("Select returns %d bytes, expected %d\n", bytes_recv, (int)sizeof(message));
+                ret = -1;
+            }
+            else if (!is_supported) {
+                if (receive_time != 0) {
+                    DBG_PRINTF("%s", "Unexpected receive time stamp");
+                    ret = -1;
+                }
+            }
+            else if (receive_time == 0 || receive_time > current_time || receive_time < wait_start - 1000000) {
+                DBG_PRINTF("Receive time %" PRIu64 " not plausible, current time %" PRIu64, receive_time, current_time);
+                ret = -1;
+            }
+            else if (current_time - receive_time < 5000) {
+                DBG_PRINTF("Receive time %" PRIu64 " not before wait, current time %" PRIu64, receive_time, current_time);
+                ret = -1;
+            }
+        }
+
+        SOCKET_CLOSE(fd);
+    }
+
+    return ret;
+}
@@ -0,0 +1,411 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2022, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "picosocks.h"
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+#include "picoquic_packet_loop.h"
+
+/*
+ * Loopback tests of the packet loops. The loops run in their own threads, and
+ * the test thread sends short header packets with unknown connection IDs to
+ * their ports. Each packet is answered with a stateless reset, which exercises
+ * the receive and send paths of the loops without requiring a handshake.
+ */
+
+#define SOCKLOOP_TEST_PACKET_LENGTH 200
+#define SOCKLOOP_TEST_WAIT_MAX 2000000
+#define SOCKLOOP_TEST_NB_WORKERS 4
+#define SOCKLOOP_TEST_NB_ROUNDS 8
+#define SOCKLOOP_TEST_BUSY_POLL_DELAY 1000
+
+typedef struct st_sockloop_test_server_t {
+    volatile int* is_done;
+    volatile int is_ready;
+    uint16_t port;
+    int64_t busy_poll_delay;
+    picoquic_packet_loop_wait_stats_t wait_stats;
+} sockloop_test_server_t;
+
+static int sockloop_test_callback(picoquic_quic_t* quic, picoquic_packet_loop_cb_enum cb_mode,
+    void* callback_ctx, void* callback_argv)
+{
+    int ret = 0;
+    sockloop_test_server_t* server = (sockloop_test_server_t*)callback_ctx;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(quic);
+#endif
+
+    switch (cb_mode) {
+    case picoquic_packet_loop_ready:
+        if (server->busy_poll_delay > 0) {
+            picoquic_packet_loop_options_t* options = (picoquic_packet_loop_options_t*)callback_argv;
+
+            options->do_time_check = 1;
+            options->busy_poll_delay = server->busy_poll_delay;
+            options->wait_stats = &server->wait_stats;
+        }
+        break;
+    case picoquic_packet_loop_time_check: {
+        packet_loop_time_check_arg_t* time_check_arg = (packet_loop_time_check_arg_t*)callback_argv;
+
+        /* Keep the waits short enough to be done by spinning */
+        if (time_check_arg->delta_t > server->busy_poll_delay) {
+            time_check_arg->delta_t = server->busy_poll_delay;
+        }
+        break;
+    }
+    case picoquic_packet_loop_port_update:
+        server->port = ntohs(((struct sockaddr_in*)callback_argv)->sin_port);
+        server->is_ready = 1;
+        break;
+    case picoquic_packet_loop_after_receive:
+    case picoquic_packet_loop_after_send:
+        if (*server->is_done) {
+            ret = PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP;
+        }
+        break;
+    default:
+        break;
+    }
+
+    return ret;
+}
+
+static picoquic_quic_t* sockloop_test_create_quic()
+{
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, picoquic_current_time(), NULL, NULL, NULL, 0);
+
+    if (quic != NULL) {
+        /* Answer every test packet */
+        picoquic_set_default_stateless_reset_min_interval(quic, 0);
+    }
+
+    return quic;
+}
+
+static int sockloop_test_wait_ready(SOCKET_TYPE fd, sockloop_test_server_t* server, int nb_servers)
+{
+    uint64_t current_time = picoquic_current_time();
+    uint64_t wait_end = current_time + SOCKLOOP_TEST_WAIT_MAX;
+    int nb_ready = 0;
+
+    while (nb_ready < nb_servers && current_time < wait_end) {
+        struct sockaddr_storage addr_from;
+        struct sockaddr_storage addr_dest;
+        int dest_if = 0;
+        unsigned char received_ecn = 0;
+        uint8_t buffer[16];
+
+        nb_ready = 0;
+        for (int i = 0; i < nb_servers; i++) {
+            nb_ready += server[i].is_ready;
+        }
+        if (nb_ready < nb_servers) {
+            (void)picoquic_select(&fd, 1, &addr_from, &addr_dest, &dest_if, &received_ecn,
+                buffer, sizeof(buffer), 1000, &current_time);
+        }
+    }
+
+    if (nb_ready < nb_servers) {
+        DBG_PRINTF("Only %d loops out of %d are ready", nb_ready, nb_servers);
+    }
+
+    return (nb_ready == nb_servers) ? 0 : -1;
+}
+
+/* Send nb_rounds packets to each server, one for each of the server IDs in [0, nb_ids[ */
+static int sockloop_test_send(SOCKET_TYPE fd, sockloop_test_server_t* server, int nb_servers,
+    int nb_ids, int nb_rounds, int* nb_sent)
+{
+    int ret = 0;
+    uint8_t packet[SOCKLOOP_TEST_PACKET_LENGTH];
+
+    for (int r = 0; ret == 0 && r < nb_rounds; r++) {
+        for (int s = 0; ret == 0 && s < nb_servers; s++) {
+            struct sockaddr_storage server_addr;
+
+            (void)picoquic_store_text_addr(&server_addr, "127.0.0.1", server[s].port);
+            for (int i = 0; ret == 0 && i < nb_ids; i++) {
+                /* Short header, then an 8 bytes CID with the server ID in clear text in the second byte */
+                memset(packet, 0x5a, sizeof(packet));
+                packet[0] = 0x40;
+                memset(packet + 1, 0, 8);
+                packet[2] = (uint8_t)i;
+                packet[3] = (uint8_t)s;
+                packet[4] = (uint8_t)r;
+                if (sendto(fd, (const char*)packet, (int)sizeof(packet), 0, (struct sockaddr*)&server_addr,
+                    sizeof(struct sockaddr_in)) != (int)sizeof(packet)) {
+                    DBG_PRINTF("Cannot send packet %d", *nb_sent);
+                    ret = -1;
+                }
+                else {
+                    *nb_sent += 1;
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+static int sockloop_test_receive(SOCKET_TYPE fd, int nb_expected)
+{
+    int ret = 0;
+    int nb_received = 0;
+    uint64_t current_time = picoquic_current_time();
+    uint64_t wait_end = current_time + SOCKLOOP_TEST_WAIT_MAX;
+
+    while (ret == 0 && nb_received < nb_expected && current_time < wait_end) {
+        struct sockaddr_storage addr_from;
+        struct sockaddr_storage addr_dest;
+        int dest_if = 0;
+        unsigned char received_ecn = 0;
+        uint8_t buffer[1536];
+        int bytes_recv = picoquic_select(&fd, 1, &addr_from, &addr_dest, &dest_if, &received_ecn,
+            buffer, sizeof(buffer), (int64_t)(wait_end - current_time), &current_time);
+
+        if (bytes_recv < 0) {
+            ret = -1;
+        }
+        else if (bytes_recv > 0) {
+            nb_received++;
+        }
+    }
+
+    if (ret == 0 && nb_received != nb_expected) {
+        DBG_PRINTF("Received %d stateless resets, expected %d", nb_received, nb_expected);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Test of the multi-threaded loop. Each packet is sent to every worker, and
+ * the packets that carry the server ID of another worker are forwarded. */
+typedef struct st_sockloop_test_mt_t {
+    picoquic_packet_loop_mt_param_t param;
+    picoquic_quic_t* quic[SOCKLOOP_TEST_NB_WORKERS];
+    void* callback_ctx[SOCKLOOP_TEST_NB_WORKERS];
+    sockloop_test_server_t server[SOCKLOOP_TEST_NB_WORKERS];
+    volatile int is_done;
+    int loop_ret;
+} sockloop_test_mt_t;
+
+static picoquic_thread_return_t sockloop_test_mt_thread(void* v_mt)
+{
+    sockloop_test_mt_t* mt = (sockloop_test_mt_t*)v_mt;
+
+    mt->loop_ret = picoquic_packet_loop_mt(&mt->param, mt->quic, sockloop_test_callback, mt->callback_ctx);
+
+    picoquic_thread_do_return;
+}
+
+int sockloop_mt_test()
+{
+    int ret = 0;
+#ifdef SO_REUSEPORT
+    sockloop_test_mt_t* mt = (sockloop_test_mt_t*)malloc(sizeof(sockloop_test_mt_t));
+    SOCKET_TYPE fd = picoquic_open_client_socket(AF_INET);
+    picoquic_thread_t thread;
+    int thread_started = 0;
+    int nb_sent = 0;
+
+    if (mt == NULL || fd == INVALID_SOCKET) {
+        ret = -1;
+    }
+    else {
+        memset(mt, 0, sizeof(sockloop_test_mt_t));
+        mt->param.nb_workers = SOCKLOOP_TEST_NB_WORKERS;
+        mt->param.local_af = AF_INET;
+        mt->param.do_not_use_gso = 1;
+        for (int i = 0; ret == 0 && i < SOCKLOOP_TEST_NB_WORKERS; i++) {
+            mt->server[i].is_done = &mt->is_done;
+            mt->callback_ctx[i] = &mt->server[i];
+            if ((mt->quic[i] = sockloop_test_create_quic()) == NULL) {
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        if ((ret = picoquic_create_thread(&thread, sockloop_test_mt_thread, mt)) == 0) {
+            thread_started = 1;
+        }
+    }
+
+    /* With port 0, each worker binds its own port, so the test can reach every worker */
+    if (ret == 0) {
+        ret = sockloop_test_wait_ready(fd, mt->server, SOCKLOOP_TEST_NB_WORKERS);
+    }
+
+    if (ret == 0) {
+        ret = sockloop_test_send(fd, mt->server, SOCKLOOP_TEST_NB_WORKERS, SOCKLOOP_TEST_NB_WORKERS,
+            SOCKLOOP_TEST_NB_ROUNDS, &nb_sent);
+    }
+
+    if (ret == 0) {
+        ret = sockloop_test_receive(fd, nb_sent);
+    }
+
+    if (thread_started) {
+        /* Wake up the workers, so they see that the test is done */
+        mt->is_done = 1;
+        nb_sent = 0;
+        (void)sockloop_test_send(fd, mt->server, SOCKLOOP_TEST_NB_WORKERS, 1, 1, &nb_sent);
+        picoquic_delete_thread(&thread);
+        if (ret == 0 && mt->loop_ret != 0) {
+            DBG_PRINTF("Multi-threaded loop returns %d", mt->loop_ret);
+            ret = -1;
+        }
+    }
+
+    if (fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(fd);
+    }
+
+    if (mt != NULL) {
+        for (int i = 0; i < SOCKLOOP_TEST_NB_WORKERS; i++) {
+            if (mt->quic[i] != NULL) {
+                picoquic_free(mt->quic[i]);
+            }
+        }
+        free(mt);
+    }
+#endif
+
+    return ret;
+}
+
+/* Test of the single threaded loops, regular or pipelined */
+typedef struct st_sockloop_test_single_t {
+    picoquic_quic_t* quic;
+    sockloop_test_server_t server;
+    volatile int is_done;
+    int is_pipelined;
+    int loop_ret;
+} sockloop_test_single_t;
+
+static picoquic_thread_return_t sockloop_test_single_thread(void* v_single)
+{
+    sockloop_test_single_t* single = (sockloop_test_single_t*)v_single;
+
+    if (single->is_pipelined) {
+        single->loop_ret = picoquic_packet_loop_pipelined(single->quic, 0, AF_INET, 0, 0, 1,
+            sockloop_test_callback, &single->server);
+    }
+    else {
+        single->loop_ret = picoquic_packet_loop(single->quic, 0, AF_INET, 0, 0, 1,
+            sockloop_test_callback, &single->server);
+    }
+
+    picoquic_thread_do_return;
+}
+
+static int sockloop_test_single(sockloop_test_single_t* single)
+{
+    int ret = 0;
+    SOCKET_TYPE fd = picoquic_open_client_socket(AF_INET);
+    picoquic_thread_t thread;
+    int thread_started = 0;
+    int nb_sent = 0;
+
+    single->server.is_done = &single->is_done;
+    if (fd == INVALID_SOCKET || (single->quic = sockloop_test_create_quic()) == NULL) {
+        ret = -1;
+    }
+    else if ((ret = picoquic_create_thread(&thread, sockloop_test_single_thread, single)) == 0) {
+        thread_started = 1;
+    }
+
+    if (ret == 0) {
+        ret = sockloop_test_wait_ready(fd, &single->server, 1);
+    }
+
+    if (ret == 0) {
+        ret = sockloop_test_send(fd, &single->server, 1, 1, 4 * SOCKLOOP_TEST_NB_ROUNDS, &nb_sent);
+    }
+
+    if (ret == 0) {
+        ret = sockloop_test_receive(fd, nb_sent);
+    }
+
+    if (thread_started) {
+        /* Wake up the loop, so it sees that the test is done */
+        single->is_done = 1;
+        nb_sent = 0;
+        (void)sockloop_test_send(fd, &single->server, 1, 1, 1, &nb_sent);
+        picoquic_delete_thread(&thread);
+        if (ret == 0 && single->loop_ret != 0) {
+            DBG_PRINTF("Packet loop returns %d", single->loop_ret);
+            ret = -1;
+        }
+    }
+
+    if (fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(fd);
+    }
+
+    if (single->quic != NULL) {
+        picoquic_free(single->quic);
+        single->quic = NULL;
+    }
+
+    return ret;
+}
+
+int sockloop_pipelined_test()
+{
+    sockloop_test_single_t single;
+
+    memset(&single, 0, sizeof(sockloop_test_single_t));
+    single.is_pipelined = 1;
+
+    return sockloop_test_single(&single);
+}
+
+/* Test of the busy poll option, in the regular and the pipelined loops.
+ * The time check callback keeps the waits shorter than the busy poll
+ * delay, so that the packets are received while spinning. */
+int sockloop_busy_poll_test()
+{
+    int ret = 0;
+
+    for (int is_pipelined = 0; ret == 0 && is_pipelined <= 1; is_pipelined++) {
+        sockloop_test_single_t single;
+
+        memset(&single, 0, sizeof(sockloop_test_single_t));
+        single.is_pipelined = is_pipelined;
+        single.server.busy_poll_delay = SOCKLOOP_TEST_BUSY_POLL_DELAY;
+
+        ret = sockloop_test_single(&single);
+
+        if (ret == 0 && single.server.wait_stats.nb_spin_waits == 0) {
+            DBG_PRINTF("No spin wait in the %s loop", (is_pipelined) ? "pipelined" : "regular");
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
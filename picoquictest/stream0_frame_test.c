@@ -514,6 +514,11 @@ int stream_splay_test()
                         i, values[i], count, cnx->stream_tree.size);
                     ret = -1;
                 }
+                else if (cnx->stream_table == NULL || cnx->stream_table->count != (size_t)count) {
+                    DBG_PRINTF("Insert v[%d] = %d, expected table count %d\n",
+                        i, values[i], count);
+                    ret = -1;
+                }
                 else if (picoquic_first_stream(cnx)->stream_id != values_first[i]) {
                     DBG_PRINTF("Insert v[%d] = %d, expected first = %d, got %d instead\n",
                         i, values[i],
@@ -555,6 +560,11 @@ int stream_splay_test()
                     break;
                 }
                 picoquic_delete_stream(cnx, stream);
+                if (picoquic_find_stream(cnx, values[i]) != NULL) {
+                    DBG_PRINTF("Stream %d still found after deletion\n", (int)values[i]);
+                    ret = -1;
+                    break;
+                }
                 /* Verify sanity and count after each deletion */
                 count = check_stream_splay_node_sanity(cnx->stream_tree.root, NULL, NULL, cnx->stream_tree.comp);
                 if (count != 6 - i) {
@@ -567,6 +577,11 @@ int stream_splay_test()
                         i, values[i], count, cnx->stream_tree.size);
                     ret = -1;
                 }
+                else if (cnx->stream_table->count != (size_t)count) {
+                    DBG_PRINTF("Delete v[%d] = %d, expected table count %d, got %d instead\n",
+                        i, values[i], count, (int)cnx->stream_table->count);
+                    ret = -1;
+                }
                 else if (i < 6) {
                     if (picoquic_first_stream(cnx)->stream_id != value2_first[i]) {
                         DBG_PRINTF("Delete v[%d] = %d, expected first = %d, got %d instead\n",
@@ -806,16 +821,28 @@ int stream_output_test()
                     DBG_PRINTF("Unexpected ready stream[%d]\n", (int)stream->stream_id);
                     ret = -1;
                 }
+                else if (cnx->first_output_stream != NULL) {
+                    DBG_PRINTF("Idle stream[%d] was not parked\n", (int)cnx->first_output_stream->stream_id);
+                    ret = -1;
+                }
             }
 
             if (ret == 0) {
                 /* Mark all streams as active */
-                stream = cnx->first_output_stream;
+                for (size_t i = 0; ret == 0 && i < sizeof(output2) / sizeof(uint64_t); i++) {
+                    stream = picoquic_find_stream(cnx, output2[i]);
+                    if (stream == NULL || !stream->is_output_stream || !stream->is_output_parked) {
+                        DBG_PRINTF("Stream[%d] is not a parked output stream\n", (int)output2[i]);
+                        ret = -1;
+                    }
+                    else {
+                        stream->maxdata_remote = 4096;
+                        picoquic_mark_active_stream(cnx, stream->stream_id, 1, NULL);
+                    }
+                }
 
-                while (stream != NULL) {
-                    stream->maxdata_remote = 4096;
-                    picoquic_mark_active_stream(cnx, stream->stream_id, 1, NULL);
-                    stream = stream->next_output_stream;
+                if (ret == 0) {
+                    ret = stream_output_test_list(cnx, sizeof(output2) / sizeof(uint64_t), output2);
                 }
 
                 /* Check that first stream is what we expect */
@@ -849,6 +876,349 @@ int stream_output_test()
 }
 
 
+/* Test that streams are scheduled by urgency, that incremental streams of
+ * the same urgency are served in round robin, and that streams blocked by
+ * flow control are parked until the limit is raised.
+ */
+
+static int stream_priority_test_send(picoquic_cnx_t* cnx, uint64_t expected_stream_id, size_t nb_output, uint64_t* output)
+{
+    int ret = 0;
+    uint8_t buffer[200];
+    uint8_t* bytes_next;
+    int more_data = 0;
+    int is_pure_ack = 1;
+    int stream_tried_and_failed = 0;
+    picoquic_stream_head_t* stream = picoquic_find_stream(cnx, expected_stream_id);
+    uint64_t sent_offset = (stream == NULL) ? 0 : stream->sent_offset;
+
+    bytes_next = picoquic_format_available_stream_frames(cnx, buffer, buffer + sizeof(buffer), &more_data,
+        &is_pure_ack, &stream_tried_and_failed, &ret);
+
+    if (ret != 0 || bytes_next == buffer) {
+        DBG_PRINTF("Cannot format stream frames, ret = %d\n", ret);
+        ret = -1;
+    }
+    else if (stream == NULL || stream->sent_offset <= sent_offset) {
+        DBG_PRINTF("Stream[%d] was not served\n", (int)expected_stream_id);
+        ret = -1;
+    }
+    else {
+        ret = stream_output_test_list(cnx, nb_output, output);
+    }
+
+    return ret;
+}
+
+int stream_priority_test()
+{
+    int ret = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    uint64_t simulated_time = 0;
+    struct sockaddr_in saddr;
+    uint8_t data[1000];
+    uint64_t stream_ids[] = { 0, 4, 8, 12 };
+    uint8_t priorities[] = { 11, 4, 4, 3 };
+    uint64_t output1[] = { 12, 4, 8, 0 };
+    uint64_t output2[] = { 8, 4, 0 };
+    uint64_t output3[] = { 4, 8, 0 };
+    uint64_t output4[] = { 4, 0 };
+    uint64_t output5[] = { 0, 4, 8 };
+    picoquic_stream_head_t* stream = NULL;
+
+    memset(data, 0x5a, sizeof(data));
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else {
+        cnx = picoquic_create_cnx(quic,
+            picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*) & saddr,
+            simulated_time, 0, "test-sni", "test-alpn", 1);
+
+        if (cnx == NULL) {
+            DBG_PRINTF("%s", "Cannot create connection\n");
+            ret = -1;
+        }
+        else {
+            picoquic_set_callback(cnx, stream_output_test_callback, NULL);
+            cnx->maxdata_remote = PICOQUIC_DEFAULT_0RTT_WINDOW;
+            cnx->remote_parameters.initial_max_stream_data_bidi_remote = PICOQUIC_DEFAULT_0RTT_WINDOW;
+            cnx->max_stream_id_bidir_remote = 100;
+
+            /* Create the streams with their priorities, then queue data */
+            for (size_t i = 0; ret == 0 && i < sizeof(stream_ids) / sizeof(uint64_t); i++) {
+                ret = picoquic_set_stream_priority(cnx, stream_ids[i], priorities[i]);
+            }
+
+            for (size_t i = 0; ret == 0 && i < sizeof(stream_ids) / sizeof(uint64_t); i++) {
+                if (stream_ids[i] == 12) {
+                    ret = picoquic_add_to_stream(cnx, stream_ids[i], data, 50, 1);
+                }
+                else {
+                    ret = picoquic_add_to_stream(cnx, stream_ids[i], data, sizeof(data), 0);
+                }
+            }
+
+            if (ret == 0) {
+                ret = stream_output_test_list(cnx, sizeof(output1) / sizeof(uint64_t), output1);
+            }
+
+            if (ret == 0) {
+                /* Stream 12 is sent and exhausted, then stream 4 goes behind stream 8 */
+                ret = stream_priority_test_send(cnx, 4, sizeof(output2) / sizeof(uint64_t), output2);
+            }
+
+            if (ret == 0) {
+                ret = stream_priority_test_send(cnx, 8, sizeof(output3) / sizeof(uint64_t), output3);
+            }
+
+            if (ret == 0) {
+                ret = stream_priority_test_send(cnx, 4, sizeof(output2) / sizeof(uint64_t), output2);
+            }
+
+            if (ret == 0) {
+                /* Block stream 8 by flow control, verify that it is parked */
+                stream = picoquic_find_stream(cnx, 8);
+                stream->maxdata_remote = stream->sent_offset;
+
+                stream = picoquic_find_ready_stream(cnx);
+                if (stream == NULL || stream->stream_id != 4) {
+                    DBG_PRINTF("%s", "Expected stream 4 after blocking stream 8\n");
+                    ret = -1;
+                }
+                else if (!(stream = picoquic_find_stream(cnx, 8))->is_output_parked || !cnx->stream_blocked) {
+                    DBG_PRINTF("%s", "Stream 8 is not parked\n");
+                    ret = -1;
+                }
+                else {
+                    ret = stream_output_test_list(cnx, sizeof(output4) / sizeof(uint64_t), output4);
+                }
+            }
+
+            if (ret == 0) {
+                /* Raise the limit, the stream returns at the tail of its urgency level */
+                stream = picoquic_find_stream(cnx, 8);
+                stream->maxdata_remote += sizeof(data);
+                picoquic_wake_output_stream(cnx, stream);
+                if (stream->is_output_parked) {
+                    DBG_PRINTF("%s", "Stream 8 is still parked\n");
+                    ret = -1;
+                }
+                else {
+                    ret = stream_output_test_list(cnx, sizeof(output3) / sizeof(uint64_t), output3);
+                }
+            }
+
+            if (ret == 0) {
+                /* Raise the urgency of stream 0 */
+                ret = picoquic_set_stream_priority(cnx, 0, 2);
+                if (ret == 0) {
+                    ret = stream_output_test_list(cnx, sizeof(output5) / sizeof(uint64_t), output5);
+                }
+            }
+
+            picoquic_delete_cnx(cnx);
+            cnx = NULL;
+        }
+
+        picoquic_free(quic);
+        quic = NULL;
+    }
+
+    return ret;
+}
+
+/* Test the memory accounting of connections, and the memory limits.
+ */
+
+static int memory_accounting_check(picoquic_cnx_t* cnx, size_t expected, char const * step)
+{
+    int ret = 0;
+
+    if (picoquic_get_cnx_memory_used(cnx) != expected) {
+        DBG_PRINTF("%s: memory used %zu instead of %zu\n", step, picoquic_get_cnx_memory_used(cnx), expected);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int memory_accounting_test()
+{
+    int ret = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx[2] = { NULL, NULL };
+    picoquic_cnx_t* top[2] = { NULL, NULL };
+    uint64_t simulated_time = 0;
+    struct sockaddr_in saddr;
+    uint8_t data[1000];
+    uint8_t frame[256];
+    uint8_t buffer[1500];
+    size_t memory_base[2] = { 0, 0 };
+    size_t nb_top;
+
+    memset(data, 0x5a, sizeof(data));
+    /* Stream frame with offset and length, stream 1, offset 100, length 200 */
+    memset(frame, 0xa5, sizeof(frame));
+    frame[0] = 0x0e;
+    frame[1] = 1;
+    frame[2] = 0x40;
+    frame[3] = 100;
+    frame[4] = 0x40;
+    frame[5] = 200;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        cnx[i] = picoquic_create_cnx(quic,
+            picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*) & saddr,
+            simulated_time, 0, "test-sni", "test-alpn", 1);
+
+        if (cnx[i] == NULL) {
+            DBG_PRINTF("%s", "Cannot create connection\n");
+            ret = -1;
+        }
+        else {
+            picoquic_set_callback(cnx[i], stream_output_test_callback, NULL);
+            cnx[i]->maxdata_remote = PICOQUIC_DEFAULT_0RTT_WINDOW;
+            cnx[i]->remote_parameters.initial_max_stream_data_bidi_remote = PICOQUIC_DEFAULT_0RTT_WINDOW;
+            cnx[i]->max_stream_id_bidir_remote = 100;
+            memory_base[i] = picoquic_get_cnx_memory_used(cnx[i]);
+            if (memory_base[i] < sizeof(picoquic_cnx_t)) {
+                DBG_PRINTF("Connection context not charged, %zu\n", memory_base[i]);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0 && picoquic_get_quic_memory_used(quic) != memory_base[0] + memory_base[1]) {
+        DBG_PRINTF("Context memory %zu instead of %zu\n", picoquic_get_quic_memory_used(quic), memory_base[0] + memory_base[1]);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        /* Queue data on the first connection, charge the stream and the queued data */
+        ret = picoquic_add_to_stream(cnx[0], 0, data, sizeof(data), 0);
+        if (ret == 0) {
+            memory_base[0] += sizeof(picoquic_stream_head_t);
+            ret = memory_accounting_check(cnx[0], memory_base[0] + sizeof(picoquic_stream_queue_node_t) + sizeof(data), "add to stream");
+        }
+    }
+
+    if (ret == 0) {
+        /* The first connection is the top consumer */
+        nb_top = picoquic_get_top_memory_consumers(quic, top, 2);
+        if (nb_top != 2 || top[0] != cnx[0] || top[1] != cnx[1]) {
+            DBG_PRINTF("Unexpected top consumers, nb = %zu\n", nb_top);
+            ret = -1;
+        }
+        else if (picoquic_get_top_memory_consumers(quic, top, 1) != 1 || top[0] != cnx[0]) {
+            DBG_PRINTF("%s", "Unexpected top consumer\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Per connection limit only constrains the first connection */
+        picoquic_set_memory_limits(quic, memory_base[1] + sizeof(data) / 2, 0);
+        if (!picoquic_is_memory_constrained(cnx[0]) || picoquic_is_memory_constrained(cnx[1]) ||
+            picoquic_is_memory_shedding_needed(cnx[0])) {
+            DBG_PRINTF("%s", "Unexpected constraints with connection limit\n");
+            ret = -1;
+        }
+        else {
+            /* Both limits exceeded, shedding is needed */
+            picoquic_set_memory_limits(quic, memory_base[1] + sizeof(data) / 2, picoquic_get_quic_memory_used(quic) - 1);
+            if (!picoquic_is_memory_shedding_needed(cnx[0]) || picoquic_is_memory_shedding_needed(cnx[1]) ||
+                !picoquic_is_memory_constrained(cnx[1])) {
+                DBG_PRINTF("%s", "Unexpected constraints with global limit\n");
+                ret = -1;
+            }
+            picoquic_set_memory_limits(quic, 0, 0);
+        }
+    }
+
+    if (ret == 0) {
+        /* Sending the data refunds the queued data */
+        uint8_t* bytes_next;
+        int more_data = 0;
+        int is_pure_ack = 1;
+        int stream_tried_and_failed = 0;
+
+        bytes_next = picoquic_format_available_stream_frames(cnx[0], buffer, buffer + sizeof(buffer), &more_data,
+            &is_pure_ack, &stream_tried_and_failed, &ret);
+        if (ret != 0 || bytes_next == buffer) {
+            DBG_PRINTF("Cannot format stream frames, ret = %d\n", ret);
+            ret = -1;
+        }
+        else {
+            ret = memory_accounting_check(cnx[0], memory_base[0], "data sent");
+        }
+    }
+
+    if (ret == 0) {
+        /* Data received out of order is charged until delivered */
+        if (picoquic_decode_stream_frame(cnx[1], frame, frame + 6 + 200, NULL, simulated_time) == NULL) {
+            DBG_PRINTF("%s", "Cannot decode the stream frame\n");
+            ret = -1;
+        }
+        else {
+            memory_base[1] += sizeof(picoquic_stream_head_t);
+            ret = memory_accounting_check(cnx[1], memory_base[1] + sizeof(picoquic_stream_data_node_t), "out of order data");
+        }
+    }
+
+    if (ret == 0) {
+        /* Deleting a connection refunds everything it holds */
+        size_t expected = picoquic_get_quic_memory_used(quic) - picoquic_get_cnx_memory_used(cnx[1]);
+
+        picoquic_delete_cnx(cnx[1]);
+        cnx[1] = NULL;
+        if (picoquic_get_quic_memory_used(quic) != expected) {
+            DBG_PRINTF("Context memory %zu instead of %zu\n", picoquic_get_quic_memory_used(quic), expected);
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (cnx[i] != NULL) {
+            picoquic_delete_cnx(cnx[i]);
+        }
+    }
+
+    if (quic != NULL) {
+        if (ret == 0 && picoquic_get_quic_memory_used(quic) != 0) {
+            DBG_PRINTF("Context memory %zu after deleting connections\n", picoquic_get_quic_memory_used(quic));
+            ret = -1;
+        }
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
 /* Test the STREAM ID and STREAM RANK macros
  */
 
@@ -1913,6 +1913,511 @@ int tls_api_inject_hs_ack_test()
     return ret;
 }
 
+/* Queue padded pings, large enough for the connection to send one per packet */
+static int batch_test_queue_pings(picoquic_cnx_t* cnx, int nb_pings)
+{
+    int ret = 0;
+
+    for (int i = 0; ret == 0 && i < nb_pings; i++) {
+        uint8_t ping_padded[800];
+
+        memset(ping_padded, picoquic_frame_type_padding, sizeof(ping_padded));
+        ping_padded[0] = picoquic_frame_type_ping;
+        ret = picoquic_queue_misc_frame(cnx, ping_padded, sizeof(ping_padded), 0);
+    }
+
+    return ret;
+}
+
+/*
+ * Deliver a batch of 1-RTT packets from the client to the server in a single
+ * call, and verify that all of them are accepted. With the default AES suite,
+ * the header protection masks are computed for the whole batch at once.
+ */
+#define INCOMING_BATCH_TEST_NB 6
+
+int incoming_batch_test()
+{
+    uint64_t loss_mask = 0;
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    uint8_t packet_bytes[INCOMING_BATCH_TEST_NB][PICOQUIC_MAX_PACKET_SIZE];
+    struct sockaddr_storage addr_to[INCOMING_BATCH_TEST_NB];
+    struct sockaddr_storage addr_from[INCOMING_BATCH_TEST_NB];
+    picoquic_received_packet_t packets[INCOMING_BATCH_TEST_NB];
+    size_t nb_packets = 0;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0 && test_ctx->cnx_server->crypto_context[picoquic_epoch_1rtt].pn_dec_ecb == NULL) {
+        DBG_PRINTF("%s", "No ECB context for header protection removal\n");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = batch_test_queue_pings(test_ctx->cnx_client, INCOMING_BATCH_TEST_NB);
+    }
+
+    /* Collect the client packets without delivering them */
+    for (int nb_trials = 0; ret == 0 && nb_packets < INCOMING_BATCH_TEST_NB && nb_trials < 64; nb_trials++) {
+        size_t length = 0;
+
+        ret = picoquic_prepare_packet(test_ctx->cnx_client, simulated_time, packet_bytes[nb_packets],
+            PICOQUIC_MAX_PACKET_SIZE, &length, &addr_to[nb_packets], &addr_from[nb_packets], NULL);
+        if (ret == 0) {
+            if (length > 0) {
+                packets[nb_packets].bytes = packet_bytes[nb_packets];
+                packets[nb_packets].length = length;
+                packets[nb_packets].addr_from = (struct sockaddr*)&addr_from[nb_packets];
+                packets[nb_packets].addr_to = (struct sockaddr*)&addr_to[nb_packets];
+                packets[nb_packets].if_index_to = 0;
+                packets[nb_packets].received_ecn = 0;
+                packets[nb_packets].receive_time = simulated_time;
+                nb_packets++;
+            }
+            else if (test_ctx->cnx_client->next_wake_time > simulated_time) {
+                simulated_time = test_ctx->cnx_client->next_wake_time;
+            }
+        }
+    }
+
+    if (ret == 0 && nb_packets < INCOMING_BATCH_TEST_NB) {
+        DBG_PRINTF("Only %zu packets prepared by the client\n", nb_packets);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        uint64_t nb_received_before = test_ctx->cnx_server->nb_packets_received;
+        uint64_t crypto_failures_before = test_ctx->cnx_server->crypto_failure_count;
+        picoquic_cnx_t* first_cnx = NULL;
+
+        ret = picoquic_incoming_packet_batch(test_ctx->qserver, packets, nb_packets, &first_cnx, simulated_time);
+
+        if (ret == 0 && (test_ctx->cnx_server->nb_packets_received != nb_received_before + nb_packets ||
+            test_ctx->cnx_server->crypto_failure_count != crypto_failures_before)) {
+            DBG_PRINTF("Received %" PRIu64 " packets out of %zu, %" PRIu64 " crypto failures\n",
+                test_ctx->cnx_server->nb_packets_received - nb_received_before, nb_packets,
+                test_ctx->cnx_server->crypto_failure_count - crypto_failures_before);
+            ret = -1;
+        }
+        else if (ret == 0 && test_ctx->qserver->rx_hp_mask != NULL) {
+            DBG_PRINTF("%s", "Precomputed mask not cleared after the batch\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * Prepare a batch of client packets in a single call, split in individual
+ * datagrams, and verify that the server accepts all of them.
+ */
+#define PREPARE_BATCH_TEST_NB 8
+
+/* Prepare one batch from the client context, advancing the simulated time
+ * until some connection has something to send. Check the description of each
+ * packet, and fill the matching entries of the received packets array. */
+static int prepare_batch_test_one(picoquic_test_tls_api_ctx_t* test_ctx, uint64_t* simulated_time,
+    uint8_t* send_buffer, size_t send_buffer_max, picoquic_prepared_packet_t* prepared,
+    picoquic_received_packet_t* packets, size_t* nb_packets)
+{
+    int ret = 0;
+
+    *nb_packets = 0;
+    for (int nb_trials = 0; ret == 0 && *nb_packets == 0 && nb_trials < 64; nb_trials++) {
+        ret = picoquic_prepare_next_packet_batch(test_ctx->qclient, *simulated_time, send_buffer, send_buffer_max,
+            prepared, PREPARE_BATCH_TEST_NB, nb_packets, 0);
+        if (ret == 0 && *nb_packets == 0) {
+            uint64_t next_time = picoquic_get_next_wake_time(test_ctx->qclient, *simulated_time);
+
+            if (next_time > *simulated_time) {
+                *simulated_time = next_time;
+            }
+        }
+    }
+
+    for (size_t i = 0; ret == 0 && i < *nb_packets; i++) {
+        if (prepared[i].cnx == NULL || prepared[i].cnx->quic != test_ctx->qclient || prepared[i].send_msg_size != 0 ||
+            prepared[i].length == 0 || prepared[i].length > prepared[i].cnx->path[0]->send_mtu ||
+            (i > 0 && prepared[i].bytes != prepared[i - 1].bytes + prepared[i - 1].length) ||
+            picoquic_compare_addr((struct sockaddr*)&prepared[i].addr_to, (struct sockaddr*)&test_ctx->server_addr) != 0) {
+            DBG_PRINTF("Unexpected description of packet %zu\n", i);
+            ret = -1;
+        }
+        else {
+            packets[i].bytes = prepared[i].bytes;
+            packets[i].length = prepared[i].length;
+            packets[i].addr_from = (struct sockaddr*)&test_ctx->client_addr;
+            packets[i].addr_to = (struct sockaddr*)&test_ctx->server_addr;
+            packets[i].if_index_to = 0;
+            packets[i].received_ecn = 0;
+            packets[i].receive_time = *simulated_time;
+        }
+    }
+
+    return ret;
+}
+
+static uint64_t prepare_batch_test_nb_received(picoquic_quic_t* quic)
+{
+    uint64_t nb_received = 0;
+    picoquic_cnx_t* cnx = picoquic_get_first_cnx(quic);
+
+    while (cnx != NULL) {
+        nb_received += cnx->nb_packets_received;
+        cnx = picoquic_get_next_cnx(cnx);
+    }
+
+    return nb_received;
+}
+
+/* Deliver the packets to the server in a single call, and verify that the
+ * server connections received all of them. */
+static int prepare_batch_test_deliver(picoquic_test_tls_api_ctx_t* test_ctx, uint64_t simulated_time,
+    picoquic_received_packet_t* packets, size_t nb_packets)
+{
+    uint64_t nb_received_before = prepare_batch_test_nb_received(test_ctx->qserver);
+    uint64_t nb_received = 0;
+    picoquic_cnx_t* first_cnx = NULL;
+    int ret = picoquic_incoming_packet_batch(test_ctx->qserver, packets, nb_packets, &first_cnx, simulated_time);
+
+    if (ret == 0 && (nb_received = prepare_batch_test_nb_received(test_ctx->qserver) - nb_received_before) != nb_packets) {
+        DBG_PRINTF("Received %" PRIu64 " packets out of %zu\n", nb_received, nb_packets);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static size_t prepare_batch_test_count(picoquic_prepared_packet_t* prepared, size_t nb_packets, picoquic_cnx_t* cnx)
+{
+    size_t nb_cnx = 0;
+
+    for (size_t i = 0; i < nb_packets; i++) {
+        if (prepared[i].cnx == cnx) {
+            nb_cnx++;
+        }
+    }
+
+    return nb_cnx;
+}
+
+int prepare_batch_test()
+{
+    uint64_t loss_mask = 0;
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    uint8_t send_buffer[PREPARE_BATCH_TEST_NB * PICOQUIC_MAX_PACKET_SIZE];
+    picoquic_prepared_packet_t prepared[PREPARE_BATCH_TEST_NB];
+    picoquic_received_packet_t packets[PREPARE_BATCH_TEST_NB];
+    size_t nb_packets = 0;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = batch_test_queue_pings(test_ctx->cnx_client, PREPARE_BATCH_TEST_NB - 2);
+    }
+
+    if (ret == 0) {
+        ret = prepare_batch_test_one(test_ctx, &simulated_time, send_buffer, sizeof(send_buffer), prepared, packets, &nb_packets);
+    }
+
+    if (ret == 0 && (nb_packets < 2 || prepare_batch_test_count(prepared, nb_packets, test_ctx->cnx_client) != nb_packets)) {
+        DBG_PRINTF("Batch of %zu packets, not all from the client connection\n", nb_packets);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = prepare_batch_test_deliver(test_ctx, simulated_time, packets, nb_packets);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * Prepare batches from a client context with two connections. When only one
+ * of them has something to send, the batch skips the idle one even if it is
+ * first in the wake list. When both have something to send, the batch
+ * carries packets from both.
+ */
+int prepare_batch_multi_test()
+{
+    uint64_t loss_mask = 0;
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    uint8_t send_buffer[PREPARE_BATCH_TEST_NB * PICOQUIC_MAX_PACKET_SIZE];
+    picoquic_prepared_packet_t prepared[PREPARE_BATCH_TEST_NB];
+    picoquic_received_packet_t packets[PREPARE_BATCH_TEST_NB];
+    picoquic_cnx_t* cnx_idle = NULL;
+    picoquic_cnx_t* cnx_active = NULL;
+    size_t nb_packets = 0;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_synch_to_empty_loop(test_ctx, &simulated_time, 2048, 0, 1);
+    }
+
+    /* Start a second connection from the same client context */
+    if (ret == 0) {
+        cnx_idle = test_ctx->cnx_client;
+        test_ctx->cnx_server = NULL;
+        test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient, picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&test_ctx->server_addr, simulated_time, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+        if (test_ctx->cnx_client == NULL) {
+            test_ctx->cnx_client = cnx_idle;
+            ret = -1;
+        }
+        else {
+            cnx_active = test_ctx->cnx_client;
+            ret = picoquic_start_client_cnx(cnx_active);
+        }
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_synch_to_empty_loop(test_ctx, &simulated_time, 2048, 0, 1);
+    }
+
+    /* Only the second connection has data, but the idle one is due first */
+    if (ret == 0) {
+        ret = batch_test_queue_pings(cnx_active, PREPARE_BATCH_TEST_NB / 2 - 1);
+    }
+
+    if (ret == 0) {
+        picoquic_reinsert_by_wake_time(test_ctx->qclient, cnx_idle, simulated_time - 1);
+        ret = prepare_batch_test_one(test_ctx, &simulated_time, send_buffer, sizeof(send_buffer), prepared, packets, &nb_packets);
+    }
+
+    if (ret == 0 && (prepare_batch_test_count(prepared, nb_packets, cnx_active) == 0 ||
+        prepare_batch_test_count(prepared, nb_packets, cnx_idle) != 0)) {
+        DBG_PRINTF("Batch of %zu packets, %zu from the idle connection\n", nb_packets,
+            prepare_batch_test_count(prepared, nb_packets, cnx_idle));
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = prepare_batch_test_deliver(test_ctx, simulated_time, packets, nb_packets);
+    }
+
+    /* Both connections have data */
+    if (ret == 0) {
+        ret = batch_test_queue_pings(cnx_idle, PREPARE_BATCH_TEST_NB / 2 - 1);
+    }
+
+    if (ret == 0) {
+        ret = batch_test_queue_pings(cnx_active, PREPARE_BATCH_TEST_NB / 2 - 1);
+    }
+
+    if (ret == 0) {
+        ret = prepare_batch_test_one(test_ctx, &simulated_time, send_buffer, sizeof(send_buffer), prepared, packets, &nb_packets);
+    }
+
+    if (ret == 0 && (prepare_batch_test_count(prepared, nb_packets, cnx_active) == 0 ||
+        prepare_batch_test_count(prepared, nb_packets, cnx_idle) == 0)) {
+        DBG_PRINTF("Batch of %zu packets, %zu from the first connection\n", nb_packets,
+            prepare_batch_test_count(prepared, nb_packets, cnx_idle));
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = prepare_batch_test_deliver(test_ctx, simulated_time, packets, nb_packets);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/* Run the server handshake on TLS worker threads.
+ * The first server connection is deleted while its TLS job is pending, which
+ * checks that the job is cancelled. The client then repeats its Initial, and
+ * the handshake completes on the second server connection. While the job is
+ * running, the test waits for the workers instead of only advancing the
+ * simulated time.
+ */
+int tls_worker_test()
+{
+    uint64_t loss_mask = 0;
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int nb_trials = 0;
+    int nb_jobs_seen = 0;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    if (ret == 0 && (ret = picoquic_set_tls_worker_threads(test_ctx->qserver, 2)) != 0) {
+        DBG_PRINTF("Cannot start TLS workers, ret = %d (0x%x)\n", ret, ret);
+    }
+
+    if (ret == 0) {
+        ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+    }
+
+    /* Run until the first job is submitted, then delete the server connection */
+    while (ret == 0 && nb_trials < 64 && test_ctx->qserver->nb_tls_jobs == 0) {
+        int was_active = 0;
+        nb_trials++;
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+    }
+
+    if (ret == 0) {
+        if (test_ctx->cnx_server == NULL || test_ctx->cnx_server->tls_job == NULL) {
+            DBG_PRINTF("%s", "No TLS job pending on the server connection\n");
+            ret = -1;
+        }
+        else {
+            picoquic_delete_cnx(test_ctx->cnx_server);
+            test_ctx->cnx_server = NULL;
+            if (test_ctx->qserver->nb_tls_jobs != 0 || test_ctx->qserver->first_tls_job_ready != NULL) {
+                DBG_PRINTF("%zu TLS jobs left after deleting the connection\n", test_ctx->qserver->nb_tls_jobs);
+                ret = -1;
+            }
+        }
+    }
+
+    nb_trials = 0;
+    while (ret == 0 && nb_trials < 1024 && (!TEST_CLIENT_READY || !TEST_SERVER_READY)) {
+        int was_active = 0;
+        nb_trials++;
+
+        if (test_ctx->qserver->nb_tls_jobs > 0) {
+            nb_jobs_seen++;
+            (void)picoquic_worker_pool_wait_done(test_ctx->qserver->tls_worker_pool, 100000);
+        }
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+    }
+
+    if (ret == 0 && (!TEST_CLIENT_READY || !TEST_SERVER_READY)) {
+        DBG_PRINTF("Handshake not complete after %d trials\n", nb_trials);
+        ret = -1;
+    }
+    else if (ret == 0 && nb_jobs_seen == 0) {
+        DBG_PRINTF("%s", "The handshake did not use the TLS workers\n");
+        ret = -1;
+    }
+    else if (ret == 0 && test_ctx->qserver->nb_tls_jobs != 0) {
+        DBG_PRINTF("%zu TLS jobs left after the handshake\n", test_ctx->qserver->nb_tls_jobs);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_q_and_r, sizeof(test_scenario_q_and_r));
+    }
+
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, 0);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/* Run the server handshake on TLS worker threads with a ClientHello that spans
+ * several packets. The job must only start once the ClientHello is complete,
+ * otherwise the next fragments are dropped while the job runs, and the handshake
+ * stalls until the client retransmits.
+ */
+int tls_worker_large_hello_test()
+{
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int nb_trials = 0;
+    int nb_jobs_seen = 0;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0 && (ret = picoquic_set_tls_worker_threads(test_ctx->qserver, 2)) != 0) {
+        DBG_PRINTF("Cannot start TLS workers, ret = %d (0x%x)\n", ret, ret);
+    }
+
+    if (ret == 0) {
+        test_ctx->cnx_client->test_large_chello = 1;
+        ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+    }
+
+    while (ret == 0 && nb_trials < 1024 && (!TEST_CLIENT_READY || !TEST_SERVER_READY)) {
+        int was_active = 0;
+        nb_trials++;
+
+        if (test_ctx->qserver->nb_tls_jobs > 0) {
+            nb_jobs_seen++;
+            (void)picoquic_worker_pool_wait_done(test_ctx->qserver->tls_worker_pool, 100000);
+        }
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+    }
+
+    if (ret == 0 && (!TEST_CLIENT_READY || !TEST_SERVER_READY)) {
+        DBG_PRINTF("Handshake not complete after %d trials\n", nb_trials);
+        ret = -1;
+    }
+    else if (ret == 0 && nb_jobs_seen == 0) {
+        DBG_PRINTF("%s", "The handshake did not use the TLS workers\n");
+        ret = -1;
+    }
+    else if (ret == 0 && (test_ctx->cnx_client->nb_retransmission_total > 0 ||
+        test_ctx->cnx_server->nb_retransmission_total > 0)) {
+        DBG_PRINTF("Handshake stalled, client retransmitted %" PRIu64 ", server %" PRIu64 " packets\n",
+            test_ctx->cnx_client->nb_retransmission_total, test_ctx->cnx_server->nb_retransmission_total);
+        ret = -1;
+    }
+    else if (ret == 0 && simulated_time > 250000) {
+        DBG_PRINTF("Handshake completed at %" PRIu64 ", after the expected delay\n", simulated_time);
+        ret = -1;
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
 int tls_api_silence_test()
 {
     uint64_t loss_mask = 0;
@@ -8045,7 +8550,7 @@ void qlog_trace_cid_fn(picoquic_quic_t* quic, picoquic_connection_id_t cnx_id_lo
     }
 }
 
-int qlog_trace_test_one(int auto_qlog, int keep_binlog, uint8_t recv_ecn)
+int qlog_trace_test_ex(int auto_qlog, int keep_binlog, uint8_t recv_ecn, int use_threads)
 {
     uint64_t simulated_time = 0;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
@@ -8079,6 +8584,12 @@ int qlog_trace_test_one(int auto_qlog, int keep_binlog, uint8_t recv_ecn)
         if (keep_binlog) {
             picoquic_set_binlog(test_ctx->qserver, ".");
         }
+        if (use_threads &&
+            (picoquic_set_binlog_writer_thread(test_ctx->qserver, 64, 1) != 0 ||
+            picoquic_set_qlog_threads(test_ctx->qserver, 2) != 0)) {
+            DBG_PRINTF("%s", "Could not start the log threads");
+            ret = -1;
+        }
         picoquic_set_default_spinbit_policy(test_ctx->qserver, picoquic_spinbit_on);
         picoquic_set_default_spinbit_policy(test_ctx->qclient, picoquic_spinbit_on);
         picoquic_set_default_lossbit_policy(test_ctx->qserver, picoquic_lossbit_send_receive);
@@ -8105,8 +8616,10 @@ int qlog_trace_test_one(int auto_qlog, int keep_binlog, uint8_t recv_ecn)
             (struct sockaddr*) & test_ctx->server_addr, 0,
             PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
 
-        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
-            test_scenario_q2_and_r2, sizeof(test_scenario_q2_and_r2), 0, 0x00004281, 0, 20000, 2000000);
+        if (ret == 0) {
+            ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+                test_scenario_q2_and_r2, sizeof(test_scenario_q2_and_r2), 0, 0x00004281, 0, 20000, 2000000);
+        }
     }
 
     /* Add a gratuitous bad packet to test "packet dropped" log */
@@ -8161,6 +8674,11 @@ int qlog_trace_test_one(int auto_qlog, int keep_binlog, uint8_t recv_ecn)
     return ret;
 }
 
+int qlog_trace_test_one(int auto_qlog, int keep_binlog, uint8_t recv_ecn)
+{
+    return qlog_trace_test_ex(auto_qlog, keep_binlog, recv_ecn, 0);
+}
+
 int qlog_trace_test()
 {
     return qlog_trace_test_one(0, 1, 0);
@@ -8181,6 +8699,54 @@ int qlog_trace_ecn_test()
     return qlog_trace_test_one(0, 1, 0x02);
 }
 
+/* Same result when the binary log is written and converted by background threads */
+int qlog_trace_threads_test()
+{
+    return qlog_trace_test_ex(1, 0, 0, 1);
+}
+
+/*
+ * Handshake and transfer with the send buffers of GSO trains. The Initial and
+ * Handshake packets are coalesced in trains, and the Initial keys are discarded
+ * while the train is prepared, which must not affect the header protection of
+ * the packets already in the train.
+ */
+int gso_handshake_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx_ex2(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0, NULL, 8, 0, 0xFFFF);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_sustained, sizeof(test_scenario_sustained));
+    }
+
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, 5000000);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
 /*
  * Test of the performance log production
  */
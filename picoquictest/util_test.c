@@ -395,4 +395,356 @@ int util_threading_test()
     }
 
     return ret;
-}
\ No newline at end of file
+}
+/* Testing the single producer, single consumer queue.
+ * A producer thread pushes a sequence of numbers, retrying when the queue is full.
+ * The main thread pops them and verifies that none is lost, duplicated or reordered.
+ * When blocked, both threads pause briefly by waiting on an event that is never
+ * signalled, so the test also progresses on single core machines.
+ */
+#define SPSC_TEST_NB_ITEMS 20000
+
+typedef struct st_spsc_test_data_t {
+    picoquic_spsc_queue_t queue;
+    picoquic_event_t pause_event;
+    int nb_full;
+    volatile int is_done;
+} spsc_test_data_t;
+
+static picoquic_thread_return_t spsc_test_producer(void* vctx)
+{
+    spsc_test_data_t* ctx = (spsc_test_data_t*)vctx;
+
+    for (uintptr_t i = 1; i <= SPSC_TEST_NB_ITEMS; i++) {
+        while (picoquic_spsc_queue_push(&ctx->queue, (void*)i) != 0) {
+            ctx->nb_full++;
+            (void)picoquic_wait_for_event(&ctx->pause_event, 100);
+        }
+    }
+    ctx->is_done = 1;
+
+    picoquic_thread_do_return;
+}
+
+int util_spsc_queue_test()
+{
+    spsc_test_data_t ctx;
+    picoquic_thread_t thread;
+    uintptr_t expected = 1;
+    uint64_t start_time = picoquic_current_time();
+    int ret;
+
+    memset(&ctx, 0, sizeof(ctx));
+    if ((ret = picoquic_create_event(&ctx.pause_event)) != 0) {
+        DBG_PRINTF("Create event returns %d (0x%x)", ret, ret);
+    }
+    else if ((ret = picoquic_spsc_queue_init(&ctx.queue, 60)) != 0) {
+        DBG_PRINTF("Create queue returns %d (0x%x)", ret, ret);
+    }
+    else if (ctx.queue.mask != 63) {
+        DBG_PRINTF("Queue size is %d instead of 64", (int)(ctx.queue.mask + 1));
+        ret = -1;
+    }
+    else if (picoquic_spsc_queue_pop(&ctx.queue) != NULL) {
+        DBG_PRINTF("%s", "Pop from empty queue does not return NULL");
+        ret = -1;
+    }
+    else {
+        /* Fill the queue, verify that it is full, then empty it */
+        for (uintptr_t i = 1; ret == 0 && i <= 64; i++) {
+            ret = picoquic_spsc_queue_push(&ctx.queue, (void*)i);
+        }
+        if (ret != 0 || picoquic_spsc_queue_push(&ctx.queue, (void*)expected) == 0) {
+            DBG_PRINTF("%s", "Queue of size 64 does not fill as expected");
+            ret = -1;
+        }
+        for (uintptr_t i = 1; ret == 0 && i <= 64; i++) {
+            if ((uintptr_t)picoquic_spsc_queue_pop(&ctx.queue) != i) {
+                DBG_PRINTF("Unexpected value at rank %d", (int)i);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        ret = picoquic_create_thread(&thread, spsc_test_producer, &ctx);
+        if (ret != 0) {
+            DBG_PRINTF("Create thread returns %d (0x%x)", ret, ret);
+        }
+        else {
+            while (expected <= SPSC_TEST_NB_ITEMS) {
+                uintptr_t x = (uintptr_t)picoquic_spsc_queue_pop(&ctx.queue);
+                if (x == 0) {
+                    if (picoquic_current_time() - start_time > 10000000) {
+                        DBG_PRINTF("Timeout after receiving %d items", (int)(expected - 1));
+                        ret = -1;
+                        break;
+                    }
+                    (void)picoquic_wait_for_event(&ctx.pause_event, 100);
+                }
+                else if (x != expected) {
+                    DBG_PRINTF("Received %d instead of %d", (int)x, (int)expected);
+                    ret = -1;
+                    break;
+                }
+                else {
+                    expected++;
+                }
+            }
+            /* In case of error, keep the producer from blocking on a full queue */
+            while (ret != 0 && !ctx.is_done) {
+                (void)picoquic_spsc_queue_pop(&ctx.queue);
+            }
+            picoquic_delete_thread(&thread);
+        }
+    }
+
+    if (ret == 0 && picoquic_spsc_queue_pop(&ctx.queue) != NULL) {
+        DBG_PRINTF("%s", "Queue not empty after the last item");
+        ret = -1;
+    }
+
+    picoquic_spsc_queue_release(&ctx.queue);
+    picoquic_delete_event(&ctx.pause_event);
+
+    return ret;
+}
+
+/* Testing the worker pool.
+ * A set of jobs is submitted to a pool of several threads. Each job computes a
+ * value from its index. The main thread waits for one specific job, then collects
+ * the other ones, and verifies that each job ran exactly once.
+ */
+#define WORKER_POOL_TEST_NB_JOBS 64
+
+typedef struct st_worker_pool_test_job_t {
+    picoquic_worker_job_t worker_job;
+    uint64_t index;
+    uint64_t result;
+    int nb_runs;
+    int nb_collected;
+} worker_pool_test_job_t;
+
+static void worker_pool_test_job_fn(picoquic_worker_job_t* worker_job)
+{
+    worker_pool_test_job_t* job = (worker_pool_test_job_t*)worker_job;
+    uint64_t random_ctx = job->index;
+
+    for (int i = 0; i < 1000; i++) {
+        job->result ^= picoquic_test_random(&random_ctx);
+    }
+    job->nb_runs++;
+}
+
+int util_worker_pool_test()
+{
+    worker_pool_test_job_t jobs[WORKER_POOL_TEST_NB_JOBS];
+    picoquic_worker_pool_t* pool = picoquic_worker_pool_create(4);
+    uint64_t start_time = picoquic_current_time();
+    int nb_collected = 0;
+    int ret = 0;
+
+    memset(jobs, 0, sizeof(jobs));
+
+    if (pool == NULL) {
+        DBG_PRINTF("%s", "Cannot create the worker pool");
+        ret = -1;
+    }
+    else {
+        for (int i = 0; i < WORKER_POOL_TEST_NB_JOBS; i++) {
+            jobs[i].worker_job.job_fn = worker_pool_test_job_fn;
+            jobs[i].index = (uint64_t)i;
+            picoquic_worker_pool_submit(pool, &jobs[i].worker_job);
+        }
+
+        /* Waiting for a specific job removes it from the list of completed jobs */
+        picoquic_worker_pool_wait_job(pool, &jobs[WORKER_POOL_TEST_NB_JOBS / 2].worker_job);
+        jobs[WORKER_POOL_TEST_NB_JOBS / 2].nb_collected++;
+        nb_collected++;
+
+        while (ret == 0 && nb_collected < WORKER_POOL_TEST_NB_JOBS) {
+            picoquic_worker_job_t* worker_job = picoquic_worker_pool_next_done(pool);
+
+            if (worker_job == NULL) {
+                if (picoquic_current_time() - start_time > 10000000) {
+                    DBG_PRINTF("Timeout after collecting %d jobs", nb_collected);
+                    ret = -1;
+                }
+                else {
+                    (void)picoquic_worker_pool_wait_done(pool, 1000);
+                }
+            }
+            else {
+                ((worker_pool_test_job_t*)worker_job)->nb_collected++;
+                nb_collected++;
+            }
+        }
+
+        if (ret == 0 && picoquic_worker_pool_next_done(pool) != NULL) {
+            DBG_PRINTF("%s", "Completed job list not empty after the last job");
+            ret = -1;
+        }
+
+        for (int i = 0; ret == 0 && i < WORKER_POOL_TEST_NB_JOBS; i++) {
+            uint64_t random_ctx = (uint64_t)i;
+            uint64_t expected = 0;
+
+            for (int j = 0; j < 1000; j++) {
+                expected ^= picoquic_test_random(&random_ctx);
+            }
+            if (!jobs[i].worker_job.is_done || jobs[i].nb_runs != 1 || jobs[i].nb_collected != 1 ||
+                jobs[i].result != expected) {
+                DBG_PRINTF("Job %d: done %d, runs %d, collected %d", i, jobs[i].worker_job.is_done,
+                    jobs[i].nb_runs, jobs[i].nb_collected);
+                ret = -1;
+            }
+        }
+
+        picoquic_worker_pool_delete(pool);
+    }
+
+    return ret;
+}
+
+#define FILE_WRITER_TEST_FILE "file_writer_test.bin"
+#define FILE_WRITER_TEST_FILE2 "file_writer_test2.bin"
+#define FILE_WRITER_TEST_NB_RECORDS 2000
+
+/* Records have variable sizes, and some of them exceed the default record size */
+static size_t file_writer_test_record(uint8_t* record, size_t record_max, int index)
+{
+    size_t length = (index % 100 == 99) ? 1500 : (size_t)(index % 97) + 1;
+
+    if (length > record_max) {
+        length = record_max;
+    }
+    for (size_t i = 0; i < length; i++) {
+        record[i] = (uint8_t)(index + i);
+    }
+    return length;
+}
+
+typedef struct st_file_writer_test_producer_t {
+    picoquic_file_writer_t* writer;
+    FILE* F;
+    int do_flush;
+    int ret;
+} file_writer_test_producer_t;
+
+/* Write all the records, then pass the closing record to the writer, which owns the file from then on */
+static void file_writer_test_produce(file_writer_test_producer_t* producer)
+{
+    uint8_t record[2048];
+
+    for (int i = 0; producer->ret == 0 && i < FILE_WRITER_TEST_NB_RECORDS; i++) {
+        size_t length = file_writer_test_record(record, sizeof(record), i);
+
+        if (picoquic_file_writer_write(producer->writer, producer->F, record, length) != 0) {
+            DBG_PRINTF("Cannot queue record %d", i);
+            producer->ret = -1;
+        }
+        else if (producer->do_flush && i == FILE_WRITER_TEST_NB_RECORDS / 2) {
+            picoquic_file_writer_flush(producer->writer);
+        }
+    }
+    if (producer->ret == 0) {
+        size_t length = file_writer_test_record(record, sizeof(record), FILE_WRITER_TEST_NB_RECORDS);
+        producer->ret = picoquic_file_writer_close(producer->writer, producer->F, record, length);
+    }
+    else {
+        (void)picoquic_file_writer_close(producer->writer, producer->F, NULL, 0);
+    }
+}
+
+static picoquic_thread_return_t file_writer_test_producer_thread(void* v_producer)
+{
+    file_writer_test_produce((file_writer_test_producer_t*)v_producer);
+    picoquic_thread_do_return;
+}
+
+static int file_writer_test_check(char const* file_name)
+{
+    int ret = 0;
+    uint8_t record[2048];
+    uint8_t read_back[2048];
+    FILE* F = picoquic_file_open(file_name, "rb");
+
+    if (F == NULL) {
+        DBG_PRINTF("Cannot open %s", file_name);
+        ret = -1;
+    }
+    else {
+        for (int i = 0; ret == 0 && i <= FILE_WRITER_TEST_NB_RECORDS; i++) {
+            size_t length = file_writer_test_record(record, sizeof(record), i);
+
+            if (fread(read_back, 1, length, F) != length || memcmp(record, read_back, length) != 0) {
+                DBG_PRINTF("Record %d of %s does not match", i, file_name);
+                ret = -1;
+            }
+        }
+        if (ret == 0 && fgetc(F) != EOF) {
+            DBG_PRINTF("Unexpected data after the last record of %s", file_name);
+            ret = -1;
+        }
+        (void)picoquic_file_close(F);
+    }
+
+    return ret;
+}
+
+/* The owner thread and a second producer write to two files through the same writer */
+int util_file_writer_test()
+{
+    picoquic_file_writer_t* writer = picoquic_file_writer_create(16, 1);
+    file_writer_test_producer_t producer[2];
+    picoquic_thread_t thread;
+    int ret = 0;
+
+    memset(producer, 0, sizeof(producer));
+    producer[0].F = picoquic_file_open(FILE_WRITER_TEST_FILE, "wb");
+    producer[1].F = picoquic_file_open(FILE_WRITER_TEST_FILE2, "wb");
+
+    if (writer == NULL || producer[0].F == NULL || producer[1].F == NULL) {
+        DBG_PRINTF("%s", "Cannot create the file writer or the test files");
+        ret = -1;
+        producer[0].F = picoquic_file_close(producer[0].F);
+        producer[1].F = picoquic_file_close(producer[1].F);
+    }
+    else {
+        producer[0].writer = writer;
+        producer[0].do_flush = 1;
+        producer[1].writer = writer;
+
+        if ((ret = picoquic_create_thread(&thread, file_writer_test_producer_thread, &producer[1])) != 0) {
+            DBG_PRINTF("%s", "Cannot create the producer thread");
+            producer[1].F = picoquic_file_close(producer[1].F);
+            producer[1].ret = -1;
+        }
+        file_writer_test_produce(&producer[0]);
+        if (ret == 0) {
+            picoquic_delete_thread(&thread);
+        }
+
+        if (ret == 0 && (producer[0].ret != 0 || producer[1].ret != 0)) {
+            ret = -1;
+        }
+        else if (ret == 0 && picoquic_file_writer_nb_dropped(writer) != 0) {
+            DBG_PRINTF("%d records dropped", (int)picoquic_file_writer_nb_dropped(writer));
+            ret = -1;
+        }
+    }
+
+    if (writer != NULL) {
+        picoquic_file_writer_delete(writer);
+    }
+
+    if (ret == 0) {
+        ret = file_writer_test_check(FILE_WRITER_TEST_FILE);
+    }
+
+    if (ret == 0) {
+        ret = file_writer_test_check(FILE_WRITER_TEST_FILE2);
+    }
+
+    return ret;
+}
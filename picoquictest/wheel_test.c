@@ -0,0 +1,307 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2022, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_utils.h"
+#include "picosplay.h"
+#include "picowheel.h"
+
+/* Test of the timing wheel, and comparison with a splay tree ordered by
+ * wake time, as was used for the connection wake list. */
+
+typedef struct st_wheel_test_item_t {
+    picowheel_node_t wheel_node;
+    picosplay_node_t splay_node;
+    uint64_t wake_time;
+    uint64_t sequence;
+} wheel_test_item_t;
+
+static int64_t wheel_test_compare(void* l, void* r)
+{
+    wheel_test_item_t* a = (wheel_test_item_t*)l;
+    wheel_test_item_t* b = (wheel_test_item_t*)r;
+
+    if (a->wake_time != b->wake_time) {
+        return (a->wake_time < b->wake_time) ? -1 : 1;
+    }
+    return (a->sequence < b->sequence) ? -1 : ((a->sequence > b->sequence) ? 1 : 0);
+}
+
+static picosplay_node_t* wheel_test_create(void* value)
+{
+    return &((wheel_test_item_t*)value)->splay_node;
+}
+
+static void* wheel_test_value(picosplay_node_t* node)
+{
+    return (node == NULL) ? NULL : (void*)((char*)node - offsetof(wheel_test_item_t, splay_node));
+}
+
+static void wheel_test_delete(void* tree, picosplay_node_t* node)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(tree);
+#endif
+    memset(node, 0, sizeof(picosplay_node_t));
+}
+
+static wheel_test_item_t* wheel_test_wheel_first(picowheel_t* wheel)
+{
+    picowheel_node_t* node = picowheel_first(wheel);
+
+    return (node == NULL) ? NULL : (wheel_test_item_t*)((char*)node - offsetof(wheel_test_item_t, wheel_node));
+}
+
+/* Random wake time: mostly close to the current time, sometimes in the past,
+ * sometimes far away, and sometimes "never" */
+static uint64_t wheel_test_random_time(uint64_t* random_ctx, uint64_t current_time)
+{
+    uint64_t r = picoquic_test_random(random_ctx);
+
+    switch (r % 8) {
+    case 0:
+        return current_time;
+    case 1:
+        return (current_time > 1000) ? current_time - (r >> 8) % 1000 : current_time;
+    case 2:
+        return current_time + (r >> 8) % 100000000;
+    case 3:
+        return UINT64_MAX;
+    default:
+        return current_time + (r >> 8) % 25000;
+    }
+}
+
+int wheel_test()
+{
+    int ret = 0;
+    const int nb_items = 1000;
+    wheel_test_item_t* items = (wheel_test_item_t*)malloc(nb_items * sizeof(wheel_test_item_t));
+    picowheel_t* wheel = (picowheel_t*)malloc(sizeof(picowheel_t));
+    picosplay_tree_t tree;
+    uint64_t random_ctx = 0x57a1c3e5;
+    uint64_t current_time = 0x123456789ull;
+    uint64_t sequence = 0;
+
+    if (items == NULL || wheel == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(items, 0, nb_items * sizeof(wheel_test_item_t));
+        picowheel_init(wheel);
+        picowheel_advance(wheel, current_time);
+        picosplay_init_tree(&tree, wheel_test_compare, wheel_test_create, wheel_test_delete, wheel_test_value);
+
+        for (int i = 0; i < nb_items; i++) {
+            items[i].wake_time = wheel_test_random_time(&random_ctx, current_time);
+            items[i].sequence = sequence++;
+            picowheel_insert(wheel, &items[i].wheel_node, items[i].wake_time);
+            picosplay_insert(&tree, &items[i]);
+        }
+
+        /* Wake the first item, reschedule it or a random one, and check that both structures agree */
+        for (int i = 0; ret == 0 && i < 100000; i++) {
+            wheel_test_item_t* w_first = wheel_test_wheel_first(wheel);
+            wheel_test_item_t* s_first = (wheel_test_item_t*)wheel_test_value(picosplay_first(&tree));
+            wheel_test_item_t* x;
+
+            if (w_first != s_first) {
+                DBG_PRINTF("Round %d, wheel first %" PRIu64 ", splay first %" PRIu64 "\n", i,
+                    (w_first == NULL) ? 0 : w_first->wake_time, (s_first == NULL) ? 0 : s_first->wake_time);
+                ret = -1;
+                break;
+            }
+            x = (i % 4 == 3) ? &items[picoquic_test_uniform_random(&random_ctx, nb_items)] : w_first;
+            if (w_first->wake_time != UINT64_MAX && w_first->wake_time > current_time) {
+                current_time = w_first->wake_time;
+                picowheel_advance(wheel, current_time);
+            }
+            if (x->wheel_node.is_inserted) {
+                picowheel_remove(wheel, &x->wheel_node);
+                picosplay_delete_hint(&tree, &x->splay_node);
+            }
+            if (i % 16 == 5) {
+                /* Keep some items out of the lists for a while */
+                continue;
+            }
+            x->wake_time = wheel_test_random_time(&random_ctx, current_time);
+            x->sequence = sequence++;
+            picowheel_insert(wheel, &x->wheel_node, x->wake_time);
+            picosplay_insert(&tree, x);
+        }
+
+        if (ret == 0 && wheel->size != tree.size) {
+            DBG_PRINTF("Wheel size %d, tree size %d\n", wheel->size, tree.size);
+            ret = -1;
+        }
+
+        /* Empty both lists in order */
+        while (ret == 0 && tree.size > 0) {
+            wheel_test_item_t* w_first = wheel_test_wheel_first(wheel);
+            wheel_test_item_t* s_first = (wheel_test_item_t*)wheel_test_value(picosplay_first(&tree));
+
+            if (w_first != s_first) {
+                DBG_PRINTF("%s", "Wheel and splay differ while emptying\n");
+                ret = -1;
+            }
+            else {
+                picowheel_remove(wheel, &w_first->wheel_node);
+                picosplay_delete_hint(&tree, &s_first->splay_node);
+            }
+        }
+
+        if (ret == 0 && (wheel->size != 0 || picowheel_first(wheel) != NULL)) {
+            DBG_PRINTF("%s", "Wheel not empty\n");
+            ret = -1;
+        }
+
+        /* When only an idle timer is set, timers set later for the near future
+         * shall not land in the late list */
+        if (ret == 0) {
+            picowheel_advance(wheel, current_time + 1000000);
+            picowheel_insert(wheel, &items[0].wheel_node, current_time + 31000000);
+            if (picowheel_first(wheel) != &items[0].wheel_node) {
+                DBG_PRINTF("%s", "Idle timer not found\n");
+                ret = -1;
+            }
+            for (int i = 1; ret == 0 && i < 16; i++) {
+                picowheel_advance(wheel, current_time + 1000000 + 1000 * i);
+                picowheel_insert(wheel, &items[i].wheel_node, current_time + 1000000 + 1500 * i);
+                if (wheel->late.first != NULL || picowheel_first(wheel) != &items[1].wheel_node) {
+                    DBG_PRINTF("Timer %d not placed in the wheel\n", i);
+                    ret = -1;
+                }
+            }
+            for (int i = 0; i < 16; i++) {
+                picowheel_remove(wheel, &items[i].wheel_node);
+            }
+        }
+    }
+
+    if (items != NULL) {
+        free(items);
+    }
+    if (wheel != NULL) {
+        free(wheel);
+    }
+
+    return ret;
+}
+
+/* Benchmark: many connections with timers mostly a few milliseconds away,
+ * and the first connection rescheduled after each wake up, as done when
+ * preparing packets. The same schedule is run with the splay tree and with
+ * the timing wheel. */
+#define WHEEL_BENCH_NB_ITEMS 100000
+#define WHEEL_BENCH_NB_ROUNDS 1000000
+
+static uint64_t wheel_bench_time(uint64_t* random_ctx, uint64_t current_time)
+{
+    uint64_t r = picoquic_test_random(random_ctx);
+
+    /* Pacing and ACK delays, with some idle timers */
+    return current_time + ((r % 16 == 0) ? 30000000 : 1 + (r >> 8) % 25000);
+}
+
+int wheel_bench_test()
+{
+    int ret = 0;
+    wheel_test_item_t* items = (wheel_test_item_t*)malloc(WHEEL_BENCH_NB_ITEMS * sizeof(wheel_test_item_t));
+    picowheel_t* wheel = (picowheel_t*)malloc(sizeof(picowheel_t));
+    picosplay_tree_t tree;
+    uint64_t check[2] = { 0, 0 };
+    uint64_t duration[2] = { 0, 0 };
+
+    if (items == NULL || wheel == NULL) {
+        ret = -1;
+    }
+
+    for (int use_wheel = 0; ret == 0 && use_wheel < 2; use_wheel++) {
+        uint64_t random_ctx = 0xbe4c4;
+        uint64_t current_time = 0;
+        uint64_t start_time;
+
+        memset(items, 0, WHEEL_BENCH_NB_ITEMS * sizeof(wheel_test_item_t));
+        picowheel_init(wheel);
+        picosplay_init_tree(&tree, wheel_test_compare, wheel_test_create, wheel_test_delete, wheel_test_value);
+
+        start_time = picoquic_current_time();
+        for (int i = 0; i < WHEEL_BENCH_NB_ITEMS; i++) {
+            items[i].wake_time = wheel_bench_time(&random_ctx, current_time);
+            items[i].sequence = (uint64_t)i;
+            if (use_wheel) {
+                picowheel_insert(wheel, &items[i].wheel_node, items[i].wake_time);
+            }
+            else {
+                picosplay_insert(&tree, &items[i]);
+            }
+        }
+
+        for (int i = 0; i < WHEEL_BENCH_NB_ROUNDS; i++) {
+            wheel_test_item_t* x;
+
+            if (use_wheel) {
+                picowheel_advance(wheel, current_time);
+                x = wheel_test_wheel_first(wheel);
+                picowheel_remove(wheel, &x->wheel_node);
+            }
+            else {
+                x = (wheel_test_item_t*)wheel_test_value(picosplay_first(&tree));
+                picosplay_delete_hint(&tree, &x->splay_node);
+            }
+            current_time = x->wake_time;
+            check[use_wheel] += (uint64_t)(x - items) * (uint64_t)i;
+            x->wake_time = wheel_bench_time(&random_ctx, current_time);
+            x->sequence = (uint64_t)(WHEEL_BENCH_NB_ITEMS + i);
+            if (use_wheel) {
+                picowheel_insert(wheel, &x->wheel_node, x->wake_time);
+            }
+            else {
+                picosplay_insert(&tree, x);
+            }
+        }
+        duration[use_wheel] = picoquic_current_time() - start_time;
+        if (!use_wheel) {
+            picosplay_empty_tree(&tree);
+        }
+    }
+
+    if (ret == 0) {
+        DBG_PRINTF("%d items, %d rounds: splay %" PRIu64 "us, wheel %" PRIu64 "us\n",
+            WHEEL_BENCH_NB_ITEMS, WHEEL_BENCH_NB_ROUNDS, duration[0], duration[1]);
+        if (check[0] != check[1]) {
+            DBG_PRINTF("%s", "Wheel and splay woke items in different order\n");
+            ret = -1;
+        }
+    }
+
+    if (items != NULL) {
+        free(items);
+    }
+    if (wheel != NULL) {
+        free(wheel);
+    }
+
+    return ret;
+}